@@ -0,0 +1,993 @@
+/*
+    Streaming analyzer of the simulation logs (Cooja test.log or native simulator).
+
+    Computes in one pass over each log what parse-stats.py computes, plus the
+    end-to-end latency of every delivered packet (send and receive lines
+    matched on node and sequence number) and the hop count histograms.
+    Latency is also broken down per hop count and per originator, with
+    the in-network delay reported by the nodes (LATENCY_STATS builds), and
+    the radio duty cycle of each node from the energy reports received by
+    the sink (ENERGY_REPORT builds).
+    The logs are parsed in parallel, one run per worker thread.
+
+    A configuration is a directory holding one test.log, or one run
+    subdirectory (1/, 2/, ...) with a test.log each, as written by
+    run_sim.sh. The arguments can be logs, configurations, or directories
+    searched recursively for configurations (e.g. results/). One summary is
+    printed per configuration, as a JSON line or as text.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_NAME "test.log"
+#define MAX_HOPS 64 // last histogram bucket collects the longer paths
+#define NO_TIME -1
+#define NO_DELAY -1
+
+/*
+   ------------------------------------ DATA ------------------------------------
+ */
+
+// Packets of one flow (a node to the sink or the sink to a node), indexed by sequence number
+typedef struct flow {
+        int64_t *sent;  // send time, NO_TIME if not sent
+        int64_t *recv;  // first reception time, NO_TIME if not received
+        uint8_t *hops;  // hops of the first reception
+        int32_t *delay; // in-network delay of the first reception (ms), NO_DELAY if not reported
+        uint32_t len;   // allocated sequence numbers
+        uint32_t num_sent;
+        uint32_t num_recv;
+} flow;
+
+typedef struct direction {
+        flow *flows;    // indexed by node id
+        uint32_t num_flows;
+} direction;
+
+// Energy reports of a node, duty cycles in 1/10000 of the time
+typedef struct energy {
+        uint64_t radio_on;
+        uint64_t tx;
+        uint32_t reports;
+} energy;
+
+typedef struct run {
+        char *path;
+        int config;
+        bool failed;
+        uint64_t lines;
+        uint32_t resets;
+        bool *booted;   // indexed by node id
+        bool *sink;     // indexed by node id, the nodes that logged "I am sink"
+        uint32_t num_booted;
+        direction dc;   // data collection: flow of the source node
+        direction sr;   // source routing: flow of the destination node
+        energy *energy; // indexed by node id
+        uint32_t num_energy;
+} run;
+
+typedef struct config {
+        char *path;
+        int first_run;
+        int num_runs;
+} config;
+
+static run *runs;
+static int num_runs;
+static config *configs;
+static int num_configs;
+static int sink_id = 1;
+
+static void *xrealloc(void *ptr, size_t size) {
+        ptr = realloc(ptr, size);
+        if (ptr == NULL && size > 0) {
+                fprintf(stderr, "analyze-stats: out of memory\n");
+                exit(1);
+        }
+        return ptr;
+}
+
+static flow *direction_flow(direction *d, uint32_t node) {
+        if (node >= d->num_flows) {
+                uint32_t len = node + 16;
+                d->flows = xrealloc(d->flows, len * sizeof(flow));
+                memset(d->flows + d->num_flows, 0, (len - d->num_flows) * sizeof(flow));
+                d->num_flows = len;
+        }
+        return &d->flows[node];
+}
+
+static void flow_reserve(flow *f, uint32_t seqn) {
+        uint32_t len, i;
+        if (seqn < f->len) {
+                return;
+        }
+        len = seqn + 64 > f->len * 2 ? seqn + 64 : f->len * 2;
+        f->sent = xrealloc(f->sent, len * sizeof(int64_t));
+        f->recv = xrealloc(f->recv, len * sizeof(int64_t));
+        f->hops = xrealloc(f->hops, len);
+        f->delay = xrealloc(f->delay, len * sizeof(int32_t));
+        for (i = f->len; i < len; i++) {
+                f->sent[i] = NO_TIME;
+                f->recv[i] = NO_TIME;
+                f->hops[i] = 0;
+                f->delay[i] = NO_DELAY;
+        }
+        f->len = len;
+}
+
+static void flow_send(direction *d, uint32_t node, uint32_t seqn, int64_t time) {
+        flow *f = direction_flow(d, node);
+        flow_reserve(f, seqn);
+        if (f->sent[seqn] == NO_TIME) {
+                f->num_sent++;
+        }
+        f->sent[seqn] = time;
+}
+
+// Duplicates are counted once, as in parse-stats.py
+static void flow_recv(direction *d, uint32_t node, uint32_t seqn, uint32_t hops, int32_t delay, int64_t time) {
+        flow *f = direction_flow(d, node);
+        flow_reserve(f, seqn);
+        if (f->recv[seqn] != NO_TIME) {
+                return;
+        }
+        f->recv[seqn] = time;
+        f->hops[seqn] = hops > 255 ? 255 : hops;
+        f->delay[seqn] = delay;
+        f->num_recv++;
+}
+
+static void energy_add(run *r, uint32_t node, uint32_t radio_on, uint32_t tx) {
+        if (node >= r->num_energy) {
+                uint32_t len = node + 16;
+                r->energy = xrealloc(r->energy, len * sizeof(energy));
+                memset(r->energy + r->num_energy, 0, (len - r->num_energy) * sizeof(energy));
+                r->num_energy = len;
+        }
+        r->energy[node].radio_on += radio_on;
+        r->energy[node].tx += tx;
+        r->energy[node].reports++;
+}
+
+static void direction_free(direction *d) {
+        uint32_t i;
+        for (i = 0; i < d->num_flows; i++) {
+                free(d->flows[i].sent);
+                free(d->flows[i].recv);
+                free(d->flows[i].hops);
+                free(d->flows[i].delay);
+        }
+        free(d->flows);
+}
+
+/*
+   ------------------------------------ PARSING ------------------------------------
+ */
+
+// Cursor on a line, p never goes past end
+typedef struct cursor {
+        const char *p;
+        const char *end;
+} cursor;
+
+static bool skip(cursor *c, const char *s) {
+        size_t n = strlen(s);
+        if ((size_t)(c->end - c->p) < n || memcmp(c->p, s, n) != 0) {
+                return false;
+        }
+        c->p += n;
+        return true;
+}
+
+static bool parse_uint64(cursor *c, int base, uint64_t *value) {
+        uint64_t v = 0;
+        const char *start = c->p;
+        while (c->p < c->end) {
+                char ch = *c->p;
+                int digit;
+                if (ch >= '0' && ch <= '9') {
+                        digit = ch - '0';
+                } else if (base == 16 && ch >= 'a' && ch <= 'f') {
+                        digit = ch - 'a' + 10;
+                } else if (base == 16 && ch >= 'A' && ch <= 'F') {
+                        digit = ch - 'A' + 10;
+                } else {
+                        break;
+                }
+                v = v * base + digit;
+                c->p++;
+        }
+        *value = v;
+        return c->p != start;
+}
+
+static bool parse_uint(cursor *c, int base, uint32_t *value) {
+        uint64_t v;
+        bool ok = parse_uint64(c, base, &v);
+        *value = v;
+        return ok;
+}
+
+// Node address printed as %02x:%02x, u8[0] is the low byte of the node id
+static bool parse_addr(cursor *c, uint32_t *id) {
+        uint32_t low, high;
+        if (!parse_uint(c, 16, &low) || !skip(c, ":") || !parse_uint(c, 16, &high)) {
+                return false;
+        }
+        *id = low | (high << 8);
+        return true;
+}
+
+// Optional " delay <ms>" at the end of a reception line
+static int32_t parse_delay(cursor *c) {
+        uint32_t delay;
+        if (skip(c, " delay ") && parse_uint(c, 10, &delay)) {
+                return delay > INT32_MAX ? INT32_MAX : delay;
+        }
+        return NO_DELAY;
+}
+
+// Percentage printed as %u.%02u%%, in 1/10000
+static bool parse_percent(cursor *c, uint32_t *value) {
+        uint32_t units, hundredths;
+        if (!parse_uint(c, 10, &units) || !skip(c, ".") || !parse_uint(c, 10, &hundredths) || !skip(c, "%")) {
+                return false;
+        }
+        *value = units * 100 + hundredths;
+        return true;
+}
+
+/*
+    Time in microseconds: a plain number (the test.log format), or the
+    formatted Cooja time [[HH:]MM:]SS.mmm.
+ */
+
+static bool parse_time(cursor *c, int64_t *time) {
+        int64_t t;
+        uint64_t v;
+        if (!parse_uint64(c, 10, &v)) {
+                return false;
+        }
+        t = v;
+        if (c->p == c->end || (*c->p != ':' && *c->p != '.')) {
+                *time = t;
+                return true;
+        }
+        // formatted time: t counts seconds
+        while (skip(c, ":")) {
+                if (!parse_uint64(c, 10, &v)) {
+                        return false;
+                }
+                t = t * 60 + v;
+        }
+        t *= 1000000;
+        if (skip(c, ".")) {
+                const char *start = c->p;
+                if (!parse_uint64(c, 10, &v)) {
+                        return false;
+                }
+                int digits = c->p - start;
+                int64_t frac = v;
+                for (; digits < 6; digits++) {
+                        frac *= 10;
+                }
+                for (; digits > 6; digits--) {
+                        frac /= 10;
+                }
+                t += frac;
+        }
+        *time = t;
+        return true;
+}
+
+static void node_reserve(run *r, uint32_t id) {
+        if (id >= r->num_booted) {
+                uint32_t len = id + 16;
+                r->booted = xrealloc(r->booted, len * sizeof(bool));
+                r->sink = xrealloc(r->sink, len * sizeof(bool));
+                memset(r->booted + r->num_booted, 0, (len - r->num_booted) * sizeof(bool));
+                memset(r->sink + r->num_booted, 0, (len - r->num_booted) * sizeof(bool));
+                r->num_booted = len;
+        }
+}
+
+// Collection packets and energy reports are counted at every sink (several with --sink)
+static bool is_sink(run *r, uint32_t id) {
+        return id == (uint32_t)sink_id || (id < r->num_booted && r->sink[id]);
+}
+
+static void mark_boot(run *r, uint32_t id) {
+        node_reserve(r, id);
+        if (r->booted[id]) {
+                r->resets++;
+        }
+        r->booted[id] = true;
+}
+
+/*
+    One log line: <time> <whitespace> ID:<node> <whitespace> <message>.
+    Lines that are not one of the application messages are skipped.
+ */
+static void parse_line(run *r, const char *line, const char *end) {
+        cursor c = {line, end};
+        int64_t time;
+        uint32_t self, node, seqn, hops;
+
+        if (!parse_time(&c, &time)) {
+                return;
+        }
+        while (c.p < c.end && (*c.p == ' ' || *c.p == '\t')) {
+                c.p++;
+        }
+        if (!skip(&c, "ID:") || !parse_uint(&c, 10, &self)) {
+                return;
+        }
+        while (c.p < c.end && (*c.p == ' ' || *c.p == '\t')) {
+                c.p++;
+        }
+
+        if (skip(&c, "App: ")) {
+                if (skip(&c, "Send seqn ")) {
+                        if (parse_uint(&c, 10, &seqn)) {
+                                flow_send(&r->dc, self, seqn, time);
+                        }
+                } else if (skip(&c, "Recv from ")) {
+                        if (is_sink(r, self) && parse_addr(&c, &node) && skip(&c, " seqn ") &&
+                            parse_uint(&c, 10, &seqn) && skip(&c, " hops ") && parse_uint(&c, 10, &hops)) {
+                                flow_recv(&r->dc, node, seqn, hops, parse_delay(&c), time);
+                        }
+                } else if (skip(&c, "sink sending seqn ")) {
+                        if (parse_uint(&c, 10, &seqn) && skip(&c, " to ") && parse_addr(&c, &node)) {
+                                flow_send(&r->sr, node, seqn, time);
+                        }
+                } else if (skip(&c, "sr_recv from sink seqn ")) {
+                        uint32_t metric;
+                        if (parse_uint(&c, 10, &seqn) && skip(&c, " hops ") && parse_uint(&c, 10, &hops)) {
+                                if (skip(&c, " node metric ")) {
+                                        parse_uint(&c, 10, &metric);
+                                }
+                                flow_recv(&r->sr, self, seqn, hops, parse_delay(&c), time);
+                        }
+                } else if (skip(&c, "energy from ")) {
+                        uint32_t radio_on, tx;
+                        if (is_sink(r, self) && parse_addr(&c, &node) && skip(&c, " radio ") &&
+                            parse_percent(&c, &radio_on) && skip(&c, " tx ") && parse_percent(&c, &tx)) {
+                                energy_add(r, node, radio_on, tx);
+                        }
+                } else if (skip(&c, "I am sink ")) {
+                        node_reserve(r, self);
+                        r->sink[self] = true;
+                }
+        } else if (skip(&c, "Rime started with address ")) {
+                mark_boot(r, self);
+        }
+}
+
+static void parse_run(run *r) {
+        struct stat st;
+        const char *data, *p, *end;
+        int fd = open(r->path, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+                perror(r->path);
+                r->failed = true;
+                if (fd >= 0) {
+                        close(fd);
+                }
+                return;
+        }
+        if (st.st_size == 0) {
+                close(fd);
+                return;
+        }
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+                perror(r->path);
+                r->failed = true;
+                return;
+        }
+        madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+        end = data + st.st_size;
+        for (p = data; p < end; ) {
+                const char *nl = memchr(p, '\n', end - p);
+                const char *line_end = nl != NULL ? nl : end;
+                if (line_end > p && line_end[-1] == '\r') {
+                        line_end--;
+                }
+                parse_line(r, p, line_end);
+                r->lines++;
+                p = nl != NULL ? nl + 1 : end;
+        }
+        munmap((void*)data, st.st_size);
+}
+
+/*
+   ------------------------------------ WORKERS ------------------------------------
+ */
+
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+static int next_run;
+
+static void *worker(void *arg) {
+        for (;;) {
+                int i;
+                pthread_mutex_lock(&next_lock);
+                i = next_run++;
+                pthread_mutex_unlock(&next_lock);
+                if (i >= num_runs) {
+                        return NULL;
+                }
+                parse_run(&runs[i]);
+        }
+}
+
+/*
+   ------------------------------------ INPUTS ------------------------------------
+ */
+
+static bool is_file(const char *path) {
+        struct stat st;
+        return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static bool is_dir(const char *path) {
+        struct stat st;
+        return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static char *path_join(const char *dir, const char *name) {
+        char *path;
+        if (asprintf(&path, "%s/%s", dir, name) < 0) {
+                fprintf(stderr, "analyze-stats: out of memory\n");
+                exit(1);
+        }
+        return path;
+}
+
+static void add_run(char *log) {
+        runs = xrealloc(runs, (num_runs + 1) * sizeof(run));
+        memset(&runs[num_runs], 0, sizeof(run));
+        runs[num_runs].path = log;
+        runs[num_runs].config = num_configs - 1;
+        configs[num_configs - 1].num_runs++;
+        num_runs++;
+}
+
+static void add_config(const char *path) {
+        configs = xrealloc(configs, (num_configs + 1) * sizeof(config));
+        configs[num_configs].path = strdup(path);
+        configs[num_configs].first_run = num_runs;
+        configs[num_configs].num_runs = 0;
+        num_configs++;
+}
+
+static int compare_names(const void *a, const void *b) {
+        const char *x = *(const char**)a, *y = *(const char**)b;
+        // numeric run directories in numeric order
+        char *ex, *ey;
+        long nx = strtol(x, &ex, 10), ny = strtol(y, &ey, 10);
+        if (*ex == '\0' && *ey == '\0' && ex != x && ey != y) {
+                return nx < ny ? -1 : nx > ny;
+        }
+        return strcmp(x, y);
+}
+
+// Sorted subdirectories of dir (hidden ones excluded)
+static char **subdirs(const char *dir, int *count) {
+        DIR *d = opendir(dir);
+        struct dirent *e;
+        char **names = NULL;
+        int n = 0;
+        if (d == NULL) {
+                *count = 0;
+                return NULL;
+        }
+        while ((e = readdir(d)) != NULL) {
+                char *path;
+                if (e->d_name[0] == '.') {
+                        continue;
+                }
+                path = path_join(dir, e->d_name);
+                if (is_dir(path)) {
+                        names = xrealloc(names, (n + 1) * sizeof(char*));
+                        names[n++] = strdup(e->d_name);
+                }
+                free(path);
+        }
+        closedir(d);
+        qsort(names, n, sizeof(char*), compare_names);
+        *count = n;
+        return names;
+}
+
+/*
+    Collect the runs under path. A directory with a test.log is a
+    configuration of one run, a directory whose subdirectories hold a
+    test.log is a configuration of several runs, any other directory is
+    searched recursively.
+ */
+static void add_path(const char *path) {
+        char *log, **names;
+        int n, i, logs = 0;
+
+        if (is_file(path)) {
+                add_config(path);
+                add_run(strdup(path));
+                return;
+        }
+        if (!is_dir(path)) {
+                fprintf(stderr, "analyze-stats: %s: no such file or directory\n", path);
+                return;
+        }
+        log = path_join(path, LOG_NAME);
+        if (is_file(log)) {
+                add_config(path);
+                add_run(log);
+                return;
+        }
+        free(log);
+
+        names = subdirs(path, &n);
+        for (i = 0; i < n; i++) {
+                char *dir = path_join(path, names[i]);
+                log = path_join(dir, LOG_NAME);
+                if (is_file(log)) {
+                        if (logs++ == 0) {
+                                add_config(path);
+                        }
+                        add_run(log);
+                } else {
+                        free(log);
+                }
+                free(dir);
+        }
+        for (i = 0; i < n; i++) {
+                // no runs here: look for configurations inside
+                if (logs == 0) {
+                        char *dir = path_join(path, names[i]);
+                        add_path(dir);
+                        free(dir);
+                }
+                free(names[i]);
+        }
+        free(names);
+}
+
+/*
+   ------------------------------------ SUMMARY ------------------------------------
+ */
+
+// Latency of a delivered packet
+typedef struct sample {
+        int64_t latency; // microseconds
+        int32_t delay;   // in-network delay reported by the receiver (ms), NO_DELAY if not reported
+        uint8_t hops;
+} sample;
+
+typedef struct node_stats {
+        uint64_t sent;
+        uint64_t recv;
+        double latency_sum; // milliseconds
+        uint64_t num_latency;
+        double delay_sum;   // milliseconds
+        uint64_t num_delay;
+} node_stats;
+
+// Latency of the packets delivered with a given hop count
+typedef struct depth_stats {
+        uint64_t count;
+        double mean;      // ms
+        double p90;       // ms
+        double delay_mean; // ms, reported delay
+        uint64_t num_delay;
+} depth_stats;
+
+typedef struct summary {
+        uint64_t sent;
+        uint64_t recv;
+        double pdr_sum;  // sum of the per run PDRs
+        double pdr_min;
+        double pdr_max;
+        int pdr_runs;    // runs that sent packets
+        sample *latency; // sorted by latency once all the runs are added
+        size_t num_latency;
+        uint64_t hops[MAX_HOPS + 1];
+        node_stats *nodes; // indexed by node id
+        uint32_t num_nodes;
+} summary;
+
+static int compare_latency(const void *a, const void *b) {
+        int64_t x = ((const sample*)a)->latency, y = ((const sample*)b)->latency;
+        return x < y ? -1 : x > y;
+}
+
+static void summary_add(summary *s, const direction *d) {
+        uint64_t sent = 0, recv = 0;
+        uint32_t node, seqn;
+        if (d->num_flows > s->num_nodes) {
+                s->nodes = xrealloc(s->nodes, d->num_flows * sizeof(node_stats));
+                memset(s->nodes + s->num_nodes, 0, (d->num_flows - s->num_nodes) * sizeof(node_stats));
+                s->num_nodes = d->num_flows;
+        }
+        for (node = 0; node < d->num_flows; node++) {
+                const flow *f = &d->flows[node];
+                if (f->num_sent == 0) {
+                        continue;
+                }
+                // like parse-stats.py, receptions count for the nodes that sent
+                s->nodes[node].sent += f->num_sent;
+                s->nodes[node].recv += f->num_recv;
+                sent += f->num_sent;
+                recv += f->num_recv;
+                s->latency = xrealloc(s->latency, (s->num_latency + f->num_recv) * sizeof(sample));
+                for (seqn = 0; seqn < f->len; seqn++) {
+                        uint8_t hops = f->hops[seqn] < MAX_HOPS ? f->hops[seqn] : MAX_HOPS;
+                        if (f->recv[seqn] == NO_TIME) {
+                                continue;
+                        }
+                        s->hops[hops]++;
+                        if (f->sent[seqn] != NO_TIME && f->recv[seqn] >= f->sent[seqn]) {
+                                sample *l = &s->latency[s->num_latency++];
+                                l->latency = f->recv[seqn] - f->sent[seqn];
+                                l->delay = f->delay[seqn];
+                                l->hops = hops;
+                                s->nodes[node].latency_sum += l->latency / 1000.0;
+                                s->nodes[node].num_latency++;
+                        }
+                        if (f->delay[seqn] != NO_DELAY) {
+                                s->nodes[node].delay_sum += f->delay[seqn];
+                                s->nodes[node].num_delay++;
+                        }
+                }
+        }
+        s->sent += sent;
+        s->recv += recv;
+        if (sent > 0) {
+                double pdr = 100.0 * recv / sent;
+                s->pdr_min = s->pdr_runs == 0 || pdr < s->pdr_min ? pdr : s->pdr_min;
+                s->pdr_max = s->pdr_runs == 0 || pdr > s->pdr_max ? pdr : s->pdr_max;
+                s->pdr_sum += pdr;
+                s->pdr_runs++;
+        }
+}
+
+// Nearest rank percentile of the sorted latencies, in milliseconds
+static double percentile(const summary *s, double p) {
+        size_t rank;
+        if (s->num_latency == 0) {
+                return 0;
+        }
+        rank = (size_t)(p / 100.0 * s->num_latency + 0.999999);
+        rank = rank < 1 ? 1 : rank > s->num_latency ? s->num_latency : rank;
+        return s->latency[rank - 1].latency / 1000.0;
+}
+
+static void depth_latency(const summary *s, int hops, depth_stats *d) {
+        uint64_t rank, i;
+        double sum = 0;
+        size_t j;
+        memset(d, 0, sizeof(depth_stats));
+        for (j = 0; j < s->num_latency; j++) {
+                const sample *l = &s->latency[j];
+                if (l->hops != hops) {
+                        continue;
+                }
+                d->count++;
+                sum += l->latency / 1000.0;
+                if (l->delay != NO_DELAY) {
+                        d->delay_mean += l->delay;
+                        d->num_delay++;
+                }
+        }
+        if (d->count == 0) {
+                return;
+        }
+        d->mean = sum / d->count;
+        d->delay_mean = d->num_delay ? d->delay_mean / d->num_delay : 0;
+        // nearest rank, the samples are sorted by latency
+        rank = (uint64_t)(0.9 * d->count + 0.999999);
+        rank = rank < 1 ? 1 : rank;
+        for (i = 0, j = 0; j < s->num_latency; j++) {
+                if (s->latency[j].hops == hops && ++i == rank) {
+                        d->p90 = s->latency[j].latency / 1000.0;
+                        break;
+                }
+        }
+}
+
+static double latency_mean(const summary *s) {
+        double sum = 0;
+        size_t i;
+        for (i = 0; i < s->num_latency; i++) {
+                sum += s->latency[i].latency;
+        }
+        return s->num_latency ? sum / s->num_latency / 1000.0 : 0;
+}
+
+static void summary_free(summary *s) {
+        free(s->latency);
+        free(s->nodes);
+}
+
+static void json_string(FILE *out, const char *s) {
+        fputc('"', out);
+        for (; *s != '\0'; s++) {
+                if (*s == '"' || *s == '\\') {
+                        fputc('\\', out);
+                }
+                fputc(*s, out);
+        }
+        fputc('"', out);
+}
+
+static void json_summary(FILE *out, const char *name, const summary *s) {
+        uint32_t node;
+        int h, last = 0;
+        fprintf(out, "\"%s\":{\"sent\":%llu,\"recv\":%llu,\"pdr\":%.4f,\"pdr_run_mean\":%.4f,"
+                "\"pdr_run_min\":%.4f,\"pdr_run_max\":%.4f,",
+                name, (unsigned long long)s->sent, (unsigned long long)s->recv,
+                s->sent ? 100.0 * s->recv / s->sent : 0,
+                s->pdr_runs ? s->pdr_sum / s->pdr_runs : 0, s->pdr_min, s->pdr_max);
+        fprintf(out, "\"latency_ms\":{\"count\":%zu,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,"
+                "\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f},",
+                s->num_latency, latency_mean(s), percentile(s, 50), percentile(s, 90),
+                percentile(s, 95), percentile(s, 99), percentile(s, 100));
+        for (h = 0; h <= MAX_HOPS; h++) {
+                if (s->hops[h] > 0) {
+                        last = h;
+                }
+        }
+        fprintf(out, "\"hops\":[");
+        for (h = 0; h <= last; h++) {
+                fprintf(out, "%s%llu", h ? "," : "", (unsigned long long)s->hops[h]);
+        }
+        fprintf(out, "],\"depth_latency_ms\":[");
+        bool first = true;
+        for (h = 0; h <= MAX_HOPS; h++) {
+                depth_stats d;
+                depth_latency(s, h, &d);
+                if (d.count == 0) {
+                        continue;
+                }
+                fprintf(out, "%s{\"hops\":%d,\"count\":%llu,\"mean\":%.3f,\"p90\":%.3f", first ? "" : ",",
+                        h, (unsigned long long)d.count, d.mean, d.p90);
+                if (d.num_delay > 0) {
+                        fprintf(out, ",\"delay_mean\":%.3f", d.delay_mean);
+                }
+                fprintf(out, "}");
+                first = false;
+        }
+        fprintf(out, "],\"nodes\":{");
+        first = true;
+        for (node = 0; node < s->num_nodes; node++) {
+                const node_stats *n = &s->nodes[node];
+                if (n->sent == 0) {
+                        continue;
+                }
+                fprintf(out, "%s\"%u\":{\"sent\":%llu,\"recv\":%llu,\"pdr\":%.4f", first ? "" : ",", node,
+                        (unsigned long long)n->sent, (unsigned long long)n->recv, 100.0 * n->recv / n->sent);
+                if (n->num_latency > 0) {
+                        fprintf(out, ",\"latency_mean_ms\":%.3f", n->latency_sum / n->num_latency);
+                }
+                if (n->num_delay > 0) {
+                        fprintf(out, ",\"delay_mean_ms\":%.3f", n->delay_sum / n->num_delay);
+                }
+                fprintf(out, "}");
+                first = false;
+        }
+        fprintf(out, "}}");
+}
+
+static void text_summary(FILE *out, const char *name, const summary *s) {
+        int h;
+        fprintf(out, "%s PDR: %.4f%% (%llu/%llu, per run mean %.4f%% min %.4f%% max %.4f%%)\n", name,
+                s->sent ? 100.0 * s->recv / s->sent : 0, (unsigned long long)s->recv, (unsigned long long)s->sent,
+                s->pdr_runs ? s->pdr_sum / s->pdr_runs : 0, s->pdr_min, s->pdr_max);
+        fprintf(out, "%s latency (ms): mean %.1f p50 %.1f p90 %.1f p95 %.1f p99 %.1f max %.1f\n", name,
+                latency_mean(s), percentile(s, 50), percentile(s, 90), percentile(s, 95),
+                percentile(s, 99), percentile(s, 100));
+        fprintf(out, "%s hops:", name);
+        for (h = 1; h <= MAX_HOPS; h++) {
+                if (s->hops[h] > 0) {
+                        fprintf(out, " %d%s:%llu", h, h == MAX_HOPS ? "+" : "", (unsigned long long)s->hops[h]);
+                }
+        }
+        fprintf(out, "\n");
+        fprintf(out, "%s latency by hops (ms):", name);
+        for (h = 1; h <= MAX_HOPS; h++) {
+                depth_stats d;
+                depth_latency(s, h, &d);
+                if (d.count == 0) {
+                        continue;
+                }
+                fprintf(out, " %d%s: mean %.1f p90 %.1f", h, h == MAX_HOPS ? "+" : "", d.mean, d.p90);
+                if (d.num_delay > 0) {
+                        fprintf(out, " delay %.1f", d.delay_mean);
+                }
+                fprintf(out, ";");
+        }
+        fprintf(out, "\n");
+}
+
+/*
+    Energy reports of all the runs: the duty cycle of a node is the mean of
+    its reports, mean and max are taken over the nodes.
+ */
+static void energy_summary(FILE *out, const config *c, bool text) {
+        energy *nodes = NULL;
+        uint32_t num_nodes = 0, node, count = 0, max_node = 0;
+        uint64_t reports = 0;
+        double radio_on = 0, tx = 0, radio_on_max = 0;
+        bool first = true;
+        int i;
+        for (i = c->first_run; i < c->first_run + c->num_runs; i++) {
+                const run *r = &runs[i];
+                if (r->failed) {
+                        continue;
+                }
+                if (r->num_energy > num_nodes) {
+                        nodes = xrealloc(nodes, r->num_energy * sizeof(energy));
+                        memset(nodes + num_nodes, 0, (r->num_energy - num_nodes) * sizeof(energy));
+                        num_nodes = r->num_energy;
+                }
+                for (node = 0; node < r->num_energy; node++) {
+                        nodes[node].radio_on += r->energy[node].radio_on;
+                        nodes[node].tx += r->energy[node].tx;
+                        nodes[node].reports += r->energy[node].reports;
+                }
+        }
+        for (node = 0; node < num_nodes; node++) {
+                const energy *e = &nodes[node];
+                double node_radio_on;
+                if (e->reports == 0) {
+                        continue;
+                }
+                node_radio_on = e->radio_on / 100.0 / e->reports;
+                radio_on += node_radio_on;
+                tx += e->tx / 100.0 / e->reports;
+                reports += e->reports;
+                if (count == 0 || node_radio_on > radio_on_max) {
+                        radio_on_max = node_radio_on;
+                        max_node = node;
+                }
+                count++;
+        }
+        if (count == 0) {
+                free(nodes);
+                return;
+        }
+        if (text) {
+                fprintf(out, "Radio duty cycle: mean %.2f%% max %.2f%% (node %u), tx mean %.2f%% (%llu reports)\n",
+                        radio_on / count, radio_on_max, max_node, tx / count, (unsigned long long)reports);
+        } else {
+                fprintf(out, ",\"energy\":{\"reports\":%llu,\"radio_on_mean\":%.4f,\"radio_on_max\":%.4f,"
+                        "\"tx_mean\":%.4f,\"nodes\":{",
+                        (unsigned long long)reports, radio_on / count, radio_on_max, tx / count);
+                for (node = 0; node < num_nodes; node++) {
+                        const energy *e = &nodes[node];
+                        if (e->reports == 0) {
+                                continue;
+                        }
+                        fprintf(out, "%s\"%u\":{\"reports\":%u,\"radio_on\":%.4f,\"tx\":%.4f}", first ? "" : ",",
+                                node, e->reports, e->radio_on / 100.0 / e->reports, e->tx / 100.0 / e->reports);
+                        first = false;
+                }
+                fprintf(out, "}}");
+        }
+        free(nodes);
+}
+
+static void print_config(FILE *out, const config *c, bool text) {
+        summary dc = {0}, sr = {0};
+        uint64_t lines = 0;
+        uint32_t resets = 0;
+        int i, failed = 0;
+        for (i = c->first_run; i < c->first_run + c->num_runs; i++) {
+                run *r = &runs[i];
+                if (r->failed) {
+                        failed++;
+                        continue;
+                }
+                lines += r->lines;
+                resets += r->resets;
+                summary_add(&dc, &r->dc);
+                summary_add(&sr, &r->sr);
+        }
+        qsort(dc.latency, dc.num_latency, sizeof(sample), compare_latency);
+        qsort(sr.latency, sr.num_latency, sizeof(sample), compare_latency);
+
+        if (text) {
+                fprintf(out, "Simulation %s summary (%d runs, %llu lines, %u resets):\n",
+                        c->path, c->num_runs - failed, (unsigned long long)lines, resets);
+                text_summary(out, "Data Collection", &dc);
+                text_summary(out, "Source Routing", &sr);
+                energy_summary(out, c, true);
+        } else {
+                fprintf(out, "{\"config\":");
+                json_string(out, c->path);
+                fprintf(out, ",\"runs\":%d,\"failed_runs\":%d,\"lines\":%llu,\"resets\":%u,",
+                        c->num_runs - failed, failed, (unsigned long long)lines, resets);
+                json_summary(out, "data_collection", &dc);
+                fprintf(out, ",");
+                json_summary(out, "source_routing", &sr);
+                energy_summary(out, c, false);
+                fprintf(out, "}\n");
+        }
+        summary_free(&dc);
+        summary_free(&sr);
+}
+
+static void usage(const char *prog) {
+        fprintf(stderr,
+                "Usage: %s [options] PATH...\n"
+                "  PATH is a test.log, a configuration directory (with a test.log or run\n"
+                "  subdirectories holding one) or a directory searched for configurations.\n"
+                "  -j N      parallel parsing threads (default: number of CPUs)\n"
+                "  -t        text summaries instead of JSON lines\n"
+                "  -s ID     sink node id (default 1), besides the nodes logging \"I am sink\"\n",
+                prog);
+        exit(1);
+}
+
+int main(int argc, char **argv) {
+        int threads = sysconf(_SC_NPROCESSORS_ONLN);
+        bool text = false;
+        pthread_t *workers;
+        int opt, i;
+
+        while ((opt = getopt(argc, argv, "j:ts:h")) != -1) {
+                switch (opt) {
+                case 'j': threads = atoi(optarg); break;
+                case 't': text = true; break;
+                case 's': sink_id = atoi(optarg); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (optind == argc) {
+                usage(argv[0]);
+        }
+        for (i = optind; i < argc; i++) {
+                add_path(argv[i]);
+        }
+        if (num_runs == 0) {
+                fprintf(stderr, "analyze-stats: no %s found\n", LOG_NAME);
+                return 1;
+        }
+
+        threads = threads < 1 ? 1 : threads > num_runs ? num_runs : threads;
+        workers = calloc(threads, sizeof(pthread_t));
+        for (i = 0; i < threads; i++) {
+                pthread_create(&workers[i], NULL, worker, NULL);
+        }
+        for (i = 0; i < threads; i++) {
+                pthread_join(workers[i], NULL);
+        }
+        free(workers);
+
+        for (i = 0; i < num_configs; i++) {
+                if (configs[i].num_runs > 0) {
+                        print_config(stdout, &configs[i], text);
+                }
+        }
+        for (i = 0; i < num_runs; i++) {
+                direction_free(&runs[i].dc);
+                direction_free(&runs[i].sr);
+                free(runs[i].booted);
+                free(runs[i].sink);
+                free(runs[i].energy);
+                free(runs[i].path);
+        }
+        return 0;
+}
@@ -0,0 +1,193 @@
+/*
+    Decoder of the binary protocol log (src/event_log.c, built with LOG_BINARY=1).
+
+    Reads a log in the Cooja test.log format and copies it to the output,
+    replacing every EVL dump line with the text lines of its events, as the
+    protocol prints them with LOG_BINARY=0. The time of an event is the time
+    of the dump line minus the clock ticks elapsed between the event and the
+    dump, so it has the resolution of the node clock (1/CLOCK_SECOND).
+
+    The records are read in the host byte order, which is the byte order
+    of the motes (MSP430 and ARM Cortex-M are little endian).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "../../src/event_log.h"
+
+static const char *const formats[] = {
+#define EVENT(id, level, fmt) fmt,
+#include "../../src/log_events.h"
+#undef EVENT
+};
+
+static unsigned long clock_second = 128;
+
+static int hex_value(char c) {
+        if (c >= '0' && c <= '9') {
+                return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+                return c - 'a' + 10;
+        }
+        return -1;
+}
+
+/*
+    Print the text of one event: the conversions of the format (%d, %02x, ...)
+    take the 16 bit arguments of the record in order, signed for %d and %i.
+ */
+static void print_event(FILE *out, const event_record *r) {
+        const char *f;
+        char spec[16];
+        uint8_t arg = 0;
+
+        if (r->event >= EV_COUNT) {
+                fprintf(out, "EVL: unknown event %u\n", r->event);
+                return;
+        }
+        for (f = formats[r->event]; *f != '\0'; f++) {
+                size_t n = 0;
+                int16_t value;
+
+                if (*f != '%') {
+                        fputc(*f, out);
+                        continue;
+                }
+                if (f[1] == '%') {
+                        fputc('%', out);
+                        f++;
+                        continue;
+                }
+                spec[n++] = *f++;
+                while (*f != '\0' && strchr("-0123456789", *f) != NULL && n < sizeof(spec) - 3) {
+                        spec[n++] = *f++;
+                }
+                if (*f == '\0') {
+                        break;
+                }
+                spec[n++] = *f;
+                spec[n] = '\0';
+                value = arg < r->argc ? r->args[arg] : 0;
+                arg++;
+                if (*f == 'd' || *f == 'i') {
+                        fprintf(out, spec, (int)value);
+                } else {
+                        fprintf(out, spec, (unsigned int)(uint16_t)value);
+                }
+        }
+}
+
+/*
+    Decode the records of an EVL line: "EVL:<dump clock>:<lost>:<hex records>".
+    prefix is the text before the message ("<time>\tID:<n>\t"), time its time.
+ */
+static void decode_line(FILE *out, const char *prefix, int prefix_len, unsigned long long time,
+                        const char *evl) {
+        unsigned int dump_clock, lost;
+        int pos;
+        const char *s;
+
+        if (sscanf(evl, "EVL:%x:%x:%n", &dump_clock, &lost, &pos) != 2) {
+                fprintf(out, "%.*s%s", prefix_len, prefix, evl);
+                return;
+        }
+        // prefix without the time
+        const char *node = memchr(prefix, '\t', prefix_len);
+        int node_len = node != NULL ? prefix_len - (node - prefix) : 0;
+
+        if (lost > 0) {
+                fprintf(out, "%llu%.*sEVL: %u events lost\n", time, node_len, node, lost);
+        }
+        s = evl + pos;
+        for (;;) {
+                event_record r;
+                uint8_t *b = (uint8_t *)&r;
+                size_t len = EVENT_RECORD_HEADER_LEN;
+                size_t i;
+
+                memset(&r, 0, sizeof(r));
+                for (i = 0; i < len; i++) {
+                        int hi = hex_value(s[2 * i]), lo = hi < 0 ? -1 : hex_value(s[2 * i + 1]);
+                        if (lo < 0) {
+                                if (i > 0) {
+                                        fprintf(stderr, "decode-events: truncated record: %s", evl);
+                                }
+                                return;
+                        }
+                        b[i] = hi << 4 | lo;
+                        if (i == EVENT_RECORD_HEADER_LEN - 1) {
+                                len += 2 * (r.argc > LOG_MAX_ARGS ? LOG_MAX_ARGS : r.argc);
+                        }
+                }
+                s += 2 * len;
+
+                unsigned long long ago = (uint16_t)(dump_clock - r.time) * 1000000ULL / clock_second;
+                fprintf(out, "%llu%.*s", time > ago ? time - ago : 0, node_len, node);
+                print_event(out, &r);
+        }
+}
+
+static void decode(FILE *in, FILE *out) {
+        char *line = NULL;
+        size_t size = 0;
+        ssize_t len;
+
+        while ((len = getline(&line, &size, in)) > 0) {
+                char *evl = strstr(line, "\tEVL:");
+                char *end;
+                unsigned long long time;
+
+                if (evl == NULL) {
+                        fputs(line, out);
+                        continue;
+                }
+                evl++;
+                time = strtoull(line, &end, 10);
+                if (end == line || *end != '\t') {
+                        // not in the test.log format: no time to correct
+                        time = 0;
+                }
+                decode_line(out, line, evl - line, time, evl);
+        }
+        free(line);
+}
+
+static void usage(const char *prog) {
+        fprintf(stderr,
+                "Usage: %s [-c HZ] [LOG...]\n"
+                "  Decode the EVL lines of the binary protocol log, other lines are copied.\n"
+                "  Reads the standard input when no log is given.\n"
+                "  -c HZ     clock ticks per second of the nodes, CLOCK_SECOND (default 128)\n",
+                prog);
+        exit(1);
+}
+
+int main(int argc, char **argv) {
+        int opt, i;
+
+        while ((opt = getopt(argc, argv, "c:h")) != -1) {
+                switch (opt) {
+                case 'c': clock_second = strtoul(optarg, NULL, 10); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (clock_second == 0) {
+                usage(argv[0]);
+        }
+        if (optind == argc) {
+                decode(stdin, stdout);
+        }
+        for (i = optind; i < argc; i++) {
+                FILE *in = fopen(argv[i], "r");
+                if (in == NULL) {
+                        perror(argv[i]);
+                        return 1;
+                }
+                decode(in, stdout);
+                fclose(in);
+        }
+        return 0;
+}
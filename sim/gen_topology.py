@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+#
+# Topology generator for the scaling experiments.
+#
+# Writes each topology twice, with the same node positions:
+#
+#   <out>/<kind>_<nodes>.csc   Cooja simulation, a copy of the template csc
+#                              (radio medium, plugins, test script) with the
+#                              generated motes, range and timeout
+#   <out>/<kind>_<nodes>.txt   "id x y" lines for sim/native/srdcp-sim -T
+#
+# Node 1 is the sink. Kinds:
+#   grid       square grid, spacing 0.6 x range (8 neighbors), sink in the center
+#   uniform    uniform random in a square with about 8 neighbors per node
+#              (the area of srdcp-sim without -T), sink in the center
+#   clustered  gaussian clusters of about 25 nodes, each cluster center within
+#              1.5 x range of a previous one, sink in the first cluster
+#   chain      linear chain, spacing 0.8 x range, sink at one end:
+#              the deepest node is nodes - 1 hops away
+#
+# Random layouts are drawn again until the unit disk graph is connected.
+# The same seed gives the same topologies.
+
+import argparse
+import math
+import os
+import random
+import re
+import sys
+
+SIM_FOLDER = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_TEMPLATE = os.path.join(SIM_FOLDER, "cooja", "random_topology_1.csc")
+KINDS = ["grid", "uniform", "clustered", "chain"]
+MAX_TRIES = 100
+
+MOTE = """    <mote>
+      <breakpoints />
+      <interface_config>
+        org.contikios.cooja.interfaces.Position
+        <x>%r</x>
+        <y>%r</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.mspmote.interfaces.MspClock
+        <deviation>1.0</deviation>
+      </interface_config>
+      <interface_config>
+        org.contikios.cooja.mspmote.interfaces.MspMoteID
+        <id>%d</id>
+      </interface_config>
+      <motetype_identifier>sky1</motetype_identifier>
+    </mote>
+"""
+
+def grid(n, r, rng):
+	cols = math.ceil(math.sqrt(n))
+	step = 0.6 * r
+	cells = [((i % cols) * step, (i // cols) * step) for i in range(n)]
+	# the sink takes the cell closest to the center of the grid
+	cx = (cols - 1) * step / 2
+	cy = ((n - 1) // cols) * step / 2
+	sink = min(cells, key=lambda c: (c[0] - cx) ** 2 + (c[1] - cy) ** 2)
+	cells.remove(sink)
+	return [sink] + cells
+
+def uniform(n, r, rng):
+	side = r * math.sqrt(n * math.pi / 8)
+	return [(side / 2, side / 2)] + [(rng.uniform(0, side), rng.uniform(0, side)) for _ in range(n - 1)]
+
+def clustered(n, r, rng):
+	centers = [(0.0, 0.0)]
+	for _ in range(max(1, round(n / 25)) - 1):
+		x, y = rng.choice(centers)
+		d, a = rng.uniform(r, 1.5 * r), rng.uniform(0, 2 * math.pi)
+		centers.append((x + d * math.cos(a), y + d * math.sin(a)))
+	nodes = [centers[0]]
+	for i in range(1, n):
+		x, y = centers[i % len(centers)]
+		nodes.append((rng.gauss(x, r / 2), rng.gauss(y, r / 2)))
+	# positive coordinates, as in the Cooja topologies
+	min_x = min(x for x, _ in nodes)
+	min_y = min(y for _, y in nodes)
+	return [(x - min_x, y - min_y) for x, y in nodes]
+
+def chain(n, r, rng):
+	return [(i * 0.8 * r, 0.0) for i in range(n)]
+
+LAYOUTS = {"grid": grid, "uniform": uniform, "clustered": clustered, "chain": chain}
+
+def hop_depths(nodes, r):
+	"""Hops from the sink (node 1) of every node in the unit disk graph, None if unreachable"""
+	depth = [None] * len(nodes)
+	depth[0] = 0
+	frontier = [0]
+	while frontier:
+		nxt = []
+		for i in frontier:
+			xi, yi = nodes[i]
+			for j, (xj, yj) in enumerate(nodes):
+				if depth[j] is None and (xi - xj) ** 2 + (yi - yj) ** 2 <= r * r:
+					depth[j] = depth[i] + 1
+					nxt.append(j)
+		frontier = nxt
+	return depth
+
+def generate(kind, n, r, rng):
+	for _ in range(MAX_TRIES):
+		nodes = LAYOUTS[kind](n, r, rng)
+		depth = hop_depths(nodes, r)
+		if None not in depth:
+			return nodes, max(depth)
+	sys.exit("gen_topology: no connected %s topology of %d nodes in %d tries" % (kind, n, MAX_TRIES))
+
+def write_txt(path, nodes, header):
+	with open(path, "w") as f:
+		f.write("# %s\n" % header)
+		for i, (x, y) in enumerate(nodes):
+			f.write("%d %.3f %.3f\n" % (i + 1, x, y))
+
+def write_csc(path, template, nodes, r, timeout):
+	motes = "".join(MOTE % (round(x, 3), round(y, 3), i + 1) for i, (x, y) in enumerate(nodes))
+	csc = re.sub(r"[ \t]*<mote>\s*<breakpoints />.*?</mote>\n", "", template, flags=re.S)
+	csc = csc.replace("    </motetype>\n", "    </motetype>\n" + motes, 1)
+	# the TimeLine plugin lists the mote indices of the template
+	csc = re.sub(r"[ \t]*<mote>\d+</mote>\n", "", csc)
+	csc = re.sub(r"<transmitting_range>[^<]*</transmitting_range>", "<transmitting_range>%.1f</transmitting_range>" % r, csc)
+	csc = re.sub(r"<interference_range>[^<]*</interference_range>", "<interference_range>%.1f</interference_range>" % (2 * r), csc)
+	csc = re.sub(r"^(\s*)TIMEOUT\(\d+\);", lambda m: "%sTIMEOUT(%d);" % (m.group(1), timeout * 1000), csc, count=1, flags=re.M)
+	with open(path, "w") as f:
+		f.write(csc)
+
+def int_list(s):
+	return [int(v) for v in s.split(",")]
+
+def kind_list(s):
+	kinds = s.split(",")
+	for k in kinds:
+		if k not in KINDS:
+			raise argparse.ArgumentTypeError("unknown kind '%s' (kinds: %s)" % (k, ", ".join(KINDS)))
+	return kinds
+
+def main():
+	parser = argparse.ArgumentParser(description="Generate grid, uniform, clustered and chain topologies as csc and srdcp-sim files.")
+	parser.add_argument("-k", "--kinds", type=kind_list, default=KINDS, help="comma separated kinds (default: %s)" % ",".join(KINDS))
+	parser.add_argument("-n", "--nodes", type=int_list, default=[50, 100, 250, 500], help="comma separated sizes (default: 50,100,250,500)")
+	parser.add_argument("-r", "--range", type=float, default=50, help="radio range in meters, as the UDGM transmitting range (default 50)")
+	parser.add_argument("-s", "--seed", type=int, default=1, help="random seed (default 1)")
+	parser.add_argument("-t", "--timeout", type=int, default=1800, help="simulated seconds of the csc test script (default 1800)")
+	parser.add_argument("--template", default=DEFAULT_TEMPLATE, help="csc file giving everything but the motes (default cooja/random_topology_1.csc)")
+	parser.add_argument("-o", "--out", default=os.path.join(SIM_FOLDER, "topologies"), help="output folder (default sim/topologies)")
+	args = parser.parse_args()
+
+	with open(args.template) as f:
+		template = f.read()
+	os.makedirs(args.out, exist_ok=True)
+	for kind in args.kinds:
+		for n in args.nodes:
+			if n < 2:
+				parser.error("a topology needs at least 2 nodes")
+			# one generator per topology: adding a kind or a size does not change the others
+			rng = random.Random("%d:%s:%d" % (args.seed, kind, n))
+			nodes, depth = generate(kind, n, args.range, rng)
+			name = "%s_%d" % (kind, n)
+			write_txt(os.path.join(args.out, name + ".txt"), nodes,
+				  "%s, %d nodes, range %g m, seed %d, depth %d hops" % (kind, n, args.range, args.seed, depth))
+			write_csc(os.path.join(args.out, name + ".csc"), template, nodes, args.range, args.timeout)
+			print("%s: %d nodes, depth %d hops" % (name, n, depth))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,474 @@
+/*
+    Micro-benchmarks of the sink routing table and of the source routing
+    header processing, on synthetic collection trees.
+
+    The protocol sources are the ones of the simulator build, but there is no
+    network: the radio hands the frames back to the benchmark, timers never
+    fire and logging is off. Every tree has nodes 2..N spread over DEPTH equal
+    layers, each node choosing a random parent in the layer above.
+
+    Results are in ns per operation and in cycles per operation: TSC cycles
+    on x86, otherwise ns times the clock frequency given with -g. The
+    operations that look up routes also give the share served by the route
+    cache.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#else
+#define BENCH_HAVE_TSC 0
+#endif
+#include "simulator.h"
+#include "my_collect.h"
+#include "routing_table.h"
+#include "send_queue.h"
+
+// the protocol log goes through sim_printf (off), the results straight to stdout
+#undef printf
+
+#define BENCH_MAX_SIZES 8
+
+/*
+   ------------------------------------ SIMULATOR STUBS ------------------------------------
+ */
+
+sim_config sim_conf = {.verbosity = 0};
+sim_node *sim_nodes;
+int sim_num_nodes;
+int sim_current;
+sim_time_t sim_now;
+
+// Last unicast frame handed to the radio
+static uint8_t frame[PACKETBUF_SIZE];
+static uint16_t frame_len;
+static linkaddr_t frame_receiver;
+
+void sim_set_node(int idx) {
+        sim_current = idx;
+}
+
+int sim_node_index(const linkaddr_t *addr) {
+        return -1;
+}
+
+void sim_schedule_ctimer(struct ctimer *c, sim_time_t delay) {
+}
+
+void sim_schedule_call(int node, sim_time_t delay, void (*f)(void *), void *ptr) {
+}
+
+int sim_radio_broadcast(struct broadcast_conn *c) {
+        return 1;
+}
+
+int sim_radio_unicast(struct unicast_conn *c, const linkaddr_t *receiver) {
+        frame_len = packetbuf_copyto(frame);
+        linkaddr_copy(&frame_receiver, receiver);
+        return 1;
+}
+
+void sim_app_init(int num_nodes) {
+}
+
+void sim_app_boot(void *ptr) {
+}
+
+void sim_app_report(void) {
+}
+
+/*
+   ------------------------------------ TREES ------------------------------------
+ */
+
+typedef struct bench_tree {
+        int nodes;
+        int depth;
+        linkaddr_t *parent; // parent[id], ids from 2 to nodes
+        linkaddr_t *addr;   // addr[id]
+} bench_tree;
+
+static void node_addr(int id, linkaddr_t *addr) {
+        addr->u8[0] = id & 0xff;
+        addr->u8[1] = id >> 8;
+}
+
+// Layer of a node: ids are dealt round robin to the layers 1..depth
+static int node_layer(const bench_tree *t, int id) {
+        return 1 + (id - 2) % t->depth;
+}
+
+static void tree_build(bench_tree *t, int nodes, int depth) {
+        int id;
+        t->nodes = nodes;
+        t->depth = depth;
+        t->parent = calloc(nodes + 1, sizeof(linkaddr_t));
+        t->addr = calloc(nodes + 1, sizeof(linkaddr_t));
+        for (id = 1; id <= nodes; id++) {
+                node_addr(id, &t->addr[id]);
+        }
+        for (id = 2; id <= nodes; id++) {
+                int layer = node_layer(t, id);
+                if (layer == 1) {
+                        linkaddr_copy(&t->parent[id], &sink_addr);
+                } else {
+                        // ids of layer - 1: first + depth * j
+                        int first = layer;
+                        int count = (nodes - first) / depth + 1;
+                        node_addr(first + depth * (int)(random() % count), &t->parent[id]);
+                }
+        }
+}
+
+static void tree_free(bench_tree *t) {
+        free(t->parent);
+        free(t->addr);
+}
+
+/*
+   ------------------------------------ TIMING ------------------------------------
+ */
+
+static double min_time_ns = 2e8; // per benchmark
+static double cpu_ghz;           // for the cycle estimate without TSC
+
+static double now_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#if BENCH_HAVE_TSC
+        return __rdtsc();
+#else
+        return 0;
+#endif
+}
+
+// hits: route cache hit rate in percent, negative if the operation does no lookup
+static void report(const bench_tree *t, const char *name, double ns, double cycles, uint64_t ops, double hits) {
+        printf("%6d %5d  %-34s %10.1f", t->nodes, t->depth, name, ns / ops);
+        if (BENCH_HAVE_TSC) {
+                printf(" %10.0f", cycles / ops);
+        } else if (cpu_ghz > 0) {
+                printf(" %10.0f", ns / ops * cpu_ghz);
+        } else {
+                printf(" %10s", "-");
+        }
+        if (hits >= 0) {
+                printf(" %9.1f%%\n", hits);
+        } else {
+                printf(" %10s\n", "-");
+        }
+}
+
+typedef struct bench_ctx {
+        const bench_tree *tree;
+        my_collect_conn *sink;
+        my_collect_conn *node;
+        int path_len;
+        // captured source routing frames, for the destinations below the first layer
+        uint8_t (*frames)[PACKETBUF_SIZE];
+        uint16_t *frame_lens;
+        linkaddr_t *first_hops;
+        int num_frames;
+} bench_ctx;
+
+typedef void (*bench_op)(bench_ctx *ctx, uint32_t i);
+
+volatile int bench_result; // keeps the results of the operations alive
+
+/*
+    Run op in batches of doubling size until a batch takes at least
+    min_time_ns, then report the time per operation of that batch.
+ */
+static void bench_run(bench_ctx *ctx, const char *name, bench_op op) {
+        TreeDict *dict = ctx->sink->routing_table;
+        uint64_t ops, i;
+        for (ops = 64; ; ops *= 2) {
+#if ROUTE_CACHE_SIZE > 0
+                dict->route_cache_hits = 0;
+                dict->route_cache_misses = 0;
+#endif
+                double start = now_ns();
+                uint64_t start_cycles = now_cycles();
+                for (i = 0; i < ops; i++) {
+                        op(ctx, (uint32_t)i);
+                }
+                double ns = now_ns() - start;
+                uint64_t cycles = now_cycles() - start_cycles;
+                if (ns >= min_time_ns || ops >= (1ULL << 40)) {
+                        double hits = -1;
+#if ROUTE_CACHE_SIZE > 0
+                        if (dict->route_cache_hits + dict->route_cache_misses > 0) {
+                                hits = 100.0 * dict->route_cache_hits / (dict->route_cache_hits + dict->route_cache_misses);
+                        }
+#endif
+                        report(ctx->tree, name, ns, (double)cycles, ops, hits);
+                        return;
+                }
+        }
+}
+
+/*
+   ------------------------------------ BENCHMARKS ------------------------------------
+ */
+
+// Node id of the i-th operation, cycling over all the nodes but the sink
+static int op_node(const bench_tree *t, uint32_t i) {
+        return 2 + i % (t->nodes - 1);
+}
+
+static void dict_fill(bench_ctx *ctx) {
+        int id;
+        dict_init(ctx->sink->routing_table);
+        for (id = 2; id <= ctx->tree->nodes; id++) {
+                dict_add(ctx->sink->routing_table, ctx->tree->addr[id], ctx->tree->parent[id]);
+        }
+}
+
+/*
+    Insertion into an empty table: the table is reset every N - 1 inserts,
+    out of the timed loop.
+ */
+static void bench_dict_insert(bench_ctx *ctx) {
+        const bench_tree *t = ctx->tree;
+        double ns = 0, cycles = 0;
+        uint64_t ops = 0;
+        while (ns < min_time_ns) {
+                int id;
+                dict_init(ctx->sink->routing_table);
+                double start = now_ns();
+                uint64_t start_cycles = now_cycles();
+                for (id = 2; id <= t->nodes; id++) {
+                        dict_add(ctx->sink->routing_table, t->addr[id], t->parent[id]);
+                }
+                ns += now_ns() - start;
+                cycles += now_cycles() - start_cycles;
+                ops += t->nodes - 1;
+        }
+        report(t, "dict_add (insert)", ns, cycles, ops, -1);
+}
+
+static void op_dict_update(bench_ctx *ctx, uint32_t i) {
+        int id = op_node(ctx->tree, i);
+        bench_result = dict_add(ctx->sink->routing_table, ctx->tree->addr[id], ctx->tree->parent[id]);
+}
+
+static void op_dict_find_hit(bench_ctx *ctx, uint32_t i) {
+        bench_result = dict_find_index(ctx->sink->routing_table, ctx->tree->addr[op_node(ctx->tree, i)]);
+}
+
+static void op_dict_find_miss(bench_ctx *ctx, uint32_t i) {
+        linkaddr_t absent;
+        node_addr(ctx->tree->nodes + 1 + i % 1024, &absent);
+        bench_result = dict_find_index(ctx->sink->routing_table, absent);
+}
+
+// Worst case: the sink is never in the path, the whole path is scanned
+static void op_already_in_route(bench_ctx *ctx, uint32_t i) {
+        bench_result = already_in_route(ctx->sink, ctx->path_len, (linkaddr_t*)&sink_addr);
+}
+
+// Same destination every time: served from the route cache
+static void op_find_route_hit(bench_ctx *ctx, uint32_t i) {
+        bench_result = find_route(ctx->sink, &ctx->tree->addr[ctx->tree->nodes]);
+}
+
+/*
+    All the destinations in turn: with more destinations than
+    ROUTE_CACHE_SIZE the LRU cache always misses.
+ */
+static void op_find_route_walk(bench_ctx *ctx, uint32_t i) {
+        bench_result = find_route(ctx->sink, &ctx->tree->addr[op_node(ctx->tree, i)]);
+}
+
+// The destinations of app.c in turn: nodes 2..BENCH_APP_NODES
+#define BENCH_APP_NODES 10
+static void op_find_route_app(bench_ctx *ctx, uint32_t i) {
+        int nodes = ctx->tree->nodes < BENCH_APP_NODES ? ctx->tree->nodes : BENCH_APP_NODES;
+        bench_result = find_route(ctx->sink, &ctx->tree->addr[2 + i % (nodes - 1)]);
+}
+
+static void load_payload(uint16_t seqn) {
+        packetbuf_clear();
+        memcpy(packetbuf_dataptr(), &seqn, sizeof(seqn));
+        packetbuf_set_datalen(sizeof(seqn));
+}
+
+/*
+    Route lookup, header build and queueing of a source routing packet.
+    The queued packet is acknowledged right away to empty the queue.
+ */
+static void op_sr_send(bench_ctx *ctx, uint32_t i) {
+        load_payload(i);
+        bench_result = sr_send(ctx->sink, &ctx->tree->addr[op_node(ctx->tree, i)]);
+        send_queue_sent(ctx->sink, MAC_TX_OK, 1);
+}
+
+/*
+    First hop of a source routing packet: header check, path strip and
+    queueing towards the next hop.
+ */
+static void op_forward_downward(bench_ctx *ctx, uint32_t i) {
+        int id = i % ctx->num_frames;
+        linkaddr_copy(&linkaddr_node_addr, &ctx->first_hops[id]);
+        packetbuf_copyfrom(ctx->frames[id], ctx->frame_lens[id]);
+        forward_downward_data(ctx->node, &sink_addr);
+        send_queue_sent(ctx->node, MAC_TX_OK, 1);
+}
+
+/*
+    Capture the frame sent by the sink to every destination deeper than the
+    first layer, for the forwarding benchmark.
+ */
+static void capture_frames(bench_ctx *ctx) {
+        const bench_tree *t = ctx->tree;
+        int id;
+        ctx->frames = calloc(t->nodes, PACKETBUF_SIZE);
+        ctx->frame_lens = calloc(t->nodes, sizeof(uint16_t));
+        ctx->first_hops = calloc(t->nodes, sizeof(linkaddr_t));
+        ctx->num_frames = 0;
+        for (id = 2; id <= t->nodes; id++) {
+                if (node_layer(t, id) == 1) {
+                        continue;
+                }
+                frame_len = 0;
+                load_payload(0);
+                if (sr_send(ctx->sink, &t->addr[id]) && frame_len > 0) {
+                        memcpy(ctx->frames[ctx->num_frames], frame, frame_len);
+                        ctx->frame_lens[ctx->num_frames] = frame_len;
+                        linkaddr_copy(&ctx->first_hops[ctx->num_frames], &frame_receiver);
+                        ctx->num_frames++;
+                }
+                send_queue_sent(ctx->sink, MAC_TX_OK, 1);
+        }
+}
+
+static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops, uint16_t delay) {
+}
+
+static const struct my_collect_callbacks sink_cb = {.recv = NULL, .sr_recv = NULL};
+static const struct my_collect_callbacks node_cb = {.recv = NULL, .sr_recv = sr_recv_cb};
+
+static void bench_tree_run(int nodes, int depth, my_collect_conn *sink, my_collect_conn *node) {
+        bench_tree t;
+        bench_ctx ctx = {.tree = &t, .sink = sink, .node = node};
+
+        tree_build(&t, nodes, depth);
+
+        sim_set_node(0);
+        linkaddr_copy(&linkaddr_node_addr, &sink_addr);
+        bench_dict_insert(&ctx);
+        dict_fill(&ctx);
+        bench_run(&ctx, "dict_add (update)", op_dict_update);
+        bench_run(&ctx, "dict_find_index (hit)", op_dict_find_hit);
+        bench_run(&ctx, "dict_find_index (miss)", op_dict_find_miss);
+        ctx.path_len = find_route(sink, &t.addr[nodes]);
+        bench_run(&ctx, "already_in_route (full path)", op_already_in_route);
+        bench_run(&ctx, "find_route (cached)", op_find_route_hit);
+        bench_run(&ctx, "find_route (app destinations)", op_find_route_app);
+        bench_run(&ctx, "find_route (all destinations)", op_find_route_walk);
+        bench_run(&ctx, "sr_send", op_sr_send);
+        capture_frames(&ctx);
+
+        sim_set_node(1);
+        if (ctx.num_frames > 0) {
+                bench_run(&ctx, "forward_downward_data", op_forward_downward);
+        }
+
+        free(ctx.frames);
+        free(ctx.frame_lens);
+        free(ctx.first_hops);
+        tree_free(&t);
+}
+
+static void usage(const char *prog) {
+        fprintf(stderr,
+                "Usage: %s [options]\n"
+                "  -n N     tree size, repeatable (default 30, 256 and 1024)\n"
+                "  -d D     tree depth, repeatable (default 2, 6 and 10)\n"
+                "  -t MS    minimum time of each benchmark in milliseconds (default 200)\n"
+                "  -g GHZ   clock frequency for the cycle estimate without TSC\n"
+                "  -s N     random seed of the trees (default 1)\n",
+                prog);
+        exit(1);
+}
+
+int main(int argc, char **argv) {
+        int sizes[BENCH_MAX_SIZES] = {30, 256, 1024};
+        int depths[BENCH_MAX_SIZES] = {2, 6, 10};
+        int num_sizes = 0, num_depths = 0;
+        unsigned seed = 1;
+        int opt, i, j;
+
+        while ((opt = getopt(argc, argv, "n:d:t:g:s:h")) != -1) {
+                switch (opt) {
+                case 'n':
+                        if (num_sizes == BENCH_MAX_SIZES) {
+                                usage(argv[0]);
+                        }
+                        sizes[num_sizes++] = atoi(optarg);
+                        break;
+                case 'd':
+                        if (num_depths == BENCH_MAX_SIZES) {
+                                usage(argv[0]);
+                        }
+                        depths[num_depths++] = atoi(optarg);
+                        break;
+                case 't': min_time_ns = atof(optarg) * 1e6; break;
+                case 'g': cpu_ghz = atof(optarg); break;
+                case 's': seed = strtoul(optarg, NULL, 10); break;
+                default: usage(argv[0]);
+                }
+        }
+        num_sizes = num_sizes ? num_sizes : 3;
+        num_depths = num_depths ? num_depths : 3;
+        for (i = 0; i < num_sizes; i++) {
+                if (sizes[i] < 2 || sizes[i] > MAX_NODES) {
+                        fprintf(stderr, "bench: tree size must be between 2 and MAX_NODES (%d)\n", MAX_NODES);
+                        return 1;
+                }
+        }
+        for (j = 0; j < num_depths; j++) {
+                if (depths[j] < 1 || depths[j] > MAX_PATH_LENGTH) {
+                        fprintf(stderr, "bench: tree depth must be between 1 and MAX_PATH_LENGTH (%d)\n", MAX_PATH_LENGTH);
+                        return 1;
+                }
+        }
+
+        // node 0 is the sink, node 1 the forwarder of the downward packets
+        sim_num_nodes = 2;
+        sim_nodes = calloc(sim_num_nodes, sizeof(sim_node));
+        my_collect_conn *sink = calloc(1, sizeof(my_collect_conn));
+        my_collect_conn *node = calloc(1, sizeof(my_collect_conn));
+        // the forwarder has no descendant table to route storing mode packets with
+        struct my_collect_config sink_config = my_collect_default_config;
+        sink_config.storing_mode = 0;
+        sim_set_node(0);
+        linkaddr_copy(&linkaddr_node_addr, &sink_addr);
+        my_collect_open(sink, 0xAA, true, &sink_cb, &sink_config);
+        sim_set_node(1);
+        node_addr(2, &linkaddr_node_addr);
+        my_collect_open(node, 0xAA, false, &node_cb, NULL);
+
+        printf("# MAX_NODES %d, DICT_CAPACITY %d, ROUTE_CACHE_SIZE %d, MAX_PATH_LENGTH %d\n",
+               MAX_NODES, DICT_CAPACITY, ROUTE_CACHE_SIZE, MAX_PATH_LENGTH);
+        printf("# cycles: %s\n", BENCH_HAVE_TSC ? "TSC" : cpu_ghz > 0 ? "ns x -g" : "n/a (use -g)");
+        printf("%6s %5s  %-34s %10s %10s %10s\n", "nodes", "depth", "operation", "ns/op", "cycles/op", "cache hit");
+        for (i = 0; i < num_sizes; i++) {
+                for (j = 0; j < num_depths; j++) {
+                        if (depths[j] > sizes[i] - 1) {
+                                continue; // not enough nodes to fill the layers
+                        }
+                        srandom(seed);
+                        bench_tree_run(sizes[i], depths[j], sink, node);
+                }
+        }
+        return 0;
+}
@@ -0,0 +1,26 @@
+/*
+    Native shim of the Contiki APIs used by the protocol sources (src/).
+    Only the functions the protocol calls are provided, implemented in
+    contiki_shim.c on top of the discrete-event simulator.
+ */
+#ifndef CONTIKI_H_
+#define CONTIKI_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+// SIM_CLOCK_16BIT: the 16-bit clock_time_t of the motes (the Sky), whose timers wrap after 511 s
+#if SIM_CLOCK_16BIT
+typedef unsigned short clock_time_t;
+#else
+typedef unsigned long clock_time_t;
+#endif
+#define CLOCK_SECOND 128
+clock_time_t clock_time(void);
+
+#include "sys/ctimer.h"
+#include "lib/list.h"
+#include "lib/memb.h"
+
+#endif /* CONTIKI_H_ */
@@ -0,0 +1,3 @@
+#ifndef LEDS_H_
+#define LEDS_H_
+#endif /* LEDS_H_ */
@@ -0,0 +1,21 @@
+#ifndef MEMB_H_
+#define MEMB_H_
+
+/*
+    On a mote a MEMB is a static pool. In the simulator all the nodes share
+    the same static declaration, so the pool only records the element size
+    and count: every node may allocate up to num elements (heap allocated).
+ */
+struct memb {
+        unsigned short size;
+        unsigned short num;
+};
+
+#define MEMB(name, structure, num) \
+        static struct memb name = {sizeof(structure), num}
+
+void memb_init(struct memb *m);
+void *memb_alloc(struct memb *m);
+char memb_free(struct memb *m, void *ptr);
+
+#endif /* MEMB_H_ */
@@ -0,0 +1,14 @@
+#ifndef MAC_H_
+#define MAC_H_
+
+// Same values as Contiki's mac.h
+enum {
+        MAC_TX_OK,
+        MAC_TX_COLLISION,
+        MAC_TX_NOACK,
+        MAC_TX_DEFERRED,
+        MAC_TX_ERR,
+        MAC_TX_ERR_FATAL,
+};
+
+#endif /* MAC_H_ */
@@ -0,0 +1,3 @@
+#ifndef NETSTACK_H_
+#define NETSTACK_H_
+#endif /* NETSTACK_H_ */
@@ -0,0 +1,34 @@
+#ifndef PACKETBUF_H_
+#define PACKETBUF_H_
+
+#include "contiki.h"
+#include "core/net/linkaddr.h"
+
+// Same layout as Contiki's packetbuf: a header area in front of the data
+#define PACKETBUF_SIZE 128
+#define PACKETBUF_HDR_SIZE 48
+
+enum {
+        PACKETBUF_ATTR_NONE,
+        PACKETBUF_ATTR_RSSI,
+        PACKETBUF_ATTR_LINK_QUALITY,
+        PACKETBUF_NUM_ATTRS
+};
+typedef uint16_t packetbuf_attr_t;
+
+void packetbuf_clear(void);
+void *packetbuf_dataptr(void);
+void *packetbuf_hdrptr(void);
+uint16_t packetbuf_datalen(void);
+uint8_t packetbuf_hdrlen(void);
+uint16_t packetbuf_totlen(void);
+void packetbuf_set_datalen(uint16_t len);
+int packetbuf_hdralloc(int size);
+int packetbuf_hdrreduce(int size);
+void packetbuf_compact(void);
+int packetbuf_copyfrom(const void *from, uint16_t len);
+int packetbuf_copyto(void *to);
+int packetbuf_set_attr(uint8_t type, const packetbuf_attr_t val);
+packetbuf_attr_t packetbuf_attr(uint8_t type);
+
+#endif /* PACKETBUF_H_ */
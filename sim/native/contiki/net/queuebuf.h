@@ -0,0 +1,10 @@
+#ifndef QUEUEBUF_H_
+#define QUEUEBUF_H_
+
+struct queuebuf;
+
+struct queuebuf *queuebuf_new_from_packetbuf(void);
+void queuebuf_to_packetbuf(struct queuebuf *b);
+void queuebuf_free(struct queuebuf *b);
+
+#endif /* QUEUEBUF_H_ */
@@ -0,0 +1,37 @@
+#ifndef RIME_H_
+#define RIME_H_
+
+#include "contiki.h"
+#include "core/net/linkaddr.h"
+#include "net/packetbuf.h"
+#include "net/queuebuf.h"
+#include "net/mac/mac.h"
+#include "lib/random.h"
+
+// Broadcast and unicast primitives, delivered by the simulated radio
+
+struct broadcast_conn;
+struct broadcast_callbacks {
+        void (* recv)(struct broadcast_conn *ptr, const linkaddr_t *sender);
+        void (* sent)(struct broadcast_conn *ptr, int status, int num_tx);
+};
+struct broadcast_conn {
+        uint16_t channel;
+        const struct broadcast_callbacks *u;
+};
+void broadcast_open(struct broadcast_conn *c, uint16_t channel, const struct broadcast_callbacks *u);
+int broadcast_send(struct broadcast_conn *c);
+
+struct unicast_conn;
+struct unicast_callbacks {
+        void (* recv)(struct unicast_conn *c, const linkaddr_t *from);
+        void (* sent)(struct unicast_conn *ptr, int status, int num_tx);
+};
+struct unicast_conn {
+        struct broadcast_conn c;
+        const struct unicast_callbacks *u;
+};
+void unicast_open(struct unicast_conn *c, uint16_t channel, const struct unicast_callbacks *u);
+int unicast_send(struct unicast_conn *c, const linkaddr_t *receiver);
+
+#endif /* RIME_H_ */
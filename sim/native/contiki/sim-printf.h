@@ -0,0 +1,13 @@
+/*
+    Force-included in every protocol source: printf output is prefixed with the
+    simulated time and node id, in the same format as the Cooja test logs.
+ */
+#ifndef SIM_PRINTF_H_
+#define SIM_PRINTF_H_
+
+#include <stdio.h>
+
+int sim_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define printf sim_printf
+
+#endif /* SIM_PRINTF_H_ */
@@ -0,0 +1,16 @@
+#ifndef CTIMER_H_
+#define CTIMER_H_
+
+// Callback timer, scheduled as an event of the node that set it
+struct ctimer {
+        void (*f)(void *);
+        void *ptr;
+        unsigned long gen; // incremented at every set/stop, stale events are ignored
+        int active;
+};
+
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr);
+void ctimer_stop(struct ctimer *c);
+int ctimer_expired(struct ctimer *c);
+
+#endif /* CTIMER_H_ */
@@ -0,0 +1,17 @@
+#ifndef ENERGEST_H_
+#define ENERGEST_H_
+
+// Energest times in rtimer ticks, from the radio activity of the simulated node
+#define RTIMER_SECOND 32768UL
+
+enum energest_type {
+        ENERGEST_TYPE_CPU,
+        ENERGEST_TYPE_LPM,
+        ENERGEST_TYPE_TRANSMIT,
+        ENERGEST_TYPE_LISTEN
+};
+
+void energest_flush(void);
+unsigned long energest_type_time(int type);
+
+#endif /* ENERGEST_H_ */
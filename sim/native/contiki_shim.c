@@ -0,0 +1,561 @@
+/*
+    Contiki APIs used by the protocol, implemented for the native simulator.
+    packetbuf, queuebuf and list follow the Contiki 3.0 implementation, so
+    the protocol sees the same buffer semantics as on the motes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "simulator.h"
+#include "sys/energest.h"
+#include "cfs/cfs.h"
+#include "lib/crc16.h"
+
+/*
+   ------------------------------------ LINKADDR ------------------------------------
+ */
+
+linkaddr_t linkaddr_node_addr;
+const linkaddr_t linkaddr_null = {{0, 0}};
+
+void linkaddr_copy(linkaddr_t *dest, const linkaddr_t *src) {
+        memcpy(dest, src, LINKADDR_SIZE);
+}
+
+int linkaddr_cmp(const linkaddr_t *addr1, const linkaddr_t *addr2) {
+        return memcmp(addr1, addr2, LINKADDR_SIZE) == 0;
+}
+
+/*
+   ------------------------------------ CLOCK and RANDOM ------------------------------------
+ */
+
+clock_time_t clock_time(void) {
+        return sim_now * CLOCK_SECOND / SIM_SECOND;
+}
+
+static uint32_t rand_state = 1;
+
+void random_init(unsigned short seed) {
+        rand_state = seed ? seed : 1;
+}
+
+// xorshift32, shared by all the nodes
+unsigned short random_rand(void) {
+        rand_state ^= rand_state << 13;
+        rand_state ^= rand_state >> 17;
+        rand_state ^= rand_state << 5;
+        return rand_state >> 16;
+}
+
+// CRC-16 of Contiki's lib/crc16.c (CCITT polynomial, bits reversed)
+unsigned short crc16_add(unsigned char b, unsigned short acc) {
+        acc ^= b;
+        acc = (acc >> 8) | (acc << 8);
+        acc ^= (acc & 0xff00) << 4;
+        acc ^= (acc >> 8) >> 4;
+        acc ^= (acc & 0xff00) >> 5;
+        return acc;
+}
+
+unsigned short crc16_data(const unsigned char *data, int len, unsigned short acc) {
+        int i;
+        for (i = 0; i < len; i++) {
+                acc = crc16_add(data[i], acc);
+        }
+        return acc;
+}
+
+/*
+   ------------------------------------ CFS ------------------------------------
+ */
+
+/*
+    Files of each node in memory, as its flash: they survive a reboot of the
+    node. A file opened for writing is written from the start (CFS_APPEND: from
+    the end) and grows as needed.
+ */
+typedef struct sim_file {
+        int node;
+        char name[32];
+        uint8_t *data;
+        cfs_offset_t len;
+        struct sim_file *next;
+} sim_file;
+
+#define SIM_CFS_FDS 4
+
+static sim_file *files;
+static struct {
+        sim_file *f; // NULL: free descriptor
+        cfs_offset_t offset;
+        int flags;
+} fds[SIM_CFS_FDS];
+
+static sim_file **file_find(const char *name) {
+        sim_file **f;
+        for (f = &files; *f != NULL; f = &(*f)->next) {
+                if ((*f)->node == sim_current && strcmp((*f)->name, name) == 0) {
+                        break;
+                }
+        }
+        return f;
+}
+
+int cfs_open(const char *name, int flags) {
+        sim_file **f = file_find(name);
+        int fd;
+        for (fd = 0; fd < SIM_CFS_FDS && fds[fd].f != NULL; fd++) {
+        }
+        if (fd == SIM_CFS_FDS || strlen(name) >= sizeof((*f)->name)) {
+                return -1;
+        }
+        if (*f == NULL) {
+                if (!(flags & (CFS_WRITE | CFS_APPEND))) {
+                        return -1;
+                }
+                *f = calloc(1, sizeof(sim_file));
+                (*f)->node = sim_current;
+                strcpy((*f)->name, name);
+        }
+        fds[fd].f = *f;
+        fds[fd].offset = flags & CFS_APPEND ? (*f)->len : 0;
+        fds[fd].flags = flags;
+        return fd;
+}
+
+void cfs_close(int fd) {
+        if (fd >= 0 && fd < SIM_CFS_FDS) {
+                fds[fd].f = NULL;
+        }
+}
+
+int cfs_read(int fd, void *buf, unsigned int len) {
+        sim_file *f;
+        if (fd < 0 || fd >= SIM_CFS_FDS || fds[fd].f == NULL || !(fds[fd].flags & CFS_READ)) {
+                return -1;
+        }
+        f = fds[fd].f;
+        if (len > (unsigned int)(f->len - fds[fd].offset)) {
+                len = f->len - fds[fd].offset;
+        }
+        memcpy(buf, f->data + fds[fd].offset, len);
+        fds[fd].offset += len;
+        return len;
+}
+
+int cfs_write(int fd, const void *buf, unsigned int len) {
+        sim_file *f;
+        if (fd < 0 || fd >= SIM_CFS_FDS || fds[fd].f == NULL || !(fds[fd].flags & (CFS_WRITE | CFS_APPEND))) {
+                return -1;
+        }
+        f = fds[fd].f;
+        if (fds[fd].offset + len > (unsigned int)f->len) {
+                f->data = realloc(f->data, fds[fd].offset + len);
+                f->len = fds[fd].offset + len;
+        }
+        memcpy(f->data + fds[fd].offset, buf, len);
+        fds[fd].offset += len;
+        return len;
+}
+
+cfs_offset_t cfs_seek(int fd, cfs_offset_t offset, int whence) {
+        cfs_offset_t base;
+        if (fd < 0 || fd >= SIM_CFS_FDS || fds[fd].f == NULL) {
+                return -1;
+        }
+        base = whence == CFS_SEEK_CUR ? fds[fd].offset : whence == CFS_SEEK_END ? fds[fd].f->len : 0;
+        if (base + offset < 0 || base + offset > fds[fd].f->len) {
+                return -1;
+        }
+        fds[fd].offset = base + offset;
+        return fds[fd].offset;
+}
+
+int cfs_remove(const char *name) {
+        sim_file **f = file_find(name);
+        sim_file *removed = *f;
+        int fd;
+        if (removed == NULL) {
+                return -1;
+        }
+        for (fd = 0; fd < SIM_CFS_FDS; fd++) {
+                if (fds[fd].f == removed) {
+                        fds[fd].f = NULL;
+                }
+        }
+        *f = removed->next;
+        free(removed->data);
+        free(removed);
+        return 0;
+}
+
+/*
+   ------------------------------------ ENERGEST ------------------------------------
+ */
+
+void energest_flush(void) {
+}
+
+/*
+    Energest time of the current node, in rtimer ticks since the start.
+    The radio listens during receptions and channel checks (or always, with
+    the radio on), the CPU is counted active while the radio is on.
+ */
+unsigned long energest_type_time(int type) {
+        sim_node *n = &sim_nodes[sim_current];
+        sim_time_t listen, on;
+
+        if (sim_conf.rdc_rate > 0) {
+                listen = n->rx_time + sim_now * sim_conf.rdc_rate / SIM_SECOND * SIM_CHANNEL_CHECK_TIME;
+        } else {
+                listen = sim_now - n->tx_time;
+        }
+        on = n->tx_time + listen < sim_now ? n->tx_time + listen : sim_now;
+        switch (type) {
+        case ENERGEST_TYPE_CPU: return on * RTIMER_SECOND / SIM_SECOND;
+        case ENERGEST_TYPE_LPM: return (sim_now - on) * RTIMER_SECOND / SIM_SECOND;
+        case ENERGEST_TYPE_TRANSMIT: return n->tx_time * RTIMER_SECOND / SIM_SECOND;
+        case ENERGEST_TYPE_LISTEN: return listen * RTIMER_SECOND / SIM_SECOND;
+        }
+        return 0;
+}
+
+/*
+   ------------------------------------ CTIMER ------------------------------------
+ */
+
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr) {
+        c->f = f;
+        c->ptr = ptr;
+        c->gen++;
+        c->active = 1;
+        sim_schedule_ctimer(c, (sim_time_t)t * SIM_SECOND / CLOCK_SECOND);
+}
+
+void ctimer_stop(struct ctimer *c) {
+        c->gen++;
+        c->active = 0;
+}
+
+int ctimer_expired(struct ctimer *c) {
+        return !c->active;
+}
+
+/*
+   ------------------------------------ LIST ------------------------------------
+ */
+
+struct list {
+        struct list *next;
+};
+
+void list_init(list_t list) {
+        *list = NULL;
+}
+
+void *list_head(list_t list) {
+        return *list;
+}
+
+void *list_tail(list_t list) {
+        struct list *l;
+        if (*list == NULL) {
+                return NULL;
+        }
+        for (l = *list; l->next != NULL; l = l->next);
+        return l;
+}
+
+void list_remove(list_t list, void *item) {
+        struct list *l, *r = NULL;
+        for (l = *list; l != NULL; l = l->next) {
+                if (l == item) {
+                        if (r == NULL) {
+                                *list = l->next;
+                        } else {
+                                r->next = l->next;
+                        }
+                        l->next = NULL;
+                        return;
+                }
+                r = l;
+        }
+}
+
+void list_add(list_t list, void *item) {
+        struct list *l;
+        list_remove(list, item);
+        ((struct list *)item)->next = NULL;
+        l = list_tail(list);
+        if (l == NULL) {
+                *list = item;
+        } else {
+                l->next = item;
+        }
+}
+
+void list_push(list_t list, void *item) {
+        list_remove(list, item);
+        ((struct list *)item)->next = *list;
+        *list = item;
+}
+
+void *list_pop(list_t list) {
+        struct list *l = *list;
+        if (l != NULL) {
+                *list = l->next;
+        }
+        return l;
+}
+
+int list_length(list_t list) {
+        struct list *l;
+        int n = 0;
+        for (l = *list; l != NULL; l = l->next) {
+                n++;
+        }
+        return n;
+}
+
+void *list_item_next(void *item) {
+        return item == NULL ? NULL : ((struct list *)item)->next;
+}
+
+/*
+   ------------------------------------ MEMB ------------------------------------
+ */
+
+static int *memb_count(struct memb *m) {
+        sim_node *n = &sim_nodes[sim_current];
+        int i;
+        for (i = 0; i < SIM_MAX_MEMBS; i++) {
+                if (n->membs[i].m == m || n->membs[i].m == NULL) {
+                        n->membs[i].m = m;
+                        return &n->membs[i].count;
+                }
+        }
+        fprintf(stderr, "sim: too many MEMB pools, increase SIM_MAX_MEMBS\n");
+        exit(1);
+}
+
+void memb_init(struct memb *m) {
+        *memb_count(m) = 0;
+}
+
+void *memb_alloc(struct memb *m) {
+        int *count = memb_count(m);
+        if (*count >= m->num) {
+                return NULL;
+        }
+        (*count)++;
+        return calloc(1, m->size);
+}
+
+char memb_free(struct memb *m, void *ptr) {
+        (*memb_count(m))--;
+        free(ptr);
+        return 0;
+}
+
+/*
+   ------------------------------------ PACKETBUF ------------------------------------
+ */
+
+static uint16_t buflen, bufptr;
+static uint8_t hdrptr;
+static uint8_t packetbuf[PACKETBUF_HDR_SIZE + PACKETBUF_SIZE];
+static packetbuf_attr_t attrs[PACKETBUF_NUM_ATTRS];
+
+void packetbuf_clear(void) {
+        buflen = bufptr = 0;
+        hdrptr = PACKETBUF_HDR_SIZE;
+        memset(attrs, 0, sizeof(attrs));
+}
+
+void *packetbuf_dataptr(void) {
+        return &packetbuf[bufptr + PACKETBUF_HDR_SIZE];
+}
+
+void *packetbuf_hdrptr(void) {
+        return &packetbuf[hdrptr];
+}
+
+uint16_t packetbuf_datalen(void) {
+        return buflen;
+}
+
+uint8_t packetbuf_hdrlen(void) {
+        return PACKETBUF_HDR_SIZE - hdrptr;
+}
+
+uint16_t packetbuf_totlen(void) {
+        return packetbuf_hdrlen() + packetbuf_datalen();
+}
+
+void packetbuf_set_datalen(uint16_t len) {
+        buflen = len;
+}
+
+int packetbuf_hdralloc(int size) {
+        if (hdrptr >= size && packetbuf_totlen() + size <= PACKETBUF_SIZE) {
+                hdrptr -= size;
+                return 1;
+        }
+        return 0;
+}
+
+int packetbuf_hdrreduce(int size) {
+        if (buflen < size) {
+                return 0;
+        }
+        bufptr += size;
+        buflen -= size;
+        return 1;
+}
+
+void packetbuf_compact(void) {
+        if (bufptr > 0) {
+                memmove(&packetbuf[PACKETBUF_HDR_SIZE], &packetbuf[bufptr + PACKETBUF_HDR_SIZE], buflen);
+                bufptr = 0;
+        }
+}
+
+int packetbuf_copyfrom(const void *from, uint16_t len) {
+        uint16_t l;
+        packetbuf_clear();
+        l = len > PACKETBUF_SIZE ? PACKETBUF_SIZE : len;
+        memcpy(packetbuf_dataptr(), from, l);
+        buflen = l;
+        return l;
+}
+
+// Copies the header and the data, contiguous
+int packetbuf_copyto(void *to) {
+        if (packetbuf_totlen() > PACKETBUF_SIZE) {
+                return 0;
+        }
+        memcpy(to, packetbuf_hdrptr(), packetbuf_hdrlen());
+        memcpy((uint8_t *)to + packetbuf_hdrlen(), packetbuf_dataptr(), buflen);
+        return packetbuf_totlen();
+}
+
+int packetbuf_set_attr(uint8_t type, const packetbuf_attr_t val) {
+        attrs[type] = val;
+        return 1;
+}
+
+packetbuf_attr_t packetbuf_attr(uint8_t type) {
+        return attrs[type];
+}
+
+/*
+   ------------------------------------ QUEUEBUF ------------------------------------
+ */
+
+struct queuebuf {
+        uint16_t len;
+        packetbuf_attr_t attrs[PACKETBUF_NUM_ATTRS];
+        uint8_t data[PACKETBUF_SIZE];
+};
+
+struct queuebuf *queuebuf_new_from_packetbuf(void) {
+        struct queuebuf *b = malloc(sizeof(struct queuebuf));
+        if (b == NULL) {
+                return NULL;
+        }
+        b->len = packetbuf_copyto(b->data);
+        memcpy(b->attrs, attrs, sizeof(attrs));
+        return b;
+}
+
+void queuebuf_to_packetbuf(struct queuebuf *b) {
+        packetbuf_copyfrom(b->data, b->len);
+        memcpy(attrs, b->attrs, sizeof(attrs));
+}
+
+void queuebuf_free(struct queuebuf *b) {
+        free(b);
+}
+
+/*
+   ------------------------------------ RIME ------------------------------------
+ */
+
+void broadcast_open(struct broadcast_conn *c, uint16_t channel, const struct broadcast_callbacks *u) {
+        c->channel = channel;
+        c->u = u;
+        sim_nodes[sim_current].bc = c;
+}
+
+int broadcast_send(struct broadcast_conn *c) {
+        return sim_radio_broadcast(c);
+}
+
+void unicast_open(struct unicast_conn *c, uint16_t channel, const struct unicast_callbacks *u) {
+        c->c.channel = channel;
+        c->u = u;
+        sim_nodes[sim_current].uc = c;
+}
+
+int unicast_send(struct unicast_conn *c, const linkaddr_t *receiver) {
+        return sim_radio_unicast(c, receiver);
+}
+
+/*
+   ------------------------------------ LOG ------------------------------------
+ */
+
+// Line being printed by the current node
+static char line[1024];
+static size_t line_len;
+
+/*
+    Output a complete line in the Cooja test log format:
+    <time in microseconds> TAB ID:<node id> TAB <text>
+    Verbosity 1 keeps only the application lines ("App: ...").
+ */
+static void log_line(void) {
+        if (sim_conf.verbosity >= 2 || (sim_conf.verbosity == 1 && strncmp(line, "App:", 4) == 0)) {
+                fprintf(stdout, "%llu\tID:%d\t%s\n", (unsigned long long)sim_now,
+                        sim_current + 1, line);
+        }
+        line_len = 0;
+        line[0] = '\0';
+}
+
+void sim_log_flush(void) {
+        if (line_len > 0) {
+                log_line();
+        }
+}
+
+int sim_printf(const char *fmt, ...) {
+        char buf[1024];
+        char *s, *nl;
+        va_list ap;
+        int ret;
+
+        if (sim_conf.verbosity == 0) {
+                return 0;
+        }
+        va_start(ap, fmt);
+        ret = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        for (s = buf; *s != '\0'; s = nl + 1) {
+                size_t n;
+                nl = strchr(s, '\n');
+                n = nl != NULL ? (size_t)(nl - s) : strlen(s);
+                if (line_len + n >= sizeof(line)) {
+                        n = sizeof(line) - 1 - line_len;
+                }
+                memcpy(line + line_len, s, n);
+                line_len += n;
+                line[line_len] = '\0';
+                if (nl == NULL) {
+                        break;
+                }
+                log_line();
+        }
+        return ret;
+}
@@ -0,0 +1,386 @@
+/*
+    Simulated application: the same traffic as src/app.c, written with
+    ctimers instead of a Contiki process. Every node sends a data collection
+    packet every MSG_PERIOD, the sink sends a source routing packet every
+    SR_MSG_PERIOD to the nodes in turn (or to the ones given with --sr-dest).
+    The log lines match app.c, so the simulation logs can be analyzed with
+    the same tools as the Cooja ones.
+    With several sinks (--sink), the first one plays the backbone linking
+    them: it schedules the source routing packets and hands each one to the
+    sink whose partition holds the destination (my_collect_owns).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "simulator.h"
+#include "my_collect.h"
+#include "routing_table.h"
+
+#define MSG_PERIOD (30 * CLOCK_SECOND)  // send every 30 seconds
+#define SR_MSG_PERIOD (10 * CLOCK_SECOND)  // send every 10 seconds
+#if TOPOLOGY_SOLICIT
+#define SR_WARMUP (15 * CLOCK_SECOND) // the sink solicits the topology reports at startup
+#else
+#define SR_WARMUP (75 * CLOCK_SECOND) // gather topology information before source routing
+#endif
+#define SR_WARMUP_RESTORED (5 * CLOCK_SECOND) // routing table restored from the checkpoint
+#define COLLECT_CHANNEL 0xAA
+#define TICKS_TO_MS(t) ((unsigned long)(t) * 1000 / CLOCK_SECOND)
+
+/* Set of the sequence numbers received from a node */
+typedef struct seqn_set {
+        uint8_t *bitmap;
+        size_t len;
+} seqn_set;
+
+/* Application packet */
+typedef struct {
+        uint16_t seqn;
+}
+__attribute__((packed))
+test_msg_t;
+
+typedef struct app_node {
+        struct my_collect_conn conn;
+        struct ctimer periodic;
+        struct ctimer rnd;
+        test_msg_t msg;
+        uint16_t dest; // next source routing destination (backbone sink only)
+        linkaddr_t sr_dest; // source routing packet handed over by the backbone
+        uint16_t sr_seqn;
+        seqn_set collected; // packets of the node received by the sink
+        seqn_set routed; // packets of the sink received by the node
+} app_node;
+
+static app_node *apps;
+static int app_nodes;
+static int backbone; // index of the first sink
+static unsigned long sent, received, sr_sent, sr_received;
+// energy reports received by the sink, duty cycles in 1/10000
+static unsigned long energy_reports, energy_radio_on, energy_tx;
+
+static void recv_cb(const linkaddr_t *originator, uint8_t hops, uint16_t delay);
+
+/*
+    A retransmission whose ack was lost delivers the packet twice: count
+    every sequence number once, as parse-stats.py does.
+ */
+static bool first_reception(seqn_set *set, uint16_t seqn) {
+        size_t byte = seqn / 8;
+        if (byte >= set->len) {
+                size_t len = byte + 64;
+                uint8_t *bitmap = realloc(set->bitmap, len);
+                if (bitmap == NULL) {
+                        fprintf(stderr, "sim: out of memory\n");
+                        exit(1);
+                }
+                memset(bitmap + set->len, 0, len - set->len);
+                set->bitmap = bitmap;
+                set->len = len;
+        }
+        if (set->bitmap[byte] & (1 << (seqn % 8))) {
+                return false;
+        }
+        set->bitmap[byte] |= 1 << (seqn % 8);
+        return true;
+}
+static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops, uint16_t delay);
+static void energy_cb(const energy_record *report);
+
+static struct my_collect_callbacks sink_cb = {
+        .recv = recv_cb,
+        .sr_recv = NULL,
+        .energy_recv = energy_cb,
+};
+
+static struct my_collect_callbacks node_cb = {
+        .recv = NULL,
+        .sr_recv = sr_recv_cb,
+};
+
+// True if node id is one of the sinks of sim_conf
+static bool is_sink_id(int id) {
+        int i;
+        for (i = 0; i < sim_conf.num_sinks; i++) {
+                if (sim_conf.sinks[i] == id) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+static bool is_sink(int idx) {
+        return is_sink_id(sim_nodes[idx].addr.u8[0] | sim_nodes[idx].addr.u8[1] << 8);
+}
+
+void sim_app_init(int num_nodes) {
+        int i;
+        app_nodes = num_nodes;
+        apps = calloc(num_nodes, sizeof(app_node));
+        if (apps == NULL) {
+                fprintf(stderr, "sim: out of memory\n");
+                exit(1);
+        }
+        for (backbone = 0; backbone < num_nodes && !is_sink(backbone); backbone++);
+        for (i = 0; i < sim_conf.num_sinks; i++) {
+                if (sim_conf.sinks[i] < 1 || sim_conf.sinks[i] > num_nodes) {
+                        fprintf(stderr, "sim: sink %d is not a node\n", sim_conf.sinks[i]);
+                        exit(1);
+                }
+        }
+}
+
+static void send_cb(void *ptr) {
+        app_node *app = ptr;
+        packetbuf_clear();
+        memcpy(packetbuf_dataptr(), &app->msg, sizeof(test_msg_t));
+        packetbuf_set_datalen(sizeof(test_msg_t));
+        printf("App: Send seqn %d\n", app->msg.seqn);
+        my_collect_send(&app->conn);
+        app->msg.seqn++;
+        sent++;
+}
+
+static void periodic_cb(void *ptr) {
+        app_node *app = ptr;
+        ctimer_set(&app->periodic, MSG_PERIOD, periodic_cb, app);
+        /* Random shift within the interval */
+        ctimer_set(&app->rnd, random_rand() % (MSG_PERIOD / 2), send_cb, app);
+}
+
+// Next source routing destination of the backbone, the sinks are skipped
+static void next_dest(app_node *app) {
+        static int sr_dest_next;
+        if (sim_conf.num_sr_dests > 0) {
+                app->dest = sim_conf.sr_dests[sr_dest_next++ % sim_conf.num_sr_dests];
+                return;
+        }
+        do {
+                app->dest = app->dest >= app_nodes ? 1 : app->dest + 1;
+        } while (is_sink_id(app->dest));
+}
+
+// A sink sends the source routing packet handed over by the backbone
+static void sink_sr_send_cb(void *ptr) {
+        app_node *app = ptr;
+        test_msg_t msg = {.seqn = app->sr_seqn};
+        linkaddr_t dest = app->sr_dest;
+
+        packetbuf_clear();
+        memcpy(packetbuf_dataptr(), &msg, sizeof(test_msg_t));
+        packetbuf_set_datalen(sizeof(test_msg_t));
+        printf("App: sink sending seqn %d to %02x:%02x\n", msg.seqn, dest.u8[0], dest.u8[1]);
+        if (sr_send(&app->conn, &dest) == 0) {
+                printf("App: sink could not send seqn %d to %02x:%02x\n", msg.seqn, dest.u8[0], dest.u8[1]);
+        }
+}
+
+/*
+    Backbone: the packet goes out of the sink owning the destination, the
+    backbone sink itself if no sink does (its sr_send solicits the topology).
+ */
+static void sr_send_cb(void *ptr) {
+        app_node *app = ptr;
+        int owner = backbone;
+        int i;
+        app->sr_dest.u8[0] = app->dest & 0xff;
+        app->sr_dest.u8[1] = app->dest >> 8;
+        for (i = 0; i < app_nodes && sim_conf.num_sinks > 1; i++) {
+                if (is_sink(i) && sim_nodes[i].alive && my_collect_owns(&apps[i].conn, &app->sr_dest)) {
+                        owner = i;
+                        break;
+                }
+        }
+        if (owner == backbone) {
+                app->sr_seqn = app->msg.seqn;
+                sink_sr_send_cb(app);
+        } else {
+                apps[owner].sr_dest = app->sr_dest;
+                apps[owner].sr_seqn = app->msg.seqn;
+                sim_schedule_call(owner, 0, sink_sr_send_cb, &apps[owner]);
+        }
+        app->msg.seqn++;
+        next_dest(app);
+        sr_sent++;
+}
+
+static void sr_periodic_cb(void *ptr) {
+        app_node *app = ptr;
+        ctimer_set(&app->periodic, SR_MSG_PERIOD, sr_periodic_cb, app);
+        /* Random shift within the first half of the interval */
+        ctimer_set(&app->rnd, random_rand() % (SR_MSG_PERIOD / 2), sr_send_cb, app);
+}
+
+/*
+    Reboot of the current node: the connection and the timers are lost. The
+    message sequence number and the delivery bookkeeping are kept, so the
+    packets sent after the reboot are counted as new ones.
+ */
+void sim_app_reset(void) {
+        app_node *app = &apps[sim_current];
+        memset(&app->conn, 0, sizeof(app->conn));
+        memset(&app->periodic, 0, sizeof(app->periodic));
+        memset(&app->rnd, 0, sizeof(app->rnd));
+}
+
+void sim_app_boot(void *ptr) {
+        app_node *app = &apps[sim_current];
+        printf("Rime started with address %d.%d\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+        if (is_sink(sim_current)) {
+                printf("App: I am sink %02x:%02x\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                my_collect_open(&app->conn, COLLECT_CHANNEL, true, &sink_cb, &sim_conf.collect);
+                app->dest = 0;
+                next_dest(app);
+                // opened as a node without a routing table left (SINK_TABLES): nothing to source route
+                if (!app->conn.is_sink) {
+                        printf("App: sink %02x:%02x opened as a node, no source routing\n",
+                               linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                } else if (!sim_conf.no_downward && app_nodes > sim_conf.num_sinks && sim_current == backbone) {
+                        ctimer_set(&app->periodic, app->conn.routing_table->len > 0 ? SR_WARMUP_RESTORED : SR_WARMUP,
+                                   sr_periodic_cb, app);
+                }
+        } else {
+                printf("App: I am normal node %02x:%02x\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                my_collect_open(&app->conn, COLLECT_CHANNEL, false, &node_cb, &sim_conf.collect);
+                if (!sim_conf.no_upward) {
+                        ctimer_set(&app->periodic, MSG_PERIOD, periodic_cb, app);
+                }
+        }
+}
+
+static void recv_cb(const linkaddr_t *originator, uint8_t hops, uint16_t delay) {
+        test_msg_t msg;
+        if (packetbuf_datalen() != sizeof(msg)) {
+                printf("App: wrong length: %d\n", packetbuf_datalen());
+                return;
+        }
+        memcpy(&msg, packetbuf_dataptr(), sizeof(msg));
+#if LATENCY_STATS
+        printf("App: Recv from %02x:%02x seqn %u hops %u delay %lu\n",
+               originator->u8[0], originator->u8[1], msg.seqn, hops, TICKS_TO_MS(delay));
+#else
+        printf("App: Recv from %02x:%02x seqn %u hops %u\n",
+               originator->u8[0], originator->u8[1], msg.seqn, hops);
+#endif
+        int source = sim_node_index(originator);
+        if (source >= 0 && source < app_nodes && first_reception(&apps[source].collected, msg.seqn)) {
+                received++;
+        }
+}
+
+static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops, uint16_t delay) {
+        test_msg_t sr_msg;
+        if (packetbuf_datalen() != sizeof(test_msg_t)) {
+                printf("App: sr_recv wrong length: %d\n", packetbuf_datalen());
+                return;
+        }
+        memcpy(&sr_msg, packetbuf_dataptr(), sizeof(test_msg_t));
+#if LATENCY_STATS
+        printf("App: sr_recv from sink seqn %u hops %u node metric %u delay %lu\n",
+               sr_msg.seqn, hops, ptr->metric, TICKS_TO_MS(delay));
+        printf("App: node delay queue mean %lu max %lu packets %u forward mean %lu records %u\n",
+               ptr->queue_packets ? TICKS_TO_MS(ptr->queue_delay / ptr->queue_packets) : 0,
+               TICKS_TO_MS(ptr->queue_delay_max), ptr->queue_packets,
+               ptr->fwd_records ? TICKS_TO_MS(ptr->fwd_delay / ptr->fwd_records) : 0, ptr->fwd_records);
+#else
+        printf("App: sr_recv from sink seqn %u hops %u node metric %u\n",
+               sr_msg.seqn, hops, ptr->metric);
+#endif
+        if (first_reception(&apps[sim_current].routed, sr_msg.seqn)) {
+                sr_received++;
+        }
+}
+
+static void energy_cb(const energy_record *report) {
+        printf("App: energy from %02x:%02x radio %u.%02u%% tx %u.%02u%%\n",
+               report->node.u8[0], report->node.u8[1],
+               report->radio_on / 100, report->radio_on % 100, report->tx / 100, report->tx % 100);
+        energy_reports++;
+        energy_radio_on += report->radio_on;
+        energy_tx += report->tx;
+}
+
+/*
+    Depth of the tree known by a sink: the longest route of its routing
+    table, and the number of routes longer than MAX_PATH_LENGTH (sent
+    through waypoints with LOOSE_SOURCE_ROUTING, unreachable without). Routes
+    through a loop or an unknown node are not counted.
+ */
+static void sink_tree_depth(const my_collect_conn *conn, int *deepest, int *too_long) {
+        const TreeDict *dict = conn->routing_table;
+        int i;
+        *deepest = *too_long = 0;
+        for (i = 0; i < DICT_CAPACITY; i++) {
+                linkaddr_t node = dict->entries[i].key;
+                int hops = 0;
+                if (linkaddr_cmp(&node, &linkaddr_null)) {
+                        continue;
+                }
+                while (!linkaddr_cmp(&node, &conn->sink) && !linkaddr_cmp(&node, &linkaddr_null) &&
+                       hops <= dict->len) {
+                        node = dict_find((TreeDict *)dict, &node);
+                        hops++;
+                }
+                if (linkaddr_cmp(&node, &conn->sink)) {
+                        *deepest = hops > *deepest ? hops : *deepest;
+                        *too_long += hops > MAX_PATH_LENGTH;
+                }
+        }
+}
+
+// Delivery summary on stderr, for a quick look without parsing the log
+void sim_app_report(void) {
+        fprintf(stderr, "sim: data collection %lu/%lu received (%.2f%%), source routing %lu/%lu received (%.2f%%)\n",
+                received, sent, sent ? 100.0 * received / sent : 0,
+                sr_received, sr_sent, sr_sent ? 100.0 * sr_received / sr_sent : 0);
+        // the sink memory is static: what it takes, and how much of it this network uses
+        // (with several sinks: the partitions together, then each one)
+        int deepest = 0, too_long = 0, len = 0;
+        int i;
+        for (i = 0; i < app_nodes; i++) {
+                int d, t;
+                if (!is_sink(i) || apps[i].conn.routing_table == NULL) {
+                        continue;
+                }
+                sink_tree_depth(&apps[i].conn, &d, &t);
+                deepest = d > deepest ? d : deepest;
+                too_long += t;
+                len += apps[i].conn.routing_table->len;
+        }
+        fprintf(stderr, "sim: sink routing table %d/%d nodes, deepest route %d hops, %d routes longer than "
+                "MAX_PATH_LENGTH %d, connection state %zu bytes (routing table %zu)\n",
+                len, MAX_NODES, deepest, too_long, MAX_PATH_LENGTH,
+                sizeof(struct my_collect_conn), sizeof(TreeDict));
+        for (i = 0; i < app_nodes && sim_conf.num_sinks > 1; i++) {
+                int owned = 0, j;
+                if (!is_sink(i) || apps[i].conn.routing_table == NULL) {
+                        continue;
+                }
+                for (j = 0; j < app_nodes; j++) {
+                        owned += j != i && my_collect_owns(&apps[i].conn, &sim_nodes[j].addr);
+                }
+                fprintf(stderr, "sim: sink %02x:%02x routing table %d nodes, partition %d nodes\n",
+                        sim_nodes[i].addr.u8[0], sim_nodes[i].addr.u8[1], apps[i].conn.routing_table->len, owned);
+        }
+#if LATENCY_STATS
+        // delay counters of all the nodes
+        unsigned long long queue_delay = 0, fwd_delay = 0;
+        unsigned long queue_packets = 0, fwd_records = 0, queue_max = 0;
+        for (i = 0; i < app_nodes; i++) {
+                const struct my_collect_conn *c = &apps[i].conn;
+                queue_delay += c->queue_delay;
+                queue_packets += c->queue_packets;
+                queue_max = c->queue_delay_max > queue_max ? c->queue_delay_max : queue_max;
+                fwd_delay += c->fwd_delay;
+                fwd_records += c->fwd_records;
+        }
+        fprintf(stderr, "sim: per hop delay: send queue mean %.1f ms max %lu ms (%lu packets), "
+                "aggregation hold mean %.1f ms (%lu records)\n",
+                queue_packets ? 1000.0 * queue_delay / queue_packets / CLOCK_SECOND : 0,
+                TICKS_TO_MS(queue_max), queue_packets,
+                fwd_records ? 1000.0 * fwd_delay / fwd_records / CLOCK_SECOND : 0, fwd_records);
+#endif
+        if (energy_reports > 0) {
+                fprintf(stderr, "sim: energy reports %lu, mean radio duty cycle %.2f%% (tx %.2f%%)\n",
+                        energy_reports, energy_radio_on / 100.0 / energy_reports, energy_tx / 100.0 / energy_reports);
+        }
+}
@@ -0,0 +1,700 @@
+/*
+    Discrete-event network simulator for the native build of the protocol.
+
+    Every node runs the unmodified protocol sources (src/) on top of the
+    Contiki shim in contiki_shim.c. Timers and radio receptions are events in
+    a single priority queue ordered by simulated time; before handling an
+    event the simulator switches the global node context (linkaddr_node_addr),
+    so the protocol code runs as if it was alone on its mote.
+
+    The radio is either a unit disk or a log-distance RSSI model with
+    shadowing. Unicasts get MAC-layer retransmissions and acks as with CSMA,
+    and the radio duty cycle adds the wait for the receiver to wake up.
+    Collisions and interference are not simulated.
+
+    The transmit and receive time of every node is accounted as ContikiMAC
+    would spend it: a unicast is repeated until the receiver wakes up, a
+    broadcast for a whole channel check period. The shim turns these times
+    into the energest counters.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <time.h>
+#include "simulator.h"
+#include "event_log.h"
+
+sim_config sim_conf = {
+        .num_nodes = 10,
+        .range = 40,
+        .area = 0,
+        .shadowing = 3,
+        .model = sim_link_rssi,
+        .rdc_rate = 8,
+        .duration = 3600,
+        .seed = 1,
+        .topology_file = NULL,
+        .verbosity = 2,
+        .collect = MY_COLLECT_DEFAULT_CONFIG,
+};
+
+sim_node *sim_nodes;
+int sim_num_nodes;
+int sim_current = -1;
+sim_time_t sim_now;
+
+/*
+   ------------------------------------ EVENT QUEUE ------------------------------------
+ */
+
+enum sim_event_type {
+        sim_ev_ctimer,
+        sim_ev_call,
+        sim_ev_broadcast_rx,
+        sim_ev_unicast_rx,
+        sim_ev_unicast_sent,
+        sim_ev_fail,
+        sim_ev_reboot
+};
+
+typedef struct sim_event {
+        sim_time_t time;
+        uint64_t seq; // insertion order, breaks ties deterministically
+        int node;
+        uint8_t type;
+        int8_t rssi;
+        uint8_t status;
+        uint8_t num_tx;
+        unsigned epoch; // boot of the node the event belongs to
+        unsigned long gen;
+        void *ptr;
+        void (*f)(void *);
+        sim_frame *frame;
+} sim_event;
+
+// binary min-heap on (time, seq)
+static sim_event *heap;
+static size_t heap_len, heap_cap;
+static uint64_t heap_seq;
+static uint64_t events_processed;
+
+static bool event_before(const sim_event *a, const sim_event *b) {
+        return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void heap_push(sim_event *e) {
+        size_t i;
+        if (heap_len == heap_cap) {
+                heap_cap = heap_cap ? heap_cap * 2 : 1024;
+                heap = realloc(heap, heap_cap * sizeof(sim_event));
+                if (heap == NULL) {
+                        fprintf(stderr, "sim: out of memory\n");
+                        exit(1);
+                }
+        }
+        e->seq = heap_seq++;
+        e->epoch = sim_nodes[e->node].epoch;
+        i = heap_len++;
+        while (i > 0 && event_before(e, &heap[(i - 1) / 2])) {
+                heap[i] = heap[(i - 1) / 2];
+                i = (i - 1) / 2;
+        }
+        heap[i] = *e;
+}
+
+static sim_event heap_pop(void) {
+        sim_event top = heap[0];
+        sim_event last = heap[--heap_len];
+        size_t i = 0;
+        for (;;) {
+                size_t c = 2 * i + 1;
+                if (c >= heap_len) {
+                        break;
+                }
+                if (c + 1 < heap_len && event_before(&heap[c + 1], &heap[c])) {
+                        c++;
+                }
+                if (!event_before(&heap[c], &last)) {
+                        break;
+                }
+                heap[i] = heap[c];
+                i = c;
+        }
+        if (heap_len > 0) {
+                heap[i] = last;
+        }
+        return top;
+}
+
+void sim_schedule_ctimer(struct ctimer *c, sim_time_t delay) {
+        sim_event e = {.time = sim_now + delay, .node = sim_current, .type = sim_ev_ctimer,
+                       .ptr = c, .gen = c->gen};
+        heap_push(&e);
+}
+
+void sim_schedule_call(int node, sim_time_t delay, void (*f)(void *), void *ptr) {
+        sim_event e = {.time = sim_now + delay, .node = node, .type = sim_ev_call, .f = f, .ptr = ptr};
+        heap_push(&e);
+}
+
+/*
+   ------------------------------------ NODES ------------------------------------
+ */
+
+void sim_set_node(int idx) {
+        if (idx == sim_current) {
+                return;
+        }
+#if LOG_BINARY
+        // the event ring is shared by all the nodes: dump it while it holds the events of one node
+        event_log_dump();
+#endif
+        sim_log_flush();
+        sim_current = idx;
+        linkaddr_copy(&linkaddr_node_addr, &sim_nodes[idx].addr);
+}
+
+// Node ids start from 1 (the sink), address u8[0] is the low byte of the id
+int sim_node_index(const linkaddr_t *addr) {
+        int id = addr->u8[0] | (addr->u8[1] << 8);
+        if (id < 1 || id > sim_num_nodes) {
+                return -1;
+        }
+        return id - 1;
+}
+
+static void nodes_alloc(int n) {
+        int i;
+        sim_num_nodes = n;
+        sim_nodes = calloc(n, sizeof(sim_node));
+        if (sim_nodes == NULL) {
+                fprintf(stderr, "sim: out of memory\n");
+                exit(1);
+        }
+        for (i = 0; i < n; i++) {
+                sim_nodes[i].addr.u8[0] = (i + 1) & 0xff;
+                sim_nodes[i].addr.u8[1] = (i + 1) >> 8;
+                sim_nodes[i].alive = true;
+        }
+}
+
+static double uniform(void) {
+        return (double)random() / ((double)RAND_MAX + 1);
+}
+
+/*
+    Random placement in a square area, the sink in the center.
+    The default area gives about 8 neighbors in range per node.
+ */
+static void place_random(void) {
+        int i;
+        double side = sim_conf.area > 0 ? sim_conf.area : sim_conf.range * sqrt(sim_num_nodes * M_PI / 8);
+        for (i = 0; i < sim_num_nodes; i++) {
+                sim_nodes[i].x = i == 0 ? side / 2 : uniform() * side;
+                sim_nodes[i].y = i == 0 ? side / 2 : uniform() * side;
+        }
+}
+
+/*
+    Topology file: one "id x y" line per node (meters), ids from 1,
+    lines starting with # are ignored.
+ */
+static void load_topology(const char *path) {
+        FILE *f = fopen(path, "r");
+        char line[256];
+        int id, max_id = 0;
+        double x, y;
+        if (f == NULL) {
+                perror(path);
+                exit(1);
+        }
+        while (fgets(line, sizeof(line), f)) {
+                if (line[0] != '#' && sscanf(line, "%d %lf %lf", &id, &x, &y) == 3 && id > max_id) {
+                        max_id = id;
+                }
+        }
+        if (max_id == 0) {
+                fprintf(stderr, "sim: no nodes in %s\n", path);
+                exit(1);
+        }
+        nodes_alloc(max_id);
+        rewind(f);
+        while (fgets(line, sizeof(line), f)) {
+                if (line[0] != '#' && sscanf(line, "%d %lf %lf", &id, &x, &y) == 3 && id >= 1) {
+                        sim_nodes[id - 1].x = x;
+                        sim_nodes[id - 1].y = y;
+                }
+        }
+        fclose(f);
+}
+
+/*
+   ------------------------------------ LINK MODEL ------------------------------------
+ */
+
+// Symmetric per link shadowing, a deterministic gaussian sample from the node pair
+static double link_shadowing(int a, int b) {
+        uint64_t h = ((uint64_t)(a < b ? a : b) << 32 | (uint32_t)(a < b ? b : a)) ^
+                     ((uint64_t)sim_conf.seed * 0x9E3779B97F4A7C15ULL);
+        double u1, u2;
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdULL; h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL; h ^= h >> 33;
+        u1 = ((h >> 11) + 1.0) / 9007199254740993.0;
+        h *= 0x9E3779B97F4A7C15ULL; h ^= h >> 29;
+        u2 = (h >> 11) / 9007199254740992.0;
+        return sim_conf.shadowing * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static void build_links(void) {
+        int i, j;
+        double max_d = sim_conf.model == sim_link_disk ? sim_conf.range :
+                       sim_conf.range * pow(10, (SIM_RSSI_AT_RANGE - SIM_RSSI_SENSITIVITY + 3 * sim_conf.shadowing) /
+                                            (10 * SIM_PATH_LOSS_EXP));
+        long total = 0;
+        for (i = 0; i < sim_num_nodes; i++) {
+                sim_node *n = &sim_nodes[i];
+                int cap = 0;
+                for (j = 0; j < sim_num_nodes; j++) {
+                        double dx = n->x - sim_nodes[j].x, dy = n->y - sim_nodes[j].y;
+                        double d = sqrt(dx * dx + dy * dy);
+                        double rssi, prr;
+                        if (j == i || d > max_d) {
+                                continue;
+                        }
+                        rssi = SIM_RSSI_AT_RANGE - 10 * SIM_PATH_LOSS_EXP * log10((d > 1 ? d : 1) / sim_conf.range);
+                        if (sim_conf.model == sim_link_disk) {
+                                prr = 1;
+                        } else {
+                                rssi += link_shadowing(i, j);
+                                prr = (rssi - SIM_RSSI_SENSITIVITY) / (SIM_RSSI_GOOD - SIM_RSSI_SENSITIVITY);
+                                if (prr <= 0) {
+                                        continue;
+                                }
+                                prr = prr > 1 ? 1 : prr;
+                        }
+                        if (n->num_links == cap) {
+                                cap = cap ? cap * 2 : 8;
+                                n->links = realloc(n->links, cap * sizeof(sim_link));
+                        }
+                        n->links[n->num_links].to = j;
+                        n->links[n->num_links].rssi = rssi < -127 ? -127 : (rssi > 0 ? 0 : rssi);
+                        n->links[n->num_links].prr = prr * 65535;
+                        n->num_links++;
+                }
+                total += n->num_links;
+        }
+        fprintf(stderr, "sim: %d nodes, %.1f links per node\n", sim_num_nodes, (double)total / sim_num_nodes);
+}
+
+static bool link_success(const sim_link *l) {
+        return l != NULL && (random() & 0xffff) < l->prr;
+}
+
+static sim_link *link_find(int from, int to) {
+        int i;
+        for (i = 0; i < sim_nodes[from].num_links; i++) {
+                if (sim_nodes[from].links[i].to == to) {
+                        return &sim_nodes[from].links[i];
+                }
+        }
+        return NULL;
+}
+
+/*
+   ------------------------------------ RADIO ------------------------------------
+ */
+
+static sim_time_t airtime(uint16_t len) {
+        return (sim_time_t)(len + SIM_FRAME_OVERHEAD) * SIM_BYTE_TIME;
+}
+
+// Time until the receiver wakes up (uniform in a channel check period), 0 with the radio always on
+static sim_time_t rdc_wait(void) {
+        if (sim_conf.rdc_rate == 0) {
+                return 0;
+        }
+        return uniform() * SIM_SECOND / sim_conf.rdc_rate;
+}
+
+/*
+    Frames put on air, by kind: beacons (every broadcast) and the unicast
+    packet types of my_collect.h, from the first byte of the frame.
+    Every MAC transmission of a unicast counts, the bytes include SIM_FRAME_OVERHEAD.
+ */
+#define TX_KINDS (segment_request + 2)
+#define TX_BEACON (TX_KINDS - 1)
+static const char *const tx_kind_names[TX_KINDS] = {
+        [upward_data_packet] = "data", [downward_data_packet] = "source routing",
+        [topology_report] = "topology reports", [aggregated_data_packet] = "aggregated",
+        [energy_report] = "energy reports", [segment_request] = "segment requests", [TX_BEACON] = "beacons",
+};
+static unsigned long tx_frames[TX_KINDS];
+static unsigned long long tx_bytes[TX_KINDS];
+
+static void tx_count(const sim_frame *f, int kind, int transmissions) {
+        if (kind < 0 || kind >= TX_KINDS) {
+                return;
+        }
+        tx_frames[kind] += transmissions;
+        tx_bytes[kind] += (unsigned long long)(f->len + SIM_FRAME_OVERHEAD) * transmissions;
+}
+
+/*
+    Control overhead: beacons, topology reports, energy reports and segment
+    requests, against everything sent. Parents piggybacked on data packets
+    count as data, the segments sent back to waypoints as source routing.
+    The size of the source routing frames shows the header bytes saved by storing mode.
+ */
+static void tx_report(void) {
+        unsigned long long total = 0, control;
+        int k;
+        fprintf(stderr, "sim: frames sent:");
+        for (k = 0; k < TX_KINDS; k++) {
+                total += tx_bytes[k];
+                fprintf(stderr, "%s %s %lu", k ? "," : "", tx_kind_names[k], tx_frames[k]);
+        }
+        control = tx_bytes[TX_BEACON] + tx_bytes[topology_report] + tx_bytes[energy_report] +
+                  tx_bytes[segment_request];
+        fprintf(stderr, "\nsim: control overhead %llu/%llu bytes sent (%.2f%%)\n",
+                control, total, total ? 100.0 * control / total : 0);
+        fprintf(stderr, "sim: source routing %.1f bytes per frame\n", tx_frames[downward_data_packet] ?
+                (double)tx_bytes[downward_data_packet] / tx_frames[downward_data_packet] : 0);
+}
+
+static sim_frame *frame_from_packetbuf(void) {
+        sim_frame *f = malloc(sizeof(sim_frame));
+        f->refs = 0;
+        f->sender = sim_current;
+        f->len = packetbuf_copyto(f->data);
+        return f;
+}
+
+int sim_radio_broadcast(struct broadcast_conn *c) {
+        sim_node *n = &sim_nodes[sim_current];
+        sim_frame *f;
+        int i;
+        if (!n->alive) {
+                return 0;
+        }
+        f = frame_from_packetbuf();
+        n->tx_time += airtime(f->len) + (sim_conf.rdc_rate > 0 ? SIM_SECOND / sim_conf.rdc_rate : 0);
+        tx_count(f, TX_BEACON, 1);
+        for (i = 0; i < n->num_links; i++) {
+                sim_link *l = &n->links[i];
+                if (sim_nodes[l->to].alive && link_success(l)) {
+                        sim_nodes[l->to].rx_time += airtime(f->len);
+                        sim_event e = {.time = sim_now + rdc_wait() + airtime(f->len), .node = l->to,
+                                       .type = sim_ev_broadcast_rx, .rssi = l->rssi, .frame = f};
+                        f->refs++;
+                        heap_push(&e);
+                }
+        }
+        if (f->refs == 0) {
+                free(f);
+        }
+        return 1;
+}
+
+/*
+    A unicast is transmitted up to SIM_MAC_MAX_TX times until both the frame
+    and its ack get through. The receiver gets the frame at most once (MAC
+    duplicate detection), the sender gets the sent callback at the end.
+ */
+int sim_radio_unicast(struct unicast_conn *c, const linkaddr_t *receiver) {
+        sim_node *n = &sim_nodes[sim_current];
+        int to = sim_node_index(receiver);
+        sim_link *l = to >= 0 ? link_find(sim_current, to) : NULL;
+        sim_link *ack = to >= 0 ? link_find(to, sim_current) : NULL;
+        sim_frame *f;
+        sim_time_t t = 0;
+        bool delivered = false, acked = false;
+        int tx;
+        if (!n->alive) {
+                return 0;
+        }
+        f = frame_from_packetbuf();
+        for (tx = 1; tx <= SIM_MAC_MAX_TX; tx++) {
+                t += rdc_wait() + airtime(f->len);
+                if (l != NULL && sim_nodes[to].alive && link_success(l)) {
+                        sim_nodes[to].rx_time += airtime(f->len);
+                        if (!delivered) {
+                                sim_event e = {.time = sim_now + t, .node = to, .type = sim_ev_unicast_rx,
+                                               .rssi = l->rssi, .frame = f};
+                                f->refs++;
+                                heap_push(&e);
+                                delivered = true;
+                        }
+                        if (link_success(ack)) {
+                                acked = true;
+                                break;
+                        }
+                }
+        }
+        tx_count(f, f->len > 0 ? f->data[0] : -1, tx > SIM_MAC_MAX_TX ? SIM_MAC_MAX_TX : tx);
+        if (!delivered) {
+                free(f);
+        }
+        n->tx_time += t;
+        sim_event e = {.time = sim_now + t, .node = sim_current, .type = sim_ev_unicast_sent, .ptr = c,
+                       .status = acked ? MAC_TX_OK : MAC_TX_NOACK, .num_tx = acked ? tx : SIM_MAC_MAX_TX};
+        heap_push(&e);
+        return 1;
+}
+
+static void deliver(sim_event *e) {
+        sim_node *n = &sim_nodes[e->node];
+        linkaddr_t sender;
+        linkaddr_copy(&sender, &sim_nodes[e->frame->sender].addr);
+        packetbuf_clear();
+        packetbuf_copyfrom(e->frame->data, e->frame->len);
+        packetbuf_set_attr(PACKETBUF_ATTR_RSSI, (packetbuf_attr_t)e->rssi);
+        if (e->type == sim_ev_broadcast_rx && n->bc != NULL) {
+                n->bc->u->recv(n->bc, &sender);
+        } else if (e->type == sim_ev_unicast_rx && n->uc != NULL) {
+                n->uc->u->recv(n->uc, &sender);
+        }
+}
+
+/*
+   ------------------------------------ MAIN LOOP ------------------------------------
+ */
+
+/*
+    The node loses its RAM: every pending event of the node is dropped, the
+    application and protocol state are reset, and the node boots again within
+    a second. Its files (cfs) are kept, as in flash.
+ */
+static void reboot(int node) {
+        sim_node *n = &sim_nodes[node];
+        if (!n->alive) {
+                return;
+        }
+        n->epoch++;
+        n->bc = NULL;
+        n->uc = NULL;
+        // the RAM is lost: the MEMB pools of the node are empty again
+        memset(n->membs, 0, sizeof(n->membs));
+        sim_set_node(node);
+        sim_app_reset();
+        sim_schedule_call(node, uniform() * SIM_SECOND, sim_app_boot, NULL);
+}
+
+static void run(void) {
+        sim_time_t end = sim_conf.duration * SIM_SECOND;
+        while (heap_len > 0 && heap[0].time <= end) {
+                sim_event e = heap_pop();
+                sim_now = e.time;
+                events_processed++;
+                if (e.type == sim_ev_fail) {
+                        sim_set_node(e.node);
+                        printf("Node failure\n");
+                        sim_nodes[e.node].alive = false;
+                        continue;
+                }
+                if (e.type == sim_ev_reboot) {
+                        reboot(e.node);
+                        continue;
+                }
+                // events of the node before a reboot (timers, frames on air) are lost
+                if (!sim_nodes[e.node].alive || e.epoch != sim_nodes[e.node].epoch) {
+                        if (e.frame != NULL && --e.frame->refs == 0) {
+                                free(e.frame);
+                        }
+                        continue;
+                }
+                sim_set_node(e.node);
+                switch (e.type) {
+                case sim_ev_ctimer: {
+                        struct ctimer *c = e.ptr;
+                        if (c->active && c->gen == e.gen) {
+                                c->active = 0;
+                                c->f(c->ptr);
+                        }
+                        break;
+                }
+                case sim_ev_call:
+                        e.f(e.ptr);
+                        break;
+                case sim_ev_broadcast_rx:
+                case sim_ev_unicast_rx:
+                        deliver(&e);
+                        if (--e.frame->refs == 0) {
+                                free(e.frame);
+                        }
+                        break;
+                case sim_ev_unicast_sent: {
+                        struct unicast_conn *c = e.ptr;
+                        if (c->u->sent != NULL) {
+                                c->u->sent(c, e.status, e.num_tx);
+                        }
+                        break;
+                }
+                }
+        }
+#if LOG_BINARY
+        event_log_dump();
+#endif
+        sim_log_flush();
+        sim_now = end;
+}
+
+static void usage(const char *prog) {
+        fprintf(stderr,
+                "Usage: %s [options]\n"
+                "  -n, --nodes N          number of nodes, node 1 is the sink (default %d)\n"
+                "      --sink ID          node ID is a sink, instead of node 1 (repeatable, up to %d)\n"
+                "  -T, --topology FILE    node positions, one \"id x y\" line per node\n"
+                "  -a, --area M           side of the square area in meters (default: ~8 neighbors per node)\n"
+                "  -r, --range M          radio range in meters (default %.0f)\n"
+                "  -m, --model disk|rssi  link model (default rssi)\n"
+                "  -S, --shadowing DB     shadowing standard deviation for the rssi model (default %.0f)\n"
+                "  -c, --check-rate HZ    RDC channel check rate, 0 for a radio always on (default %u)\n"
+                "  -t, --time S           simulated seconds (default %.0f)\n"
+                "  -s, --seed N           random seed (default %u)\n"
+                "  -f, --fail ID:S        node ID fails at second S (repeatable)\n"
+                "      --reboot ID:S      node ID reboots at second S, keeping its files (repeatable)\n"
+                "  -v, --verbosity L      0: summary only, 1: application log, 2: full log (default %d)\n"
+                "      --no-upward        no data collection traffic\n"
+                "      --no-downward      no source routing traffic\n"
+                "      --sr-dest ID       source routing only to node ID, in turn with the others given (repeatable, up to %d)\n"
+                "      --no-topology-report  nodes do not send topology reports\n"
+                "      --no-piggybacking  nodes do not piggyback their parent on data packets\n"
+                "      --no-storing       the sink source routes every downward packet (no storing mode)\n"
+                "      --beacon-interval S   shortest Trickle beacon interval (default %.0f)\n"
+                "      --treport-hold S   longest wait before a topology report (default %.0f)\n"
+                "      --rssi-threshold DBM  ignore beacons below this RSSI (default %d)\n"
+                "  -h, --help             print this help\n",
+                prog, sim_conf.num_nodes, MAX_SINKS, sim_conf.range, sim_conf.shadowing, sim_conf.rdc_rate,
+                sim_conf.duration, sim_conf.seed, sim_conf.verbosity, SIM_MAX_SR_DESTS,
+                (double)sim_conf.collect.beacon_interval / CLOCK_SECOND,
+                (double)sim_conf.collect.treport_hold_time / CLOCK_SECOND, sim_conf.collect.rssi_threshold);
+        exit(1);
+}
+
+int main(int argc, char **argv) {
+        static const struct option options[] = {
+                {"nodes", required_argument, NULL, 'n'},
+                {"sink", required_argument, NULL, 'K'},
+                {"topology", required_argument, NULL, 'T'},
+                {"area", required_argument, NULL, 'a'},
+                {"range", required_argument, NULL, 'r'},
+                {"model", required_argument, NULL, 'm'},
+                {"shadowing", required_argument, NULL, 'S'},
+                {"check-rate", required_argument, NULL, 'c'},
+                {"time", required_argument, NULL, 't'},
+                {"seed", required_argument, NULL, 's'},
+                {"fail", required_argument, NULL, 'f'},
+                {"reboot", required_argument, NULL, 'X'},
+                {"verbosity", required_argument, NULL, 'v'},
+                {"no-upward", no_argument, NULL, 'U'},
+                {"no-downward", no_argument, NULL, 'D'},
+                {"sr-dest", required_argument, NULL, 'Y'},
+                {"no-topology-report", no_argument, NULL, 'R'},
+                {"no-piggybacking", no_argument, NULL, 'P'},
+                {"no-storing", no_argument, NULL, 'O'},
+                {"beacon-interval", required_argument, NULL, 'B'},
+                {"treport-hold", required_argument, NULL, 'H'},
+                {"rssi-threshold", required_argument, NULL, 'Q'},
+                {"help", no_argument, NULL, 'h'},
+                {NULL, 0, NULL, 0}
+        };
+        struct { int id; double time; uint8_t type; } node_events[64];
+        int num_node_events = 0;
+        int opt, i;
+        clock_t wall;
+
+        while ((opt = getopt_long(argc, argv, "n:T:a:r:m:S:c:t:s:f:v:h", options, NULL)) != -1) {
+                switch (opt) {
+                case 'n': sim_conf.num_nodes = atoi(optarg); break;
+                case 'K':
+                        if (sim_conf.num_sinks == MAX_SINKS) {
+                                usage(argv[0]);
+                        }
+                        sim_conf.sinks[sim_conf.num_sinks++] = atoi(optarg);
+                        break;
+                case 'T': sim_conf.topology_file = optarg; break;
+                case 'a': sim_conf.area = atof(optarg); break;
+                case 'r': sim_conf.range = atof(optarg); break;
+                case 'm':
+                        if (strcmp(optarg, "disk") == 0) {
+                                sim_conf.model = sim_link_disk;
+                        } else if (strcmp(optarg, "rssi") == 0) {
+                                sim_conf.model = sim_link_rssi;
+                        } else {
+                                usage(argv[0]);
+                        }
+                        break;
+                case 'S': sim_conf.shadowing = atof(optarg); break;
+                case 'c': sim_conf.rdc_rate = atoi(optarg); break;
+                case 't': sim_conf.duration = atof(optarg); break;
+                case 's': sim_conf.seed = strtoul(optarg, NULL, 10); break;
+                case 'f':
+                case 'X':
+                        if (num_node_events == 64 ||
+                            sscanf(optarg, "%d:%lf", &node_events[num_node_events].id, &node_events[num_node_events].time) != 2) {
+                                usage(argv[0]);
+                        }
+                        node_events[num_node_events++].type = opt == 'f' ? sim_ev_fail : sim_ev_reboot;
+                        break;
+                case 'v': sim_conf.verbosity = atoi(optarg); break;
+                case 'U': sim_conf.no_upward = true; break;
+                case 'D': sim_conf.no_downward = true; break;
+                case 'Y':
+                        if (sim_conf.num_sr_dests == SIM_MAX_SR_DESTS) {
+                                usage(argv[0]);
+                        }
+                        sim_conf.sr_dests[sim_conf.num_sr_dests++] = atoi(optarg);
+                        break;
+                case 'R': sim_conf.collect.topology_report = 0; break;
+                case 'P': sim_conf.collect.piggybacking = 0; break;
+                case 'O': sim_conf.collect.storing_mode = 0; break;
+                case 'B': sim_conf.collect.beacon_interval = atof(optarg) * CLOCK_SECOND; break;
+                case 'H': sim_conf.collect.treport_hold_time = atof(optarg) * CLOCK_SECOND; break;
+                case 'Q': sim_conf.collect.rssi_threshold = atoi(optarg); break;
+                default: usage(argv[0]);
+                }
+        }
+        if (sim_conf.num_nodes < 1 || sim_conf.range <= 0 || sim_conf.duration <= 0 ||
+            sim_conf.collect.beacon_interval < 2) {
+                usage(argv[0]);
+        }
+
+        if (sim_conf.num_sinks == 0) {
+                sim_conf.sinks[sim_conf.num_sinks++] = 1;
+        }
+
+        srandom(sim_conf.seed);
+        random_init(sim_conf.seed);
+        if (sim_conf.topology_file != NULL) {
+                load_topology(sim_conf.topology_file);
+        } else {
+                nodes_alloc(sim_conf.num_nodes);
+                place_random();
+        }
+        build_links();
+        for (i = 0; i < num_node_events; i++) {
+                if (node_events[i].id >= 1 && node_events[i].id <= sim_num_nodes) {
+                        sim_event e = {.time = node_events[i].time * SIM_SECOND, .node = node_events[i].id - 1,
+                                       .type = node_events[i].type};
+                        heap_push(&e);
+                }
+        }
+
+        // nodes boot at random times during the first second
+        sim_app_init(sim_num_nodes);
+        for (i = 0; i < sim_num_nodes; i++) {
+                sim_schedule_call(i, uniform() * SIM_SECOND, sim_app_boot, NULL);
+        }
+
+        wall = clock();
+        run();
+        double wall_s = (double)(clock() - wall) / CLOCKS_PER_SEC;
+        fprintf(stderr, "sim: %.0f s simulated in %.2f s (%llu events, %.0fx real time)\n",
+                sim_conf.duration, wall_s, (unsigned long long)events_processed,
+                wall_s > 0 ? sim_conf.duration / wall_s : 0);
+        tx_report();
+        sim_app_report();
+        return 0;
+}
@@ -0,0 +1,113 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "my_collect.h"
+
+// Simulated time in microseconds
+typedef uint64_t sim_time_t;
+#define SIM_SECOND 1000000ULL
+
+// Radio parameters
+#define SIM_RSSI_AT_RANGE -92   // RSSI at the nominal range
+#define SIM_PATH_LOSS_EXP 3.0   // log-distance path loss exponent
+#define SIM_RSSI_SENSITIVITY -97 // no reception below (rssi model)
+#define SIM_RSSI_GOOD -87       // perfect reception above (rssi model)
+#define SIM_MAC_MAX_TX 3        // transmissions of a unicast at the MAC layer (as CSMA)
+#define SIM_FRAME_OVERHEAD 23   // MAC and Rime header bytes added to each frame
+#define SIM_BYTE_TIME 32        // microseconds per byte at 250 kbit/s
+#define SIM_CHANNEL_CHECK_TIME 1000 // microseconds the radio is on for an RDC channel check
+#define SIM_MAX_SR_DESTS 16     // source routing destinations given with --sr-dest
+#define SIM_MAX_MEMBS 4
+
+enum sim_link_model {
+        sim_link_disk = 0, // unit disk: perfect links up to the range, nothing beyond
+        sim_link_rssi = 1  // log-distance RSSI with shadowing, reception probability from RSSI
+};
+
+typedef struct sim_link {
+        int to;
+        int8_t rssi;
+        uint16_t prr; // packet reception ratio, out of 65535
+} sim_link;
+
+// Frame on air, shared by all the receivers of a broadcast
+typedef struct sim_frame {
+        int refs;
+        int sender;
+        uint16_t len;
+        uint8_t data[PACKETBUF_SIZE];
+} sim_frame;
+
+typedef struct sim_node {
+        linkaddr_t addr;
+        double x, y;
+        bool alive;
+        unsigned epoch; // number of reboots
+        struct broadcast_conn *bc;
+        struct unicast_conn *uc;
+        sim_link *links;
+        int num_links;
+        // radio activity, the energest times of the node (contiki_shim.c)
+        sim_time_t tx_time;
+        sim_time_t rx_time;
+        // elements allocated by this node from each MEMB
+        struct { struct memb *m; int count; } membs[SIM_MAX_MEMBS];
+} sim_node;
+
+typedef struct sim_config {
+        int num_nodes;
+        double range;   // meters
+        double area;    // side of the square area, meters (0: computed from the range)
+        double shadowing; // dB, standard deviation (rssi model)
+        enum sim_link_model model;
+        unsigned rdc_rate; // channel check rate in Hz, 0: radio always on
+        double duration; // seconds
+        unsigned seed;
+        const char *topology_file;
+        int verbosity; // 0: summary only, 1: application lines, 2: everything
+        bool no_upward;
+        bool no_downward;
+        int sinks[MAX_SINKS]; // node ids of the sinks (none given: node 1)
+        int num_sinks;
+        int sr_dests[SIM_MAX_SR_DESTS]; // node ids the sink source routes to in turn (none given: every node)
+        int num_sr_dests;
+        struct my_collect_config collect; // protocol configuration of every node
+} sim_config;
+
+extern sim_config sim_conf;
+extern sim_node *sim_nodes;
+extern int sim_num_nodes;
+extern int sim_current; // index of the node being run
+extern sim_time_t sim_now;
+
+// -------- NODES --------
+
+void sim_set_node(int idx);
+int sim_node_index(const linkaddr_t *addr);
+
+// -------- EVENTS --------
+
+void sim_schedule_ctimer(struct ctimer *c, sim_time_t delay);
+void sim_schedule_call(int node, sim_time_t delay, void (*f)(void *), void *ptr);
+
+// -------- RADIO --------
+
+int sim_radio_broadcast(struct broadcast_conn *c);
+int sim_radio_unicast(struct unicast_conn *c, const linkaddr_t *receiver);
+
+// -------- LOG --------
+
+void sim_log_flush(void);
+
+// -------- APPLICATION (sim_app.c) --------
+
+void sim_app_init(int num_nodes);
+void sim_app_boot(void *ptr);
+void sim_app_reset(void);
+void sim_app_report(void);
+
+#endif // SIMULATOR_H
@@ -0,0 +1,651 @@
+/*
+    Deterministic unit tests of the protocol data structures: the hash index
+    of the sink routing table and the validation of its restored entries, the
+    source routing path encoding, the route segments of loose source routing,
+    and the descendant table and the sink marks of storing mode.
+
+    As in the benchmarks, the protocol sources are the ones of the simulator
+    build without a network: timers never fire and logging is off. Random
+    operations use a fixed seed (-s to change it), so a failure reproduces.
+    Exits with 1 if a check failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "simulator.h"
+#include "my_collect.h"
+#include "routing_table.h"
+#include "descendant_table.h"
+#include "routing_checkpoint.h"
+
+// the protocol log goes through sim_printf (off), the results straight to stdout
+#undef printf
+
+/*
+   ------------------------------------ SIMULATOR STUBS ------------------------------------
+ */
+
+sim_config sim_conf = {.verbosity = 0};
+sim_node *sim_nodes;
+int sim_num_nodes;
+int sim_current;
+sim_time_t sim_now;
+
+void sim_set_node(int idx) {
+        sim_current = idx;
+}
+
+int sim_node_index(const linkaddr_t *addr) {
+        return -1;
+}
+
+void sim_schedule_ctimer(struct ctimer *c, sim_time_t delay) {
+}
+
+void sim_schedule_call(int node, sim_time_t delay, void (*f)(void *), void *ptr) {
+}
+
+int sim_radio_broadcast(struct broadcast_conn *c) {
+        return 1;
+}
+
+int sim_radio_unicast(struct unicast_conn *c, const linkaddr_t *receiver) {
+        return 1;
+}
+
+void sim_app_init(int num_nodes) {
+}
+
+void sim_app_boot(void *ptr) {
+}
+
+void sim_app_report(void) {
+}
+
+/*
+   ------------------------------------ CHECKS ------------------------------------
+ */
+
+static const char *test_name;
+static unsigned checks;
+static unsigned failures;
+
+#define CHECK(cond) do { \
+                checks++; \
+                if (!(cond)) { \
+                        failures++; \
+                        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, test_name, #cond); \
+                } \
+} while (0)
+
+static linkaddr_t addr(int id) {
+        linkaddr_t a;
+        a.u8[0] = id & 0xff;
+        a.u8[1] = id >> 8;
+        return a;
+}
+
+static my_collect_conn *sink;
+static my_collect_conn *node;
+
+static const struct my_collect_callbacks sink_cb = {.recv = NULL, .sr_recv = NULL};
+static const struct my_collect_callbacks node_cb = {.recv = NULL, .sr_recv = NULL};
+
+/*
+   ------------------------------------ HASH INDEX ------------------------------------
+ */
+
+#define KEY_BASE 2
+// Parents of the random tests are never keys: a route is one hop, and the
+// storing mode bits only depend on the entry itself (see dict_storing)
+#define PARENT_BASE 0x7000
+
+typedef struct dict_model {
+        bool present;
+        linkaddr_t parent;
+        bool storing;
+        bool provisional;
+} dict_model;
+
+static void dict_check_model(const dict_model *model, int keys) {
+        TreeDict *dict = sink->routing_table;
+        int id, len = 0;
+        for (id = 0; id < keys; id++) {
+                linkaddr_t key = addr(KEY_BASE + id);
+                int idx = dict_find_index(dict, key);
+                if (!model[id].present) {
+                        CHECK(idx == -1);
+                        continue;
+                }
+                len++;
+                CHECK(idx != -1);
+                if (idx == -1) {
+                        continue;
+                }
+                CHECK(linkaddr_cmp(&dict->entries[idx].value, &model[id].parent));
+#if DESCENDANT_TABLE_SIZE > 0
+                CHECK(dict_storing(dict, key) == model[id].storing);
+#endif
+#if ROUTING_CHECKPOINT
+                CHECK(((dict->provisional[idx / 8] >> (idx % 8)) & 1) == model[id].provisional);
+#endif
+        }
+        CHECK(dict->len == len);
+}
+
+/*
+    Random inserts, updates and drops near MAX_NODES entries, against a model:
+    after backward shift deletions every key stays reachable, with its value
+    and the slot bits (storing, provisional) that moved with it.
+ */
+static void test_dict_random(void) {
+        TreeDict *dict = sink->routing_table;
+        int keys = MAX_NODES + MAX_NODES / 4;
+        dict_model *model = calloc(keys, sizeof(dict_model));
+        int op, len = 0;
+
+        test_name = "dict_random";
+        dict_init(dict);
+        for (op = 0; op < 40 * keys; op++) {
+                int id = random() % keys;
+                linkaddr_t key = addr(KEY_BASE + id);
+                int action = random() % 8;
+                if (action < 4) {
+                        linkaddr_t parent = addr(PARENT_BASE + random() % 4);
+                        int ret = dict_add(dict, key, parent);
+                        if (model[id].present) {
+                                CHECK(ret == 0);
+                                if (!linkaddr_cmp(&model[id].parent, &parent)) {
+                                        model[id].storing = false;
+                                }
+                                model[id].provisional = false;
+                        } else if (len == MAX_NODES) {
+                                CHECK(ret == -1);
+                                continue;
+                        } else {
+                                CHECK(ret == 0);
+                                model[id].present = true;
+                                model[id].storing = false;
+                                model[id].provisional = false;
+                                len++;
+                        }
+                        model[id].parent = parent;
+                } else if (action < 6) {
+                        dict_drop(dict, key);
+                        if (model[id].present) {
+                                model[id].present = false;
+                                len--;
+                        }
+                } else if (model[id].present) {
+#if DESCENDANT_TABLE_SIZE > 0
+                        if (action == 6) {
+                                dict_set_storing(dict, key, true);
+                                model[id].storing = true;
+                        }
+#endif
+#if ROUTING_CHECKPOINT
+                        if (action == 7) {
+                                dict_set_provisional(dict, key, true);
+                                model[id].provisional = true;
+                        }
+#endif
+                }
+                if (op % 1000 == 0) {
+                        dict_check_model(model, keys);
+                }
+        }
+        dict_check_model(model, keys);
+        free(model);
+}
+
+// Home slot of a key, as dict_hash in routing_table.c
+static uint16_t home_slot(int id) {
+        return (uint16_t)(id * 40503u) >> (16 - DICT_CAPACITY_BITS);
+}
+
+/*
+    Keys with the same home slot form one probe sequence: deleting one of
+    them moves the ones after it back, so the sequence stays contiguous from
+    the home slot and every key reachable, down to an empty table.
+ */
+static void test_dict_cluster(void) {
+        TreeDict *dict = sink->routing_table;
+        linkaddr_t keys[16];
+        int n = 0, id, i, j, slot;
+
+        test_name = "dict_cluster";
+        dict_init(dict);
+        for (id = KEY_BASE; id < 0xffff && n < 16; id++) {
+                if (home_slot(id) == home_slot(KEY_BASE)) {
+                        keys[n] = addr(id);
+                        CHECK(dict_add(dict, keys[n], sink_addr) == 0);
+                        n++;
+                }
+        }
+        CHECK(n == 16);
+        // a hole in the middle first, then from the head of the sequence
+        dict_drop(dict, keys[n / 2]);
+        memmove(&keys[n / 2], &keys[n / 2 + 1], sizeof(linkaddr_t) * (n - n / 2 - 1));
+        n--;
+        for (i = 0; i <= n; i++) {
+                CHECK(dict->len == n - i);
+                for (j = i, slot = home_slot(KEY_BASE); j < n; j++, slot = (slot + 1) & (DICT_CAPACITY - 1)) {
+                        CHECK(dict_find_index(dict, keys[j]) == slot);
+                }
+                for (j = 0; j < i; j++) {
+                        CHECK(dict_find_index(dict, keys[j]) == -1);
+                }
+                if (i < n) {
+                        dict_drop(dict, keys[i]);
+                }
+        }
+}
+
+/*
+    Dropping a subtree forgets the node and all its descendants, and only
+    them.
+ */
+static void test_dict_drop_subtree(void) {
+        TreeDict *dict = sink->routing_table;
+        int nodes = MAX_NODES < 200 ? MAX_NODES : 200;
+        linkaddr_t *parent = calloc(nodes + KEY_BASE, sizeof(linkaddr_t));
+        bool *below = calloc(nodes + KEY_BASE, sizeof(bool));
+        int id, root = KEY_BASE + nodes / 4;
+
+        test_name = "dict_drop_subtree";
+        dict_init(dict);
+        for (id = KEY_BASE; id < KEY_BASE + nodes; id++) {
+                parent[id] = id < KEY_BASE + 4 ? sink_addr : addr(KEY_BASE + random() % (id - KEY_BASE));
+                dict_add(dict, addr(id), parent[id]);
+        }
+        // parents have lower ids: the flags propagate in one pass
+        for (id = KEY_BASE; id < KEY_BASE + nodes; id++) {
+                int p = parent[id].u8[0] | parent[id].u8[1] << 8;
+                below[id] = id == root || (p >= KEY_BASE && below[p]);
+        }
+        dict_drop_subtree(dict, addr(root));
+        for (id = KEY_BASE; id < KEY_BASE + nodes; id++) {
+                linkaddr_t key = addr(id);
+                linkaddr_t found = dict_find(dict, &key);
+                if (below[id]) {
+                        CHECK(linkaddr_cmp(&found, &linkaddr_null));
+                } else {
+                        CHECK(linkaddr_cmp(&found, &parent[id]));
+                }
+        }
+        free(parent);
+        free(below);
+}
+
+/*
+   ------------------------------------ SOURCE ROUTING PATHS ------------------------------------
+ */
+
+// Chain sink <- ids[0] <- ids[1] ... <- ids[len - 1] in a fresh table
+static void chain_build(const int *ids, int len) {
+        int i;
+        dict_init(sink->routing_table);
+        for (i = 0; i < len; i++) {
+                dict_add(sink->routing_table, addr(ids[i]), i == 0 ? sink_addr : addr(ids[i - 1]));
+        }
+}
+
+/*
+    Plan, append and read back the path to the end of the chain: the hops in
+    the packet are the last path_len hops of tree_path, the first hop last.
+ */
+static void check_path(const int *ids, int len, uint8_t fmt, uint8_t path_len) {
+        downward_data_packet_header hdr = {0};
+        linkaddr_t dest = addr(ids[len - 1]), first_hop = addr(ids[0]), hop;
+        int route_len, n, i;
+
+        chain_build(ids, len);
+        route_len = find_route(sink, &dest);
+        CHECK(route_len == len);
+        CHECK(sr_path_plan(sink, route_len, &hdr) == path_len);
+        CHECK(hdr.path_fmt == fmt);
+        CHECK(hdr.path_len == path_len);
+        if (hdr.path_len != path_len) {
+                return;
+        }
+        packetbuf_clear();
+        CHECK(sr_path_append(sink, route_len, &hdr));
+        CHECK(packetbuf_datalen() == path_len * sr_path_hop_size(fmt));
+        n = len < MAX_PATH_LENGTH ? len : MAX_PATH_LENGTH;
+        for (i = 0; i < path_len; i++) {
+                sr_path_read(&hdr, (uint8_t*)packetbuf_dataptr() + i * sr_path_hop_size(fmt), &hop);
+                CHECK(linkaddr_cmp(&hop, &sink->routing_table->tree_path[n - path_len + i]));
+        }
+        // the first hop is the child of the sink, a full path ends with the destination
+        CHECK(linkaddr_cmp(&hop, &first_hop));
+        if (!(fmt & SR_PATH_LOOSE)) {
+                sr_path_read(&hdr, packetbuf_dataptr(), &hop);
+                CHECK(linkaddr_cmp(&hop, &dest));
+        }
+}
+
+static void test_sr_path(void) {
+        int ids[MAX_PATH_LENGTH + 8];
+        int i;
+
+        test_name = "sr_path";
+        // one byte per hop while the high bytes are the same
+        for (i = 0; i < MAX_PATH_LENGTH + 8; i++) {
+                ids[i] = 0x0300 + 2 + i;
+        }
+        check_path(ids, 1, sr_path_compact, 1);
+        check_path(ids, 6, sr_path_compact, 6);
+        check_path(ids, SR_MAX_PATH_BYTES < MAX_PATH_LENGTH ? SR_MAX_PATH_BYTES : MAX_PATH_LENGTH,
+                   sr_path_compact, SR_MAX_PATH_BYTES < MAX_PATH_LENGTH ? SR_MAX_PATH_BYTES : MAX_PATH_LENGTH);
+        // another high byte: full addresses
+        ids[3] = 0x0400 + 5;
+        check_path(ids, 6, sr_path_full, 6);
+#if LOOSE_SOURCE_ROUTING
+        // too long: the hops nearest to the sink that fit with the destination
+        check_path(ids, SR_MAX_PATH_BYTES / sizeof(linkaddr_t) + 2, sr_path_full | SR_PATH_LOOSE,
+                   (SR_MAX_PATH_BYTES - sizeof(linkaddr_t)) / sizeof(linkaddr_t));
+        ids[3] = 0x0300 + 5;
+        check_path(ids, MAX_PATH_LENGTH + 8, sr_path_compact | SR_PATH_LOOSE,
+                   SR_MAX_PATH_BYTES - sizeof(linkaddr_t));
+#endif
+}
+
+/*
+   ------------------------------------ ROUTE SEGMENTS ------------------------------------
+ */
+
+static void check_segment(const linkaddr_t *waypoint, const linkaddr_t *dest, const int *expected, int len) {
+        int i, route_len = find_segment(sink, waypoint, dest);
+        CHECK(route_len == len);
+        for (i = 0; i < len && i < route_len; i++) {
+                linkaddr_t hop = addr(expected[i]);
+                CHECK(linkaddr_cmp(&sink->routing_table->tree_path[i], &hop));
+        }
+}
+
+/*
+    Tree of the segment tests:
+        1 - 2 - 3 - 4 - 5
+                  \ 6 - 7
+                  8 - 9
+    (8 is a child of 1; 9 is not in the table: 10 is its child)
+ */
+static void test_find_segment(void) {
+        TreeDict *dict = sink->routing_table;
+        linkaddr_t n2 = addr(2), n3 = addr(3), n5 = addr(5), n7 = addr(7), n8 = addr(8), n10 = addr(10), n11 = addr(11);
+
+        test_name = "find_segment";
+        dict_init(dict);
+        dict_add(dict, addr(2), sink_addr);
+        dict_add(dict, addr(3), addr(2));
+        dict_add(dict, addr(4), addr(3));
+        dict_add(dict, addr(5), addr(4));
+        dict_add(dict, addr(6), addr(3));
+        dict_add(dict, addr(7), addr(6));
+        dict_add(dict, addr(8), sink_addr);
+        dict_add(dict, addr(10), addr(9));
+        // waypoint on the route: the hops below it
+        check_segment(&n3, &n5, (int[]){5, 4}, 2);
+        check_segment(&n2, &n5, (int[]){5, 4, 3}, 3);
+        // waypoint off the route: up to the common ancestor, then down
+        check_segment(&n7, &n5, (int[]){5, 4, 3, 6}, 4);
+        check_segment(&n8, &n5, (int[]){5, 4, 3, 2, 1}, 5);
+        // destination is an ancestor of the waypoint: only the way up
+        check_segment(&n7, &n3, (int[]){3, 6}, 2);
+        // no route: broken chain to the destination, unknown destination
+        check_segment(&n5, &n10, NULL, 0);
+        check_segment(&n5, &n11, NULL, 0);
+        // loop in the table
+        dict_add(dict, addr(2), addr(4));
+        check_segment(&n8, &n5, NULL, 0);
+}
+
+/*
+   ------------------------------------ ROUTING TABLE CHECKPOINT ------------------------------------
+ */
+
+#if ROUTING_CHECKPOINT
+/*
+    Validation of restored entries by the hop count of a data packet: a
+    matching route confirms the entry, another length drops it, and an entry
+    without a complete route waits for one.
+ */
+static void test_checkpoint_check(void) {
+        TreeDict *dict = sink->routing_table;
+        linkaddr_t n10 = addr(10), n11 = addr(11), n12 = addr(12), n13 = addr(13);
+
+        test_name = "checkpoint_check";
+        chain_build((int[]){10, 11, 12}, 3);
+        dict_add(dict, n13, addr(14)); // 14 unknown
+        dict_set_provisional(dict, n11, true);
+        dict_set_provisional(dict, n12, true);
+        dict_set_provisional(dict, n13, true);
+        routing_checkpoint_check(sink, &n11, 2);
+        CHECK(!dict_provisional(dict, n11));
+        CHECK(dict_find_index(dict, n11) != -1);
+        routing_checkpoint_check(sink, &n12, 4);
+        CHECK(dict_find_index(dict, n12) == -1);
+        // no route: still provisional, checked once the ancestor is known
+        routing_checkpoint_check(sink, &n13, 2);
+        CHECK(dict_provisional(dict, n13));
+        dict_add(dict, addr(14), n10);
+        routing_checkpoint_check(sink, &n13, 3);
+        CHECK(!dict_provisional(dict, n13));
+        CHECK(dict_find_index(dict, n13) != -1);
+        // a confirmed entry is not checked again
+        routing_checkpoint_check(sink, &n13, 5);
+        CHECK(dict_find_index(dict, n13) != -1);
+}
+#endif
+
+/*
+   ------------------------------------ DESCENDANT TABLE ------------------------------------
+ */
+
+#if DESCENDANT_TABLE_SIZE > 0
+// Index of id in the descendant table, -1 if absent
+static int descendant_pos(int id) {
+        linkaddr_t a = addr(id);
+        int i;
+        for (i = 0; i < node->descendants_len; i++) {
+                if (linkaddr_cmp(&node->descendants[i].node, &a)) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+// A source routed packet to dest forwarded to child: the entry is used by a downward packet
+static void descendant_learn_dest(int dest, int child) {
+        downward_data_packet_header hdr = {.path_len = 1, .path_fmt = sr_path_full};
+        linkaddr_t d = addr(dest), c = addr(child);
+        packetbuf_clear();
+        packetbuf_copyfrom(&d, sizeof(linkaddr_t));
+        descendant_learn_path(node, &hdr, &c);
+}
+
+/*
+    LRU order of the descendant table: a node heard again moves to the front,
+    a new one replaces the least recently used entry no downward packet used,
+    and upward traffic never evicts the downward destinations.
+ */
+static void test_descendant_lru(void) {
+        linkaddr_t child = addr(50), child2 = addr(51);
+        linkaddr_t n100 = addr(100), n102 = addr(102), n200 = addr(200), n201 = addr(201);
+        int id;
+
+        test_name = "descendant_lru";
+        descendant_table_init(node);
+        for (id = 100; id < 100 + DESCENDANT_TABLE_SIZE; id++) {
+                linkaddr_t a = addr(id);
+                descendant_learn(node, &a, &child);
+        }
+        CHECK(node->descendants_len == DESCENDANT_TABLE_SIZE);
+        CHECK(descendant_pos(100 + DESCENDANT_TABLE_SIZE - 1) == 0);
+        CHECK(descendant_pos(100) == DESCENDANT_TABLE_SIZE - 1);
+        // heard again: to the front
+        descendant_learn(node, &n100, &child);
+        CHECK(descendant_pos(100) == 0);
+        // a new node replaces the least recently used one (101)
+        descendant_learn(node, &n200, &child);
+        CHECK(descendant_pos(101) == -1);
+        CHECK(descendant_pos(200) == 0);
+        CHECK(node->descendants_len == DESCENDANT_TABLE_SIZE);
+        // a downward destination is kept while upward traffic washes the rest out
+        descendant_learn_dest(102, 51);
+        CHECK(descendant_pos(102) == 0);
+        CHECK(linkaddr_cmp(&node->descendants[0].child, &child2));
+        for (id = 300; id < 300 + 2 * DESCENDANT_TABLE_SIZE; id++) {
+                linkaddr_t a = addr(id);
+                descendant_learn(node, &a, &child);
+        }
+        CHECK(descendant_pos(102) != -1);
+        CHECK(descendant_pos(300 + 2 * DESCENDANT_TABLE_SIZE - 1) == 0);
+        CHECK(descendant_pos(300) == -1);
+        // heard upward again, it stays a downward destination (and keeps its place when full)
+        descendant_learn(node, &n102, &child);
+        CHECK(descendant_pos(102) == 0);
+        CHECK(node->descendants[0].used);
+        // every entry used: upward traffic is not added, a destination takes the LRU entry
+        descendant_table_init(node);
+        for (id = 100; id < 100 + DESCENDANT_TABLE_SIZE; id++) {
+                descendant_learn_dest(id, 51);
+        }
+        descendant_learn(node, &n201, &child);
+        CHECK(descendant_pos(201) == -1);
+        descendant_learn_dest(202, 51);
+        CHECK(descendant_pos(202) == 0);
+        CHECK(descendant_pos(100) == -1);
+        CHECK(node->descendants_len == DESCENDANT_TABLE_SIZE);
+        // never learns itself, nor from its parent
+        descendant_learn(node, &linkaddr_node_addr, &child);
+        CHECK(descendant_pos(linkaddr_node_addr.u8[0] | linkaddr_node_addr.u8[1] << 8) == -1);
+        descendant_learn_dest(203, node->parent.u8[0] | node->parent.u8[1] << 8);
+        CHECK(descendant_pos(203) == -1);
+}
+
+/*
+    Storing mode marks at the sink: a destination loses its mark when a node
+    of its route gets a new parent, and only then.
+ */
+static void test_storing_mark(void) {
+        TreeDict *dict = sink->routing_table;
+        linkaddr_t n10 = addr(10), n11 = addr(11), n12 = addr(12), n13 = addr(13), n14 = addr(14), n20 = addr(20);
+
+        test_name = "storing_mark";
+        chain_build((int[]){10, 11, 12, 13}, 4);
+        dict_add(dict, n20, sink_addr);
+        dict_set_storing(dict, n13, true);
+        dict_set_storing(dict, n20, true);
+        CHECK(dict_storing(dict, n13));
+        // same parent reported again, a node off the route moves: still valid
+        dict_add(dict, n11, n10);
+        dict_add(dict, n20, n10);
+        CHECK(dict_storing(dict, n13));
+        CHECK(!dict_storing(dict, n20));
+        // an ancestor moves: the mark is gone, even after it moves back
+        dict_add(dict, n11, sink_addr);
+        CHECK(!dict_storing(dict, n13));
+        dict_add(dict, n11, n10);
+        CHECK(!dict_storing(dict, n13));
+        // marked again after the move, with an ancestor marked at the same version
+        dict_set_storing(dict, n13, true);
+        dict_set_storing(dict, n11, true);
+        CHECK(dict_storing(dict, n13));
+        CHECK(dict_storing(dict, n11));
+        // a new node below the destination changes nothing
+        dict_add(dict, n14, n13);
+        CHECK(dict_storing(dict, n13));
+        // an ancestor dropped and added again is a move
+        dict_drop(dict, n12);
+        dict_add(dict, n12, n11);
+        CHECK(!dict_storing(dict, n13));
+        CHECK(dict_storing(dict, n11));
+        // the destination itself moves
+        dict_set_storing(dict, n13, true);
+        CHECK(dict_storing(dict, n13));
+        dict_add(dict, n13, n11);
+        CHECK(!dict_storing(dict, n13));
+        // a tree round clears every mark
+        dict_clear_storing(dict);
+        CHECK(!dict_storing(dict, n11));
+}
+#endif
+
+/*
+   ------------------------------------ MAIN ------------------------------------
+ */
+
+typedef struct test_case {
+        const char *name;
+        void (*run)(void);
+        int node; // simulated node running the test: 0 the sink, 1 an ordinary node
+} test_case;
+
+static const test_case tests[] = {
+        {"dict_random", test_dict_random, 0},
+        {"dict_cluster", test_dict_cluster, 0},
+        {"dict_drop_subtree", test_dict_drop_subtree, 0},
+        {"sr_path", test_sr_path, 0},
+        {"find_segment", test_find_segment, 0},
+#if ROUTING_CHECKPOINT
+        {"checkpoint_check", test_checkpoint_check, 0},
+#endif
+#if DESCENDANT_TABLE_SIZE > 0
+        {"descendant_lru", test_descendant_lru, 1},
+        {"storing_mark", test_storing_mark, 0},
+#endif
+};
+
+static void usage(const char *prog) {
+        fprintf(stderr,
+                "Usage: %s [options] [test...]\n"
+                "  -s N     random seed (default 1)\n"
+                "Runs the tests given by name, all of them by default.\n",
+                prog);
+        exit(1);
+}
+
+int main(int argc, char **argv) {
+        unsigned seed = 1;
+        int opt, i, j, run = 0;
+
+        while ((opt = getopt(argc, argv, "s:h")) != -1) {
+                switch (opt) {
+                case 's': seed = strtoul(optarg, NULL, 10); break;
+                default: usage(argv[0]);
+                }
+        }
+
+        // node 0 is the sink, node 1 an ordinary node with parent 1.0
+        sim_num_nodes = 2;
+        sim_nodes = calloc(sim_num_nodes, sizeof(sim_node));
+        sink = calloc(1, sizeof(my_collect_conn));
+        node = calloc(1, sizeof(my_collect_conn));
+        sim_set_node(0);
+        linkaddr_copy(&linkaddr_node_addr, &sink_addr);
+        my_collect_open(sink, 0xAA, true, &sink_cb, NULL);
+        sim_set_node(1);
+        linkaddr_node_addr = addr(40);
+        my_collect_open(node, 0xAA, false, &node_cb, NULL);
+        linkaddr_copy(&node->parent, &sink_addr);
+
+        for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+                unsigned before = failures;
+                if (optind < argc) {
+                        for (j = optind; j < argc && strcmp(argv[j], tests[i].name) != 0; j++);
+                        if (j == argc) {
+                                continue;
+                        }
+                }
+                srandom(seed);
+                sim_set_node(tests[i].node);
+                linkaddr_node_addr = tests[i].node == 0 ? sink_addr : addr(40);
+                tests[i].run();
+                printf("%-20s %s\n", tests[i].name, failures == before ? "ok" : "FAILED");
+                run++;
+        }
+        printf("%d tests, %u checks, %u failed\n", run, checks, failures);
+        return failures > 0 || run == 0;
+}
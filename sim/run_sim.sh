@@ -4,6 +4,8 @@
 PROJECT_PATH="/code/"
 SIM_FOLDER="${PROJECT_PATH}sim/"
 RESULTS_FOLDER="${PROJECT_PATH}results/"
+# compiled log analyzer (make -C sim/analyze), the PDR averages fall back to grep without it
+ANALYZER="${SIM_FOLDER}analyze/analyze-stats"
 
 # aggregate_stat:
 #     Average results from multiple simulations
@@ -142,9 +144,15 @@ fi
 
 # Average simulations results
 rm ${SIM_FOLDER}${SIMULATION}/sim_average.log
-echo "Simulation ${SIM_FOLDER}${SIMULATION} summary:" >> ${SIM_FOLDER}${SIMULATION}/sim_average.log
-aggregate_stat 1 ${NUM_SIMS} "Data Collection PDR: "
-aggregate_stat 2 ${NUM_SIMS} "Source Routing PDR: "
+if [[ -x ${ANALYZER} ]]; then
+    # one pass over all the runs: PDR, latency and hop counts
+    ${ANALYZER} -t ${SIM_FOLDER}${SIMULATION} > ${SIM_FOLDER}${SIMULATION}/sim_average.log
+    ${ANALYZER} ${SIM_FOLDER}${SIMULATION} > ${SIM_FOLDER}${SIMULATION}/summary.json
+else
+    echo "Simulation ${SIM_FOLDER}${SIMULATION} summary:" >> ${SIM_FOLDER}${SIMULATION}/sim_average.log
+    aggregate_stat 1 ${NUM_SIMS} "Data Collection PDR: "
+    aggregate_stat 2 ${NUM_SIMS} "Source Routing PDR: "
+fi
 
 # Copy the test csc cooja file into the simulation folder for reproducibility
 cp ${SIM_FOLDER}${CSC_FILE} ${SIM_FOLDER}${SIMULATION}/${CSC_FILE}
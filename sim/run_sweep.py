@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+#
+# Parameter sweep runner: topologies x protocol settings x seeds.
+#
+# Every run has its own directory, so the runs are independent and are
+# spread over all the CPU cores. Results use the layout of run_sim.sh:
+#
+#   <out>/<topology>/<setting>/<run>/test.log
+#   <out>/<topology>/<setting>/sim_average.log, summary.json
+#
+# A configuration (topology and setting) is summarized by analyze-stats as
+# soon as its last run ends, and its JSON line is appended to <out>/sweep.jsonl.
+#
+# Backends:
+#   native  sim/native/srdcp-sim with the node positions, radio range and
+#           duration of the csc file (unit disk links, as Cooja's UDGM)
+#   cooja   one firmware per setting, built in a copy of src/, then Cooja
+#           in the run directory with the seed written in the csc file
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import xml.etree.ElementTree as ET
+from concurrent.futures import ThreadPoolExecutor, as_completed
+
+SIM_FOLDER = os.path.dirname(os.path.abspath(__file__))
+PROJECT_PATH = os.path.dirname(SIM_FOLDER)
+NATIVE_SIM = os.path.join(SIM_FOLDER, "native", "srdcp-sim")
+ANALYZER = os.path.join(SIM_FOLDER, "analyze", "analyze-stats")
+
+# Setting keys: native simulator option, Cooja build macro
+SETTING_KEYS = {
+	"check_rate":      (lambda v: ["-c", v],                                    lambda v: "RDC_CHANNEL_CHECK_RATE=%d" % int(v)),
+	"topology_report": (lambda v: [] if int(v) else ["--no-topology-report"],   lambda v: "TOPOLOGY_REPORT=%d" % int(v)),
+	"piggybacking":    (lambda v: [] if int(v) else ["--no-piggybacking"],      lambda v: "PIGGYBACKING=%d" % int(v)),
+	"storing_mode":    (lambda v: [] if int(v) else ["--no-storing"],           lambda v: "STORING_MODE=%d" % int(v)),
+	"beacon_interval": (lambda v: ["--beacon-interval", v],                     lambda v: "TRICKLE_IMIN=(CLOCK_SECOND*%d/1000)" % (float(v) * 1000)),
+	"treport_hold":    (lambda v: ["--treport-hold", v],                        lambda v: "TOPOLOGY_REPORT_HOLD_TIME=(CLOCK_SECOND*%d/1000)" % (float(v) * 1000)),
+	"rssi_threshold":  (lambda v: ["--rssi-threshold", v],                      lambda v: "RSSI_THRESHOLD=%d" % int(v)),
+}
+
+def parse_setting(spec):
+	"""NAME[:key=value,...] -> (name, {key: value})"""
+	name, _, params = spec.partition(":")
+	values = {}
+	for p in filter(None, params.split(",")):
+		key, _, value = p.partition("=")
+		if key not in SETTING_KEYS or value == "":
+			raise argparse.ArgumentTypeError("bad setting parameter '%s' (keys: %s)" % (p, ", ".join(SETTING_KEYS)))
+		values[key] = value
+	if not name or "/" in name:
+		raise argparse.ArgumentTypeError("bad setting name '%s'" % name)
+	return name, values
+
+class Topology:
+	"""Node positions, radio range and duration of a csc file"""
+	def __init__(self, csc):
+		self.csc = os.path.abspath(csc)
+		self.name = os.path.splitext(os.path.basename(csc))[0]
+		root = ET.parse(self.csc).getroot()
+		self.range = float(root.findtext("simulation/radiomedium/transmitting_range", "50"))
+		self.nodes = []
+		for mote in root.iter("mote"):
+			x = y = node_id = None
+			for conf in mote.iter("interface_config"):
+				if conf.find("x") is not None:
+					x, y = float(conf.findtext("x")), float(conf.findtext("y"))
+				if conf.find("id") is not None:
+					node_id = int(conf.findtext("id"))
+			if node_id is not None and x is not None:
+				self.nodes.append((node_id, x, y))
+		# first TIMEOUT() of the test script that is not commented out
+		self.duration = 3600
+		for line in (root.findtext(".//script") or "").splitlines():
+			m = re.match(r"\s*TIMEOUT\((\d+)", line)
+			if m:
+				self.duration = int(m.group(1)) / 1000
+				break
+
+	def write_positions(self, path):
+		with open(path, "w") as f:
+			f.write("# %s\n" % self.csc)
+			for node in self.nodes:
+				f.write("%d %g %g\n" % node)
+
+def build_firmware(name, values, out):
+	"""Cooja backend: build app.sky for a setting in a copy of src/"""
+	build_dir = os.path.join(out, ".build", name)
+	shutil.rmtree(build_dir, ignore_errors=True)
+	shutil.copytree(os.path.join(PROJECT_PATH, "src"), build_dir,
+			ignore=shutil.ignore_patterns("obj_*", "*.sky", "build"))
+	defines = ['PROJECT_CONF_H=\\"project-conf.h\\"'] + [SETTING_KEYS[k][1](v) for k, v in sorted(values.items())]
+	subprocess.run(["make", "TARGET=sky", "DEFINES=" + ",".join(defines)], cwd=build_dir, check=True,
+		       stdout=subprocess.DEVNULL)
+	return os.path.join(build_dir, "app.sky")
+
+def run_native(topology, values, seed, run_dir):
+	cmd = [NATIVE_SIM, "-T", os.path.join(os.path.dirname(run_dir), "topology.txt"), "-m", "disk",
+	       "-r", str(topology.range), "-t", str(topology.duration), "-s", str(seed), "-v", "2"]
+	for key, value in sorted(values.items()):
+		cmd += SETTING_KEYS[key][0](value)
+	with open(os.path.join(run_dir, "cmd"), "w") as f:
+		f.write(" ".join(cmd) + "\n")
+	with open(os.path.join(run_dir, "test.log"), "w") as log, \
+	     open(os.path.join(run_dir, "sim_output.log"), "w") as err:
+		return subprocess.run(cmd, stdout=log, stderr=err).returncode
+
+def run_cooja(topology, firmware, seed, run_dir, cooja):
+	with open(topology.csc) as f:
+		csc = f.read()
+	csc = re.sub(r"<randomseed>[^<]*</randomseed>", "<randomseed>%d</randomseed>" % seed, csc)
+	with open(os.path.join(run_dir, topology.name + ".csc"), "w") as f:
+		f.write(csc)
+	# the csc loads [CONFIG_DIR]/src/app.sky
+	os.makedirs(os.path.join(run_dir, "src"), exist_ok=True)
+	shutil.copy(firmware, os.path.join(run_dir, "src", "app.sky"))
+	cmd = "%s %s.csc" % (cooja, topology.name)
+	with open(os.path.join(run_dir, "cmd"), "w") as f:
+		f.write(cmd + "\n")
+	with open(os.path.join(run_dir, "cooja_output.log"), "w") as out:
+		ret = subprocess.run(cmd, shell=True, cwd=run_dir, stdout=out, stderr=subprocess.STDOUT).returncode
+	shutil.rmtree(os.path.join(run_dir, "src"), ignore_errors=True)
+	return ret
+
+def summarize(config_dir, sweep_log):
+	"""analyze-stats summaries of a configuration whose runs are all done"""
+	with open(os.path.join(config_dir, "sim_average.log"), "w") as f:
+		subprocess.run([ANALYZER, "-t", "-j", "1", config_dir], stdout=f)
+	summary = subprocess.run([ANALYZER, "-j", "1", config_dir], stdout=subprocess.PIPE,
+				 universal_newlines=True).stdout
+	with open(os.path.join(config_dir, "summary.json"), "w") as f:
+		f.write(summary)
+	with open(sweep_log, "a") as f:
+		f.write(summary)
+
+def main():
+	parser = argparse.ArgumentParser(description="Run a parameter sweep: topologies x settings x seeds, in parallel.")
+	parser.add_argument("csc", nargs="+", help="Cooja csc files (e.g. sim/cooja/*.csc)")
+	parser.add_argument("-S", "--setting", type=parse_setting, action="append", default=[],
+			    help="NAME[:key=value,...], repeatable. Keys: " + ", ".join(SETTING_KEYS) +
+			    ". Default: one setting 'default' with the protocol defaults")
+	parser.add_argument("-n", "--runs", type=int, default=8, help="runs per configuration, seeds 1..N (default 8)")
+	parser.add_argument("--seed-base", type=int, default=0, help="seed of run i is seed-base + i")
+	parser.add_argument("-b", "--backend", choices=["native", "cooja"], default="native")
+	parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="parallel runs (default: number of CPUs)")
+	parser.add_argument("-o", "--out", default=os.path.join(PROJECT_PATH, "results"), help="results folder (default results/)")
+	parser.add_argument("--cooja", default="cooja_nogui", help="command running a csc file without GUI (cooja backend)")
+	args = parser.parse_args()
+	settings = args.setting or [("default", {})]
+	if len(set(name for name, _ in settings)) != len(settings):
+		parser.error("setting names must be unique")
+
+	if args.backend == "native":
+		subprocess.run(["make", "-C", os.path.join(SIM_FOLDER, "native")], check=True, stdout=subprocess.DEVNULL)
+	subprocess.run(["make", "-C", os.path.join(SIM_FOLDER, "analyze")], check=True, stdout=subprocess.DEVNULL)
+
+	topologies = [Topology(csc) for csc in args.csc]
+	out = os.path.abspath(args.out)
+	sweep_log = os.path.join(out, "sweep.jsonl")
+	os.makedirs(out, exist_ok=True)
+	firmwares = {}
+	if args.backend == "cooja":
+		for name, values in settings:
+			print("Building firmware for %s" % name)
+			firmwares[name] = build_firmware(name, values, out)
+
+	# configuration directory -> runs left
+	pending = {}
+	jobs = []
+	for topology in topologies:
+		for name, values in settings:
+			config_dir = os.path.join(out, topology.name, name)
+			shutil.rmtree(config_dir, ignore_errors=True)
+			os.makedirs(config_dir)
+			if args.backend == "native":
+				topology.write_positions(os.path.join(config_dir, "topology.txt"))
+			# for reproducibility, as run_sim.sh
+			shutil.copy(topology.csc, config_dir)
+			pending[config_dir] = args.runs
+			for i in range(1, args.runs + 1):
+				run_dir = os.path.join(config_dir, str(i))
+				os.makedirs(run_dir)
+				jobs.append((config_dir, topology, name, values, args.seed_base + i, run_dir))
+
+	print("Running %d runs of %d configurations on %d workers" % (len(jobs), len(pending), args.jobs))
+	failed = 0
+	with ThreadPoolExecutor(max_workers=max(1, args.jobs)) as pool:
+		futures = {}
+		for config_dir, topology, name, values, seed, run_dir in jobs:
+			if args.backend == "native":
+				f = pool.submit(run_native, topology, values, seed, run_dir)
+			else:
+				f = pool.submit(run_cooja, topology, firmwares[name], seed, run_dir, args.cooja)
+			futures[f] = (config_dir, run_dir)
+		for f in as_completed(futures):
+			config_dir, run_dir = futures[f]
+			if f.result() != 0:
+				failed += 1
+				print("Run %s failed (exit status %d)" % (run_dir, f.result()), file=sys.stderr)
+			pending[config_dir] -= 1
+			if pending[config_dir] == 0:
+				summarize(config_dir, sweep_log)
+				print("Done %s" % os.path.relpath(config_dir, out))
+	if failed:
+		print("%d runs failed" % failed, file=sys.stderr)
+		sys.exit(1)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+#
+# Network size scaling benchmark on the native simulator.
+#
+# Runs the topologies of gen_topology.py (every kind and size) for -n seeds,
+# once per sink limit: a build of srdcp-sim with its own MAX_NODES and
+# DICT_CAPACITY_BITS. For each limit, kind and size it reports
+#
+#   PDR and latency      data collection and source routing, from analyze-stats
+#   control overhead     beacon, topology report, energy report and segment
+#                        request bytes over all the bytes sent (srdcp-sim
+#                        frame counters)
+#   sink RAM             size of the sink connection state and of its routing
+#                        table (static), routing table entries used
+#   limits               nodes missing from the routing table (MAX_NODES)
+#                        and routes longer than MAX_PATH_LENGTH
+#
+# Layout: <out>/<limit>/<kind>_<nodes>/<run>/test.log, sim_output.log.
+# The table is printed and written to <out>/scaling.txt, one JSON line per
+# configuration to <out>/scaling.jsonl.
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+SIM_FOLDER = os.path.dirname(os.path.abspath(__file__))
+PROJECT_PATH = os.path.dirname(SIM_FOLDER)
+GENERATOR = os.path.join(SIM_FOLDER, "gen_topology.py")
+ANALYZER = os.path.join(SIM_FOLDER, "analyze", "analyze-stats")
+
+# srdcp-sim summary lines (stderr)
+CONTROL_RE = re.compile(r"control overhead (\d+)/(\d+) bytes")
+SINK_RE = re.compile(r"sink routing table (\d+)/(\d+) nodes, deepest route (\d+) hops, (\d+) routes longer than "
+		     r"MAX_PATH_LENGTH (\d+), connection state (\d+) bytes \(routing table (\d+)\)")
+
+def parse_limit(spec):
+	"""NAME:MAX_NODES:DICT_CAPACITY_BITS"""
+	m = re.match(r"^([\w.-]+):(\d+):(\d+)$", spec)
+	if m is None or int(m.group(2)) * 4 > (1 << int(m.group(3))) * 3:
+		raise argparse.ArgumentTypeError("bad limit '%s' (NAME:MAX_NODES:DICT_CAPACITY_BITS, load factor at most 3/4)" % spec)
+	return m.group(1), int(m.group(2)), int(m.group(3))
+
+def build(limit, out):
+	name, max_nodes, dict_bits = limit
+	build_dir = os.path.join(out, ".build", name)
+	binary = os.path.join(build_dir, "srdcp-sim")
+	subprocess.run(["make", "-C", os.path.join(SIM_FOLDER, "native"), "BUILD_DIR=" + build_dir, "SIM_BIN=" + binary,
+			"SIM_MAX_NODES=%d" % max_nodes, "SIM_DICT_CAPACITY_BITS=%d" % dict_bits],
+		       check=True, stdout=subprocess.DEVNULL)
+	return binary
+
+def run(binary, topology, args, seed, run_dir):
+	cmd = [binary, "-T", topology, "-m", "disk", "-r", str(args.range), "-t", str(args.time),
+	       "-s", str(seed), "-v", "1"] + args.sim_args.split()
+	with open(os.path.join(run_dir, "cmd"), "w") as f:
+		f.write(" ".join(cmd) + "\n")
+	with open(os.path.join(run_dir, "test.log"), "w") as log, \
+	     open(os.path.join(run_dir, "sim_output.log"), "w") as err:
+		return subprocess.run(cmd, stdout=log, stderr=err).returncode
+
+def mean(values):
+	return sum(values) / len(values) if values else 0
+
+def summarize(limit, kind, nodes, config_dir, runs):
+	"""One result per configuration: analyze-stats summary and the srdcp-sim counters averaged over the runs"""
+	stats = json.loads(subprocess.run([ANALYZER, "-j", "1", config_dir], stdout=subprocess.PIPE,
+					  universal_newlines=True, check=True).stdout)
+	control, sink = [], []
+	for i in range(1, runs + 1):
+		with open(os.path.join(config_dir, str(i), "sim_output.log")) as f:
+			text = f.read()
+		m = CONTROL_RE.search(text)
+		if m:
+			control.append(100.0 * int(m.group(1)) / max(1, int(m.group(2))))
+		m = SINK_RE.search(text)
+		if m:
+			sink.append([int(v) for v in m.groups()])
+	if not sink:
+		sys.exit("scaling_bench: no srdcp-sim summary in %s" % config_dir)
+	dc, sr = stats["data_collection"], stats["source_routing"]
+	return {
+		"limit": limit[0], "max_nodes": limit[1], "kind": kind, "nodes": nodes, "runs": stats["runs"],
+		"dc_pdr": dc["pdr"], "dc_latency_mean_ms": dc["latency_ms"]["mean"], "dc_latency_p90_ms": dc["latency_ms"]["p90"],
+		"sr_pdr": sr["pdr"], "sr_latency_mean_ms": sr["latency_ms"]["mean"], "sr_latency_p90_ms": sr["latency_ms"]["p90"],
+		"control_overhead": mean(control),
+		"table_nodes": mean([s[0] for s in sink]),
+		"missing_nodes": mean([nodes - 1 - s[0] for s in sink]),
+		"depth": max(s[2] for s in sink),
+		"routes_too_long": mean([s[3] for s in sink]),
+		"max_path_length": sink[0][4],
+		"sink_conn_bytes": sink[0][5],
+		"sink_table_bytes": sink[0][6],
+	}
+
+HEADER = ("%-6s %-10s %5s  %7s %9s %9s  %7s %9s  %7s  %9s %7s %5s %8s  %s" %
+	  ("limit", "kind", "nodes", "DC PDR", "DC mean", "DC p90", "SR PDR", "SR mean", "control",
+	   "table", "missing", "depth", "too long", "sink RAM"))
+
+def table_row(r):
+	return ("%-6s %-10s %5d  %6.2f%% %7.0fms %7.0fms  %6.2f%% %7.0fms  %6.2f%%  %4.0f/%-4d %7.1f %5d %8.1f  %d B (table %d B)" %
+		(r["limit"], r["kind"], r["nodes"], r["dc_pdr"], r["dc_latency_mean_ms"], r["dc_latency_p90_ms"],
+		 r["sr_pdr"], r["sr_latency_mean_ms"], r["control_overhead"], r["table_nodes"], r["max_nodes"],
+		 r["missing_nodes"], r["depth"], r["routes_too_long"], r["sink_conn_bytes"], r["sink_table_bytes"]))
+
+def main():
+	parser = argparse.ArgumentParser(description="Scaling benchmark: PDR, latency, control overhead and sink RAM as the network grows.")
+	parser.add_argument("-k", "--kinds", default="grid,uniform,clustered,chain", help="topology kinds (default: all)")
+	parser.add_argument("-N", "--nodes", default="50,100,250,500", help="network sizes (default: 50,100,250,500)")
+	parser.add_argument("-L", "--limit", type=parse_limit, action="append", default=[],
+			    help="NAME:MAX_NODES:DICT_CAPACITY_BITS, repeatable (default: mote:30:6, the firmware, and sim:1500:11)")
+	parser.add_argument("-n", "--runs", type=int, default=3, help="runs per configuration, seeds 1..N (default 3)")
+	parser.add_argument("-t", "--time", type=float, default=1800, help="simulated seconds (default 1800)")
+	parser.add_argument("-r", "--range", type=float, default=50, help="radio range in meters (default 50)")
+	parser.add_argument("-s", "--seed", type=int, default=1, help="topology seed (default 1)")
+	parser.add_argument("--sim-args", default="", help="more srdcp-sim options, e.g. \"-c 0\"")
+	parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="parallel runs (default: number of CPUs)")
+	parser.add_argument("-o", "--out", default=os.path.join(PROJECT_PATH, "results", "scaling"), help="results folder (default results/scaling)")
+	args = parser.parse_args()
+	limits = args.limit or [("mote", 30, 6), ("sim", 1500, 11)]
+	kinds = args.kinds.split(",")
+	sizes = [int(n) for n in args.nodes.split(",")]
+
+	out = os.path.abspath(args.out)
+	topologies = os.path.join(out, "topologies")
+	os.makedirs(out, exist_ok=True)
+	subprocess.run([GENERATOR, "-k", args.kinds, "-n", args.nodes, "-r", str(args.range), "-s", str(args.seed),
+			"-t", "%d" % args.time, "-o", topologies], check=True, stdout=subprocess.DEVNULL)
+	subprocess.run(["make", "-C", os.path.join(SIM_FOLDER, "analyze")], check=True, stdout=subprocess.DEVNULL)
+	binaries = {limit: build(limit, out) for limit in limits}
+
+	configs, jobs = [], []
+	for limit in limits:
+		for kind in kinds:
+			for n in sizes:
+				config_dir = os.path.join(out, limit[0], "%s_%d" % (kind, n))
+				shutil.rmtree(config_dir, ignore_errors=True)
+				configs.append((limit, kind, n, config_dir))
+				for i in range(1, args.runs + 1):
+					run_dir = os.path.join(config_dir, str(i))
+					os.makedirs(run_dir)
+					jobs.append((binaries[limit], os.path.join(topologies, "%s_%d.txt" % (kind, n)), i, run_dir))
+
+	print("Running %d runs of %d configurations on %d workers" % (len(jobs), len(configs), args.jobs))
+	with ThreadPoolExecutor(max_workers=max(1, args.jobs)) as pool:
+		failed = [job[3] for job, ret in zip(jobs, pool.map(lambda job: run(job[0], job[1], args, job[2], job[3]), jobs)) if ret != 0]
+	if failed:
+		sys.exit("scaling_bench: runs failed: %s" % " ".join(failed))
+
+	results = [summarize(limit, kind, n, config_dir, args.runs) for limit, kind, n, config_dir in configs]
+	with open(os.path.join(out, "scaling.jsonl"), "w") as f:
+		for r in results:
+			f.write(json.dumps(r) + "\n")
+	with open(os.path.join(out, "scaling.txt"), "w") as f:
+		for line in [HEADER] + [table_row(r) for r in results]:
+			print(line)
+			f.write(line + "\n")
+
+if __name__ == "__main__":
+	main()
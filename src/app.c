@@ -10,13 +10,27 @@
 #define APP_UPWARD_TRAFFIC 1
 #define APP_DOWNWARD_TRAFFIC 1
 /*---------------------------------------------------------------------------*/
+// Source routing destinations: nodes 2..APP_NODES (sim/gen_topology.py networks need APP_NODES=<nodes>)
+#ifndef APP_NODES
 #define APP_NODES 10
+#endif
+// Nodes 1..APP_SINKS are sinks, each one source routes to the nodes of its partition
+#ifndef APP_SINKS
+#define APP_SINKS 1
+#endif
 /*---------------------------------------------------------------------------*/
 #define MSG_PERIOD (30 * CLOCK_SECOND)  // send every 30 seconds
 #define SR_MSG_PERIOD (10 * CLOCK_SECOND)  // send every 10 seconds
+#if TOPOLOGY_SOLICIT
+#define SR_WARMUP (15 * CLOCK_SECOND) // the sink solicits the topology reports at startup
+#else
+#define SR_WARMUP (75 * CLOCK_SECOND) // gather topology information before source routing
+#endif
+#define SR_WARMUP_RESTORED (5 * CLOCK_SECOND) // routing table restored from the checkpoint
 #define COLLECT_CHANNEL 0xAA
+#define TICKS_TO_MS(t) ((unsigned long)(t) * 1000 / CLOCK_SECOND)
 /*---------------------------------------------------------------------------*/
-static linkaddr_t sink = {{0x01, 0x00}}; // node 1 will be our sink
+#define NODE_ID(addr) ((addr).u8[0] | (addr).u8[1] << 8)
 /*---------------------------------------------------------------------------*/
 PROCESS(app_process, "App process");
 AUTOSTART_PROCESSES(&app_process);
@@ -29,19 +43,31 @@ __attribute__((packed))
 test_msg_t;
 /*---------------------------------------------------------------------------*/
 static struct my_collect_conn my_collect;
-static void recv_cb(const linkaddr_t *originator, uint8_t hops);
+/*
+ * Protocol configuration, the same for every node. Starts from the defaults
+ * of my_collect.h, can be changed at run time with my_collect_set_config().
+ */
+static const struct my_collect_config collect_config = MY_COLLECT_DEFAULT_CONFIG;
+static void recv_cb(const linkaddr_t *originator, uint8_t hops, uint16_t delay);
 /*
  * Source Routing Callback
  * This function is called upon receiving a message from the sink in a node.
  * Params:
  *  ptr: a pointer to the connection of the collection protocol
  *  hops: number of hops of the route followed by the packet to reach the destination
+ *  delay: clock ticks the packet spent in the network (with LATENCY_STATS)
  */
-static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops);
+static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops, uint16_t delay);
+/*
+ * Energy Report Callback
+ * Called in the sink for the radio duty cycle of a node (with ENERGY_REPORT).
+ */
+static void energy_cb(const energy_record *report);
 /*---------------------------------------------------------------------------*/
 static struct my_collect_callbacks sink_cb = {
   .recv = recv_cb,
   .sr_recv = NULL,
+  .energy_recv = energy_cb,
 };
 /*---------------------------------------------------------------------------*/
 static struct my_collect_callbacks node_cb = {
@@ -54,61 +80,81 @@ PROCESS_THREAD(app_process, ev, data)
   static struct etimer periodic;
   static struct etimer rnd;
   static test_msg_t msg = {.seqn=0};
-  static uint8_t dest_low = 2;
+  static uint16_t dest_id = APP_SINKS + 1;
   // static linkaddr_t dest = {{0x00, 0x00}};
   static linkaddr_t dest;
   dest.u8[0] = 0x00;
   dest.u8[1] = 0x00;
   static int ret;
+#if APP_SINKS > 1
+  static uint16_t skipped;
+#endif
 
   PROCESS_BEGIN();
 
-  if(linkaddr_cmp(&sink, &linkaddr_node_addr)) {
+  if(NODE_ID(linkaddr_node_addr) <= APP_SINKS) {
     printf("App: I am sink %02x:%02x\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
-    my_collect_open(&my_collect, COLLECT_CHANNEL, true, &sink_cb);
+    my_collect_open(&my_collect, COLLECT_CHANNEL, true, &sink_cb, &collect_config);
 #if APP_DOWNWARD_TRAFFIC == 1
-    /* Wait a bit longer at the beginning to gather enough topology information */
-    etimer_set(&periodic, 75 * CLOCK_SECOND);
-    // etimer_set(&periodic, 120 * CLOCK_SECOND);
-    while(1) {
-      PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&periodic));
-      /* Fixed interval */
-      etimer_set(&periodic, SR_MSG_PERIOD);
-      /* Random shift within the first half of the interval */
-      etimer_set(&rnd, random_rand() % (SR_MSG_PERIOD / 2));
-      PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&rnd));
+    if(!my_collect.is_sink) {
+      /* No routing table was left for this sink (SINK_TABLES): the connection
+         was opened as a node, there is nothing to source route */
+      printf("App: sink %02x:%02x opened as a node, no source routing\n",
+        linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+    } else {
+      /* Wait a bit longer at the beginning to gather enough topology information,
+         unless the sink restarted with the routing table of its checkpoint */
+      etimer_set(&periodic, my_collect.routing_table->len > 0 ? SR_WARMUP_RESTORED : SR_WARMUP);
+      // etimer_set(&periodic, 120 * CLOCK_SECOND);
+      while(1) {
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&periodic));
+        /* Fixed interval */
+        etimer_set(&periodic, SR_MSG_PERIOD);
+        /* Random shift within the first half of the interval */
+        etimer_set(&rnd, random_rand() % (SR_MSG_PERIOD / 2));
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&rnd));
 
-      /* Set application data packet */
-      packetbuf_clear();
-      memcpy(packetbuf_dataptr(), &msg, sizeof(msg));
-      packetbuf_set_datalen(sizeof(msg));
+        /* Set application data packet */
+        packetbuf_clear();
+        memcpy(packetbuf_dataptr(), &msg, sizeof(msg));
+        packetbuf_set_datalen(sizeof(msg));
 
-      /* Change the Destination Link Address to a different node */
-      dest.u8[0] = dest_low;
+        /* Change the Destination Link Address to a different node */
+        dest.u8[0] = dest_id & 0xff;
+        dest.u8[1] = dest_id >> 8;
+#if APP_SINKS > 1
+        /* Skip the nodes in the partition of another sink (unless no node is ours) */
+        for(skipped = 0; skipped < APP_NODES - APP_SINKS && !my_collect_owns(&my_collect, &dest); skipped++) {
+          dest_id = dest_id >= APP_NODES ? APP_SINKS + 1 : dest_id + 1;
+          dest.u8[0] = dest_id & 0xff;
+          dest.u8[1] = dest_id >> 8;
+        }
+#endif
 
-      /* Send the packet downwards */
-      printf("App: sink sending seqn %d to %02x:%02x\n",
-        msg.seqn, dest.u8[0], dest.u8[1]);
-      ret = sr_send(&my_collect, &dest);
-
-      /* Check that the packet could be sent */
-      if(ret == 0) {
-        printf("App: sink could not send seqn %d to %02x:%02x\n",
+        /* Send the packet downwards */
+        printf("App: sink sending seqn %d to %02x:%02x\n",
           msg.seqn, dest.u8[0], dest.u8[1]);
-      }
+        ret = sr_send(&my_collect, &dest);
 
-      /* Update sequence number and next destination address */
-      msg.seqn++;
-      dest_low++;
-      if(dest_low > APP_NODES) {
-        dest_low = 2;
+        /* Check that the packet could be sent */
+        if(ret == 0) {
+          printf("App: sink could not send seqn %d to %02x:%02x\n",
+            msg.seqn, dest.u8[0], dest.u8[1]);
+        }
+
+        /* Update sequence number and next destination address */
+        msg.seqn++;
+        dest_id++;
+        if(dest_id > APP_NODES) {
+          dest_id = APP_SINKS + 1;
+        }
       }
     }
 #endif /* APP_DOWNWARD_TRAFFIC == 1 */
   }
   else {
     printf("App: I am normal node %02x:%02x\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
-    my_collect_open(&my_collect, COLLECT_CHANNEL, false, &node_cb);
+    my_collect_open(&my_collect, COLLECT_CHANNEL, false, &node_cb, &collect_config);
 #if APP_UPWARD_TRAFFIC == 1
     etimer_set(&periodic, MSG_PERIOD);
     while(1) {
@@ -131,18 +177,23 @@ PROCESS_THREAD(app_process, ev, data)
   PROCESS_END();
 }
 /*---------------------------------------------------------------------------*/
-static void recv_cb(const linkaddr_t *originator, uint8_t hops) {
+static void recv_cb(const linkaddr_t *originator, uint8_t hops, uint16_t delay) {
   test_msg_t msg;
   if (packetbuf_datalen() != sizeof(msg)) {
     printf("App: wrong length: %d\n", packetbuf_datalen());
     return;
   }
   memcpy(&msg, packetbuf_dataptr(), sizeof(msg));
+#if LATENCY_STATS
+  printf("App: Recv from %02x:%02x seqn %u hops %u delay %lu\n",
+    originator->u8[0], originator->u8[1], msg.seqn, hops, TICKS_TO_MS(delay));
+#else
   printf("App: Recv from %02x:%02x seqn %u hops %u\n",
     originator->u8[0], originator->u8[1], msg.seqn, hops);
+#endif
 }
 /*---------------------------------------------------------------------------*/
-static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops)
+static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops, uint16_t delay)
 {
   test_msg_t sr_msg;
   if (packetbuf_datalen() != sizeof(test_msg_t)) {
@@ -150,7 +201,24 @@ static void sr_recv_cb(struct my_collect_conn *ptr, uint8_t hops)
     return;
   }
   memcpy(&sr_msg, packetbuf_dataptr(), sizeof(test_msg_t));
+#if LATENCY_STATS
+  printf("App: sr_recv from sink seqn %u hops %u node metric %u delay %lu\n",
+    sr_msg.seqn, hops, ptr->metric, TICKS_TO_MS(delay));
+  /* Delay counters of this node (averages in ms) */
+  printf("App: node delay queue mean %lu max %lu packets %u forward mean %lu records %u\n",
+    ptr->queue_packets ? TICKS_TO_MS(ptr->queue_delay / ptr->queue_packets) : 0,
+    TICKS_TO_MS(ptr->queue_delay_max), ptr->queue_packets,
+    ptr->fwd_records ? TICKS_TO_MS(ptr->fwd_delay / ptr->fwd_records) : 0, ptr->fwd_records);
+#else
   printf("App: sr_recv from sink seqn %u hops %u node metric %u\n",
     sr_msg.seqn, hops, ptr->metric);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static void energy_cb(const energy_record *report)
+{
+  printf("App: energy from %02x:%02x radio %u.%02u%% tx %u.%02u%%\n",
+    report->node.u8[0], report->node.u8[1],
+    report->radio_on / 100, report->radio_on % 100, report->tx / 100, report->tx % 100);
 }
 /*---------------------------------------------------------------------------*/
@@ -0,0 +1,411 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "my_collect.h"
+#include "event_log.h"
+#include "send_queue.h"
+#include "routing_table.h"
+#include "data_aggregation.h"
+#include "energy_report.h"
+#include "routing_checkpoint.h"
+#include "descendant_table.h"
+
+// Copy of the packet being processed: adding a record may flush the
+// aggregation buffer, which reuses the packetbuf.
+static uint8_t rx_buf[PACKETBUF_SIZE];
+
+// Energy records in the aggregation buffer, 0 without ENERGY_REPORT
+#if ENERGY_REPORT
+#define AGG_ENERGY_LEN(conn) ((conn)->agg_energy_len)
+#else
+#define AGG_ENERGY_LEN(conn) 0
+#endif
+
+/*
+   ------------ TIMER Callbacks ------------
+ */
+
+/*
+    Called when the aggregation window has ended: send all the
+    records collected so far to the parent.
+ */
+void aggregation_window_cb(void* ptr) {
+        struct my_collect_conn *conn = ptr;
+        aggregation_flush(conn);
+}
+
+/*
+   ------------ Aggregation Buffer Management ------------
+ */
+
+static uint16_t aggregation_frame_len(my_collect_conn* conn) {
+        return sizeof(packet_type_t) + sizeof(aggregated_data_packet_header) +
+               conn->agg_len + sizeof(energy_record) * AGG_ENERGY_LEN(conn) +
+               sizeof(tree_connection) * conn->agg_piggy_len;
+}
+
+/*
+    True if data_bytes of records, piggy tree_connections and energy
+    energy_records can be added to the aggregation buffer without
+    exceeding MAX_PACKET_LEN.
+ */
+static bool aggregation_fits(my_collect_conn* conn, uint16_t data_bytes, uint8_t piggy, uint8_t energy) {
+        return aggregation_frame_len(conn) + data_bytes + sizeof(tree_connection) * piggy +
+               sizeof(energy_record) * energy <= MAX_PACKET_LEN &&
+               conn->agg_piggy_len + piggy <= AGGREGATION_MAX_PIGGY &&
+               AGG_ENERGY_LEN(conn) + energy <= AGGREGATION_MAX_ENERGY;
+}
+
+// True if the aggregation buffer holds nothing to send
+static bool aggregation_empty(my_collect_conn* conn) {
+        return conn->agg_count == 0 && conn->agg_piggy_len == 0 && AGG_ENERGY_LEN(conn) == 0;
+}
+
+static int aggregation_find_piggy(my_collect_conn* conn, const linkaddr_t* node) {
+        uint8_t i;
+        for (i = 0; i < conn->agg_piggy_len; i++) {
+                if (linkaddr_cmp(&conn->agg_piggy[i].node, node)) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+// The window starts with the first record added to an empty buffer
+static void aggregation_start(my_collect_conn* conn) {
+        if (aggregation_empty(conn)) {
+                ctimer_set(&conn->agg_timer, AGGREGATION_WINDOW, aggregation_window_cb, conn);
+#if LATENCY_STATS
+                conn->agg_start = clock_time();
+                conn->agg_arrivals = 0;
+#endif
+        }
+}
+
+/*
+    Add a data record to the buffer. With LATENCY_STATS the record keeps its
+    delay minus its arrival time while it is buffered: adding the flush time
+    gives the delay including the time spent here.
+ */
+static void aggregation_add_record(my_collect_conn* conn, const linkaddr_t* source, uint8_t hops,
+                                   uint16_t delay, const uint8_t* payload, uint8_t len) {
+        aggregated_data_record rec = {.hops=hops, .len=len};
+        linkaddr_copy(&rec.source, source);
+        if (!aggregation_fits(conn, sizeof(aggregated_data_record) + len, 0, 0)) {
+                aggregation_flush(conn);
+        }
+        aggregation_start(conn);
+#if LATENCY_STATS
+        rec.delay = delay - (uint16_t)clock_time();
+        conn->agg_arrivals += (uint16_t)(clock_time() - conn->agg_start);
+#endif
+        memcpy(conn->agg_buf + conn->agg_len, &rec, sizeof(aggregated_data_record));
+        memcpy(conn->agg_buf + conn->agg_len + sizeof(aggregated_data_record), payload, len);
+        conn->agg_len += sizeof(aggregated_data_record) + len;
+        conn->agg_count++;
+}
+
+/*
+    Add a tree_connection to the buffer. A node already present is updated
+    with the newest parent instead of being added twice.
+ */
+static void aggregation_add_piggy(my_collect_conn* conn, const tree_connection* tc) {
+        int i = aggregation_find_piggy(conn, &tc->node);
+        if (i >= 0) {
+                conn->agg_piggy[i] = *tc;
+                return;
+        }
+        if (!aggregation_fits(conn, 0, 1, 0)) {
+                aggregation_flush(conn);
+        }
+        aggregation_start(conn);
+        conn->agg_piggy[conn->agg_piggy_len] = *tc;
+        conn->agg_piggy_len++;
+}
+
+/*
+    Add an energy record to the buffer. A newer record of the same node
+    replaces the buffered one.
+ */
+static void aggregation_add_energy(my_collect_conn* conn, const energy_record* rec) {
+#if ENERGY_REPORT
+        uint8_t i;
+        for (i = 0; i < conn->agg_energy_len; i++) {
+                if (linkaddr_cmp(&conn->agg_energy[i].node, &rec->node)) {
+                        conn->agg_energy[i] = *rec;
+                        return;
+                }
+        }
+        if (!aggregation_fits(conn, 0, 0, 1)) {
+                aggregation_flush(conn);
+        }
+        aggregation_start(conn);
+        conn->agg_energy[conn->agg_energy_len] = *rec;
+        conn->agg_energy_len++;
+#endif
+}
+
+#if LATENCY_STATS
+/*
+    Add ticks to the delay of the count data records starting at records.
+ */
+static void aggregation_records_add_delay(uint8_t* records, uint8_t count, uint16_t ticks) {
+        aggregated_data_record rec;
+        uint8_t i;
+        for (i = 0; i < count; i++) {
+                memcpy(&rec, records, sizeof(aggregated_data_record));
+                rec.delay += ticks;
+                memcpy(records, &rec, sizeof(aggregated_data_record));
+                records += sizeof(aggregated_data_record) + rec.len;
+        }
+}
+
+/*
+    Add ticks to the delay of every record of an aggregated data packet
+    (ptr points to its header).
+ */
+void aggregation_add_delay(uint8_t* ptr, uint16_t ticks) {
+        aggregated_data_packet_header hdr;
+        memcpy(&hdr, ptr, sizeof(aggregated_data_packet_header));
+        aggregation_records_add_delay(ptr + sizeof(aggregated_data_packet_header), hdr.count, ticks);
+}
+#endif
+
+/*
+    Send the content of the aggregation buffer to the parent in a single
+    aggregated data packet and empty the buffer. The node piggybacks its own
+    parent if the sink has not acknowledged it yet, as for normal forwarding,
+    and its pending energy record.
+    Returns 0 if nothing was queued for transmission.
+ */
+int aggregation_flush(my_collect_conn* conn) {
+        int ret = 0;
+        ctimer_stop(&conn->agg_timer);
+        if (aggregation_empty(conn)) {
+                return 0;
+        }
+#if LATENCY_STATS
+        uint16_t now = clock_time();
+        aggregation_records_add_delay(conn->agg_buf, conn->agg_count, now);
+        conn->fwd_delay += (uint32_t)conn->agg_count * (uint16_t)(now - conn->agg_start) - conn->agg_arrivals;
+        conn->fwd_records += conn->agg_count;
+#endif
+        if (linkaddr_cmp(&conn->parent, &linkaddr_null)) {
+                EVENT_LOG(EV_AGG_NO_PARENT,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], conn->agg_count);
+        } else {
+                if (piggyback_pending(conn) && aggregation_find_piggy(conn, &linkaddr_node_addr) < 0 &&
+                    aggregation_fits(conn, 0, 1, 0)) {
+                        tree_connection tc = {.node=linkaddr_node_addr, .parent=conn->parent};
+                        conn->agg_piggy[conn->agg_piggy_len] = tc;
+                        conn->agg_piggy_len++;
+                }
+                packet_type_t pt = aggregated_data_packet;
+                aggregated_data_packet_header hdr = {.count=conn->agg_count, .piggy_len=conn->agg_piggy_len};
+                uint8_t* ptr;
+#if ENERGY_REPORT
+                if (energy_report_pending(conn) && aggregation_fits(conn, 0, 0, 1)) {
+                        conn->agg_energy[conn->agg_energy_len] = conn->energy_rec;
+                        conn->agg_energy_len++;
+                        energy_report_sent(conn);
+                }
+                hdr.energy_len = conn->agg_energy_len;
+#endif
+
+                packetbuf_clear();
+                ptr = packetbuf_dataptr();
+                memcpy(ptr, &pt, sizeof(packet_type_t));
+                ptr += sizeof(packet_type_t);
+                memcpy(ptr, &hdr, sizeof(aggregated_data_packet_header));
+                ptr += sizeof(aggregated_data_packet_header);
+                memcpy(ptr, conn->agg_buf, conn->agg_len);
+                ptr += conn->agg_len;
+#if ENERGY_REPORT
+                memcpy(ptr, conn->agg_energy, sizeof(energy_record) * conn->agg_energy_len);
+                ptr += sizeof(energy_record) * conn->agg_energy_len;
+#endif
+                memcpy(ptr, conn->agg_piggy, sizeof(tree_connection) * conn->agg_piggy_len);
+                packetbuf_set_datalen(aggregation_frame_len(conn));
+
+                EVENT_LOG(EV_AGG_SEND,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], conn->agg_count);
+                ret = send_queue_add(conn, NULL);
+        }
+        conn->agg_len = 0;
+        conn->agg_count = 0;
+        conn->agg_piggy_len = 0;
+#if ENERGY_REPORT
+        conn->agg_energy_len = 0;
+#endif
+        return ret;
+}
+
+/*
+   ------------ Upward Data Aggregation ------------
+ */
+
+/*
+    Called by a forwarding node for a (length checked) upward data packet.
+    The payload, the energy record and the piggybacked blocks are moved to
+    the aggregation buffer.
+    Returns 0 if the packet does not fit an aggregated packet and has to be
+    forwarded as it is.
+ */
+int aggregate_upward_data(my_collect_conn* conn) {
+        upward_data_packet_header hdr;
+        linkaddr_t source;
+        tree_connection tc;
+        energy_record er;
+        uint8_t i;
+        uint16_t len = packetbuf_datalen();
+
+        memcpy(&hdr, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), sizeof(upward_data_packet_header));
+        uint16_t piggy_bytes = sizeof(tree_connection) * hdr.piggy_len;
+        uint16_t energy_bytes = sizeof(energy_record) * PACKET_ENERGY_LEN(hdr);
+        uint16_t payload_len = len - sizeof(packet_type_t) - sizeof(upward_data_packet_header) - piggy_bytes - energy_bytes;
+        if (sizeof(packet_type_t) + sizeof(aggregated_data_packet_header) + sizeof(aggregated_data_record) +
+            payload_len + energy_bytes + piggy_bytes > MAX_PACKET_LEN || hdr.piggy_len > AGGREGATION_MAX_PIGGY ||
+            PACKET_ENERGY_LEN(hdr) > AGGREGATION_MAX_ENERGY) {
+                return 0;
+        }
+        packetbuf_copyto(rx_buf);
+        linkaddr_copy(&source, &hdr.source);
+        aggregation_add_record(conn, &source, hdr.hops+1, PACKET_DELAY(hdr),
+                               rx_buf + sizeof(packet_type_t) + sizeof(upward_data_packet_header), payload_len);
+        for (i = 0; i < hdr.piggy_len; i++) {
+                memcpy(&tc, rx_buf + len - piggy_bytes + sizeof(tree_connection) * i, sizeof(tree_connection));
+                aggregation_add_piggy(conn, &tc);
+        }
+        for (i = 0; i < PACKET_ENERGY_LEN(hdr); i++) {
+                memcpy(&er, rx_buf + len - piggy_bytes - energy_bytes + sizeof(energy_record) * i, sizeof(energy_record));
+                aggregation_add_energy(conn, &er);
+        }
+        return 1;
+}
+
+/*
+    Called by a forwarding node for a (length checked) energy report while
+    its send queue is busy: the energy records are moved to the aggregation
+    buffer, to leave in one frame with the other records of the window.
+    Returns 0 if the report has to be forwarded as it is.
+ */
+int aggregate_energy_report(my_collect_conn* conn) {
+#if ENERGY_REPORT
+        energy_record er;
+        uint8_t len;
+        uint8_t i;
+
+        memcpy(&len, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), sizeof(uint8_t));
+        if (len > AGGREGATION_MAX_ENERGY) {
+                return 0;
+        }
+        packetbuf_copyto(rx_buf);
+        for (i = 0; i < len; i++) {
+                memcpy(&er, rx_buf + sizeof(packet_type_t) + sizeof(uint8_t) + sizeof(energy_record) * i,
+                       sizeof(energy_record));
+                aggregation_add_energy(conn, &er);
+        }
+        return 1;
+#else
+        return 0;
+#endif
+}
+
+/*
+    Called by my_collect_send while records are waiting in the aggregation
+    buffer: the application packet joins them (the caller then flushes the
+    buffer). Returns false if the packet can not be aggregated.
+ */
+bool aggregate_own_data(my_collect_conn* conn) {
+        uint16_t len = packetbuf_datalen();
+        if (sizeof(packet_type_t) + sizeof(aggregated_data_packet_header) + sizeof(aggregated_data_record) +
+            len > MAX_PACKET_LEN) {
+                return false;
+        }
+        packetbuf_copyto(rx_buf);
+        aggregation_add_record(conn, &linkaddr_node_addr, 0, 0, rx_buf, len);
+        return true;
+}
+
+/*
+    Aggregated data packet received.
+
+        - Sink: updates the routing table with the piggybacked blocks, delivers
+        the energy records, then calls the application callback once per data record.
+        - Node: moves every record (piggybacked blocks and energy records included)
+        to its own aggregation buffer, to be sent with the other records of the window.
+        The sources and the piggybacked nodes are descendants below the sender.
+ */
+void forward_aggregated_data(my_collect_conn* conn, const linkaddr_t* sender) {
+        aggregated_data_packet_header hdr;
+        aggregated_data_record rec;
+        tree_connection tc;
+        energy_record er;
+        linkaddr_t source;
+        uint16_t len = packetbuf_datalen();
+        uint16_t offset;
+        uint8_t i;
+
+        packetbuf_copyto(rx_buf);
+        if (len < sizeof(packet_type_t) + sizeof(aggregated_data_packet_header)) {
+                EVENT_LOG(EV_AGG_TOO_SHORT, len);
+                return;
+        }
+        memcpy(&hdr, rx_buf + sizeof(packet_type_t), sizeof(aggregated_data_packet_header));
+        if (len < sizeof(packet_type_t) + sizeof(aggregated_data_packet_header) + sizeof(tree_connection) * hdr.piggy_len) {
+                EVENT_LOG(EV_AGG_PIGGY_TOO_SHORT, hdr.piggy_len, len);
+                return;
+        }
+        uint16_t energy_bytes = sizeof(energy_record) * PACKET_ENERGY_LEN(hdr);
+        if (len < sizeof(packet_type_t) + sizeof(aggregated_data_packet_header) + sizeof(tree_connection) * hdr.piggy_len +
+            energy_bytes) {
+                EVENT_LOG(EV_ENERGY_TOO_SHORT, PACKET_ENERGY_LEN(hdr), len);
+                return;
+        }
+        uint16_t records_end = len - sizeof(tree_connection) * hdr.piggy_len - energy_bytes;
+        // check that all the records are in the packet before using any of them
+        offset = sizeof(packet_type_t) + sizeof(aggregated_data_packet_header);
+        for (i = 0; i < hdr.count && offset + sizeof(aggregated_data_record) <= records_end; i++) {
+                memcpy(&rec, rx_buf + offset, sizeof(aggregated_data_record));
+                offset += sizeof(aggregated_data_record) + rec.len;
+        }
+        if (i < hdr.count || offset != records_end) {
+                EVENT_LOG(EV_AGG_MALFORMED, hdr.count, len);
+                return;
+        }
+
+        for (i = 0; i < hdr.piggy_len; i++) {
+                memcpy(&tc, rx_buf + records_end + energy_bytes + sizeof(tree_connection) * i, sizeof(tree_connection));
+                topology_ack_record(conn, sender, &tc);
+                if (conn->is_sink == 1) {
+                        dict_add(conn->routing_table, tc.node, tc.parent);
+                } else {
+                        descendant_learn(conn, &tc.node, sender);
+                        aggregation_add_piggy(conn, &tc);
+                }
+        }
+        for (i = 0; i < PACKET_ENERGY_LEN(hdr); i++) {
+                memcpy(&er, rx_buf + records_end + sizeof(energy_record) * i, sizeof(energy_record));
+                if (conn->is_sink == 1) {
+                        deliver_energy_record(conn, &er);
+                } else {
+                        aggregation_add_energy(conn, &er);
+                }
+        }
+        offset = sizeof(packet_type_t) + sizeof(aggregated_data_packet_header);
+        for (i = 0; i < hdr.count; i++) {
+                memcpy(&rec, rx_buf + offset, sizeof(aggregated_data_record));
+                linkaddr_copy(&source, &rec.source);
+                offset += sizeof(aggregated_data_record);
+                if (conn->is_sink == 1) {
+                        routing_checkpoint_check(conn, &source, rec.hops +1);
+                        // hand each record to the application as a normal data packet
+                        packetbuf_clear();
+                        packetbuf_copyfrom(rx_buf + offset, rec.len);
+                        conn->callbacks->recv(&source, rec.hops +1, PACKET_DELAY(rec));
+                } else {
+                        descendant_learn(conn, &source, sender);
+                        aggregation_add_record(conn, &source, rec.hops+1, PACKET_DELAY(rec), rx_buf + offset, rec.len);
+                }
+                offset += rec.len;
+        }
+}
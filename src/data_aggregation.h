@@ -0,0 +1,15 @@
+#ifndef DATA_AGGREGATION_H
+#define DATA_AGGREGATION_H
+
+void aggregation_window_cb(void*);
+
+int  aggregation_flush(my_collect_conn*);
+int  aggregate_upward_data(my_collect_conn*);
+int  aggregate_energy_report(my_collect_conn*);
+bool aggregate_own_data(my_collect_conn*);
+void forward_aggregated_data(my_collect_conn*, const linkaddr_t*);
+#if LATENCY_STATS
+void aggregation_add_delay(uint8_t*, uint16_t);
+#endif
+
+#endif // DATA_AGGREGATION_H
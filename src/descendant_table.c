@@ -0,0 +1,189 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "my_collect.h"
+#include "event_log.h"
+#include "send_queue.h"
+#include "routing_table.h"
+#include "loose_routing.h"
+#include "descendant_table.h"
+
+/*
+    Storing mode downward routing: a forwarder learns the descendants whose
+    upward data it relays (the source and the piggybacked nodes of a data
+    packet, the records of an aggregated one), and the child each one came
+    from. It also learns the destination of the source routed packets it
+    forwards, below the next hop. The table is small and kept in LRU order.
+    A new node takes the place of the least recently used entry that no
+    downward packet used: the traffic of the whole subtree does not wash the
+    common destinations out, and a node keeps the descendants it relayed
+    last, which its ancestors may have just pointed at it.
+    After a source routed packet to a destination, whose path the hops
+    learned, the sink sends the next ones with only the destination
+    (SR_PATH_STORING) to the first hop of the route, and every hop sends them
+    on to the child its entry names. Where the entry is missing, the node
+    becomes the waypoint of a loose source route (see loose_routing.c): the
+    rest of the route comes from the sink, and the sink source routes the
+    next packet to the destination again.
+ */
+
+#if DESCENDANT_TABLE_SIZE > 0
+// Position of node in the table, descendants_len if absent
+static uint8_t descendant_index(my_collect_conn* conn, const linkaddr_t* node) {
+        uint8_t i;
+        for (i = 0; i < conn->descendants_len; i++) {
+                if (linkaddr_cmp(&conn->descendants[i].node, node)) {
+                        break;
+                }
+        }
+        return i;
+}
+
+/*
+    Node is below child: its entry moves to the front. A new node takes a
+    free entry, or the place of the least recently used one among the entries
+    no downward packet used. If there is none, a downward destination (used)
+    takes the place of the least recently used entry, an upward node is not
+    added.
+ */
+static void descendant_add(my_collect_conn* conn, const linkaddr_t* node, const linkaddr_t* child, bool used) {
+        uint8_t i = descendant_index(conn, node);
+        if (i < conn->descendants_len) {
+                used = used || conn->descendants[i].used;
+        } else if (conn->descendants_len < DESCENDANT_TABLE_SIZE) {
+                conn->descendants_len++;
+        } else {
+                // the least recently used entry no downward packet used
+                i = conn->descendants_len;
+                while (i > 0 && conn->descendants[i - 1].used) {
+                        i--;
+                }
+                if (i > 0) {
+                        i--;
+                } else if (used) {
+                        i = conn->descendants_len - 1;
+                } else {
+                        return; // every entry is a downward destination
+                }
+        }
+        memmove(&conn->descendants[1], &conn->descendants[0], sizeof(Descendant) * i);
+        linkaddr_copy(&conn->descendants[0].node, node);
+        linkaddr_copy(&conn->descendants[0].child, child);
+        conn->descendants[0].used = used;
+}
+#endif
+
+void descendant_table_init(my_collect_conn* conn) {
+#if DESCENDANT_TABLE_SIZE > 0
+        conn->descendants_len = 0;
+#endif
+}
+
+/*
+    Upward traffic of node received from child: node is below child.
+ */
+void descendant_learn(my_collect_conn* conn, const linkaddr_t* node, const linkaddr_t* child) {
+#if DESCENDANT_TABLE_SIZE > 0
+        if (!linkaddr_cmp(node, &linkaddr_node_addr)) {
+                descendant_add(conn, node, child, false);
+        }
+#endif
+}
+
+/*
+    Source routed packet forwarded to child (the packetbuf holds the rest of
+    the path, hdr its header): its destination is below child. That is the
+    end of the path, or the address stored before a loose one (its end is a
+    waypoint). A segment ends at the waypoint that asked for it, which learns
+    the destination when it sends the held packet on.
+ */
+void descendant_learn_path(my_collect_conn* conn, const downward_data_packet_header* hdr, const linkaddr_t* child) {
+#if DESCENDANT_TABLE_SIZE > 0
+        uint8_t* path = (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - sr_path_hop_size(hdr->path_fmt) * hdr->path_len;
+        linkaddr_t node;
+
+        if ((hdr->path_fmt & SR_PATH_SEGMENT) || linkaddr_cmp(child, &conn->parent)) {
+                return; // a segment from a waypoint off the route may also go up first
+        }
+        if (hdr->path_fmt & SR_PATH_LOOSE) {
+                memcpy(&node, path - sizeof(linkaddr_t), sizeof(linkaddr_t));
+        } else {
+                sr_path_read(hdr, path, &node);
+        }
+        descendant_add(conn, &node, child, true);
+#endif
+}
+
+/*
+    Sink: true if the packet for dest, whose source route is planned in hdr
+    (see sr_path_plan), goes in storing mode. The destination must take
+    STORING_MODE_MIN_SAVING header bytes less than the path (the bytes of the
+    loose destination included), and a source routed packet must have taught
+    the route to the hops in this tree round, with no miss since.
+ */
+bool storing_mode_route(my_collect_conn* conn, const linkaddr_t* dest, const downward_data_packet_header* hdr) {
+#if DESCENDANT_TABLE_SIZE > 0
+        uint16_t path_bytes = sr_path_hop_size(hdr->path_fmt) * hdr->path_len;
+        if (!conn->config.storing_mode) {
+                return false;
+        }
+        if (hdr->path_fmt & SR_PATH_LOOSE) {
+                path_bytes += sizeof(linkaddr_t);
+        }
+        return path_bytes >= sizeof(linkaddr_t) + STORING_MODE_MIN_SAVING && dict_storing(conn->routing_table, *dest);
+#else
+        return false;
+#endif
+}
+
+/*
+    Storing mode packet received: delivered if this node is the destination
+    (the last address of the packet), else sent to the child the destination
+    was heard from. A node that does not know the destination ends the hop by
+    hop route: it becomes a waypoint and asks the sink for the rest of the
+    route. So does a node whose entry leads back to the sender or to its
+    parent (the entry is dropped), or a packet that went around a loop of
+    stale entries until its hop count ran out.
+ */
+void forward_storing_data(my_collect_conn* conn, const linkaddr_t* sender) {
+#if DESCENDANT_TABLE_SIZE > 0
+        downward_data_packet_header hdr;
+        linkaddr_t dest, child;
+        uint8_t i;
+
+        if (packetbuf_datalen() < sizeof(packet_type_t) + sizeof(downward_data_packet_header) + sizeof(linkaddr_t)) {
+                EVENT_LOG(EV_SR_MALFORMED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                return;
+        }
+        memcpy(&hdr, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), sizeof(downward_data_packet_header));
+        memcpy(&dest, (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - sizeof(linkaddr_t), sizeof(linkaddr_t));
+        if (linkaddr_cmp(&dest, &linkaddr_node_addr)) {
+                EVENT_LOG(EV_SR_DELIVERED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                packetbuf_set_datalen(packetbuf_datalen() - sizeof(linkaddr_t));
+                packetbuf_hdrreduce(sizeof(packet_type_t) + sizeof(downward_data_packet_header));
+                conn->callbacks->sr_recv(conn, hdr.hops +1, PACKET_DELAY(hdr));
+                return;
+        }
+        i = descendant_index(conn, &dest);
+        if (i < conn->descendants_len) {
+                linkaddr_copy(&child, &conn->descendants[i].child);
+                if (linkaddr_cmp(&child, sender) || linkaddr_cmp(&child, &conn->parent)) {
+                        // stale: the tree turned since, the destination is not below child
+                        conn->descendants_len--;
+                        memmove(&conn->descendants[i], &conn->descendants[i + 1],
+                                sizeof(Descendant) * (conn->descendants_len - i));
+                        i = conn->descendants_len;
+                } else {
+                        descendant_add(conn, &dest, &child, true);
+                }
+        }
+        if (i == conn->descendants_len || hdr.hops == UINT8_MAX) {
+                EVENT_LOG(EV_STORING_MISS, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+                          dest.u8[0], dest.u8[1]);
+                loose_routing_hold(conn);
+                return;
+        }
+        hdr.hops = hdr.hops + 1;
+        memcpy((uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), &hdr, sizeof(downward_data_packet_header));
+        send_queue_add(conn, &child);
+#endif
+}
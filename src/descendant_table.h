@@ -0,0 +1,10 @@
+#ifndef DESCENDANT_TABLE_H
+#define DESCENDANT_TABLE_H
+
+void descendant_table_init(my_collect_conn*);
+void descendant_learn(my_collect_conn*, const linkaddr_t*, const linkaddr_t*);
+void descendant_learn_path(my_collect_conn*, const downward_data_packet_header*, const linkaddr_t*);
+bool storing_mode_route(my_collect_conn*, const linkaddr_t*, const downward_data_packet_header*);
+void forward_storing_data(my_collect_conn*, const linkaddr_t*);
+
+#endif // DESCENDANT_TABLE_H
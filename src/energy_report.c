@@ -0,0 +1,176 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "sys/energest.h"
+#include "my_collect.h"
+#include "event_log.h"
+#include "send_queue.h"
+#include "data_aggregation.h"
+#include "energy_report.h"
+
+#if ENERGY_REPORT
+static const uint8_t energest_types[ENERGY_SAMPLES] = {
+        ENERGEST_TYPE_CPU, ENERGEST_TYPE_LPM, ENERGEST_TYPE_TRANSMIT, ENERGEST_TYPE_LISTEN
+};
+
+static void energy_read(unsigned long* times) {
+        uint8_t i;
+        energest_flush();
+        for (i = 0; i < ENERGY_SAMPLES; i++) {
+                times[i] = energest_type_time(energest_types[i]);
+        }
+}
+
+// part / total in 1/10000, without 64 bit arithmetic (part <= total)
+static uint16_t energy_ratio(unsigned long part, unsigned long total) {
+        while (total > 0x3ffffUL) {
+                total >>= 1;
+                part >>= 1;
+        }
+        return total == 0 ? 0 : (uint16_t)(part * 10000UL / total);
+}
+#endif
+
+/*
+   ------------ TIMER Callbacks ------------
+ */
+
+void energy_report_init(my_collect_conn* conn) {
+#if ENERGY_REPORT
+        energy_read(conn->energy_last);
+        conn->energy_pending = 0;
+        ctimer_set(&conn->energy_timer, ENERGY_REPORT_INTERVAL, energy_report_timer_cb, conn);
+#endif
+}
+
+/*
+    Every ENERGY_REPORT_INTERVAL: compute the radio duty cycle since the last
+    report from the energest times (CPU + LPM is the elapsed time). The sink
+    hands its own record to the application, a node keeps it to be
+    piggybacked for at most ENERGY_REPORT_HOLD_TIME.
+ */
+void energy_report_timer_cb(void* ptr) {
+#if ENERGY_REPORT
+        struct my_collect_conn *conn = ptr;
+        unsigned long now[ENERGY_SAMPLES];
+        unsigned long cpu, lpm, tx, listen;
+
+        ctimer_set(&conn->energy_timer, ENERGY_REPORT_INTERVAL, energy_report_timer_cb, conn);
+        energy_read(now);
+        cpu = now[0] - conn->energy_last[0];
+        lpm = now[1] - conn->energy_last[1];
+        tx = now[2] - conn->energy_last[2];
+        listen = now[3] - conn->energy_last[3];
+        memcpy(conn->energy_last, now, sizeof(now));
+
+        energy_record rec = {.node=linkaddr_node_addr,
+                             .radio_on=energy_ratio(tx + listen, cpu + lpm),
+                             .tx=energy_ratio(tx, cpu + lpm)};
+        if (conn->is_sink) {
+                deliver_energy_record(conn, &rec);
+                return;
+        }
+        // a record never sent is replaced by the newest one
+        conn->energy_rec = rec;
+        conn->energy_pending = 1;
+        ctimer_set(&conn->energy_hold_timer, ENERGY_REPORT_HOLD_TIME, energy_report_hold_cb, conn);
+#endif
+}
+
+/*
+    No packet to piggyback the energy record on within ENERGY_REPORT_HOLD_TIME:
+    send it in a dedicated energy report. While more than half of the send
+    queue is taken the report waits another ENERGY_REPORT_HOLD_TIME, still
+    pending for piggybacking (the next record replaces it): a busy node has
+    data to carry it, and a full queue would drop the data instead.
+ */
+void energy_report_hold_cb(void* ptr) {
+#if ENERGY_REPORT
+        struct my_collect_conn *conn = ptr;
+        packet_type_t pt = energy_report;
+        uint8_t len = 1;
+
+        if (!conn->energy_pending || linkaddr_cmp(&conn->parent, &linkaddr_null)) {
+                return;
+        }
+        if (send_queue_len(conn) > SEND_QUEUE_SIZE / 2) {
+                EVENT_LOG(EV_ENERGY_DEFERRED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], send_queue_len(conn));
+                ctimer_set(&conn->energy_hold_timer, ENERGY_REPORT_HOLD_TIME, energy_report_hold_cb, conn);
+                return;
+        }
+        EVENT_LOG(EV_ENERGY_SEND, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+        packetbuf_clear();
+        packetbuf_set_datalen(sizeof(energy_record));
+        memcpy(packetbuf_dataptr(), &conn->energy_rec, sizeof(energy_record));
+        packetbuf_hdralloc(sizeof(packet_type_t) + sizeof(uint8_t));
+        memcpy(packetbuf_hdrptr(), &pt, sizeof(packet_type_t));
+        memcpy(packetbuf_hdrptr() + sizeof(packet_type_t), &len, sizeof(uint8_t));
+        energy_report_sent(conn);
+        send_queue_add(conn, NULL);
+#endif
+}
+
+/*
+   ------------ Energy Report Management ------------
+ */
+
+// True if the node has an energy record to piggyback (conn->energy_rec)
+bool energy_report_pending(my_collect_conn* conn) {
+#if ENERGY_REPORT
+        return conn->energy_pending == 1;
+#else
+        return false;
+#endif
+}
+
+// The pending energy record has been added to a packet
+void energy_report_sent(my_collect_conn* conn) {
+#if ENERGY_REPORT
+        conn->energy_pending = 0;
+        ctimer_stop(&conn->energy_hold_timer);
+#endif
+}
+
+// Sink: hand an energy record to the application
+void deliver_energy_record(my_collect_conn* conn, const energy_record* rec) {
+        EVENT_LOG(EV_ENERGY_RECV, rec->node.u8[0], rec->node.u8[1], rec->radio_on, rec->tx);
+        if (conn->callbacks->energy_recv != NULL) {
+                conn->callbacks->energy_recv(rec);
+        }
+}
+
+/*
+    Energy report received. The sink delivers every record, a node forwards
+    the report to its parent, appending its own pending record if any. While
+    more than half of the send queue is taken the records join the
+    aggregation buffer instead, so that a burst of reports takes one frame.
+ */
+void forward_energy_report(my_collect_conn* conn) {
+        energy_record rec;
+        uint8_t len;
+        uint8_t i;
+
+        memcpy(&len, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), sizeof(uint8_t));
+        if (packetbuf_datalen() != sizeof(packet_type_t) + sizeof(uint8_t) + sizeof(energy_record) * len) {
+                EVENT_LOG(EV_ENERGY_MALFORMED, len, packetbuf_datalen());
+                return;
+        }
+        if (conn->is_sink) {
+                for (i = 0; i < len; i++) {
+                        memcpy(&rec, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t) + sizeof(uint8_t) +
+                               sizeof(energy_record) * i, sizeof(energy_record));
+                        deliver_energy_record(conn, &rec);
+                }
+                return;
+        }
+        if (AGGREGATION_WINDOW > 0 && send_queue_len(conn) > SEND_QUEUE_SIZE / 2 && aggregate_energy_report(conn)) {
+                return;
+        }
+#if ENERGY_REPORT
+        if (conn->energy_pending && packet_append(&conn->energy_rec, sizeof(energy_record))) {
+                len = len + 1;
+                memcpy((uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), &len, sizeof(uint8_t));
+                energy_report_sent(conn);
+        }
+#endif
+        send_queue_add(conn, NULL);
+}
@@ -0,0 +1,13 @@
+#ifndef ENERGY_REPORT_H
+#define ENERGY_REPORT_H
+
+void energy_report_init(my_collect_conn*);
+void energy_report_timer_cb(void*);
+void energy_report_hold_cb(void*);
+
+bool energy_report_pending(my_collect_conn*);
+void energy_report_sent(my_collect_conn*);
+void deliver_energy_record(my_collect_conn*, const energy_record*);
+void forward_energy_report(my_collect_conn*);
+
+#endif // ENERGY_REPORT_H
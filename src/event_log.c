@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include "my_collect.h"
+#include "event_log.h"
+
+const char* const event_log_formats[] = {
+#define EVENT(id, level, fmt) fmt,
+#include "log_events.h"
+#undef EVENT
+};
+
+#if LOG_BINARY
+static event_record ring[LOG_RING_SIZE];
+static uint8_t ring_head; // oldest record
+static uint8_t ring_len;
+static uint16_t ring_lost; // records overwritten since the last dump
+static struct ctimer dump_timer;
+
+static void dump_timer_cb(void* ptr) {
+        event_log_dump();
+}
+
+/*
+    Store an event in the ring. When the ring is full the oldest record
+    is overwritten and counted as lost in the next dump.
+    The first record after a dump schedules the next one.
+ */
+void event_log_record(uint8_t event, const int16_t* args, uint8_t argc) {
+        event_record* r;
+        uint8_t i;
+
+        if (ring_len == LOG_RING_SIZE) {
+                ring_head = (ring_head + 1) % LOG_RING_SIZE;
+                ring_len--;
+                ring_lost++;
+        }
+        r = &ring[(ring_head + ring_len) % LOG_RING_SIZE];
+        ring_len++;
+        if (argc > LOG_MAX_ARGS) {
+                argc = LOG_MAX_ARGS;
+        }
+        r->time = (uint16_t)clock_time();
+        r->event = event;
+        r->argc = argc;
+        for (i = 0; i < argc; i++) {
+                r->args[i] = args[i];
+        }
+        if (ctimer_expired(&dump_timer)) {
+                ctimer_set(&dump_timer, LOG_DUMP_INTERVAL, dump_timer_cb, NULL);
+        }
+}
+
+/*
+    Print the records in the ring and empty it. Each line is
+        EVL:<clock_time() of the dump>:<lost records>:<records>
+    with clock and lost count in hex and the records as hex bytes, LOG_DUMP_RECORDS_PER_LINE
+    records per line. sim/analyze/decode-events turns these lines back into text.
+ */
+void event_log_dump(void) {
+        static const char hex[] = "0123456789abcdef";
+        char line[2 * sizeof(event_record) + 1];
+        uint16_t now = (uint16_t)clock_time();
+        uint8_t n = 0;
+        uint8_t i;
+
+        ctimer_stop(&dump_timer);
+        while (ring_len > 0) {
+                const uint8_t* b = (const uint8_t*)&ring[ring_head];
+                uint8_t len = EVENT_RECORD_HEADER_LEN + 2 * ring[ring_head].argc;
+
+                if (n == 0) {
+                        printf("EVL:%04x:%x:", now, ring_lost);
+                        ring_lost = 0;
+                }
+                for (i = 0; i < len; i++) {
+                        line[2 * i] = hex[b[i] >> 4];
+                        line[2 * i + 1] = hex[b[i] & 0x0f];
+                }
+                line[2 * len] = '\0';
+                printf("%s", line);
+                ring_head = (ring_head + 1) % LOG_RING_SIZE;
+                ring_len--;
+                if (++n == LOG_DUMP_RECORDS_PER_LINE || ring_len == 0) {
+                        printf("\n");
+                        n = 0;
+                }
+        }
+}
+#endif
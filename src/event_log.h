@@ -0,0 +1,68 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DBG 3
+
+// Most arguments of an event (the rest are not recorded in binary mode)
+#define LOG_MAX_ARGS 5
+// Records per EVL line of a dump
+#define LOG_DUMP_RECORDS_PER_LINE 16
+
+enum event_id {
+#define EVENT(id, level, fmt) id,
+#include "log_events.h"
+#undef EVENT
+        EV_COUNT
+};
+
+enum event_level {
+#define EVENT(id, level, fmt) id##_LEVEL = level,
+#include "log_events.h"
+#undef EVENT
+};
+
+/*
+    Binary event record, as kept in the ring. A dump sends the first
+    4 + 2*argc bytes of each record, in the byte order of the node.
+ */
+struct event_record {
+        uint16_t time; // clock_time() when the event was logged
+        uint8_t event;
+        uint8_t argc;
+        int16_t args[LOG_MAX_ARGS];
+} __attribute__((packed));
+typedef struct event_record event_record;
+
+#define EVENT_RECORD_HEADER_LEN 4
+
+extern const char* const event_log_formats[];
+
+void event_log_record(uint8_t, const int16_t*, uint8_t);
+void event_log_dump(void);
+
+// Dumps of whole tables (routing table, neighbor table) are only printed in text debug builds
+#define LOG_DUMPS (LOG_LEVEL >= LOG_LEVEL_DBG && !LOG_BINARY)
+
+/*
+    Log an event of log_events.h. The level of the event is a constant,
+    so events above LOG_LEVEL are removed by the compiler.
+ */
+#if LOG_BINARY
+#define EVENT_LOG(id, ...) do { \
+                if (id##_LEVEL <= LOG_LEVEL) { \
+                        const int16_t event_args[] = {0, ##__VA_ARGS__}; \
+                        event_log_record(id, event_args + 1, sizeof(event_args) / sizeof(int16_t) - 1); \
+                } \
+} while (0)
+#else
+#define EVENT_LOG(id, ...) do { \
+                if (id##_LEVEL <= LOG_LEVEL) { \
+                        printf(event_log_formats[id], ##__VA_ARGS__); \
+                } \
+} while (0)
+#endif
+
+#endif // EVENT_LOG_H
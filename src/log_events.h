@@ -0,0 +1,124 @@
+/*
+    Log events of the protocol: EVENT(id, level, format).
+
+    This list is included with different definitions of EVENT: by event_log.h
+    for the event ids and their levels, by event_log.c for the text formats,
+    and by the host decoder (sim/analyze/decode-events.c), which turns the
+    binary records back into these lines.
+    Arguments are 16 bit integers: conversions %d print them signed, the
+    others unsigned. The formats are not literals at the EVENT_LOG calls, so
+    the compiler does not check them: cast wider arguments (clock_time_t,
+    unsigned long) to (unsigned). Add new events at the end, the position is
+    the id.
+ */
+
+// Beacons and parent selection (my_collect.c)
+EVENT(EV_BEACON_SUPPRESSED, LOG_LEVEL_DBG, "my_collect: beacon suppressed (%d consistent beacons heard)\n")
+EVENT(EV_BEACON_SEND, LOG_LEVEL_DBG, "my_collect: sending beacon: seqn %d metric %d\n")
+EVENT(EV_NEW_PARENT, LOG_LEVEL_INFO, "my_collect: new parent %02x:%02x (old %02x:%02x) metric %u\n")
+EVENT(EV_PARENT_UNREACHABLE, LOG_LEVEL_ERR, "my_collect: parent %02x:%02x unreachable, no backup parent\n")
+EVENT(EV_PARENT_FAILOVER, LOG_LEVEL_INFO, "my_collect: parent %02x:%02x unreachable, failover to %02x:%02x\n")
+EVENT(EV_BEACON_WRONG_SIZE, LOG_LEVEL_ERR, "my_collect: broadcast of wrong size (not a beacon)\n")
+EVENT(EV_BEACON_RECV, LOG_LEVEL_DBG, "my_collect: recv beacon from %02x:%02x seqn %u metric %u rssi %d\n")
+EVENT(EV_BEACON_LOW_RSSI, LOG_LEVEL_DBG, "packet rejected due to low rssi\n")
+EVENT(EV_NEIGHBOR_TABLE_FULL, LOG_LEVEL_ERR, "my_collect: neighbor table full, beacon from %02x:%02x ignored\n")
+
+// Unicast receive (my_collect.c)
+EVENT(EV_UC_RECV, LOG_LEVEL_DBG, "Node %02x:%02x received unicast packet with type %d\n")
+EVENT(EV_UC_RECV_DATA, LOG_LEVEL_DBG, "Node %02x:%02x receivd a unicast data packet\n")
+EVENT(EV_UC_RECV_AGGREGATED, LOG_LEVEL_DBG, "Node %02x:%02x receivd an aggregated data packet\n")
+EVENT(EV_UC_RECV_TREPORT, LOG_LEVEL_DBG, "Node %02x:%02x receivd a unicast topology report\n")
+EVENT(EV_UC_RECV_SR, LOG_LEVEL_DBG, "Node %02x:%02x receivd a unicast source routing packet\n")
+EVENT(EV_UC_UNKNOWN_TYPE, LOG_LEVEL_ERR, "Packet type not recognized.\n")
+EVENT(EV_TREPORT_DISABLED, LOG_LEVEL_ERR, "ERROR: Received a topoloy report with topology reports disabled. Node: %02x:%02x\n")
+
+// Upward data and piggybacking (my_collect.c)
+EVENT(EV_PIGGY_CHECK, LOG_LEVEL_DBG, "Checking piggy address: %02x:%02x\n")
+EVENT(EV_PIGGY_LOOP, LOG_LEVEL_ERR, "ERROR: Checking piggy address found: %02x:%02x\n")
+EVENT(EV_PIGGY_TOO_SHORT, LOG_LEVEL_ERR, "ERROR: Piggy len=%d, too short data packet %d\n")
+EVENT(EV_PIGGY_ADD, LOG_LEVEL_DBG, "Adding tree_connection to piggyinfo: key %02x:%02x value: %02x:%02x\n")
+
+// Source routing (my_collect.c)
+EVENT(EV_SR_PATH_TOO_BIG, LOG_LEVEL_ERR, "PATH ERROR: Path of %d hops does not fit in the header for destination node: %02x:%02x\n")
+EVENT(EV_SR_PACKET_TOO_LONG, LOG_LEVEL_ERR, "PATH ERROR: Packet too long for destination node: %02x:%02x\n")
+EVENT(EV_SR_MALFORMED, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x received malformed sr message\n")
+EVENT(EV_SR_DELIVERED, LOG_LEVEL_INFO, "PATH COMPLETE: Node %02x:%02x delivers packet from sink\n")
+EVENT(EV_SR_WRONG_NODE, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x received sr message. Was meant for node %02x:%02x\n")
+
+// Routing table (routing_table.c)
+EVENT(EV_DICT_ADD, LOG_LEVEL_DBG, "Dictionary add: key: %02x:%02x value: %02x:%02x\n")
+EVENT(EV_DICT_FULL, LOG_LEVEL_ERR, "Dictionary is full. MAX_NODES cap reached. Proposed key: %02x:%02x value: %02x:%02x\n")
+EVENT(EV_ROUTE_LOOP, LOG_LEVEL_ERR, "PATH ERROR: cannot build path for destination node: %02x:%02x. Loop detected.\n")
+EVENT(EV_ROUTE_TOO_LONG, LOG_LEVEL_ERR, "PATH ERROR: Path too long for destination node: %02x:%02x\n")
+
+// Topology reports (topology_report.c)
+EVENT(EV_TREPORT_CHECK, LOG_LEVEL_DBG, "Checking topology report address: %02x:%02x\n")
+EVENT(EV_TREPORT_LOOP, LOG_LEVEL_ERR, "ERROR: Checking topology report address found: %02x:%02x\n")
+EVENT(EV_TREPORT_APPEND, LOG_LEVEL_DBG, "Appending topology report info for node: %02x:%02x\n")
+EVENT(EV_TREPORT_SEND, LOG_LEVEL_INFO, "Node %02x:%02x sending a topology report (%d records)\n")
+EVENT(EV_TREPORT_TOO_SHORT, LOG_LEVEL_ERR, "ERROR: too short topology report %d\n")
+EVENT(EV_TREPORT_RECV, LOG_LEVEL_DBG, "Sink: received %d topology reports.\n")
+EVENT(EV_TREPORT_UPDATE, LOG_LEVEL_DBG, "Sink: received topology report. Updating parent of node %02x:%02x\n")
+
+// Aggregation (data_aggregation.c)
+EVENT(EV_AGG_NO_PARENT, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x dropping %d aggregated records (no parent)\n")
+EVENT(EV_AGG_SEND, LOG_LEVEL_DBG, "Node %02x:%02x sending %d aggregated data records\n")
+EVENT(EV_AGG_TOO_SHORT, LOG_LEVEL_ERR, "ERROR: too short aggregated data packet %d\n")
+EVENT(EV_AGG_PIGGY_TOO_SHORT, LOG_LEVEL_ERR, "ERROR: Piggy len=%d, too short aggregated data packet %d\n")
+EVENT(EV_AGG_MALFORMED, LOG_LEVEL_ERR, "ERROR: malformed aggregated data packet (%d records, %d bytes)\n")
+
+// Send queue (send_queue.c)
+EVENT(EV_QUEUE_FULL, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x send queue full, packet dropped (queue drops %u)\n")
+EVENT(EV_QUEUEBUF_FULL, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x no queuebuf available, packet dropped (queue drops %u)\n")
+EVENT(EV_QUEUE_NO_PARENT, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x no parent, packet dropped (tx drops %u)\n")
+EVENT(EV_TX_DROP, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x unicast failed after %d transmissions (status %d), packet dropped (tx drops %u)\n")
+EVENT(EV_TX_RETRY, LOG_LEVEL_INFO, "Node %02x:%02x unicast failed (status %d, num_tx %d), retransmitting\n")
+
+// Sink routing tables (my_collect.c)
+EVENT(EV_SINK_NO_TABLE, LOG_LEVEL_ERR, "ERROR: my_collect: no routing table left (SINK_TABLES), opened as a node\n")
+
+// Topology acknowledgement (my_collect.c)
+EVENT(EV_TOPOLOGY_ACK, LOG_LEVEL_DBG, "my_collect: parent %02x:%02x acknowledged topology version %u\n")
+
+// Energy reports (energy_report.c)
+EVENT(EV_ENERGY_SEND, LOG_LEVEL_INFO, "Node %02x:%02x sending an energy report\n")
+EVENT(EV_ENERGY_RECV, LOG_LEVEL_DBG, "Sink: energy report of node %02x:%02x radio on %u tx %u (1/10000)\n")
+EVENT(EV_ENERGY_MALFORMED, LOG_LEVEL_ERR, "ERROR: malformed energy report (%d records, %d bytes)\n")
+EVENT(EV_ENERGY_TOO_SHORT, LOG_LEVEL_ERR, "ERROR: Energy len=%d, too short data packet %d\n")
+
+// Energy reports under load (energy_report.c)
+EVENT(EV_ENERGY_DEFERRED, LOG_LEVEL_INFO, "Node %02x:%02x energy report deferred, %d packets queued\n")
+
+// Runtime configuration (my_collect.c)
+EVENT(EV_CONFIG_BEACON_INTERVAL, LOG_LEVEL_ERR, "ERROR: my_collect: beacon interval %u out of range, set to %u\n")
+EVENT(EV_CONFIG_TREPORT_HOLD, LOG_LEVEL_ERR, "ERROR: my_collect: topology report hold %u out of range, set to %u\n")
+
+// Routing table checkpoint (routing_checkpoint.c)
+EVENT(EV_CHECKPOINT_SAVE, LOG_LEVEL_DBG, "Sink: routing table checkpoint %u saved (%d entries)\n")
+EVENT(EV_CHECKPOINT_RESTORE, LOG_LEVEL_INFO, "Sink: routing table checkpoint %u restored (%d entries, tree round %u)\n")
+EVENT(EV_CHECKPOINT_ERROR, LOG_LEVEL_ERR, "ERROR: Sink: cannot write routing table checkpoint %u\n")
+EVENT(EV_CHECKPOINT_CONFIRM, LOG_LEVEL_DBG, "Sink: restored route to node %02x:%02x confirmed (%d hops)\n")
+EVENT(EV_CHECKPOINT_STALE, LOG_LEVEL_INFO, "Sink: restored route to node %02x:%02x is stale (%d hops, data came in %d), dropped\n")
+EVENT(EV_SINK_ROUND_CATCHUP, LOG_LEVEL_INFO, "Sink: heard tree round %u, ahead of ours, starting round %u\n")
+
+// Topology solicitation (topology_report.c)
+EVENT(EV_SOLICIT_SEND, LOG_LEVEL_INFO, "Sink: soliciting topology reports (tree round %u)\n")
+EVENT(EV_SOLICIT_RECV, LOG_LEVEL_DBG, "Node %02x:%02x solicited: metric %u, topology report in %u ticks\n")
+
+// Several sinks (my_collect.c, topology_report.c)
+EVENT(EV_SINK_JOIN, LOG_LEVEL_INFO, "my_collect: joining the tree of sink %02x:%02x (old %02x:%02x) in round %u\n")
+EVENT(EV_SINK_TABLE_FULL, LOG_LEVEL_ERR, "my_collect: sink table full, beacon of sink %02x:%02x ignored\n")
+EVENT(EV_TREPORT_LEAVE, LOG_LEVEL_INFO, "Node %02x:%02x leaving the tree of sink %02x:%02x\n")
+
+// Loose source routing (my_collect.c, loose_routing.c)
+EVENT(EV_SR_LOOSE, LOG_LEVEL_INFO, "Sink: route of %d hops to node %02x:%02x, loose up to waypoint %02x:%02x\n")
+EVENT(EV_SR_HOLD, LOG_LEVEL_INFO, "Node %02x:%02x waypoint for node %02x:%02x, requesting the next segment\n")
+EVENT(EV_SR_HOLD_FAILED, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x cannot hold the packet for node %02x:%02x, dropped\n")
+EVENT(EV_SR_SEGMENT_SEND, LOG_LEVEL_INFO, "Sink: segment of %d hops from waypoint %02x:%02x to node %02x:%02x\n")
+EVENT(EV_SR_SEGMENT_TIMEOUT, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x got no segment for node %02x:%02x, packet dropped\n")
+EVENT(EV_SR_SEGMENT_UNEXPECTED, LOG_LEVEL_ERR, "ERROR: Node %02x:%02x received a segment for node %02x:%02x, no packet held\n")
+EVENT(EV_SR_SEGMENT_CACHED, LOG_LEVEL_DBG, "Node %02x:%02x waypoint for node %02x:%02x, cached segment\n")
+
+// Storing mode (descendant_table.c)
+EVENT(EV_STORING_SEND, LOG_LEVEL_DBG, "Sink: storing mode packet for node %02x:%02x (route of %d hops)\n")
+EVENT(EV_STORING_MISS, LOG_LEVEL_INFO, "Node %02x:%02x has no descendant entry for node %02x:%02x, waypoint\n")
@@ -0,0 +1,296 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "my_collect.h"
+#include "event_log.h"
+#include "send_queue.h"
+#include "routing_table.h"
+#include "topology_report.h"
+#include "loose_routing.h"
+#include "descendant_table.h"
+
+/*
+    Loose source routing: the header of a downward packet holds at most
+    SR_MAX_PATH_BYTES of path. The sink sends a deeper packet to a waypoint,
+    the last hop that fits, with the destination stored before the path
+    (SR_PATH_LOOSE). The waypoint holds the packet and asks the sink for the
+    next segment of the route, from itself to the destination. The sink
+    source routes the segment to the waypoint (SR_PATH_SEGMENT), which writes
+    it in the held packet and sends it on. A segment that does not fit either
+    ends at the next waypoint, so routes of any depth need no larger header.
+    The segment for a waypoint out of reach of a header travels the same way,
+    through the waypoints before it.
+    Waypoints keep the segments they receive: the next packets to the same
+    destination, and the segments for the next waypoint, go on without a
+    request.
+ */
+
+#if LOOSE_SOURCE_ROUTING
+static void held_drop(HeldPacket* h) {
+        queuebuf_free(h->q);
+        h->q = NULL;
+        ctimer_stop(&h->timer);
+}
+
+/*
+    Keep a segment received for dest, replacing an older one for the same
+    destination or the entries in turn.
+ */
+static void segment_cache_store(my_collect_conn* conn, const sr_segment* seg, const uint8_t* path) {
+        SegmentCacheEntry* e = NULL;
+        uint8_t i;
+        for (i = 0; i < LOOSE_ROUTING_CACHE_SIZE && e == NULL; i++) {
+                if (linkaddr_cmp(&conn->sr_cache[i].dest, &seg->dest)) {
+                        e = &conn->sr_cache[i];
+                }
+        }
+        if (e == NULL) {
+                e = &conn->sr_cache[conn->sr_cache_next];
+                conn->sr_cache_next = (conn->sr_cache_next + 1) % LOOSE_ROUTING_CACHE_SIZE;
+        }
+        linkaddr_copy(&e->dest, &seg->dest);
+        e->path_len = seg->path_len;
+        e->path_fmt = seg->path_fmt & ~SR_PATH_SEGMENT;
+        e->prefix = seg->prefix;
+        memcpy(e->path, path, sr_path_hop_size(seg->path_fmt) * seg->path_len);
+        e->time = clock_time();
+}
+
+/*
+    A segment from this node to dest, from the segments received in the last
+    LOOSE_ROUTING_CACHE_TIME: one received for dest, or the beginning of a
+    loose one whose waypoint is dest (the first hop of its path).
+ */
+static SegmentCacheEntry* segment_cache_find(my_collect_conn* conn, const linkaddr_t* dest, sr_segment* seg) {
+        downward_data_packet_header hdr;
+        linkaddr_t waypoint;
+        uint8_t i;
+        for (i = 0; i < LOOSE_ROUTING_CACHE_SIZE; i++) {
+                SegmentCacheEntry* e = &conn->sr_cache[i];
+                if (linkaddr_cmp(&e->dest, &linkaddr_null) ||
+                    (clock_time_t)(clock_time() - e->time) > LOOSE_ROUTING_CACHE_TIME) {
+                        continue;
+                }
+                hdr.path_fmt = e->path_fmt;
+                hdr.prefix = e->prefix;
+                sr_path_read(&hdr, e->path, &waypoint);
+                if (linkaddr_cmp(&e->dest, dest) ||
+                    ((e->path_fmt & SR_PATH_LOOSE) && linkaddr_cmp(&waypoint, dest))) {
+                        linkaddr_copy(&seg->dest, dest);
+                        seg->path_len = e->path_len;
+                        seg->path_fmt = linkaddr_cmp(&e->dest, dest) ? e->path_fmt : e->path_fmt & ~SR_PATH_LOOSE;
+                        seg->prefix = e->prefix;
+                        return e;
+                }
+        }
+        return NULL;
+}
+
+/*
+    Write the segment in the packet in the packetbuf, which ended its path at
+    this node (our own hop already removed), and send the packet on. The
+    segment replaces the path, and the destination too when the segment ends
+    there. held: ticks the packet waited for the segment.
+ */
+static void segment_extend(my_collect_conn* conn, const sr_segment* seg, const uint8_t* path, uint16_t held) {
+        downward_data_packet_header hdr;
+        linkaddr_t next_hop;
+
+        memcpy(&hdr, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), sizeof(downward_data_packet_header));
+        if (!(seg->path_fmt & SR_PATH_LOOSE)) {
+                // the segment ends at the destination
+                packetbuf_set_datalen(packetbuf_datalen() - sizeof(linkaddr_t));
+        }
+        if (!packet_append(path, sr_path_hop_size(seg->path_fmt) * seg->path_len)) {
+                EVENT_LOG(EV_SR_PACKET_TOO_LONG, seg->dest.u8[0], seg->dest.u8[1]);
+                return;
+        }
+        hdr.path_len = seg->path_len;
+        // a segment packet stays one (for a waypoint deeper than a header can reach)
+        hdr.path_fmt = (seg->path_fmt & ~SR_PATH_SEGMENT) | (hdr.path_fmt & SR_PATH_SEGMENT);
+        hdr.prefix = seg->prefix;
+        hdr.hops = hdr.hops + 1;
+        memcpy((uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), &hdr, sizeof(downward_data_packet_header));
+#if LATENCY_STATS
+        packet_add_delay(held);
+#endif
+        sr_path_read(&hdr, (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - sr_path_hop_size(hdr.path_fmt), &next_hop);
+        descendant_learn_path(conn, &hdr, &next_hop);
+        send_queue_add(conn, &next_hop);
+}
+#endif
+
+void loose_routing_init(my_collect_conn* conn) {
+#if LOOSE_SOURCE_ROUTING
+        uint8_t i;
+        for (i = 0; i < LOOSE_ROUTING_HOLD_SLOTS; i++) {
+                conn->sr_held[i].q = NULL;
+                conn->sr_held[i].conn = conn;
+        }
+        for (i = 0; i < LOOSE_ROUTING_CACHE_SIZE; i++) {
+                linkaddr_copy(&conn->sr_cache[i].dest, &linkaddr_null);
+        }
+        conn->sr_cache_next = 0;
+#endif
+}
+
+/*
+    No segment came back within LOOSE_ROUTING_HOLD_TIME per hop: the request or the
+    segment was lost, or the sink has no route below the waypoint.
+ */
+void loose_routing_hold_cb(void* ptr) {
+#if LOOSE_SOURCE_ROUTING
+        HeldPacket* h = ptr;
+        if (h->q == NULL) {
+                return;
+        }
+        EVENT_LOG(EV_SR_SEGMENT_TIMEOUT, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+                  h->dest.u8[0], h->dest.u8[1]);
+        held_drop(h);
+#endif
+}
+
+/*
+    The downward packet in the packetbuf reached the end of its loose path at
+    this node (our own hop already removed): the destination is the last
+    address of the packet. Extend the path with a cached segment, or hold the
+    packet and send the sink a segment request (one for all the packets held
+    for the same destination).
+ */
+void loose_routing_hold(my_collect_conn* conn) {
+#if LOOSE_SOURCE_ROUTING
+        packet_type_t pt = segment_request;
+        sr_segment_request req = {.waypoint=linkaddr_node_addr};
+        downward_data_packet_header hdr;
+        SegmentCacheEntry* cached;
+        sr_segment seg;
+        HeldPacket* h = NULL;
+        bool requested = false;
+        uint8_t i;
+
+        if (packetbuf_datalen() < sizeof(packet_type_t) + sizeof(downward_data_packet_header) + sizeof(linkaddr_t)) {
+                EVENT_LOG(EV_SR_MALFORMED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                return;
+        }
+        memcpy(&req.dest, (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - sizeof(linkaddr_t), sizeof(linkaddr_t));
+        if ((cached = segment_cache_find(conn, &req.dest, &seg)) != NULL) {
+                EVENT_LOG(EV_SR_SEGMENT_CACHED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+                          req.dest.u8[0], req.dest.u8[1]);
+                segment_extend(conn, &seg, cached->path, 0);
+                return;
+        }
+        for (i = 0; i < LOOSE_ROUTING_HOLD_SLOTS; i++) {
+                if (conn->sr_held[i].q == NULL) {
+                        h = &conn->sr_held[i];
+                } else if (linkaddr_cmp(&conn->sr_held[i].dest, &req.dest)) {
+                        requested = true;
+                }
+        }
+        if (h == NULL || (h->q = queuebuf_new_from_packetbuf()) == NULL) {
+                EVENT_LOG(EV_SR_HOLD_FAILED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+                          req.dest.u8[0], req.dest.u8[1]);
+                return;
+        }
+        memcpy(&hdr, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), sizeof(downward_data_packet_header));
+#if DESCENDANT_TABLE_SIZE > 0
+        req.storing_miss = (hdr.path_fmt & SR_PATH_STORING) != 0;
+#endif
+        linkaddr_copy(&h->dest, &req.dest);
+        h->time = clock_time();
+        ctimer_set(&h->timer, LOOSE_ROUTING_HOLD_TIME * (hdr.hops + 1), loose_routing_hold_cb, h);
+        if (requested) {
+                return;
+        }
+
+        EVENT_LOG(EV_SR_HOLD, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], req.dest.u8[0], req.dest.u8[1]);
+        packetbuf_clear();
+        packetbuf_set_datalen(sizeof(sr_segment_request));
+        memcpy(packetbuf_dataptr(), &req, sizeof(sr_segment_request));
+        packetbuf_hdralloc(sizeof(packet_type_t));
+        memcpy(packetbuf_hdrptr(), &pt, sizeof(packet_type_t));
+        send_queue_add(conn, NULL);
+#endif
+}
+
+/*
+    Segment request received: a node forwards it to its parent. The sink
+    computes the route from the waypoint to the destination and source
+    routes it to the waypoint, itself a loose path if it does not fit.
+ */
+void forward_segment_request(my_collect_conn* conn) {
+#if LOOSE_SOURCE_ROUTING
+        sr_segment_request req;
+        downward_data_packet_header hdr = {.hops=0};
+        int route_len;
+
+        if (packetbuf_datalen() < sizeof(packet_type_t) + sizeof(sr_segment_request)) {
+                EVENT_LOG(EV_SR_MALFORMED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                return;
+        }
+        if (!conn->is_sink) {
+                send_queue_add(conn, NULL);
+                return;
+        }
+        memcpy(&req, (uint8_t*)packetbuf_dataptr() + sizeof(packet_type_t), sizeof(sr_segment_request));
+#if DESCENDANT_TABLE_SIZE > 0
+        if (req.storing_miss) {
+                // a hop missed the destination in storing mode (see descendant_table.c)
+                dict_set_storing(conn->routing_table, req.dest, false);
+        }
+#endif
+        route_len = find_segment(conn, &req.waypoint, &req.dest);
+        if (route_len == 0 || sr_path_plan(conn, route_len, &hdr) == 0) {
+                // the waypoint left the route of the destination
+                topology_solicit(conn);
+                return;
+        }
+        sr_segment seg = {.dest=req.dest, .path_len=hdr.path_len, .path_fmt=hdr.path_fmt, .prefix=hdr.prefix};
+        EVENT_LOG(EV_SR_SEGMENT_SEND, route_len, req.waypoint.u8[0], req.waypoint.u8[1],
+                  req.dest.u8[0], req.dest.u8[1]);
+        packetbuf_clear();
+        if (packet_append(&seg, sizeof(sr_segment)) && sr_path_append(conn, route_len, &hdr)) {
+                sr_send_path(conn, &req.waypoint, SR_PATH_SEGMENT);
+        }
+#endif
+}
+
+/*
+    The next segment for the packet held by this waypoint arrived (our own hop
+    already removed from the segment packet): it is cached for the next
+    packets, and the packets held for its destination go on.
+ */
+void loose_routing_segment_recv(my_collect_conn* conn) {
+#if LOOSE_SOURCE_ROUTING
+        uint8_t path[SR_MAX_PATH_BYTES];
+        sr_segment seg;
+        uint16_t offset = sizeof(packet_type_t) + sizeof(downward_data_packet_header);
+        uint16_t path_bytes;
+        uint8_t i, held = 0;
+
+        if (packetbuf_datalen() < offset + sizeof(sr_segment)) {
+                EVENT_LOG(EV_SR_MALFORMED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                return;
+        }
+        memcpy(&seg, (uint8_t*)packetbuf_dataptr() + offset, sizeof(sr_segment));
+        path_bytes = sr_path_hop_size(seg.path_fmt) * seg.path_len;
+        if (seg.path_len == 0 || path_bytes > SR_MAX_PATH_BYTES ||
+            packetbuf_datalen() != offset + sizeof(sr_segment) + path_bytes) {
+                EVENT_LOG(EV_SR_MALFORMED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                return;
+        }
+        memcpy(path, (uint8_t*)packetbuf_dataptr() + offset + sizeof(sr_segment), path_bytes);
+        segment_cache_store(conn, &seg, path);
+        for (i = 0; i < LOOSE_ROUTING_HOLD_SLOTS; i++) {
+                HeldPacket* h = &conn->sr_held[i];
+                if (h->q != NULL && linkaddr_cmp(&h->dest, &seg.dest)) {
+                        queuebuf_to_packetbuf(h->q);
+                        held_drop(h);
+                        segment_extend(conn, &seg, path, clock_time() - h->time);
+                        held++;
+                }
+        }
+        if (held == 0) {
+                EVENT_LOG(EV_SR_SEGMENT_UNEXPECTED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+                          seg.dest.u8[0], seg.dest.u8[1]);
+        }
+#endif
+}
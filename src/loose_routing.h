@@ -0,0 +1,11 @@
+#ifndef LOOSE_ROUTING_H
+#define LOOSE_ROUTING_H
+
+void loose_routing_init(my_collect_conn*);
+void loose_routing_hold_cb(void*);
+
+void loose_routing_hold(my_collect_conn*);
+void loose_routing_segment_recv(my_collect_conn*);
+void forward_segment_request(my_collect_conn*);
+
+#endif // LOOSE_ROUTING_H
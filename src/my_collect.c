@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include "contiki.h"
 #include "lib/random.h"
+#include "lib/memb.h"
 #include "net/rime/rime.h"
 #include "leds.h"
 #include "net/netstack.h"
@@ -9,23 +10,102 @@
 #include "my_collect.h"
 #include "routing_table.h"
 #include "topology_report.h"
+#include "data_aggregation.h"
+#include "send_queue.h"
+#include "neighbor_table.h"
+#include "energy_report.h"
+#include "routing_checkpoint.h"
+#include "loose_routing.h"
+#include "descendant_table.h"
+#include "event_log.h"
 
 /*--------------------------------------------------------------------------------------*/
 /* Callback structures */
 struct broadcast_callbacks bc_cb = {.recv=bc_recv};
-struct unicast_callbacks uc_cb = {.recv=uc_recv};
+struct unicast_callbacks uc_cb = {.recv=uc_recv, .sent=uc_sent};
+
+const struct my_collect_config my_collect_default_config = MY_COLLECT_DEFAULT_CONFIG;
+
+static void refresh_timer_start(my_collect_conn*);
+
+// Routing tables of the connections opened as a sink
+MEMB(sink_table_memb, TreeDict, SINK_TABLES);
 
 // -------------------------------------------------------------------------------------
 
+static clock_time_t config_clamp(clock_time_t t, clock_time_t min, clock_time_t max) {
+        return t < min ? min : (t > max ? max : t);
+}
+
+// Bring every field of the configuration of conn within its valid range (see my_collect.h)
+static void config_check(my_collect_conn* conn) {
+        struct my_collect_config* c = &conn->config;
+        clock_time_t t;
+
+        c->topology_report = c->topology_report != 0;
+        c->piggybacking = c->piggybacking != 0;
+        c->storing_mode = c->storing_mode != 0;
+        t = config_clamp(c->beacon_interval, CONFIG_BEACON_INTERVAL_MIN, CONFIG_BEACON_INTERVAL_MAX);
+        if (t != c->beacon_interval) {
+                EVENT_LOG(EV_CONFIG_BEACON_INTERVAL, (unsigned)c->beacon_interval, (unsigned)t);
+                c->beacon_interval = t;
+        }
+        t = config_clamp(c->treport_hold_time, TOPOLOGY_REPORT_JITTER, CONFIG_TREPORT_HOLD_MAX);
+        if (t != c->treport_hold_time) {
+                EVENT_LOG(EV_CONFIG_TREPORT_HOLD, (unsigned)c->treport_hold_time, (unsigned)t);
+                c->treport_hold_time = t;
+        }
+}
+
 void my_collect_open(struct my_collect_conn* conn, uint16_t channels,
-                     bool is_sink, const struct my_collect_callbacks *callbacks)
+                     bool is_sink, const struct my_collect_callbacks *callbacks,
+                     const struct my_collect_config *config)
 {
         // initialise the connector structure
+        conn->routing_table = NULL;
+        if (is_sink) {
+                // only a sink keeps the tree
+                conn->routing_table = memb_alloc(&sink_table_memb);
+                if (conn->routing_table == NULL) {
+                        EVENT_LOG(EV_SINK_NO_TABLE);
+                        is_sink = false;
+                }
+        }
+        conn->config = config != NULL ? *config : my_collect_default_config;
+        config_check(conn);
         linkaddr_copy(&conn->parent, &linkaddr_null);
+        linkaddr_copy(&conn->sink, is_sink ? &linkaddr_node_addr : &linkaddr_null);
         conn->metric = 65535; // the max metric (means that the node is not connected yet)
+        conn->advertised_metric = 65535;
+        neighbor_table_init(conn);
         conn->beacon_seqn = 0;
+        conn->trickle_i = 0;
+        conn->trickle_c = 0;
         conn->callbacks = callbacks;
         conn->treport_hold = 0;
+        conn->treport_len = 0;
+        conn->topo_version = 0;
+        conn->topo_acked_version = 0;
+#if TOPOLOGY_SOLICIT
+        conn->solicited = 0;
+        conn->solicit_wait = 0;
+#endif
+        conn->agg_len = 0;
+        conn->agg_count = 0;
+        conn->agg_piggy_len = 0;
+#if BEACON_MAX_ACKS > 0
+        conn->beacon_acks_len = 0;
+#endif
+#if ENERGY_REPORT
+        conn->agg_energy_len = 0;
+#endif
+#if LATENCY_STATS
+        conn->fwd_delay = 0;
+        conn->fwd_records = 0;
+#endif
+        send_queue_init(conn);
+        loose_routing_init(conn);
+        descendant_table_init(conn);
 
         if (is_sink) {
                 conn->is_sink = 1;
@@ -39,9 +119,38 @@ void my_collect_open(struct my_collect_conn* conn, uint16_t channels,
 
         if (is_sink) {
                 conn->metric = 0;
-                conn->routing_table.len = 0;
-                // we pass the connection object conn to the timer callback
-                ctimer_set(&conn->beacon_timer, CLOCK_SECOND, beacon_timer_cb, conn);
+                dict_init(conn->routing_table);
+                // a restarted sink gets its routing table and tree round back
+                routing_checkpoint_init(conn);
+                // the first round asks every node for its parent
+                if (!topology_solicit(conn)) {
+                        refresh_timer_start(conn);
+                        trickle_reset(conn);
+                }
+        }
+        energy_report_init(conn);
+}
+
+/*
+    Change the protocol parameters at run time (clamped as in my_collect_open).
+    A new beacon interval
+    restarts Trickle from it; with topology reports turned off a pending
+    report is cancelled (the parent is still piggybacked if enabled).
+ */
+void my_collect_set_config(struct my_collect_conn* conn, const struct my_collect_config* config)
+{
+        clock_time_t old_interval = conn->config.beacon_interval;
+
+        conn->config = *config;
+        config_check(conn);
+        if (!conn->config.topology_report && (conn->treport_hold || conn->treport_len > 0)) {
+                conn->treport_hold = 0;
+                conn->treport_len = 0;
+                ctimer_stop(&conn->treport_hold_timer);
+        }
+        if (conn->config.beacon_interval != old_interval && conn->trickle_i != 0) {
+                conn->trickle_i = 0;
+                trickle_reset(conn);
         }
 }
 
@@ -50,35 +159,265 @@ void my_collect_open(struct my_collect_conn* conn, uint16_t channels,
    ------------------------------------ BEACON Management ------------------------------------
  */
 
-// Beacon timer callback
+/*
+    Beacons are scheduled with a Trickle timer. In each interval I the node
+    broadcasts one beacon at a random time in [I/2, I), unless it has already
+    heard TRICKLE_K consistent beacons (same tree round, no change to its
+    parent or metric). At the end of the interval I doubles, from the configured
+    beacon_interval up to beacon_interval << TRICKLE_IMAX_DOUBLINGS (or the
+    longest clock_time_t).
+    An inconsistency (new round, parent or metric change, neighbor in an old
+    round) resets I to beacon_interval, so the tree is repaired quickly while
+    control traffic fades out in steady state.
+ */
+static void trickle_start_interval(my_collect_conn* conn) {
+        clock_time_t half = conn->trickle_i / 2;
+        clock_time_t t = half > 0 ? half + random_rand() % half : conn->trickle_i;
+        conn->trickle_c = 0;
+        // we pass the connection object conn to the timer callback
+        ctimer_set(&conn->beacon_timer, t, beacon_timer_cb, conn);
+        ctimer_set(&conn->trickle_timer, conn->trickle_i, trickle_interval_cb, conn);
+}
+
+void trickle_reset(my_collect_conn* conn) {
+        if (conn->trickle_i == conn->config.beacon_interval) {
+                // already beaconing at the fastest rate
+                return;
+        }
+        conn->trickle_i = conn->config.beacon_interval;
+        trickle_start_interval(conn);
+}
+
+// Longest Trickle interval, computed in 32 bits: the shift overflows a 16-bit
+// clock_time_t from a beacon_interval of 2048 ticks
+static clock_time_t trickle_imax(my_collect_conn* conn) {
+        uint32_t imax = (uint32_t)conn->config.beacon_interval << TRICKLE_IMAX_DOUBLINGS;
+        return imax < (clock_time_t)~0 ? imax : (clock_time_t)~0;
+}
+
+// End of a Trickle interval: the tree was consistent, double the interval
+void trickle_interval_cb(void* ptr) {
+        struct my_collect_conn *conn = ptr;
+        uint32_t i = (uint32_t)conn->trickle_i * 2;
+        clock_time_t imax = trickle_imax(conn);
+        conn->trickle_i = i < imax ? i : imax;
+        trickle_start_interval(conn);
+}
+
+// Beacon timer callback. The beacons heard only suppress ours if we have nothing new to
+// say: acknowledgements to carry, or a metric worse than the advertised one (see
+// neighbor_best), are always sent.
 void beacon_timer_cb(void* ptr) {
         struct my_collect_conn *conn = ptr;
+        uint8_t acks = 0;
+#if BEACON_MAX_ACKS > 0
+        acks = conn->beacon_acks_len;
+#endif
+        if (conn->trickle_c >= TRICKLE_K && acks == 0 &&
+            conn->metric <= conn->advertised_metric + PARENT_SWITCH_THRESHOLD) {
+                EVENT_LOG(EV_BEACON_SUPPRESSED, conn->trickle_c);
+                return;
+        }
         send_beacon(conn);
-        if (conn->is_sink == 1) {
-                // we pass the connection object conn to the timer callback
-                ctimer_set(&conn->beacon_timer, BEACON_INTERVAL, beacon_timer_cb, conn);
-                conn->seqn = conn->seqn+1;
+}
+
+// Sink only: count the TRICKLE_IMAX periods until the next tree round
+static void refresh_period_cb(void* ptr) {
+        struct my_collect_conn *conn = ptr;
+        conn->refresh_periods++;
+        if (conn->refresh_periods < TREE_REFRESH_PERIODS) {
+                ctimer_set(&conn->refresh_timer, TRICKLE_IMAX, refresh_period_cb, conn);
+                return;
         }
+        tree_refresh_cb(conn);
+}
+
+static void refresh_timer_start(my_collect_conn* conn) {
+        conn->refresh_periods = 0;
+        // we pass the connection object conn to the timer callback
+        ctimer_set(&conn->refresh_timer, TRICKLE_IMAX, refresh_period_cb, conn);
+}
+
+// Sink only: start a new tree round to refresh the metrics of the whole network
+void tree_refresh_cb(void* ptr) {
+        struct my_collect_conn *conn = ptr;
+        conn->beacon_seqn = conn->beacon_seqn+1;
+#if TOPOLOGY_SOLICIT
+        conn->solicited = 0;
+#endif
+#if DESCENDANT_TABLE_SIZE > 0
+        // the descendant tables may have forgotten the routes of the last round
+        dict_clear_storing(conn->routing_table);
+#endif
+        refresh_timer_start(conn);
+        conn->trickle_i = 0; // always restart from the shortest interval
+        trickle_reset(conn);
 }
 
 /*
-    The node sends a beacon in broadcast to everyone.
+    The node sends a beacon in broadcast to everyone, with the children whose
+    topology record it received since the last one.
  */
 void send_beacon(struct my_collect_conn* conn) {
-        struct beacon_msg beacon = {.seqn = conn->beacon_seqn, .metric = conn->metric};
+        struct beacon_msg beacon = {.seqn = conn->beacon_seqn, .metric = conn->metric, .sink = conn->sink};
+#if TOPOLOGY_SOLICIT
+        beacon.flags = conn->solicited ? BEACON_SOLICIT : 0;
+#endif
 
         packetbuf_clear();
         packetbuf_copyfrom(&beacon, sizeof(beacon));
-        printf("my_collect: sending beacon: seqn %d metric %d\n", conn->beacon_seqn, conn->metric);
+#if BEACON_MAX_ACKS > 0
+        packet_append(conn->beacon_acks, sizeof(linkaddr_t) * conn->beacon_acks_len);
+        conn->beacon_acks_len = 0;
+#endif
+        EVENT_LOG(EV_BEACON_SEND, conn->beacon_seqn, conn->metric);
+        conn->advertised_metric = conn->metric;
         broadcast_send(&conn->bc);
 }
 
+/*
+    Change the parent of the node. The new topology version has to reach the
+    sink: it is piggybacked on data packets or sent with a topology report
+    held for at most treport_hold_time, less for deeper nodes (see
+    topology_report_hold()), and TOPOLOGY_SOLICIT_HOLD in a round soliciting
+    topology reports.
+ */
+void set_parent(my_collect_conn* conn, const linkaddr_t* parent) {
+        EVENT_LOG(EV_NEW_PARENT,
+                  parent->u8[0], parent->u8[1], conn->parent.u8[0], conn->parent.u8[1], conn->metric);
+        linkaddr_copy(&conn->parent, parent);
+        conn->topo_version++;
+        // our children have to learn the new metric
+        trickle_reset(conn);
+        if (conn->config.topology_report) {
+                // send a topology report using the timer callback
+                clock_time_t max_hold = conn->config.treport_hold_time;
+#if TOPOLOGY_SOLICIT
+                if (conn->solicited) {
+                        // the sink is waiting for the reports of this round
+                        max_hold = TOPOLOGY_SOLICIT_HOLD;
+                }
+#endif
+                topology_report_schedule(conn, max_hold);
+        }
+}
+
+/*
+    Move the node to the tree of the neighbor n, if it is the tree of another
+    sink: the node takes the round of that tree, and its children follow it
+    as in a new round. Returns true if the node changed tree.
+ */
+static bool join_tree(my_collect_conn* conn, const Neighbor* n) {
+        const SinkRound* tree = &conn->sinks[n->sink];
+        if (linkaddr_cmp(&tree->addr, &conn->sink)) {
+                return false;
+        }
+        EVENT_LOG(EV_SINK_JOIN,
+                  tree->addr.u8[0], tree->addr.u8[1], conn->sink.u8[0], conn->sink.u8[1], tree->seqn);
+        linkaddr_copy(&conn->sink, &tree->addr);
+        conn->beacon_seqn = tree->seqn;
+#if TOPOLOGY_SOLICIT
+        conn->solicited = 0;
+#endif
+        conn->trickle_i = 0; // always restart from the shortest interval
+        return true;
+}
+
+/*
+    Choose the parent that minimizes the expected transmissions to a sink
+    and update the node's metric. The candidates of every tree compete, so
+    the node joins the tree of the cheapest sink (anycast: upward packets go
+    to that sink). The current parent is kept unless another candidate is
+    cheaper by more than PARENT_SWITCH_THRESHOLD, to avoid flapping between
+    links of similar quality.
+    Only the parent and the neighbors below the metric we advertised compete
+    (see neighbor_best): when the path through the parent gets worse, the node
+    takes the worse metric and advertises it, and the neighbors that look
+    cheaper only become candidates once our descendants heard it.
+    Returns true if the parent changed.
+ */
+bool select_parent(my_collect_conn* conn) {
+        Neighbor* best = neighbor_best(conn);
+        Neighbor* current = neighbor_find(conn, &conn->parent);
+
+        if (best == NULL) {
+                return false;
+        }
+        if (current != NULL && current != best && neighbor_is_candidate(conn, current) &&
+            neighbor_path_etx(best) + PARENT_SWITCH_THRESHOLD >= neighbor_path_etx(current)) {
+                best = current;
+        }
+        conn->metric = neighbor_path_etx(best);
+        if (linkaddr_cmp(&conn->parent, &best->addr)) {
+                if (join_tree(conn, best)) {
+                        // we followed the parent to another tree: the new sink has to learn it
+                        set_parent(conn, &best->addr);
+                        return true;
+                }
+                return false;
+        }
+        // the sink of the old parent drops us (and our subtree) if we leave its tree
+        topology_report_leave(conn, &conn->sinks[best->sink].addr);
+        join_tree(conn, best);
+        set_parent(conn, &best->addr);
+        return true;
+}
+
+/*
+    The parent did not acknowledge a unicast: switch right away to the best
+    backup parent in the neighbor table, without waiting for the next beacon
+    round. The queued packets follow the new parent, starting with the
+    retransmission of the lost one.
+    Returns true if the parent changed.
+ */
+bool failover_parent(my_collect_conn* conn) {
+        Neighbor* backup = neighbor_backup(conn);
+        if (backup == NULL) {
+                EVENT_LOG(EV_PARENT_UNREACHABLE,
+                          conn->parent.u8[0], conn->parent.u8[1]);
+                return false;
+        }
+        EVENT_LOG(EV_PARENT_FAILOVER,
+                  conn->parent.u8[0], conn->parent.u8[1], backup->addr.u8[0], backup->addr.u8[1]);
+        conn->metric = neighbor_path_etx(backup);
+        // the sink of the old parent drops us (and our subtree) if we leave its tree
+        topology_report_leave(conn, &conn->sinks[backup->sink].addr);
+        join_tree(conn, backup);
+        set_parent(conn, &backup->addr);
+        return true;
+}
+
+/*
+    Our parent's beacon: if it lists us, it received our record naming it as
+    parent, and the current topology version is acknowledged.
+ */
+static void beacon_ack_recv(my_collect_conn* conn) {
+        linkaddr_t addr;
+        uint16_t offset;
+        for (offset = sizeof(struct beacon_msg); offset < packetbuf_datalen(); offset += sizeof(linkaddr_t)) {
+                memcpy(&addr, (uint8_t*)packetbuf_dataptr() + offset, sizeof(linkaddr_t));
+                if (linkaddr_cmp(&addr, &linkaddr_node_addr)) {
+                        EVENT_LOG(EV_TOPOLOGY_ACK, conn->parent.u8[0], conn->parent.u8[1], conn->topo_version);
+                        conn->topo_acked_version = conn->topo_version;
+                        return;
+                }
+        }
+}
+
 /*
     Broadcast receive callback
 
     Here we manage the beacon receive logic.
-    The beacon is the only message sent in broadcast, initiated by the sink
-    every BEACON_INTERVAL seconds.
+    The beacon is the only message sent in broadcast. The sink starts a new
+    tree round every TREE_REFRESH_PERIODS * TRICKLE_IMAX and all nodes beacon following
+    their Trickle timer.
+    Every beacon updates the neighbor table, then the node re-evaluates its
+    parent. A beacon that changes nothing is consistent and counts towards
+    Trickle suppression, any other resets the Trickle interval.
+    With several sinks, the rounds of each tree are compared with the latest
+    round heard from its sink (conn->sinks). A sink ignores the other trees.
+    A beacon soliciting topology reports (BEACON_SOLICIT) is answered once
+    per round, see topology_solicit_recv().
  */
 void bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender) {
         struct beacon_msg beacon;
@@ -87,58 +426,210 @@ void bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender) {
         struct my_collect_conn* conn = (struct my_collect_conn*)(((uint8_t*)bc_conn) -
                                                                  offsetof(struct my_collect_conn, bc));
 
-        if (packetbuf_datalen() != sizeof(struct beacon_msg)) {
-                printf("my_collect: broadcast of wrong size (not a beacon)\n");
+        if (packetbuf_datalen() < sizeof(struct beacon_msg) ||
+            (packetbuf_datalen() - sizeof(struct beacon_msg)) % sizeof(linkaddr_t) != 0) {
+                EVENT_LOG(EV_BEACON_WRONG_SIZE);
                 return;
         }
         memcpy(&beacon, packetbuf_dataptr(), sizeof(struct beacon_msg));
         rssi = packetbuf_attr(PACKETBUF_ATTR_RSSI);
-        printf("my_collect: recv beacon from %02x:%02x seqn %u metric %u rssi %d\n",
-               sender->u8[0], sender->u8[1],
-               beacon.seqn, beacon.metric, rssi);
+        EVENT_LOG(EV_BEACON_RECV,
+                  sender->u8[0], sender->u8[1],
+                  beacon.seqn, beacon.metric, rssi);
 
-        if (rssi < RSSI_THRESHOLD) {
-                printf("packet rejected due to low rssi\n");
+        if (rssi < conn->config.rssi_threshold) {
+                EVENT_LOG(EV_BEACON_LOW_RSSI);
+                return;
+        }
+        if (linkaddr_cmp(sender, &conn->parent)) {
+                beacon_ack_recv(conn);
+        }
+        if (linkaddr_cmp(&beacon.sink, &linkaddr_null)) {
+                // the neighbor is not connected: help it join
+                trickle_reset(conn);
+                return;
+        }
+        bool own_tree = linkaddr_cmp(&beacon.sink, &conn->sink);
+        // latest round of the tree of the beacon
+        uint16_t* round = &conn->beacon_seqn;
+        int sink = 0;
+        if (conn->is_sink == 1) {
+                if (!own_tree) {
+                        return;
+                }
+        } else {
+                sink = neighbor_sink_index(conn, &beacon.sink, beacon.seqn);
+                if (sink < 0) {
+                        EVENT_LOG(EV_SINK_TABLE_FULL, beacon.sink.u8[0], beacon.sink.u8[1]);
+                        return;
+                }
+                round = &conn->sinks[sink].seqn;
+        }
+        // difference of tree rounds (robust to sequence number wrap around)
+        int16_t round_diff = beacon.seqn - *round;
+        if (round_diff < 0) {
+                // the neighbor is in an old round: help it catch up (we only beacon in our tree)
+                if (own_tree) {
+                        trickle_reset(conn);
+                }
+                return;
+        }
+        if (conn->is_sink == 1) {
+                if (round_diff > 0) {
+                        // the network is in a later round than the sink (restarted without
+                        // its checkpoint): start a round after it, or the nodes ignore our beacons
+                        conn->beacon_seqn = beacon.seqn;
+#if TOPOLOGY_SOLICIT
+                        if (conn->solicited) {
+                                // the nodes ignored the solicitation of our old round
+                                conn->solicit_wait = 0;
+                                ctimer_stop(&conn->solicit_timer);
+                        }
+#endif
+                        if (!topology_solicit(conn)) {
+                                tree_refresh_cb(conn);
+                        }
+                        EVENT_LOG(EV_SINK_ROUND_CATCHUP, beacon.seqn, conn->beacon_seqn);
+                        return;
+                }
+                conn->trickle_c++;
                 return;
         }
 
+        if (neighbor_update_beacon(conn, sender, rssi, &beacon, sink) == NULL) {
+                EVENT_LOG(EV_NEIGHBOR_TABLE_FULL,
+                          sender->u8[0], sender->u8[1]);
+                return;
+        }
         // check received sequence number
-        if (conn->beacon_seqn < beacon.seqn) {
-                // new tree
-                conn->beacon_seqn = beacon.seqn;
-        }else{
-                if (conn->metric <= beacon.metric+1) {
-                        // current hop count is better
-                        printf("my_collect: return. conn->metric: %u, beacon.metric: %u\n",
-                               conn->metric, beacon.metric);
-                        return;
+        bool new_round = false;
+        if (round_diff > 0) {
+                *round = beacon.seqn;
+                if (own_tree) {
+                        // new tree
+                        conn->beacon_seqn = beacon.seqn;
+                        new_round = true;
+#if TOPOLOGY_SOLICIT
+                        conn->solicited = 0;
+#endif
                 }
         }
-        // update metric (hop count)
-        conn->metric = beacon.metric+1;
-
-        // Parent update
-        if (!linkaddr_cmp(&conn->parent, sender)) {
-                // update parent
-                linkaddr_copy(&conn->parent, sender);
-                if (TOPOLOGY_REPORT) {
-                        // send a topology report using the timer callback
-                        conn->treport_hold=1;
-                        ctimer_stop(&conn->treport_hold_timer);
-                        ctimer_set(&conn->treport_hold_timer, TOPOLOGY_REPORT_HOLD_TIME, topology_report_hold_cb, conn);
+        uint16_t old_metric = conn->metric;
+        linkaddr_t old_sink = conn->sink;
+        bool parent_changed = select_parent(conn);
+        uint16_t metric_change = conn->metric > old_metric ? conn->metric - old_metric : old_metric - conn->metric;
+        // joining the tree of another sink is a new round for our children
+        new_round = new_round || !linkaddr_cmp(&old_sink, &conn->sink);
+        bool solicit = false;
+#if TOPOLOGY_SOLICIT
+        solicit = (beacon.flags & BEACON_SOLICIT) && !conn->solicited && linkaddr_cmp(&beacon.sink, &conn->sink);
+#endif
+        // a metric worse than the advertised one is advertised right away: the neighbors
+        // below it only become parent candidates after that (see neighbor_best)
+        bool worse = conn->metric > old_metric && conn->metric > conn->advertised_metric;
+        if (!new_round && !parent_changed && metric_change <= PARENT_SWITCH_THRESHOLD && !solicit && !worse) {
+                // consistent beacon: nothing new to advertise (beacons of other trees do not
+                // suppress ours)
+                if (own_tree) {
+                        conn->trickle_c++;
                 }
+                return;
+        }
+        if (LOG_DUMPS) {
+                print_neighbor_table(conn);
         }
 
-        // Retransmit the beacon since the metric has been updated.
-        // Introduce small random delay with the BEACON_FORWARD_DELAY to avoid synch
-        // issues when multiple nodes broadcast at the same time.
-        ctimer_set(&conn->beacon_timer, BEACON_FORWARD_DELAY, beacon_timer_cb, conn);
+        // Advertise the new round or metric soon (set_parent already resets Trickle).
+        if (new_round) {
+                conn->trickle_i = 0; // always restart from the shortest interval
+        }
+        trickle_reset(conn);
+#if TOPOLOGY_SOLICIT
+        if (solicit) {
+                topology_solicit_recv(conn);
+        }
+#endif
 }
 
 /*
    ------------------------------------ General Send and Receive Functions ------------------------------------
  */
 
+/*
+    True if the node has to piggyback its parent in upward data packets,
+    i.e. the sink has not yet acknowledged the current topology version.
+ */
+bool piggyback_pending(my_collect_conn *conn) {
+        return conn->config.piggybacking == 1 && conn->topo_version != conn->topo_acked_version;
+}
+
+/*
+    A topology record (piggybacked or in a report) received from sender: if it
+    is the sender's own record naming us as parent, our next beacon
+    acknowledges it (see beacon_ack_recv). That beacon is sent at the Trickle
+    time even if consistent beacons would suppress it.
+ */
+void topology_ack_record(my_collect_conn* conn, const linkaddr_t* sender, const tree_connection* tc) {
+#if BEACON_MAX_ACKS > 0
+        uint8_t i;
+        if (!linkaddr_cmp(&tc->node, sender) || !linkaddr_cmp(&tc->parent, &linkaddr_node_addr)) {
+                return;
+        }
+        for (i = 0; i < conn->beacon_acks_len; i++) {
+                if (linkaddr_cmp(&conn->beacon_acks[i], sender)) {
+                        return;
+                }
+        }
+        if (conn->beacon_acks_len < BEACON_MAX_ACKS) {
+                linkaddr_copy(&conn->beacon_acks[conn->beacon_acks_len++], sender);
+        }
+#endif
+}
+
+/*
+    Append len bytes at the end of the packet data (after the payload).
+    Forwarders add their records at the tail so that the packet never has to be
+    moved in memory. Returns 0 if the packet would exceed MAX_PACKET_LEN: a
+    sender allocates its header (packetbuf_hdralloc) before appending.
+ */
+int packet_append(const void* data, uint16_t len) {
+        uint16_t datalen = packetbuf_datalen();
+        if (packetbuf_totlen() + len > MAX_PACKET_LEN) {
+                return 0;
+        }
+        memcpy((uint8_t*)packetbuf_dataptr() + datalen, data, len);
+        packetbuf_set_datalen(datalen + len);
+        return 1;
+}
+
+#if LATENCY_STATS
+/*
+    Add ticks to the delay carried by the data packet in the packetbuf
+    (to every record of an aggregated packet). Called by the send queue
+    right before each transmission, on the copy of the queued packet.
+ */
+void packet_add_delay(uint16_t ticks) {
+        uint8_t* ptr = packetbuf_dataptr();
+        packet_type_t pt;
+
+        memcpy(&pt, ptr, sizeof(packet_type_t));
+        ptr += sizeof(packet_type_t);
+        if (pt == upward_data_packet) {
+                upward_data_packet_header hdr;
+                memcpy(&hdr, ptr, sizeof(upward_data_packet_header));
+                hdr.delay += ticks;
+                memcpy(ptr, &hdr, sizeof(upward_data_packet_header));
+        } else if (pt == downward_data_packet) {
+                downward_data_packet_header hdr;
+                memcpy(&hdr, ptr, sizeof(downward_data_packet_header));
+                hdr.delay += ticks;
+                memcpy(ptr, &hdr, sizeof(downward_data_packet_header));
+        } else if (pt == aggregated_data_packet) {
+                aggregation_add_delay(ptr, ticks);
+        }
+}
+#endif
+
 /*
     DATA COLLECTION PROTOCOL: Send function called by the application layer.
 
@@ -146,33 +637,134 @@ void bc_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender) {
     until it reached the sink.
 
     In case the node wants to piggy back its topology information (its parent)
-    to the sink, it adds this information in the packet header.
+    to the sink, it appends this information after the payload. This happens only
+    until the sink acknowledges the current topology version, so in steady state
+    data packets carry no topology information.
+
+    The pending energy record of the node (ENERGY_REPORT) is piggybacked the
+    same way, before the topology information.
+
+    If forwarded records are waiting for the aggregation window, the packet is
+    sent together with them right away.
  */
 int my_collect_send(struct my_collect_conn *conn) {
-        uint8_t piggy_len = 0;
-        // piggyback information
-        tree_connection tc = {.node=linkaddr_node_addr, .parent=conn->parent};;
-        if (PIGGYBACKING == 1) {
-                piggy_len = 1;
-        }
-
-        struct upward_data_packet_header hdr = {.source=linkaddr_node_addr, .hops=0, .piggy_len=piggy_len};
-        enum packet_type pt = upward_data_packet;
+        struct upward_data_packet_header hdr = {.source=linkaddr_node_addr, .hops=0, .piggy_len=0};
+        packet_type_t pt = upward_data_packet;
 
         if (linkaddr_cmp(&conn->parent, &linkaddr_null))
                 return 0; // no parent
 
-        if (PIGGYBACKING == 1 ) {
-                packetbuf_hdralloc(sizeof(enum packet_type) + sizeof(upward_data_packet_header) + sizeof(tree_connection));
-                memcpy(packetbuf_hdrptr(), &pt, sizeof(enum packet_type));
-                memcpy(packetbuf_hdrptr() + sizeof(enum packet_type), &hdr, sizeof(upward_data_packet_header));
-                memcpy(packetbuf_hdrptr() + sizeof(enum packet_type) + sizeof(upward_data_packet_header), &tc, sizeof(tree_connection));
+        if (AGGREGATION_WINDOW > 0 && conn->agg_count > 0 && aggregate_own_data(conn)) {
+                return aggregation_flush(conn);
+        }
+        // the header first, so that packet_append counts it in MAX_PACKET_LEN
+        packetbuf_hdralloc(sizeof(packet_type_t) + sizeof(upward_data_packet_header));
+#if ENERGY_REPORT
+        if (energy_report_pending(conn) && packet_append(&conn->energy_rec, sizeof(energy_record))) {
+                hdr.energy_len = 1;
+                energy_report_sent(conn);
+        }
+#endif
+        if (piggyback_pending(conn)) {
+                tree_connection tc = {.node=linkaddr_node_addr, .parent=conn->parent};
+                if (packet_append(&tc, sizeof(tree_connection))) {
+                        hdr.piggy_len = 1;
+                }
+        }
+        memcpy(packetbuf_hdrptr(), &pt, sizeof(packet_type_t));
+        memcpy(packetbuf_hdrptr() + sizeof(packet_type_t), &hdr, sizeof(upward_data_packet_header));
+        return send_queue_add(conn, NULL);
+}
+
+/*
+    Bytes used by each hop of a source routing path encoded with fmt.
+ */
+uint8_t sr_path_hop_size(uint8_t fmt) {
+        return SR_PATH_ENCODING(fmt) == sr_path_compact ? 1 : sizeof(linkaddr_t);
+}
+
+/*
+    Decode the address stored at ptr in a source routing path.
+ */
+void sr_path_read(const downward_data_packet_header* hdr, const uint8_t* ptr, linkaddr_t* addr) {
+        if (SR_PATH_ENCODING(hdr->path_fmt) == sr_path_compact) {
+                addr->u8[0] = ptr[0];
+                addr->u8[1] = hdr->prefix;
         } else {
-                packetbuf_hdralloc(sizeof(enum packet_type) + sizeof(upward_data_packet_header));
-                memcpy(packetbuf_hdrptr(), &pt, sizeof(enum packet_type));
-                memcpy(packetbuf_hdrptr() + sizeof(enum packet_type), &hdr, sizeof(upward_data_packet_header));
+                memcpy(addr, ptr, sizeof(linkaddr_t));
+        }
+}
+
+/*
+    Hops of a route of route_len hops held in tree_path (the ones nearest to the sink).
+ */
+static int sr_path_hops(int route_len) {
+        return route_len < MAX_PATH_LENGTH ? route_len : MAX_PATH_LENGTH;
+}
+
+/*
+    True if the hops from..to-1 of tree_path share the high address byte.
+ */
+static bool sr_path_same_prefix(my_collect_conn* conn, int from, int to) {
+        int i;
+        for (i = from + 1; i < to; i++) {
+                if (conn->routing_table->tree_path[i].u8[1] != conn->routing_table->tree_path[from].u8[1]) {
+                        return false;
+                }
         }
-        return unicast_send(&conn->uc, &conn->parent);
+        return true;
+}
+
+/*
+    Choose the encoding of the route in tree_path (route_len hops, see find_route)
+    and fill path_len, path_fmt and prefix of hdr.
+    When all the nodes in the path share the same high address byte, the path is
+    written in the compact format (one byte per hop), so that longer paths fit in
+    SR_MAX_PATH_BYTES. With LOOSE_SOURCE_ROUTING, a route that still does not fit
+    keeps the hops nearest to the sink that do, with the destination (SR_PATH_LOOSE).
+    Returns the number of hops in the header, 0 if the route does not fit.
+ */
+uint8_t sr_path_plan(my_collect_conn* conn, int route_len, downward_data_packet_header* hdr) {
+        int n = sr_path_hops(route_len);
+        int k = n;
+
+        if (route_len == n && n <= SR_MAX_PATH_BYTES && sr_path_same_prefix(conn, 0, n)) {
+                hdr->path_fmt = sr_path_compact;
+        } else if (route_len == n && n * sizeof(linkaddr_t) <= SR_MAX_PATH_BYTES) {
+                hdr->path_fmt = sr_path_full;
+        } else if (LOOSE_SOURCE_ROUTING) {
+                // the destination takes the room of a full hop
+                k = SR_MAX_PATH_BYTES - sizeof(linkaddr_t);
+                k = k < n ? k : n;
+                if (sr_path_same_prefix(conn, n - k, n)) {
+                        hdr->path_fmt = sr_path_compact | SR_PATH_LOOSE;
+                } else {
+                        k = (SR_MAX_PATH_BYTES - sizeof(linkaddr_t)) / sizeof(linkaddr_t);
+                        k = k < n ? k : n;
+                        hdr->path_fmt = sr_path_full | SR_PATH_LOOSE;
+                }
+        } else {
+                return 0;
+        }
+        hdr->path_len = k;
+        hdr->prefix = conn->routing_table->tree_path[n - k].u8[1];
+        return k;
+}
+
+/*
+    Append the path_len hops of hdr (see sr_path_plan) to the packet, the last
+    one being the first hop.
+ */
+bool sr_path_append(my_collect_conn* conn, int route_len, const downward_data_packet_header* hdr) {
+        int n = sr_path_hops(route_len);
+        uint8_t hop_size = sr_path_hop_size(hdr->path_fmt);
+        int i;
+        for (i = n - hdr->path_len; i < n; i++) {
+                if (!packet_append(&conn->routing_table->tree_path[i], hop_size)) {
+                        return false;
+                }
+        }
+        return true;
 }
 
 /*
@@ -184,35 +776,77 @@ int my_collect_send(struct my_collect_conn *conn) {
     first node of the path.
  */
 int sr_send(struct my_collect_conn* conn, const linkaddr_t* dest) {
+        return sr_send_path(conn, dest, 0);
+}
+
+/*
+    sr_send with the path_fmt flags of the packet: SR_PATH_SEGMENT for the
+    segment of a loose source route, sent to its waypoint. A waypoint deeper
+    than a header can reach gets it through a waypoint of its own.
+ */
+int sr_send_path(my_collect_conn* conn, const linkaddr_t* dest, uint8_t flags) {
         if (!conn->is_sink) {
                 // if this is an ordinary node
                 return 0;
         }
 
         // populate the array present in the source_routing structure in conn.
-        int path_len = find_route(conn, dest);
-        print_route(conn, path_len, dest);
-        if (path_len == 0) {
+        int route_len = find_route(conn, dest);
+        if (LOG_DUMPS) {
+                print_route(conn, route_len, dest);
+        }
+        if (route_len == 0) {
                 // printf("PATH ERROR: Path with len 0 for destination node: %02x:%02x",
                 //     (*dest).u8[0], (*dest).u8[1]);
+                // the routing table is missing a node or holds a stale parent
+                topology_solicit(conn);
                 return 0;
         }
 
-        enum packet_type pt = downward_data_packet;
-        downward_data_packet_header hdr = {.hops=0, .path_len=path_len };
+        packet_type_t pt = downward_data_packet;
+        downward_data_packet_header hdr = {.hops=0};
+        int n = sr_path_hops(route_len);
+        if (sr_path_plan(conn, route_len, &hdr) == 0) {
+                EVENT_LOG(EV_SR_PATH_TOO_BIG,
+                          route_len, (*dest).u8[0], (*dest).u8[1]);
+                return 0;
+        }
+        hdr.path_fmt |= flags;
+        if (flags == 0 && storing_mode_route(conn, dest, &hdr)) {
+                // only the destination, the forwarders know the way (see descendant_table.c)
+                EVENT_LOG(EV_STORING_SEND, (*dest).u8[0], (*dest).u8[1], route_len);
+                hdr.path_len = 0;
+                hdr.path_fmt = SR_PATH_STORING;
+                hdr.prefix = 0;
+        }
 
-        // allocate enough space in the header for the path
-        packetbuf_hdralloc(sizeof(enum packet_type) + sizeof(downward_data_packet_header) + sizeof(linkaddr_t) * path_len);
-        memcpy(packetbuf_hdrptr(), &pt, sizeof(enum packet_type));
-        memcpy(packetbuf_hdrptr() + sizeof(enum packet_type), &hdr, sizeof(downward_data_packet_header));
-        int i;
-        // copy path in reverse order.
-        for (i = path_len-1; i >= 0; i--) { // path len because to insert the Nth element I do sizeof(linkaddr_t)*(N-1)
-                memcpy(packetbuf_hdrptr()+sizeof(enum packet_type)+sizeof(downward_data_packet_header)+sizeof(linkaddr_t)*(path_len-(i+1)),
-                       &conn->routing_table.tree_path[i],
-                       sizeof(linkaddr_t));
+        // The path goes after the payload, destination first: the next hop is always
+        // the last element, so forwarders consume it just by shortening the packet.
+        // The header is allocated first, so that packet_append counts it in MAX_PACKET_LEN.
+        packetbuf_hdralloc(sizeof(packet_type_t) + sizeof(downward_data_packet_header));
+        if (((hdr.path_fmt & (SR_PATH_LOOSE | SR_PATH_STORING)) && !packet_append(dest, sizeof(linkaddr_t))) ||
+            !sr_path_append(conn, route_len, &hdr)) {
+                EVENT_LOG(EV_SR_PACKET_TOO_LONG,
+                          (*dest).u8[0], (*dest).u8[1]);
+                return 0;
+        }
+        if (hdr.path_fmt & SR_PATH_LOOSE) {
+                linkaddr_t* waypoint = &conn->routing_table->tree_path[n - hdr.path_len];
+                EVENT_LOG(EV_SR_LOOSE, route_len, (*dest).u8[0], (*dest).u8[1],
+                          waypoint->u8[0], waypoint->u8[1]);
+        }
+        memcpy(packetbuf_hdrptr(), &pt, sizeof(packet_type_t));
+        memcpy(packetbuf_hdrptr() + sizeof(packet_type_t), &hdr, sizeof(downward_data_packet_header));
+        if (!send_queue_add(conn, &conn->routing_table->tree_path[n - 1])) {
+                return 0;
+        }
+#if DESCENDANT_TABLE_SIZE > 0
+        if (flags == 0 && !(hdr.path_fmt & SR_PATH_STORING)) {
+                // the hops learn dest from the path, the next packets can go in storing mode
+                dict_set_storing(conn->routing_table, *dest, true);
         }
-        return unicast_send(&conn->uc, &conn->routing_table.tree_path[path_len-1]);
+#endif
+        return 1;
 }
 
 
@@ -221,10 +855,12 @@ int sr_send(struct my_collect_conn* conn, const linkaddr_t* dest) {
     Based on the packet type read from the first byte in the header
     a specific function is caled to handle the logic.
 
-    Here we expect three types of packets:
+    Here we expect four types of packets:
         - upward traffic (DATA COLLECTION): from node to sink data packet passing through parents.
+        - aggregated upward traffic: several data packets merged by a forwarding node.
         - topology report: from node to sink passing through parents.
         - downward traffic (SOURCE ROUTING): from sink to node using path computed at the sink.
+        - segment request: from the waypoint of a loose source route to the sink.
  */
 void uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *sender) {
         // Get the pointer to the overall structure my_collect_conn from its field uc
@@ -237,21 +873,26 @@ void uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *sender) {
         //     return;
         // }
 
-        enum packet_type pt;
-        memcpy(&pt, packetbuf_dataptr(), sizeof(enum packet_type));
+        packet_type_t pt;
+        memcpy(&pt, packetbuf_dataptr(), sizeof(packet_type_t));
 
-        printf("Node %02x:%02x received unicast packet with type %d\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], pt);
+        EVENT_LOG(EV_UC_RECV, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], pt);
         switch (pt) {
         case upward_data_packet:
-                printf("Node %02x:%02x receivd a unicast data packet\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                EVENT_LOG(EV_UC_RECV_DATA, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
                 forward_upward_data(conn, sender);
                 break;
+        case aggregated_data_packet:
+                EVENT_LOG(EV_UC_RECV_AGGREGATED, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                forward_aggregated_data(conn, sender);
+                break;
         case topology_report:
-                if (TOPOLOGY_REPORT==0) {
-                        printf("ERROR: Received a topoloy report with TOPOLOGY_REPORT=0. Node: %02x:%02x\n",
-                               linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                if (conn->config.topology_report == 0) {
+                        EVENT_LOG(EV_TREPORT_DISABLED,
+                                  linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
                 } else {
-                        printf("Node %02x:%02x receivd a unicast topology report\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                        EVENT_LOG(EV_UC_RECV_TREPORT, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                        topology_report_ack(conn, sender);
                         if (conn->is_sink) {
                                 deliver_topology_report_to_sink(conn);
                         } else {
@@ -260,12 +901,42 @@ void uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *sender) {
                 }
                 break;
         case downward_data_packet:
-                printf("Node %02x:%02x receivd a unicast source routing packet\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                EVENT_LOG(EV_UC_RECV_SR, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
                 forward_downward_data(conn, sender);
                 break;
+        case energy_report:
+                forward_energy_report(conn);
+                break;
+        case segment_request:
+                forward_segment_request(conn);
+                break;
         default:
-                printf("Packet type not recognized.\n");
+                EVENT_LOG(EV_UC_UNKNOWN_TYPE);
+        }
+}
+
+/*
+    Unicast sent callback: reports the link-layer outcome of the
+    transmission at the head of the send queue, also used to estimate
+    the quality of the link to the receiver.
+ */
+void uc_sent(struct unicast_conn *uc_conn, int status, int num_tx) {
+        struct my_collect_conn* conn = (struct my_collect_conn*)(((uint8_t*)uc_conn) -
+                                                                 offsetof(struct my_collect_conn, uc));
+        linkaddr_t receiver;
+
+        // link estimation, and a worse link to the parent may change the parent
+        if (status != MAC_TX_DEFERRED && send_queue_receiver(conn, &receiver)) {
+                neighbor_update_tx(conn, &receiver, status, num_tx);
+                if (conn->is_sink == 0 && linkaddr_cmp(&receiver, &conn->parent)) {
+                        if (PARENT_FAILOVER == 1 && status == MAC_TX_NOACK) {
+                                failover_parent(conn);
+                        } else {
+                                select_parent(conn);
+                        }
+                }
         }
+        send_queue_sent(conn, status, num_tx);
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -281,15 +952,15 @@ void uc_recv(struct unicast_conn *uc_conn, const linkaddr_t *sender) {
     but caution is never too much :)
  */
 bool check_address_in_piggyback_block(uint8_t piggy_len, linkaddr_t node) {
-        printf("Checking piggy address: %02x:%02x\n", node.u8[0], node.u8[1]);
+        EVENT_LOG(EV_PIGGY_CHECK, node.u8[0], node.u8[1]);
         uint8_t i;
         tree_connection tc;
+        // piggybacked blocks are the last piggy_len records of the packet
+        uint8_t* records = (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - sizeof(tree_connection) * piggy_len;
         for (i = 0; i < piggy_len; i++) {
-                memcpy(&tc,
-                       packetbuf_dataptr() + sizeof(enum packet_type) + sizeof(upward_data_packet_header),
-                       sizeof(tree_connection));
+                memcpy(&tc, records + sizeof(tree_connection) * i, sizeof(tree_connection));
                 if (linkaddr_cmp(&tc.node, &node)) {
-                        printf("ERROR: Checking piggy address found: %02x:%02x\n", node.u8[0], node.u8[1]);
+                        EVENT_LOG(EV_PIGGY_LOOP, node.u8[0], node.u8[1]);
                         return true;
                 }
         }
@@ -300,86 +971,141 @@ bool check_address_in_piggyback_block(uint8_t piggy_len, linkaddr_t node) {
 /*
     Forwarding or collection of data sent from one node to the sink.
 
-        - Sink: Counts the number of topology informations with piggy_len present in the header.
-        Then calls the callback to the application layer to retrieve the packet data.
-        - Node: A node just forwards upwards the message. In case it wants to piggyback
-        some topology information (its parent) it increases header size and writes in the header
-        its parent.
+        - Sink: Reads the piggy_len topology informations at the end of the packet and
+        removes them, as well as the energy record of the source if any. Then calls the
+        callback to the application layer to retrieve the packet data.
+        - Node: A node just forwards upwards the message, updating the header in place.
+        In case it wants to piggyback some topology information (its parent) it appends it
+        at the end of the packet.
+        With AGGREGATION_WINDOW > 0 the packet is instead added to the aggregation buffer
+        and sent later with the other records received in the window.
  */
 void forward_upward_data(my_collect_conn *conn, const linkaddr_t *sender) {
         upward_data_packet_header hdr;
-        memcpy(&hdr, packetbuf_dataptr() + sizeof(enum packet_type), sizeof(upward_data_packet_header));
+        memcpy(&hdr, packetbuf_dataptr() + sizeof(packet_type_t), sizeof(upward_data_packet_header));
+        uint16_t piggy_bytes = sizeof(tree_connection) * hdr.piggy_len;
+        uint16_t energy_bytes = sizeof(energy_record) * PACKET_ENERGY_LEN(hdr);
+        if (packetbuf_datalen() < sizeof(packet_type_t) + sizeof(upward_data_packet_header) + piggy_bytes) {
+                EVENT_LOG(EV_PIGGY_TOO_SHORT, hdr.piggy_len, packetbuf_datalen());
+                return;
+        }
+        if (packetbuf_datalen() < sizeof(packet_type_t) + sizeof(upward_data_packet_header) + piggy_bytes + energy_bytes) {
+                EVENT_LOG(EV_ENERGY_TOO_SHORT, PACKET_ENERGY_LEN(hdr), packetbuf_datalen());
+                return;
+        }
         // if this is the sink
         if (conn->is_sink == 1) {
-                packetbuf_hdrreduce(sizeof(enum packet_type) + sizeof(upward_data_packet_header));
-                if (PIGGYBACKING == 1) {
-                        tree_connection tc;
-                        uint8_t i;
-                        if (hdr.piggy_len > MAX_PATH_LENGTH) {
-                                printf("ERROR: Piggy len=%d, path is supposed to be max %d\n", hdr.piggy_len, MAX_PATH_LENGTH);
-                        }
-                        for (i = 0; i < hdr.piggy_len; i++) {
-                                memcpy(&tc, packetbuf_dataptr() + sizeof(tree_connection) * i, sizeof(tree_connection));
-                                dict_add(&conn->routing_table, tc.node, tc.parent);
-                        }
-                        packetbuf_hdrreduce(sizeof(tree_connection) * hdr.piggy_len);
+                tree_connection tc;
+                uint8_t i;
+                uint8_t* records = (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - piggy_bytes;
+                for (i = 0; i < hdr.piggy_len; i++) {
+                        memcpy(&tc, records + sizeof(tree_connection) * i, sizeof(tree_connection));
+                        topology_ack_record(conn, sender, &tc);
+                        dict_add(conn->routing_table, tc.node, tc.parent);
+                }
+                if (energy_bytes > 0) {
+                        energy_record er;
+                        memcpy(&er, records - energy_bytes, sizeof(energy_record));
+                        deliver_energy_record(conn, &er);
                 }
-                conn->callbacks->recv(&hdr.source, hdr.hops +1 );
+                routing_checkpoint_check(conn, &hdr.source, hdr.hops +1);
+                // leave just the payload
+                packetbuf_set_datalen(packetbuf_datalen() - piggy_bytes - energy_bytes);
+                packetbuf_hdrreduce(sizeof(packet_type_t) + sizeof(upward_data_packet_header));
+                conn->callbacks->recv(&hdr.source, hdr.hops +1, PACKET_DELAY(hdr));
         }else{
+                tree_connection tc;
+                uint8_t i;
+                uint8_t* records = (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - piggy_bytes;
+                // the source and the piggybacked nodes are below the sender
+                descendant_learn(conn, &hdr.source, sender);
+                for (i = 0; i < hdr.piggy_len; i++) {
+                        memcpy(&tc, records + sizeof(tree_connection) * i, sizeof(tree_connection));
+                        topology_ack_record(conn, sender, &tc);
+                        descendant_learn(conn, &tc.node, sender);
+                }
+                if (AGGREGATION_WINDOW > 0 && aggregate_upward_data(conn)) {
+                        return;
+                }
                 hdr.hops = hdr.hops+1;
-                // alloc space for piggyback information
-                if (PIGGYBACKING == 1 && !check_address_in_piggyback_block(hdr.piggy_len, linkaddr_node_addr)) {
-                        packetbuf_hdralloc(sizeof(tree_connection));
-                        packetbuf_compact();
-                        tree_connection tc = {.node=linkaddr_node_addr, .parent=conn->parent};
-                        hdr.piggy_len = hdr.piggy_len+1;
-
-                        printf("Adding tree_connection to piggyinfo: key %02x:%02x value: %02x:%02x\n",
-                               tc.node.u8[0], tc.node.u8[1], tc.parent.u8[0], tc.parent.u8[1]);
-
-                        memcpy(packetbuf_hdrptr(), packetbuf_dataptr(), sizeof(enum packet_type));
-                        memcpy(packetbuf_hdrptr() + sizeof(enum packet_type), &hdr, sizeof(upward_data_packet_header));
-                        memcpy(packetbuf_hdrptr() + sizeof(enum packet_type) + sizeof(upward_data_packet_header), &tc, sizeof(tree_connection));
-                } else {
-                        memcpy(packetbuf_dataptr() + sizeof(enum packet_type), &hdr, sizeof(upward_data_packet_header));
+                if (piggyback_pending(conn) && !check_address_in_piggyback_block(hdr.piggy_len, linkaddr_node_addr)) {
+                        linkaddr_copy(&tc.node, &linkaddr_node_addr);
+                        linkaddr_copy(&tc.parent, &conn->parent);
+                        if (packet_append(&tc, sizeof(tree_connection))) {
+                                hdr.piggy_len = hdr.piggy_len+1;
+                                EVENT_LOG(EV_PIGGY_ADD,
+                                          tc.node.u8[0], tc.node.u8[1], tc.parent.u8[0], tc.parent.u8[1]);
+                        }
                 }
-                unicast_send(&conn->uc, &conn->parent);
+                // update the header in place
+                memcpy(packetbuf_dataptr() + sizeof(packet_type_t), &hdr, sizeof(upward_data_packet_header));
+                send_queue_add(conn, NULL);
         }
 }
 
 /*
     Packet forwarding from a node to another node in the path computed by the sink.
-    The node first checks that it is indeed the next hop in the path, then reduces the
-    header (removing itself) and sends the packet to the next node in the path.
+    The node first checks that it is indeed the next hop in the path (the last
+    element of the packet), then removes itself shortening the packet, updates
+    the header in place and sends the packet to the next node in the path.
+
+    At the end of a loose path the node is a waypoint, or receives the next
+    segment for the packet it holds as a waypoint (see loose_routing.c).
+    Storing mode packets carry no path (see descendant_table.c).
+
+    The path was computed from the sink's routing table: if the packet comes from
+    our current parent, the sink knows our parent, which acknowledges the current
+    topology version and stops piggybacking.
  */
 void forward_downward_data(my_collect_conn *conn, const linkaddr_t *sender) {
         linkaddr_t addr;
         downward_data_packet_header hdr;
 
-        memcpy(&hdr, packetbuf_dataptr() + sizeof(enum packet_type), sizeof(downward_data_packet_header));
-        // Get first address in path
-        memcpy(&addr, packetbuf_dataptr() + sizeof(enum packet_type) + sizeof(downward_data_packet_header), sizeof(linkaddr_t));
+        memcpy(&hdr, packetbuf_dataptr() + sizeof(packet_type_t), sizeof(downward_data_packet_header));
+        if (hdr.path_fmt & SR_PATH_STORING) {
+                // not routed by the sink's routing table: no topology acknowledgement
+                forward_storing_data(conn, sender);
+                return;
+        }
+        uint8_t hop_size = sr_path_hop_size(hdr.path_fmt);
+        if (hdr.path_len == 0 ||
+            packetbuf_datalen() < sizeof(packet_type_t) + sizeof(downward_data_packet_header) + hop_size * hdr.path_len) {
+                EVENT_LOG(EV_SR_MALFORMED,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+                return;
+        }
+        // Get next address in path
+        sr_path_read(&hdr, (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - hop_size, &addr);
         // This is the correct recipient
         if (linkaddr_cmp(&addr, &linkaddr_node_addr)) {
-                if (hdr.path_len == 1) {
-                        printf("PATH COMPLETE: Node %02x:%02x delivers packet from sink\n",
-                               linkaddr_node_addr.u8[0],
-                               linkaddr_node_addr.u8[1]);
-                        packetbuf_hdrreduce(sizeof(enum packet_type) + sizeof(downward_data_packet_header) + sizeof(linkaddr_t));
-                        conn->callbacks->sr_recv(conn, hdr.hops +1 );
+                if (linkaddr_cmp(sender, &conn->parent)) {
+                        conn->topo_acked_version = conn->topo_version;
+                }
+                // remove this node from the path
+                packetbuf_set_datalen(packetbuf_datalen() - hop_size);
+                if (hdr.path_len == 1 && (hdr.path_fmt & SR_PATH_LOOSE)) {
+                        // a waypoint: the route goes on from here
+                        loose_routing_hold(conn);
+                } else if (hdr.path_len == 1 && (hdr.path_fmt & SR_PATH_SEGMENT)) {
+                        loose_routing_segment_recv(conn);
+                } else if (hdr.path_len == 1) {
+                        EVENT_LOG(EV_SR_DELIVERED,
+                                  linkaddr_node_addr.u8[0],
+                                  linkaddr_node_addr.u8[1]);
+                        packetbuf_hdrreduce(sizeof(packet_type_t) + sizeof(downward_data_packet_header));
+                        conn->callbacks->sr_recv(conn, hdr.hops +1, PACKET_DELAY(hdr));
                 } else {
-                        // reduce header and decrease path length
-                        packetbuf_hdrreduce(sizeof(linkaddr_t));
+                        // decrease path length and count this hop in place
                         hdr.path_len = hdr.path_len - 1;
-                        enum packet_type pt = downward_data_packet;
-                        memcpy(packetbuf_dataptr(), &pt, sizeof(enum packet_type));
-                        memcpy(packetbuf_dataptr() + sizeof(enum packet_type), &hdr, sizeof(downward_data_packet_header));
+                        hdr.hops = hdr.hops + 1;
+                        memcpy(packetbuf_dataptr() + sizeof(packet_type_t), &hdr, sizeof(downward_data_packet_header));
                         // get next addr in path
-                        memcpy(&addr, packetbuf_dataptr() + sizeof(enum packet_type) + sizeof(downward_data_packet_header), sizeof(linkaddr_t));
-                        unicast_send(&conn->uc, &addr);
+                        sr_path_read(&hdr, (uint8_t*)packetbuf_dataptr() + packetbuf_datalen() - hop_size, &addr);
+                        descendant_learn_path(conn, &hdr, &addr);
+                        send_queue_add(conn, &addr);
                 }
         } else {
-                printf("ERROR: Node %02x:%02x received sr message. Was meant for node %02x:%02x\n",
-                       linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], addr.u8[0], addr.u8[1]);
+                EVENT_LOG(EV_SR_WRONG_NODE,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], addr.u8[0], addr.u8[1]);
         }
 }
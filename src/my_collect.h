@@ -7,46 +7,425 @@
 #include "net/rime/rime.h"
 #include "net/netstack.h"
 #include "core/net/linkaddr.h"
+#include "lib/list.h"
 
+// Defaults of the runtime configuration (struct my_collect_config below).
 // Allow or not to send topology reports.
+#ifndef TOPOLOGY_REPORT
 #define TOPOLOGY_REPORT 1
+#endif
+#ifndef PIGGYBACKING
 #define PIGGYBACKING 1
+#endif
+// Allow or not the sink to send storing mode downward packets (see DESCENDANT_TABLE_SIZE).
+#ifndef STORING_MODE
+#define STORING_MODE 1
+#endif
 
+#ifndef MAX_NODES
 #define MAX_NODES 30
-#define MAX_PATH_LENGTH 10
+#endif
+// Longest route the sink computes (compact paths use one byte per hop).
+// With LOOSE_SOURCE_ROUTING the sink keeps the MAX_PATH_LENGTH hops of a longer route
+// nearest to the sink, and sends the packet in segments.
+#define MAX_PATH_LENGTH 20
+// Header bytes available for the source routing path in a downward packet
+#define SR_MAX_PATH_BYTES 20
+// Loose source routing (loose_routing.c): a route that does not fit in SR_MAX_PATH_BYTES
+// ends at a waypoint, the last hop that fits. The waypoint extends the route with a segment
+// it received for the same destination in the last LOOSE_ROUTING_CACHE_TIME (it keeps
+// LOOSE_ROUTING_CACHE_SIZE), or holds the packet (up to LOOSE_ROUTING_HOLD_SLOTS) and asks
+// the sink for the next segment, for at most LOOSE_ROUTING_HOLD_TIME per hop from the sink
+// (the request goes all the way up).
+#ifndef LOOSE_SOURCE_ROUTING
+#define LOOSE_SOURCE_ROUTING 1
+#endif
+#define LOOSE_ROUTING_HOLD_TIME (CLOCK_SECOND/2)
+#ifndef LOOSE_ROUTING_HOLD_SLOTS
+#define LOOSE_ROUTING_HOLD_SLOTS 2
+#endif
+#ifndef LOOSE_ROUTING_CACHE_SIZE
+#define LOOSE_ROUTING_CACHE_SIZE 2
+#endif
+#define LOOSE_ROUTING_CACHE_TIME (CLOCK_SECOND*120)
+// Storing mode (descendant_table.c): forwarders keep the last DESCENDANT_TABLE_SIZE
+// descendants heard in the upward data or downward paths they relay, with the child leading
+// to each. Once a source routed packet has taught its path to the hops, the next packets to
+// the same destination carry only its address (SR_PATH_STORING) when that saves at least
+// STORING_MODE_MIN_SAVING header bytes, and every hop looks it up. A node that has no entry
+// for it becomes a waypoint and asks the sink for the rest of the route, so misses need
+// LOOSE_SOURCE_ROUTING. A miss costs a round trip to the sink: short routes are not worth it.
+#ifndef DESCENDANT_TABLE_SIZE
+#if LOOSE_SOURCE_ROUTING
+#define DESCENDANT_TABLE_SIZE 8
+#else
+#define DESCENDANT_TABLE_SIZE 0
+#endif
+#endif
+#ifndef STORING_MODE_MIN_SAVING
+#define STORING_MODE_MIN_SAVING 8
+#endif
+#if DESCENDANT_TABLE_SIZE > 0 && !LOOSE_SOURCE_ROUTING
+#error "DESCENDANT_TABLE_SIZE needs LOOSE_SOURCE_ROUTING (a storing mode miss ends at a waypoint)"
+#endif
 
-#define BEACON_INTERVAL (CLOCK_SECOND*30)
-#define BEACON_FORWARD_DELAY (random_rand() % (CLOCK_SECOND*4))
-// Used for topology reports
+// Routing table hash index: 2^DICT_CAPACITY_BITS slots.
+// Keep the load factor (MAX_NODES / DICT_CAPACITY) at most 3/4 so probe sequences stay short.
+#ifndef DICT_CAPACITY_BITS
+#define DICT_CAPACITY_BITS 6
+#endif
+#define DICT_CAPACITY (1 << DICT_CAPACITY_BITS)
+#if (MAX_NODES * 4) > (DICT_CAPACITY * 3)
+#error "DICT_CAPACITY_BITS too small for MAX_NODES (load factor above 3/4)"
+#endif
+
+// Routing tables of the sinks, in a pool shared by the connections: only a connection
+// opened as a sink takes one (with its route cache), the other nodes keep no tree
+#ifndef SINK_TABLES
+#define SINK_TABLES 1
+#endif
+
+// Number of source routes cached at the sink (0 disables the cache), least recently used
+// replaced first. Enough for the destinations of app.c (APP_NODES - 1, 9 by default): a
+// cache smaller than the set of destinations served in turn never hits.
+#ifndef ROUTE_CACHE_SIZE
+#define ROUTE_CACHE_SIZE 10
+#endif
+
+// Sink routing table checkpoint in flash (routing_checkpoint.c): every
+// ROUTING_CHECKPOINT_INTERVAL the sink saves its routing table if it changed, and a
+// restarted sink restores it as provisional entries, so source routing works right away.
+#ifndef ROUTING_CHECKPOINT
+#define ROUTING_CHECKPOINT 1
+#endif
+#ifndef ROUTING_CHECKPOINT_INTERVAL
+#define ROUTING_CHECKPOINT_INTERVAL (CLOCK_SECOND*60)
+#endif
+
+// Trickle beacon scheduling: the beacon interval starts at TRICKLE_IMIN (default of
+// beacon_interval in the runtime configuration) and doubles while the tree is consistent,
+// up to TRICKLE_IMIN << TRICKLE_IMAX_DOUBLINGS.
+// A node skips its beacon if it heard TRICKLE_K consistent beacons in the interval.
+#ifndef TRICKLE_IMIN
+#define TRICKLE_IMIN (CLOCK_SECOND*4)
+#endif
+#define TRICKLE_IMAX_DOUBLINGS 5
+#define TRICKLE_IMAX (TRICKLE_IMIN << TRICKLE_IMAX_DOUBLINGS)
+#define TRICKLE_K 2
+// The sink starts a new tree round (new beacon sequence number) every TREE_REFRESH_PERIODS
+// periods of TRICKLE_IMAX, counted by the sink (a single timer can not last that long with a
+// 16-bit clock_time_t). A new round resets Trickle at every node, so the interval is well
+// above TRICKLE_IMAX: otherwise the beacon interval never grows to TRICKLE_IMAX. Changes of
+// parent or metric reset Trickle on their own and do not wait for the next round.
+#ifndef TREE_REFRESH_PERIODS
+#define TREE_REFRESH_PERIODS 8
+#endif
+// Used for topology reports: longest hold (default of treport_hold_time in the runtime
+// configuration). The hold shrinks with the path ETX of the node, down to TOPOLOGY_REPORT_JITTER
+// at TOPOLOGY_REPORT_MAX_METRIC, so that the reports of a subtree reach its ancestors while
+// they still hold theirs. Forwarders keep the reports of their children and send them with
+// their own, or after at most TOPOLOGY_REPORT_FORWARD_HOLD (scaled the same way), in as few
+// frames as possible.
+#ifndef TOPOLOGY_REPORT_HOLD_TIME
 #define TOPOLOGY_REPORT_HOLD_TIME (CLOCK_SECOND*15)
+#endif
+#define TOPOLOGY_REPORT_MAX_METRIC (ETX_SCALE*24)
+#define TOPOLOGY_REPORT_JITTER (CLOCK_SECOND/8)
+#define TOPOLOGY_REPORT_FORWARD_HOLD (CLOCK_SECOND*2)
+// Topology solicitation (topology_report.c): at startup and when a source route is missing,
+// the sink starts a tree round whose beacons ask every node for its parent. The flagged
+// beacons are passed on within TOPOLOGY_SOLICIT_JITTER, and a node answers with a topology
+// report held for at most TOPOLOGY_SOLICIT_HOLD (scaled with its path ETX as above).
+// At most one solicited round every TOPOLOGY_SOLICIT_MIN_INTERVAL.
+#ifndef TOPOLOGY_SOLICIT
+#define TOPOLOGY_SOLICIT 1
+#endif
+#define TOPOLOGY_SOLICIT_JITTER (CLOCK_SECOND/8)
+#define TOPOLOGY_SOLICIT_HOLD (CLOCK_SECOND*6)
+#define TOPOLOGY_SOLICIT_MIN_INTERVAL (CLOCK_SECOND*120)
+// Topology acknowledgement: a node lists in its next beacon (at most BEACON_MAX_ACKS) the
+// children whose report or piggybacked record naming it as parent it received. A child
+// stops piggybacking its parent when its parent's beacon lists it.
+#ifndef BEACON_MAX_ACKS
+#define BEACON_MAX_ACKS 4
+#endif
+// Forwarding nodes hold upward data for this long to send several records in one frame
+// (0 forwards every data packet right away)
+#ifndef AGGREGATION_WINDOW
+#define AGGREGATION_WINDOW (CLOCK_SECOND*2)
+#endif
 
+// Beacons received below this RSSI are ignored
+#ifndef RSSI_THRESHOLD
 #define RSSI_THRESHOLD -95
+#endif
+
+// Link estimation: metrics are expected transmissions (ETX) in fixed point,
+// ETX_SCALE is one transmission
+#define ETX_SCALE 16
+// RSSI above which a link with no unicast history is assumed to be perfect
+#define RSSI_GOOD -80
+// ETX assumed at RSSI_THRESHOLD for a link with no unicast history
+#define ETX_RSSI_MAX 4
+// ETX sample of a unicast that was not acknowledged
+#define ETX_NOACK_PENALTY 10
+// Weight of a new sample in the RSSI and ETX moving averages (out of 8)
+#define NEIGHBOR_EWMA_ALPHA 2
+// A node changes parent only if the new path is this much cheaper (hysteresis)
+#define PARENT_SWITCH_THRESHOLD (ETX_SCALE*3/2)
+// Switch to a backup parent as soon as the parent does not acknowledge a unicast
+#define PARENT_FAILOVER 1
+#ifndef MAX_NEIGHBORS
+#define MAX_NEIGHBORS 8
+#endif
+// Several sinks: each one roots a tree, a node joins the tree of the cheapest sink it hears
+// and keeps the tree round of up to MAX_SINKS sinks (the beacons of other sinks are ignored).
+#ifndef MAX_SINKS
+#define MAX_SINKS 4
+#endif
+// Unicast retransmissions after a failed link-layer transmission, then the packet is dropped
+#ifndef MAX_RETRANSMISSIONS
 #define MAX_RETRANSMISSIONS 1
+#endif
+// Outbound unicast packets that can wait for the radio (queuebufs are taken from the Rime pool)
+#ifndef SEND_QUEUE_SIZE
+#define SEND_QUEUE_SIZE 4
+#endif
+#define SEND_RETRY_DELAY (CLOCK_SECOND/8 + random_rand() % (CLOCK_SECOND/8))
+
+// Latency instrumentation: data packets carry the time they spent in the network
+// (a delay field in the headers, 2 bytes per packet or data record), and every
+// node counts the time packets wait in its aggregation buffer and send queue.
+#ifndef LATENCY_STATS
+#define LATENCY_STATS 0
+#endif
 
-static const linkaddr_t sink_addr = {{0x01, 0x00}}; // node 1 will be our sink
+// Energy reports: every ENERGY_REPORT_INTERVAL a node samples energest and sends its radio
+// duty cycle to the sink, piggybacked on the next data packet it sends or on the next
+// aggregated data or energy report it forwards, or in a dedicated energy report after
+// ENERGY_REPORT_HOLD_TIME. The dedicated report waits another ENERGY_REPORT_HOLD_TIME while
+// more than half of the send queue is taken, and under the same load a forwarding node merges
+// the energy reports it receives in its aggregation buffer, so that they do not crowd data out.
+#ifndef ENERGY_REPORT
+#define ENERGY_REPORT 0
+#endif
+#ifndef ENERGY_REPORT_INTERVAL
+#define ENERGY_REPORT_INTERVAL (CLOCK_SECOND*120)
+#endif
+#define ENERGY_REPORT_HOLD_TIME (CLOCK_SECOND*40)
+// energest counters sampled for a report: CPU, LPM, TRANSMIT, LISTEN
+#define ENERGY_SAMPLES 4
+
+// Protocol log (see event_log.h): events above LOG_LEVEL are compiled out.
+// With LOG_BINARY the events are kept as binary records in a ring of LOG_RING_SIZE
+// and dumped every LOG_DUMP_INTERVAL, instead of being printed as text right away.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DBG
+#endif
+#ifndef LOG_BINARY
+#define LOG_BINARY 0
+#endif
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 32
+#endif
+#ifndef LOG_DUMP_INTERVAL
+#define LOG_DUMP_INTERVAL (CLOCK_SECOND*10)
+#endif
+
+// clock_time_t is 16 bits on the motes (the Sky counts CLOCK_SECOND 128 ticks per second,
+// so a timer lasts at most 511 s): every timer set from these constants has to fit.
+#define CLOCK_TIME_16BIT_MAX 0xffffUL
+#if TRICKLE_IMAX > CLOCK_TIME_16BIT_MAX || TOPOLOGY_REPORT_HOLD_TIME > CLOCK_TIME_16BIT_MAX || \
+    TOPOLOGY_REPORT_FORWARD_HOLD > CLOCK_TIME_16BIT_MAX || TOPOLOGY_SOLICIT_HOLD > CLOCK_TIME_16BIT_MAX || \
+    TOPOLOGY_SOLICIT_MIN_INTERVAL > CLOCK_TIME_16BIT_MAX || AGGREGATION_WINDOW > CLOCK_TIME_16BIT_MAX || \
+    LOOSE_ROUTING_HOLD_TIME * 256 > CLOCK_TIME_16BIT_MAX || \
+    LOOSE_ROUTING_CACHE_TIME > CLOCK_TIME_16BIT_MAX || ROUTING_CHECKPOINT_INTERVAL > CLOCK_TIME_16BIT_MAX || \
+    ENERGY_REPORT_INTERVAL > CLOCK_TIME_16BIT_MAX || ENERGY_REPORT_HOLD_TIME > CLOCK_TIME_16BIT_MAX || \
+    LOG_DUMP_INTERVAL > CLOCK_TIME_16BIT_MAX
+#error "a timer constant does not fit in a 16-bit clock_time_t"
+#endif
+
+static const linkaddr_t sink_addr = {{0x01, 0x00}}; // node 1 will be our sink (the first one of several)
 
 enum packet_type {
         upward_data_packet = 0,
         downward_data_packet = 1,
-        topology_report = 2
+        topology_report = 2,
+        aggregated_data_packet = 3,
+        energy_report = 4,
+        segment_request = 5
 };
+// Packet type as sent on air, first byte of every unicast packet
+typedef uint8_t packet_type_t;
+
+// Largest packet handed to Rime (headers, payload and trailing records).
+// Leaves room for the MAC and Rime headers in a 127 bytes 802.15.4 frame.
+#define MAX_PACKET_LEN 100
+
+// Maximum number of tree_connection records carried by an aggregated data packet
+#define AGGREGATION_MAX_PIGGY MAX_PATH_LENGTH
+
+struct tree_connection {
+        linkaddr_t node;
+        linkaddr_t parent;
+} __attribute__((packed));
+typedef struct tree_connection tree_connection;
+// Records in a topology report of MAX_PACKET_LEN bytes
+#define TOPOLOGY_REPORT_MAX_RECORDS ((MAX_PACKET_LEN - sizeof(packet_type_t) - sizeof(uint8_t)) / sizeof(tree_connection))
+
+// Radio duty cycle of a node since its previous energy report
+struct energy_record {
+        linkaddr_t node;
+        uint16_t radio_on; // radio on time (listen + transmit), in 1/10000 of the elapsed time
+        uint16_t tx;       // transmit time, in 1/10000 of the elapsed time
+} __attribute__((packed));
+typedef struct energy_record energy_record;
+
+// Maximum number of energy_record carried by an aggregated data packet
+#define AGGREGATION_MAX_ENERGY 8
 
 // --------------------------------------------------------------------
 //                              DICT STRUCTS
 // --------------------------------------------------------------------
 
 typedef struct DictEntry {
-        linkaddr_t key; // the address of the node
+        linkaddr_t key; // the address of the node (linkaddr_null marks an empty slot)
         linkaddr_t value; // the address of the parent
 } DictEntry;
 
+// Cached source route to dest, stored in the same order as TreeDict.tree_path
+// (path[0] is the destination, path[path_len-1] is the first hop)
+typedef struct RouteCacheEntry {
+        linkaddr_t dest; // linkaddr_null marks an unused entry
+        uint8_t path_len;
+        uint16_t used; // TreeDict.route_cache_clock at the last use
+        linkaddr_t path[MAX_PATH_LENGTH];
+} RouteCacheEntry;
+
 typedef struct TreeDict {
         int len;
-        // int cap;
-        DictEntry entries[MAX_NODES];
+        uint16_t version; // incremented at every new entry or parent change
+        // open addressing hash index keyed on the node address (linear probing)
+        DictEntry entries[DICT_CAPACITY];
         linkaddr_t tree_path[MAX_PATH_LENGTH];
+        // probe statistics
+        uint32_t lookups;
+        uint32_t probes;
+        uint8_t max_probe;
+#if ROUTE_CACHE_SIZE > 0
+        RouteCacheEntry route_cache[ROUTE_CACHE_SIZE];
+        uint16_t route_cache_clock; // counts the uses, for the LRU replacement
+        uint32_t route_cache_hits;
+        uint32_t route_cache_misses;
+#endif
+#if ROUTING_CHECKPOINT
+        // entries restored from the checkpoint and not confirmed since (one bit per slot)
+        uint8_t provisional[(DICT_CAPACITY + 7) / 8];
+#endif
+#if DESCENDANT_TABLE_SIZE > 0
+        // destinations sent in storing mode (one bit per slot, see dict_set_storing)
+        uint8_t storing[(DICT_CAPACITY + 7) / 8];
+        // per slot: version when the node got its parent or was marked storing
+        uint16_t storing_stamp[DICT_CAPACITY];
+#endif
 } TreeDict;
 
+/*
+    Outbound unicast packet waiting in the send queue of a connection.
+    The packet is kept in a queuebuf, so the packetbuf can be reused
+    while the packet waits for its link-layer acknowledgement.
+ */
+typedef struct send_queue_entry {
+        struct send_queue_entry *next;
+        struct queuebuf *q;
+        linkaddr_t receiver; // receiver of the last transmission
+        uint8_t to_parent; // 1: send to the current parent, whoever it is at transmission time
+        uint8_t transmissions;
+#if LATENCY_STATS
+        uint16_t enqueued; // clock_time() of send_queue_add
+#endif
+} send_queue_entry;
+
+// --------------------------------------------------------------------
+//                              NEIGHBOR TABLE STRUCTS
+// --------------------------------------------------------------------
+
+typedef struct Neighbor {
+        linkaddr_t addr; // linkaddr_null marks an empty entry
+        uint16_t metric; // path ETX advertised in the last beacon
+        uint16_t beacon_seqn; // tree round of the last beacon
+        uint8_t sink; // tree of the last beacon (index in my_collect_conn.sinks)
+        int8_t rssi; // moving average of the beacons RSSI
+        uint16_t etx; // moving average of the unicast transmissions (valid if tx_samples > 0)
+        uint8_t tx_samples;
+} Neighbor;
+
+// Descendant learned from the upward traffic relayed by a node (storing mode)
+typedef struct Descendant {
+        linkaddr_t node;
+        linkaddr_t child; // next hop towards node, the child its traffic came from
+        uint8_t used; // 1 once a downward packet used the entry
+} Descendant;
+
+// Segment of a loose source route kept by a waypoint (see struct sr_segment)
+typedef struct SegmentCacheEntry {
+        linkaddr_t dest; // linkaddr_null marks an unused entry
+        uint8_t path_len;
+        uint8_t path_fmt;
+        uint8_t prefix;
+        uint8_t path[SR_MAX_PATH_BYTES];
+        clock_time_t time; // when the segment arrived
+} SegmentCacheEntry;
+
+// Packet held by a waypoint until the next segment of its route arrives
+typedef struct HeldPacket {
+        struct queuebuf* q; // NULL marks an unused slot
+        linkaddr_t dest;
+        clock_time_t time; // when the packet arrived
+        struct ctimer timer;
+        struct my_collect_conn* conn;
+} HeldPacket;
+
+// Latest tree round heard from a sink (linkaddr_null marks an empty entry)
+typedef struct SinkRound {
+        linkaddr_t addr;
+        uint16_t seqn;
+} SinkRound;
+
+// --------------------------------------------------------------------
+//                              CONFIGURATION
+// --------------------------------------------------------------------
+
+/* Protocol parameters that can change without rebuilding the firmware.
+ * Given to my_collect_open() (NULL for the defaults) and changed at run time
+ * with my_collect_set_config(). Both bring the fields to their valid range
+ * (and log the times they change): the flags are 0 or 1, beacon_interval is within
+ * CONFIG_BEACON_INTERVAL_MIN and CONFIG_BEACON_INTERVAL_MAX (Trickle draws the
+ * beacon time in the second half of the interval), treport_hold_time within
+ * TOPOLOGY_REPORT_JITTER and CONFIG_TREPORT_HOLD_MAX, and any rssi_threshold is valid. */
+struct my_collect_config {
+        uint8_t topology_report; // 1: send a topology report after a parent change
+        uint8_t piggybacking;    // 1: piggyback the parent on upward data packets
+        uint8_t storing_mode;    // sink: 1 to route downward packets hop by hop when it saves header bytes
+        clock_time_t beacon_interval;   // shortest Trickle interval (the longest is << TRICKLE_IMAX_DOUBLINGS)
+        clock_time_t treport_hold_time; // longest wait for a data packet to piggyback on before a topology report
+        int8_t rssi_threshold;          // beacons received below this RSSI are ignored
+};
+#define CONFIG_BEACON_INTERVAL_MIN (CLOCK_SECOND/8)
+#define CONFIG_BEACON_INTERVAL_MAX (CLOCK_SECOND*60)
+#define CONFIG_TREPORT_HOLD_MAX (CLOCK_SECOND*120)
+
+#define MY_COLLECT_DEFAULT_CONFIG { \
+                .topology_report = TOPOLOGY_REPORT, \
+                .piggybacking = PIGGYBACKING, \
+                .storing_mode = STORING_MODE, \
+                .beacon_interval = TRICKLE_IMIN, \
+                .treport_hold_time = TOPOLOGY_REPORT_HOLD_TIME, \
+                .rssi_threshold = RSSI_THRESHOLD, \
+}
+
+extern const struct my_collect_config my_collect_default_config;
+
 // --------------------------------------------------------------------
 
 /* Connection object */
@@ -56,46 +435,176 @@ struct my_collect_conn {
         // unicast connection object
         struct unicast_conn uc;
         const struct my_collect_callbacks* callbacks;
+        struct my_collect_config config;
         // address of parent node
         linkaddr_t parent;
         struct ctimer beacon_timer;
-        // metric: hop count
+        // Trickle state: current interval (0 while not started), consistent beacons
+        // heard in the interval, timer of the interval end
+        clock_time_t trickle_i;
+        uint8_t trickle_c;
+        struct ctimer trickle_timer;
+        // sink only: starts a new tree round after TREE_REFRESH_PERIODS expiries (TRICKLE_IMAX)
+        struct ctimer refresh_timer;
+        uint8_t refresh_periods;
+        // metric: expected transmissions to the sink through the parent (ETX_SCALE fixed point),
+        // and the metric of our last beacon (our descendants' metrics are above it)
         uint16_t metric;
+        uint16_t advertised_metric;
+        // link quality of the neighbors heard through beacons and unicast acks
+        Neighbor neighbors[MAX_NEIGHBORS];
         // sequence number of the tree protocol
         uint16_t beacon_seqn;
+        // root of the tree of the node (linkaddr_null while not connected, our address at a sink),
+        // and the tree rounds of the sinks heard (nodes only)
+        linkaddr_t sink;
+        SinkRound sinks[MAX_SINKS];
         // true if this node is the sink
         uint8_t is_sink; // 1: is_sink, 0: not_sink
-        // tree table (used only in the sink)
-        TreeDict routing_table;
+        // tree table, allocated at open for a sink only (NULL at the other nodes)
+        TreeDict* routing_table;
 
         // 1: Wait to send topology report (may be able to append to incoming t-report)
         // 0: Send topology report right away
         uint8_t treport_hold;
         struct ctimer treport_hold_timer;
+        // records of the reports forwarded by this node, sent with our own (if any)
+        // when treport_hold_timer expires
+        tree_connection treport_buf[TOPOLOGY_REPORT_MAX_RECORDS - 1];
+        uint8_t treport_len;
+
+        // Topology version: incremented at every parent change.
+        // The node piggybacks its parent only while the current version is not
+        // acknowledged (topo_version != topo_acked_version).
+        uint8_t topo_version;
+        uint8_t topo_acked_version;
+#if BEACON_MAX_ACKS > 0
+        // children whose record we received since our last beacon, listed in it
+        linkaddr_t beacon_acks[BEACON_MAX_ACKS];
+        uint8_t beacon_acks_len;
+#endif
+
+#if TOPOLOGY_SOLICIT
+        // 1 if the current tree round solicits topology reports (our beacons carry
+        // BEACON_SOLICIT and we answered). Sink: 1 for TOPOLOGY_SOLICIT_MIN_INTERVAL
+        // after a solicitation (a timer: a clock difference wraps with a 16-bit clock_time_t)
+        uint8_t solicited;
+        uint8_t solicit_wait;
+        struct ctimer solicit_timer;
+#endif
+
+        // Upward data aggregation (forwarding nodes): records waiting for the
+        // aggregation window to expire, sent to the parent in a single frame
+        uint8_t agg_buf[MAX_PACKET_LEN];
+        uint8_t agg_len; // bytes of data records in agg_buf
+        uint8_t agg_count; // number of data records in agg_buf
+        tree_connection agg_piggy[AGGREGATION_MAX_PIGGY];
+        uint8_t agg_piggy_len;
+#if ENERGY_REPORT
+        energy_record agg_energy[AGGREGATION_MAX_ENERGY];
+        uint8_t agg_energy_len;
+#endif
+        struct ctimer agg_timer;
+
+        // Outbound unicast queue (send_queue.c): every unicast packet waits here
+        // until it is acknowledged at the link layer or dropped. The entries come
+        // from the pool of the connection, the unused ones are in send_queue_free.
+        LIST_STRUCT(send_queue);
+        LIST_STRUCT(send_queue_free);
+        send_queue_entry send_queue_pool[SEND_QUEUE_SIZE];
+        struct ctimer send_timer;
+        uint8_t sending; // 1 while the head of the queue waits for the sent callback
+        uint16_t queue_drops; // packets dropped because the queue was full
+        uint16_t tx_drops; // packets dropped after MAX_RETRANSMISSIONS
+
+#if LATENCY_STATS
+        // Delay counters (clock ticks). Forwarding: data records held in the aggregation
+        // buffer. Queueing: packets from send_queue_add to the outcome of their last transmission.
+        uint32_t fwd_delay;
+        uint16_t fwd_records;
+        uint32_t queue_delay;
+        uint16_t queue_delay_max;
+        uint16_t queue_packets;
+        uint16_t agg_start; // start of the aggregation window
+        uint32_t agg_arrivals; // sum of the arrival times (from agg_start) of the records in agg_buf
+#endif
+
+#if ENERGY_REPORT
+        // Energy reports (energy_report.c): energest times at the last report,
+        // and the record waiting to be piggybacked while energy_pending is 1
+        struct ctimer energy_timer;
+        struct ctimer energy_hold_timer;
+        unsigned long energy_last[ENERGY_SAMPLES];
+        energy_record energy_rec;
+        uint8_t energy_pending;
+#endif
+
+#if LOOSE_SOURCE_ROUTING
+        // Waypoint of a loose source route (loose_routing.c): the packets waiting for
+        // the next segment of their route, and the last segments received
+        HeldPacket sr_held[LOOSE_ROUTING_HOLD_SLOTS];
+        SegmentCacheEntry sr_cache[LOOSE_ROUTING_CACHE_SIZE];
+        uint8_t sr_cache_next; // round robin replacement
+#endif
+
+#if DESCENDANT_TABLE_SIZE > 0
+        // Storing mode (descendant_table.c): descendants heard in the upward or downward
+        // traffic, most recently heard or used first
+        Descendant descendants[DESCENDANT_TABLE_SIZE];
+        uint8_t descendants_len;
+#endif
+
+#if ROUTING_CHECKPOINT
+        // Sink only (routing_checkpoint.c): routing table version and number of the last checkpoint
+        struct ctimer checkpoint_timer;
+        uint16_t checkpoint_version;
+        uint16_t checkpoint_seqn;
+#endif
 };
 typedef struct my_collect_conn my_collect_conn;
 
+/* Application callbacks
+ *  - hops -- hops travelled by the packet
+ *  - delay -- clock ticks the packet spent in the network (0 without LATENCY_STATS)
+ *  - energy_recv -- sink only, called for every energy report (optional, ENERGY_REPORT) */
 struct my_collect_callbacks {
-        void (* recv)(const linkaddr_t *originator, uint8_t hops);
-        void (* sr_recv)(struct my_collect_conn *ptr, uint8_t hops);
+        void (* recv)(const linkaddr_t *originator, uint8_t hops, uint16_t delay);
+        void (* sr_recv)(struct my_collect_conn *ptr, uint8_t hops, uint16_t delay);
+        void (* energy_recv)(const energy_record *report);
 };
 
 /* Initialize a collect connection
  *  - conn -- a pointer to a connection object
  *  - channels -- starting channel C (the collect uses two: C and C+1)
  *  - is_sink -- initialize in either sink or router mode
- *  - callbacks -- a pointer to the callback structure */
-void my_collect_open(struct my_collect_conn*, uint16_t, bool, const struct my_collect_callbacks*);
+ *  - callbacks -- a pointer to the callback structure
+ *  - config -- protocol parameters, copied in the connection (NULL: my_collect_default_config) */
+void my_collect_open(struct my_collect_conn*, uint16_t, bool, const struct my_collect_callbacks*,
+                     const struct my_collect_config*);
+
+/* Change the protocol parameters of an open connection */
+void my_collect_set_config(struct my_collect_conn*, const struct my_collect_config*);
 
 // -------- COMMUNICATION FUNCTIONS --------
 
 int  my_collect_send(struct my_collect_conn *c);
+int  packet_append(const void*, uint16_t);
 void bc_recv(struct broadcast_conn *conn, const linkaddr_t *sender);
 void uc_recv(struct unicast_conn *c, const linkaddr_t *from);
+void uc_sent(struct unicast_conn *c, int status, int num_tx);
 void send_beacon(struct my_collect_conn*);
+bool select_parent(my_collect_conn*);
+bool failover_parent(my_collect_conn*);
+void set_parent(my_collect_conn*, const linkaddr_t*);
 void send_topology_report(my_collect_conn*, uint8_t);
 void forward_upward_data(my_collect_conn *conn, const linkaddr_t *sender);
 void forward_downward_data(my_collect_conn*, const linkaddr_t*);
+int sr_send_path(my_collect_conn*, const linkaddr_t*, uint8_t);
+void topology_ack_record(my_collect_conn*, const linkaddr_t*, const tree_connection*);
+bool piggyback_pending(my_collect_conn*);
+#if LATENCY_STATS
+void packet_add_delay(uint16_t);
+#endif
 
 /*
    Source routing send function:
@@ -106,34 +615,145 @@ void forward_downward_data(my_collect_conn*, const linkaddr_t*);
  */
 int sr_send(struct my_collect_conn*, const linkaddr_t*);
 
+/*
+   Sink only: true if dest is in the partition of the sink, i.e. its routing
+   table leads from the sink to dest. With several sinks, the one owning the
+   destination is the one to call sr_send on.
+ */
+bool my_collect_owns(struct my_collect_conn*, const linkaddr_t*);
+
 void beacon_timer_cb(void* ptr);
+void trickle_interval_cb(void* ptr);
+void trickle_reset(my_collect_conn*);
+void tree_refresh_cb(void* ptr);
 
 // -------- MESSAGE STRUCTURES --------
 
-struct tree_connection {
-        linkaddr_t node;
-        linkaddr_t parent;
-} __attribute__((packed));
-typedef struct tree_connection tree_connection;
-
-// Beacon message structure
+// Beacon message structure, followed by the addresses of the children it
+// acknowledges (BEACON_MAX_ACKS at most)
 struct beacon_msg {
         uint16_t seqn;
-        uint16_t metric;
+        uint16_t metric; // path ETX of the sender (ETX_SCALE fixed point)
+        linkaddr_t sink; // root of the tree of the sender
+#if TOPOLOGY_SOLICIT
+        uint8_t flags;
+#endif
 } __attribute__((packed));
 typedef struct beacon_msg beacon_msg;
 
+// beacon_msg flags
+#define BEACON_SOLICIT 0x01 // the round solicits topology reports
+
+/*
+   On air layout of the unicast packets. Records added or removed by the
+   forwarders live at the end of the packet, so that a forwarder only updates
+   the fixed header in place and changes the packet length:
+
+   upward data:     [type][upward_data_packet_header][payload]
+                    [energy_record * energy_len][tree_connection * piggy_len]
+   downward data:   [type][downward_data_packet_header][payload][path: dest ... next hop]
+                    loose: [type][downward_data_packet_header][payload][dest][path: waypoint ... next hop]
+                    storing: [type][downward_data_packet_header][payload][dest]
+   segment request: [type][sr_segment_request]
+   topology report: [type][len][tree_connection * len]
+   aggregated data: [type][aggregated_data_packet_header][(aggregated_data_record, payload) * count]
+                    [energy_record * energy_len][tree_connection * piggy_len]
+   energy report:   [type][len][energy_record * len]
+
+   energy_len and the energy records are only present with ENERGY_REPORT.
+ */
+
 struct upward_data_packet_header { // Header structure for data packets
         linkaddr_t source;
         uint8_t hops;
         uint8_t piggy_len; // 0 in case there is no piggybacking
+#if ENERGY_REPORT
+        uint8_t energy_len; // energy_record before the piggybacked blocks (0 or 1)
+#endif
+#if LATENCY_STATS
+        uint16_t delay; // clock ticks spent in the network, updated at every transmission
+#endif
 } __attribute__((packed));
 typedef struct upward_data_packet_header upward_data_packet_header;
 
+// Source routing path encodings
+enum sr_path_fmt {
+        sr_path_full = 0,    // one linkaddr_t per hop
+        sr_path_compact = 1  // one byte per hop (u8[0]), u8[1] is shared and carried once in prefix
+};
+// Flags of path_fmt, above the encoding
+#define SR_PATH_LOOSE 0x80   // the path ends at a waypoint, the destination is stored before the path
+#define SR_PATH_SEGMENT 0x40 // the payload is the next segment of the packet held by the destination
+#define SR_PATH_STORING 0x20 // no path (path_len 0): every hop looks the destination up in its descendants
+#define SR_PATH_ENCODING(fmt) ((fmt) & 0x0f)
+
 struct downward_data_packet_header {
         uint8_t hops;
         uint8_t path_len;
+        uint8_t path_fmt; // enum sr_path_fmt
+        uint8_t prefix;   // u8[1] of every address in a compact path (unused for full paths)
+#if LATENCY_STATS
+        uint16_t delay;   // clock ticks spent in the network, updated at every transmission
+#endif
 } __attribute__((packed));
 typedef struct downward_data_packet_header downward_data_packet_header;
 
+// Asks the sink for the route from a waypoint to the destination of the packet it holds
+struct sr_segment_request {
+        linkaddr_t waypoint;
+        linkaddr_t dest;
+#if DESCENDANT_TABLE_SIZE > 0
+        uint8_t storing_miss; // 1 if the held packet came in storing mode (see descendant_table.c)
+#endif
+} __attribute__((packed));
+typedef struct sr_segment_request sr_segment_request;
+
+// Payload of a SR_PATH_SEGMENT packet, followed by the path: [sr_segment][path: dest|waypoint ... next hop]
+struct sr_segment {
+        linkaddr_t dest;  // destination of the held packet
+        uint8_t path_len;
+        uint8_t path_fmt; // as in downward_data_packet_header (SR_PATH_LOOSE for another waypoint)
+        uint8_t prefix;
+} __attribute__((packed));
+typedef struct sr_segment sr_segment;
+
+// Source routing paths (my_collect.c)
+uint8_t sr_path_plan(my_collect_conn*, int, downward_data_packet_header*);
+bool sr_path_append(my_collect_conn*, int, const downward_data_packet_header*);
+uint8_t sr_path_hop_size(uint8_t);
+void sr_path_read(const downward_data_packet_header*, const uint8_t*, linkaddr_t*);
+
+struct aggregated_data_packet_header {
+        uint8_t count;     // number of data records
+        uint8_t piggy_len; // tree_connection records at the end of the packet
+#if ENERGY_REPORT
+        uint8_t energy_len; // energy_record before the tree_connection records
+#endif
+} __attribute__((packed));
+typedef struct aggregated_data_packet_header aggregated_data_packet_header;
+
+// Header of each data record in an aggregated packet, followed by len payload bytes
+struct aggregated_data_record {
+        linkaddr_t source;
+        uint8_t hops;
+        uint8_t len;
+#if LATENCY_STATS
+        uint16_t delay; // as in upward_data_packet_header
+#endif
+} __attribute__((packed));
+typedef struct aggregated_data_record aggregated_data_record;
+
+// Delay field of a data header or record, 0 when the headers have none
+#if LATENCY_STATS
+#define PACKET_DELAY(hdr) ((hdr).delay)
+#else
+#define PACKET_DELAY(hdr) 0
+#endif
+// Number of energy records announced by a data header, 0 when the headers have none
+#if ENERGY_REPORT
+#define PACKET_ENERGY_LEN(hdr) ((hdr).energy_len)
+#else
+#define PACKET_ENERGY_LEN(hdr) 0
+#endif
+
 #endif //MY_COLLECT_H
@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "my_collect.h"
+#include "neighbor_table.h"
+
+/*
+   ------------ Link Estimation ------------
+ */
+
+// Exponentially weighted moving average, new samples weigh NEIGHBOR_EWMA_ALPHA/8
+static int16_t ewma(int16_t old, int16_t sample) {
+        return (old * (8 - NEIGHBOR_EWMA_ALPHA) + sample * NEIGHBOR_EWMA_ALPHA) / 8;
+}
+
+/*
+    Link ETX guessed from the RSSI, used until the first unicast to the
+    neighbor has been acknowledged or has failed: 1 transmission above
+    RSSI_GOOD, growing linearly up to ETX_RSSI_MAX at RSSI_THRESHOLD (the
+    default beacon threshold: the ramp does not follow the runtime value).
+ */
+static uint16_t rssi_to_etx(int16_t rssi) {
+        if (rssi >= RSSI_GOOD) {
+                return ETX_SCALE;
+        }
+        if (rssi <= RSSI_THRESHOLD) {
+                return ETX_RSSI_MAX * ETX_SCALE;
+        }
+        return ETX_SCALE + (uint16_t)(RSSI_GOOD - rssi) * (ETX_RSSI_MAX - 1) * ETX_SCALE /
+               (RSSI_GOOD - RSSI_THRESHOLD);
+}
+
+/*
+    Expected transmissions on the link to the neighbor (ETX_SCALE is one
+    transmission).
+ */
+uint16_t neighbor_link_etx(const Neighbor* n) {
+        return n->tx_samples > 0 ? n->etx : rssi_to_etx(n->rssi);
+}
+
+/*
+    Expected transmissions to the sink through the neighbor: the cost advertised
+    in its beacon plus the cost of the link to it.
+ */
+uint16_t neighbor_path_etx(const Neighbor* n) {
+        uint32_t cost = (uint32_t)n->metric + neighbor_link_etx(n);
+        return cost > 65535 ? 65535 : cost;
+}
+
+/*
+   ------------ Neighbor Table Management ------------
+ */
+
+void neighbor_table_init(my_collect_conn* conn) {
+        uint8_t i;
+        for (i = 0; i < MAX_NEIGHBORS; i++) {
+                linkaddr_copy(&conn->neighbors[i].addr, &linkaddr_null);
+        }
+        for (i = 0; i < MAX_SINKS; i++) {
+                linkaddr_copy(&conn->sinks[i].addr, &linkaddr_null);
+        }
+}
+
+/*
+    Index of the tree of sink in conn->sinks. A sink heard for the first time
+    gets an entry in round seqn. Returns -1 if the table is full.
+ */
+int neighbor_sink_index(my_collect_conn* conn, const linkaddr_t* sink, uint16_t seqn) {
+        uint8_t i;
+        for (i = 0; i < MAX_SINKS; i++) {
+                if (linkaddr_cmp(&conn->sinks[i].addr, sink)) {
+                        return i;
+                }
+        }
+        for (i = 0; i < MAX_SINKS; i++) {
+                if (linkaddr_cmp(&conn->sinks[i].addr, &linkaddr_null)) {
+                        linkaddr_copy(&conn->sinks[i].addr, sink);
+                        conn->sinks[i].seqn = seqn;
+                        return i;
+                }
+        }
+        return -1;
+}
+
+// Rounds of its tree since the last beacon of the neighbor
+static uint16_t neighbor_age(my_collect_conn* conn, const Neighbor* n) {
+        return conn->sinks[n->sink].seqn - n->beacon_seqn;
+}
+
+Neighbor* neighbor_find(my_collect_conn* conn, const linkaddr_t* addr) {
+        uint8_t i;
+        // the null address marks the empty entries (e.g. the parent of a disconnected node)
+        if (linkaddr_cmp(addr, &linkaddr_null)) {
+                return NULL;
+        }
+        for (i = 0; i < MAX_NEIGHBORS; i++) {
+                if (linkaddr_cmp(&conn->neighbors[i].addr, addr)) {
+                        return &conn->neighbors[i];
+                }
+        }
+        return NULL;
+}
+
+/*
+    A neighbor can be chosen as parent if it is connected to a tree and
+    has sent a beacon in the current round of that tree or in the previous one.
+ */
+bool neighbor_is_candidate(my_collect_conn* conn, const Neighbor* n) {
+        return n->metric != 65535 && neighbor_age(conn, n) <= 1;
+}
+
+/*
+    Entry to reuse for a new neighbor: an empty one, otherwise the neighbor
+    heard in the oldest round (the most expensive one among equals).
+    The parent is never replaced.
+ */
+static Neighbor* neighbor_victim(my_collect_conn* conn) {
+        Neighbor* victim = NULL;
+        uint16_t victim_age = 0;
+        uint8_t i;
+        for (i = 0; i < MAX_NEIGHBORS; i++) {
+                Neighbor* n = &conn->neighbors[i];
+                if (linkaddr_cmp(&n->addr, &linkaddr_null)) {
+                        return n;
+                }
+                uint16_t age = neighbor_age(conn, n);
+                if (linkaddr_cmp(&n->addr, &conn->parent)) {
+                        continue;
+                }
+                if (victim == NULL || age > victim_age ||
+                    (age == victim_age && neighbor_path_etx(n) > neighbor_path_etx(victim))) {
+                        victim = n;
+                        victim_age = age;
+                }
+        }
+        return victim;
+}
+
+/*
+    Record a beacon received from sender: advertised cost, tree (sink index
+    from neighbor_sink_index()), tree round and RSSI.
+    Returns the neighbor entry (NULL if the table is full).
+ */
+Neighbor* neighbor_update_beacon(my_collect_conn* conn, const linkaddr_t* sender, int8_t rssi,
+                                 const beacon_msg* beacon, uint8_t sink) {
+        Neighbor* n = neighbor_find(conn, sender);
+        if (n == NULL) {
+                n = neighbor_victim(conn);
+                if (n == NULL) {
+                        return NULL;
+                }
+                linkaddr_copy(&n->addr, sender);
+                n->rssi = rssi;
+                n->etx = 0;
+                n->tx_samples = 0;
+        } else {
+                n->rssi = ewma(n->rssi, rssi);
+        }
+        n->metric = beacon->metric;
+        n->beacon_seqn = beacon->seqn;
+        n->sink = sink;
+        return n;
+}
+
+/*
+    Record the outcome of a unicast transmission to receiver. An acknowledged
+    packet is a sample of num_tx transmissions, a lost one counts as
+    ETX_NOACK_PENALTY transmissions.
+ */
+void neighbor_update_tx(my_collect_conn* conn, const linkaddr_t* receiver, int status, int num_tx) {
+        Neighbor* n = neighbor_find(conn, receiver);
+        int16_t sample;
+        if (n == NULL) {
+                return;
+        }
+        if (status == MAC_TX_OK) {
+                sample = (num_tx > 0 ? num_tx : 1) * ETX_SCALE;
+        } else {
+                sample = ETX_NOACK_PENALTY * ETX_SCALE;
+        }
+        // the first sample replaces the RSSI guess
+        n->etx = n->tx_samples == 0 ? sample : ewma(n->etx, sample);
+        if (n->tx_samples < 255) {
+                n->tx_samples++;
+        }
+}
+
+/*
+    A neighbor advertising a metric not below the one of our last beacon may
+    be one of our descendants, whose metric is stale: choosing it would close
+    a loop.
+ */
+static bool neighbor_below(my_collect_conn* conn, const Neighbor* n) {
+        return n->metric < conn->advertised_metric;
+}
+
+/*
+    Candidate neighbor with the lowest path ETX, NULL if there is none.
+    Only the parent and the neighbors below our advertised metric are
+    considered (see neighbor_below).
+ */
+Neighbor* neighbor_best(my_collect_conn* conn) {
+        Neighbor* best = NULL;
+        uint8_t i;
+        for (i = 0; i < MAX_NEIGHBORS; i++) {
+                Neighbor* n = &conn->neighbors[i];
+                if (linkaddr_cmp(&n->addr, &linkaddr_null) || !neighbor_is_candidate(conn, n) ||
+                    (!neighbor_below(conn, n) && !linkaddr_cmp(&n->addr, &conn->parent))) {
+                        continue;
+                }
+                if (best == NULL || neighbor_path_etx(n) < neighbor_path_etx(best)) {
+                        best = n;
+                }
+        }
+        return best;
+}
+
+/*
+    Best backup parent: the candidate with the lowest path ETX other than the
+    parent. Only neighbors below our advertised metric are considered, so that
+    a node never falls back on one of its descendants (see neighbor_below).
+    NULL if there is none.
+ */
+Neighbor* neighbor_backup(my_collect_conn* conn) {
+        Neighbor* best = NULL;
+        uint8_t i;
+        for (i = 0; i < MAX_NEIGHBORS; i++) {
+                Neighbor* n = &conn->neighbors[i];
+                if (linkaddr_cmp(&n->addr, &linkaddr_null) || linkaddr_cmp(&n->addr, &conn->parent) ||
+                    !neighbor_is_candidate(conn, n) || !neighbor_below(conn, n)) {
+                        continue;
+                }
+                if (best == NULL || neighbor_path_etx(n) < neighbor_path_etx(best)) {
+                        best = n;
+                }
+        }
+        return best;
+}
+
+void print_neighbor_table(my_collect_conn* conn) {
+        uint8_t i;
+        printf("Neighbor table of %02x:%02x (ETX x%d)\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], ETX_SCALE);
+        for (i = 0; i < MAX_NEIGHBORS; i++) {
+                Neighbor* n = &conn->neighbors[i];
+                if (linkaddr_cmp(&n->addr, &linkaddr_null)) {
+                        continue;
+                }
+                printf("  %02x:%02x sink %02x:%02x seqn %u rssi %d link etx %u path etx %u%s\n",
+                       n->addr.u8[0], n->addr.u8[1], conn->sinks[n->sink].addr.u8[0], conn->sinks[n->sink].addr.u8[1],
+                       n->beacon_seqn, n->rssi,
+                       neighbor_link_etx(n), neighbor_path_etx(n),
+                       linkaddr_cmp(&n->addr, &conn->parent) ? " (parent)" : "");
+        }
+}
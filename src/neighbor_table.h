@@ -0,0 +1,16 @@
+#ifndef NEIGHBOR_TABLE_H
+#define NEIGHBOR_TABLE_H
+
+void neighbor_table_init(my_collect_conn*);
+Neighbor* neighbor_find(my_collect_conn*, const linkaddr_t*);
+int neighbor_sink_index(my_collect_conn*, const linkaddr_t*, uint16_t);
+Neighbor* neighbor_update_beacon(my_collect_conn*, const linkaddr_t*, int8_t, const beacon_msg*, uint8_t);
+void neighbor_update_tx(my_collect_conn*, const linkaddr_t*, int, int);
+bool neighbor_is_candidate(my_collect_conn*, const Neighbor*);
+uint16_t neighbor_link_etx(const Neighbor*);
+uint16_t neighbor_path_etx(const Neighbor*);
+Neighbor* neighbor_best(my_collect_conn*);
+Neighbor* neighbor_backup(my_collect_conn*);
+void print_neighbor_table(my_collect_conn*);
+
+#endif // NEIGHBOR_TABLE_H
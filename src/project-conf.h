@@ -14,13 +14,23 @@
 #define RF_BLE_CONF_ENABLED                   0
 /*---------------------------------------------------------------------------*/
 // https://github.com/contiki-os/contiki/wiki/Change-mac-or-radio-duty-cycling-protocols
-#undef NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE
+// RDC_CHANNEL_CHECK_RATE can be set at build time (sim/run_sweep.py), 0 selects nullrdc
+#ifndef RDC_CHANNEL_CHECK_RATE
 // default is 8
-#define NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE 8
+#define RDC_CHANNEL_CHECK_RATE 8
+#endif
+#undef NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE
 #undef NETSTACK_RDC
-// #define NETSTACK_RDC nullrdc_driver
+#if RDC_CHANNEL_CHECK_RATE == 0
+#define NETSTACK_RDC nullrdc_driver
+#else
+#define NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE RDC_CHANNEL_CHECK_RATE
 #define NETSTACK_RDC contikimac_driver
+#endif
 #define NULLRDC_802154_AUTOACK 1
 /*---------------------------------------------------------------------------*/
+/* Energest counters, read by the energy reports (ENERGY_REPORT) */
+#define ENERGEST_CONF_ON 1
+/*---------------------------------------------------------------------------*/
 #endif /* PROJECT_CONF_H_ */
 /*---------------------------------------------------------------------------*/
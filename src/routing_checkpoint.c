@@ -0,0 +1,196 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "cfs/cfs.h"
+#include "lib/crc16.h"
+#include "my_collect.h"
+#include "routing_table.h"
+#include "routing_checkpoint.h"
+#include "event_log.h"
+
+#if ROUTING_CHECKPOINT
+/*
+    Checkpoint file: a header and len tree_connection records (node, parent).
+    Checkpoints alternate between two files, so a reset while one is written
+    leaves the previous checkpoint intact: the complete file (CRC-16 of the
+    records and the header) with the latest seqn is restored. A file of
+    another CHECKPOINT_FORMAT (older firmware) is ignored.
+ */
+#define CHECKPOINT_MAGIC 0x5254
+#define CHECKPOINT_FORMAT 1
+
+struct checkpoint_header {
+        uint16_t magic;
+        uint8_t format;
+        uint16_t seqn; // checkpoint number
+        uint16_t beacon_seqn; // tree round of the sink
+        uint16_t len;
+        uint16_t crc; // last field, not covered by the CRC
+} __attribute__((packed));
+
+static const char* const checkpoint_files[2] = {"rtable.0", "rtable.1"};
+
+#define HEADER_CRC_LEN offsetof(struct checkpoint_header, crc)
+
+// The record of a slot of the table, false if the slot is empty or its parent was dropped
+static bool entry_record(const DictEntry* e, tree_connection* tc) {
+        linkaddr_copy(&tc->node, &e->key);
+        linkaddr_copy(&tc->parent, &e->value);
+        return !linkaddr_cmp(&e->key, &linkaddr_null) && !linkaddr_cmp(&e->value, &linkaddr_null);
+}
+
+// Write the routing table to the file of the next checkpoint
+static void checkpoint_save(my_collect_conn* conn) {
+        TreeDict* dict = conn->routing_table;
+        struct checkpoint_header h = {.magic=CHECKPOINT_MAGIC, .format=CHECKPOINT_FORMAT,
+                                      .seqn=conn->checkpoint_seqn + 1, .beacon_seqn=conn->beacon_seqn, .len=0};
+        tree_connection tc;
+        uint16_t crc = 0;
+        bool ok;
+        int i, fd;
+
+        for (i = 0; i < DICT_CAPACITY; i++) {
+                if (entry_record(&dict->entries[i], &tc)) {
+                        crc = crc16_data((const unsigned char*)&tc, sizeof(tc), crc);
+                        h.len++;
+                }
+        }
+        h.crc = crc16_data((const unsigned char*)&h, HEADER_CRC_LEN, crc);
+
+        cfs_remove(checkpoint_files[h.seqn % 2]);
+        fd = cfs_open(checkpoint_files[h.seqn % 2], CFS_WRITE);
+        ok = fd >= 0 && cfs_write(fd, &h, sizeof(h)) == sizeof(h);
+        for (i = 0; ok && i < DICT_CAPACITY; i++) {
+                if (entry_record(&dict->entries[i], &tc)) {
+                        ok = cfs_write(fd, &tc, sizeof(tc)) == sizeof(tc);
+                }
+        }
+        if (fd >= 0) {
+                cfs_close(fd);
+        }
+        if (!ok) {
+                EVENT_LOG(EV_CHECKPOINT_ERROR, h.seqn);
+                return;
+        }
+        conn->checkpoint_seqn = h.seqn;
+        conn->checkpoint_version = dict->version;
+        EVENT_LOG(EV_CHECKPOINT_SAVE, h.seqn, h.len);
+}
+
+// True if the file holds a complete checkpoint, whose header is read into h
+static bool checkpoint_valid(const char* name, struct checkpoint_header* h) {
+        tree_connection tc;
+        uint16_t crc = 0;
+        uint16_t i;
+        bool ok;
+        int fd = cfs_open(name, CFS_READ);
+
+        if (fd < 0) {
+                return false;
+        }
+        ok = cfs_read(fd, h, sizeof(*h)) == sizeof(*h) && h->magic == CHECKPOINT_MAGIC &&
+             h->format == CHECKPOINT_FORMAT && h->len <= MAX_NODES;
+        for (i = 0; ok && i < h->len; i++) {
+                ok = cfs_read(fd, &tc, sizeof(tc)) == sizeof(tc);
+                crc = crc16_data((const unsigned char*)&tc, sizeof(tc), crc);
+        }
+        cfs_close(fd);
+        return ok && crc16_data((const unsigned char*)h, HEADER_CRC_LEN, crc) == h->crc;
+}
+
+// Load the records of a valid checkpoint as provisional entries
+static void checkpoint_load(my_collect_conn* conn, const char* name, const struct checkpoint_header* h) {
+        tree_connection tc;
+        uint16_t i;
+        int fd = cfs_open(name, CFS_READ);
+
+        if (fd < 0) {
+                return;
+        }
+        cfs_seek(fd, sizeof(*h), CFS_SEEK_SET);
+        for (i = 0; i < h->len && cfs_read(fd, &tc, sizeof(tc)) == sizeof(tc); i++) {
+                if (dict_add(conn->routing_table, tc.node, tc.parent) == 0) {
+                        dict_set_provisional(conn->routing_table, tc.node, true);
+                }
+        }
+        cfs_close(fd);
+}
+#endif
+
+/*
+   ------------ TIMER Callbacks ------------
+ */
+
+/*
+    Sink only, at open: restore the latest checkpoint into the empty routing
+    table, then save a new checkpoint every ROUTING_CHECKPOINT_INTERVAL in
+    which the table changed. The restored entries are provisional: the
+    topology reports and piggybacked parents that arrive confirm or replace
+    them, and routing_checkpoint_check validates the others lazily.
+    The tree round continues from the saved one, so the nodes follow the
+    beacons of the restarted sink.
+ */
+void routing_checkpoint_init(my_collect_conn* conn) {
+#if ROUTING_CHECKPOINT
+        struct checkpoint_header h[2];
+        int8_t latest = -1;
+        uint8_t i;
+
+        for (i = 0; i < 2; i++) {
+                if (checkpoint_valid(checkpoint_files[i], &h[i]) &&
+                    (latest == -1 || (int16_t)(h[i].seqn - h[latest].seqn) > 0)) {
+                        latest = i;
+                }
+        }
+        conn->checkpoint_seqn = 0;
+        if (latest != -1) {
+                checkpoint_load(conn, checkpoint_files[latest], &h[latest]);
+                conn->checkpoint_seqn = h[latest].seqn;
+                conn->beacon_seqn = h[latest].beacon_seqn + 1;
+                EVENT_LOG(EV_CHECKPOINT_RESTORE, h[latest].seqn, conn->routing_table->len, h[latest].beacon_seqn);
+        }
+        conn->checkpoint_version = conn->routing_table->version;
+        ctimer_set(&conn->checkpoint_timer, ROUTING_CHECKPOINT_INTERVAL, routing_checkpoint_timer_cb, conn);
+#endif
+}
+
+void routing_checkpoint_timer_cb(void* ptr) {
+#if ROUTING_CHECKPOINT
+        struct my_collect_conn *conn = ptr;
+        ctimer_set(&conn->checkpoint_timer, ROUTING_CHECKPOINT_INTERVAL, routing_checkpoint_timer_cb, conn);
+        if (conn->routing_table->version != conn->checkpoint_version) {
+                checkpoint_save(conn);
+        }
+#endif
+}
+
+/*
+    Lazy validation of a restored entry, when the sink receives a data packet
+    of node after hops hops. Upward data follows the tree: a restored route of
+    the same length confirms the entry. A different length means the tree
+    changed while the sink was off and the node does not know that the sink
+    lost its report: the entry is dropped until the node reports its parent
+    again. An entry is checked once, by the first data packet of the node
+    that finds a complete route to compare with.
+ */
+void routing_checkpoint_check(my_collect_conn* conn, const linkaddr_t* node, uint8_t hops) {
+#if ROUTING_CHECKPOINT
+        int route_len;
+
+        if (!dict_provisional(conn->routing_table, *node)) {
+                return;
+        }
+        route_len = find_route(conn, node);
+        if (route_len == 0) {
+                // no complete route yet (ancestor unknown or loop): provisional until a
+                // later packet of the node, once the ancestors reported their parents
+                return;
+        }
+        if (route_len == hops) {
+                EVENT_LOG(EV_CHECKPOINT_CONFIRM, node->u8[0], node->u8[1], route_len);
+                dict_set_provisional(conn->routing_table, *node, false);
+        } else {
+                EVENT_LOG(EV_CHECKPOINT_STALE, node->u8[0], node->u8[1], route_len, hops);
+                dict_drop(conn->routing_table, *node);
+        }
+#endif
+}
@@ -0,0 +1,8 @@
+#ifndef ROUTING_CHECKPOINT_H
+#define ROUTING_CHECKPOINT_H
+
+void routing_checkpoint_init(my_collect_conn*);
+void routing_checkpoint_timer_cb(void*);
+void routing_checkpoint_check(my_collect_conn*, const linkaddr_t*, uint8_t);
+
+#endif // ROUTING_CHECKPOINT_H
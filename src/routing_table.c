@@ -1,14 +1,138 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "my_collect.h"
+#include "event_log.h"
 
 // -------------------------------------------------------------------------------------------------
 //                                      DICT IMPLEMENTATION
 // -------------------------------------------------------------------------------------------------
 
+/*
+    Home slot of a key in the hash index.
+    Fibonacci hashing on the 16 bit address: node ids are usually
+    consecutive, the multiplication spreads them over the whole table.
+ */
+static uint16_t dict_hash(const linkaddr_t* key) {
+        uint16_t k = key->u8[0] | ((uint16_t)key->u8[1] << 8);
+        return (uint16_t)(k * 40503u) >> (16 - DICT_CAPACITY_BITS);
+}
+
+/*
+    Linear probing from the home slot of key.
+    Returns the slot holding key, or the first empty slot of the
+    probe sequence if the key is not present (-1 if the table is full).
+ */
+static int dict_probe(TreeDict* dict, const linkaddr_t* key) {
+        uint16_t slot = dict_hash(key);
+        uint16_t n;
+        for (n = 0; n < DICT_CAPACITY; n++) {
+                DictEntry* e = &dict->entries[slot];
+                if (linkaddr_cmp(&e->key, key) || linkaddr_cmp(&e->key, &linkaddr_null)) {
+                        break;
+                }
+                slot = (slot + 1) & (DICT_CAPACITY - 1);
+        }
+        dict->lookups++;
+        dict->probes += n + 1;
+        if (n + 1 > dict->max_probe) {
+                dict->max_probe = n + 1 > 255 ? 255 : n + 1;
+        }
+        return n == DICT_CAPACITY ? -1 : slot;
+}
+
+// -------------------------------------------------------------------------------------------------
+//                                      ROUTE CACHE
+// -------------------------------------------------------------------------------------------------
+
+#if ROUTE_CACHE_SIZE > 0
+/*
+    Drop every cached route that goes through node.
+    Called when the parent of node changes: the routes to node and to all its
+    descendants (its subtree) are exactly the cached paths containing node,
+    any other cached route is still valid.
+ */
+static void route_cache_invalidate(TreeDict* dict, const linkaddr_t* node) {
+        uint8_t i, j;
+        for (i = 0; i < ROUTE_CACHE_SIZE; i++) {
+                RouteCacheEntry* e = &dict->route_cache[i];
+                if (linkaddr_cmp(&e->dest, &linkaddr_null)) {
+                        continue;
+                }
+                for (j = 0; j < e->path_len; j++) {
+                        if (linkaddr_cmp(&e->path[j], node)) {
+                                linkaddr_copy(&e->dest, &linkaddr_null);
+                                break;
+                        }
+                }
+        }
+}
+
+static RouteCacheEntry* route_cache_find(TreeDict* dict, const linkaddr_t* dest) {
+        uint8_t i;
+        for (i = 0; i < ROUTE_CACHE_SIZE; i++) {
+                if (linkaddr_cmp(&dict->route_cache[i].dest, dest)) {
+                        dict->route_cache[i].used = ++dict->route_cache_clock;
+                        return &dict->route_cache[i];
+                }
+        }
+        return NULL;
+}
+
+/*
+    Cache the route in tree_path, in an unused entry or in place of the least
+    recently used one (ages are counted modulo 2^16 uses).
+ */
+static void route_cache_store(TreeDict* dict, const linkaddr_t* dest, uint8_t path_len) {
+        RouteCacheEntry* e = &dict->route_cache[0];
+        uint8_t i;
+        for (i = 0; i < ROUTE_CACHE_SIZE && !linkaddr_cmp(&e->dest, &linkaddr_null); i++) {
+                RouteCacheEntry* c = &dict->route_cache[i];
+                if (linkaddr_cmp(&c->dest, &linkaddr_null) ||
+                    (uint16_t)(dict->route_cache_clock - c->used) > (uint16_t)(dict->route_cache_clock - e->used)) {
+                        e = c;
+                }
+        }
+        e->used = ++dict->route_cache_clock;
+        linkaddr_copy(&e->dest, dest);
+        e->path_len = path_len;
+        memcpy(e->path, dict->tree_path, sizeof(linkaddr_t) * path_len);
+}
+#endif
+
+void dict_init(TreeDict* dict) {
+        int i;
+        for (i = 0; i < DICT_CAPACITY; i++) {
+                linkaddr_copy(&dict->entries[i].key, &linkaddr_null);
+                linkaddr_copy(&dict->entries[i].value, &linkaddr_null);
+        }
+        dict->len = 0;
+        dict->version = 0;
+        dict->lookups = 0;
+        dict->probes = 0;
+        dict->max_probe = 0;
+#if ROUTE_CACHE_SIZE > 0
+        for (i = 0; i < ROUTE_CACHE_SIZE; i++) {
+                linkaddr_copy(&dict->route_cache[i].dest, &linkaddr_null);
+        }
+        dict->route_cache_clock = 0;
+        dict->route_cache_hits = 0;
+        dict->route_cache_misses = 0;
+#endif
+#if ROUTING_CHECKPOINT
+        memset(dict->provisional, 0, sizeof(dict->provisional));
+#endif
+#if DESCENDANT_TABLE_SIZE > 0
+        memset(dict->storing, 0, sizeof(dict->storing));
+        memset(dict->storing_stamp, 0, sizeof(dict->storing_stamp));
+#endif
+}
+
 void print_dict_state(TreeDict* dict) {
         int i;
-        for (i = 0; i < dict->len; i++) {
+        for (i = 0; i < DICT_CAPACITY; i++) {
+                if (linkaddr_cmp(&dict->entries[i].key, &linkaddr_null)) {
+                        continue;
+                }
                 printf("\tDictEntry %d: node %02x:%02x - parent %02x:%02x\n",
                        i,
                        dict->entries[i].key.u8[0],
@@ -18,15 +142,29 @@ void print_dict_state(TreeDict* dict) {
         }
 }
 
+/*
+    Occupancy and probe length statistics of the hash index.
+    Average probe length is printed in hundredths to avoid floats on the mote.
+ */
+void print_dict_stats(TreeDict* dict) {
+        uint32_t avg = dict->lookups ? (dict->probes * 100) / dict->lookups : 0;
+        printf("Dictionary stats: occupancy %d/%d (max %d) lookups %lu avg probe %lu.%02lu max probe %u\n",
+               dict->len, DICT_CAPACITY, MAX_NODES,
+               (unsigned long)dict->lookups,
+               (unsigned long)(avg / 100), (unsigned long)(avg % 100),
+               dict->max_probe);
+#if ROUTE_CACHE_SIZE > 0
+        printf("Route cache stats: hits %lu misses %lu\n",
+               (unsigned long)dict->route_cache_hits, (unsigned long)dict->route_cache_misses);
+#endif
+}
+
 int dict_find_index(TreeDict* dict, const linkaddr_t key) {
-        int i;
-        for (i = 0; i < dict->len; i++) {
-                DictEntry tmp = dict->entries[i];
-                if (linkaddr_cmp(&(tmp.key), &key) != 0) {
-                        return i;
-                }
+        int slot = dict_probe(dict, &key);
+        if (slot == -1 || linkaddr_cmp(&dict->entries[slot].key, &linkaddr_null)) {
+                return -1;
         }
-        return -1;
+        return slot;
 }
 
 linkaddr_t dict_find(TreeDict* dict, const linkaddr_t *key) {
@@ -45,25 +183,222 @@ int dict_add(TreeDict* dict, const linkaddr_t key, linkaddr_t value) {
            Adds a new entry to the Dictionary
            In case the key already exists, it replaces the value
          */
-        printf("Dictionary add: key: %02x:%02x value: %02x:%02x\n",
-               key.u8[0], key.u8[1], value.u8[0], value.u8[1]);
-        int idx = dict_find_index(dict, key);
-        if (idx != -1) { // Element already present, update its value
+        EVENT_LOG(EV_DICT_ADD,
+                  key.u8[0], key.u8[1], value.u8[0], value.u8[1]);
+        if (linkaddr_cmp(&key, &linkaddr_null)) {
+                return -1; // null address is the empty slot marker
+        }
+        int idx = dict_probe(dict, &key);
+        if (idx != -1 && linkaddr_cmp(&dict->entries[idx].key, &key)) {
+                // Element already present, update its value
+                if (!linkaddr_cmp(&dict->entries[idx].value, &value)) {
+#if ROUTE_CACHE_SIZE > 0
+                        route_cache_invalidate(dict, &key);
+#endif
+                        dict->version++;
+#if DESCENDANT_TABLE_SIZE > 0
+                        // the storing mode destinations below key see the stamp (see dict_storing)
+                        dict->storing[idx / 8] &= ~(1 << (idx % 8));
+                        dict->storing_stamp[idx] = dict->version;
+#endif
+                }
+#if ROUTING_CHECKPOINT
+                // fresh information from the network confirms a restored entry
+                dict->provisional[idx / 8] &= ~(1 << (idx % 8));
+#endif
                 linkaddr_copy(&dict->entries[idx].value, &value);
                 return 0;
         }
         // Try to insert new element
-        if (dict->len == MAX_NODES) {
-                printf("Dictionary is full. MAX_NODES cap reached. Proposed key: %02x:%02x value: %02x:%02x\n",
-                       key.u8[0], key.u8[1], value.u8[0], value.u8[1]);
+        if (idx == -1 || dict->len == MAX_NODES) {
+                EVENT_LOG(EV_DICT_FULL,
+                          key.u8[0], key.u8[1], value.u8[0], value.u8[1]);
                 return -1;
         }
-        linkaddr_copy(&dict->entries[dict->len].key, &key);
-        linkaddr_copy(&dict->entries[dict->len].value, &value);
+        linkaddr_copy(&dict->entries[idx].key, &key);
+        linkaddr_copy(&dict->entries[idx].value, &value);
         dict->len++;
+        dict->version++;
+#if DESCENDANT_TABLE_SIZE > 0
+        dict->storing_stamp[idx] = dict->version;
+#endif
         return 0;
 }
 
+#if ROUTING_CHECKPOINT
+/*
+    Provisional entries: restored from a checkpoint (routing_checkpoint.c) and
+    not yet confirmed by the network. dict_add confirms an entry.
+ */
+void dict_set_provisional(TreeDict* dict, const linkaddr_t key, bool provisional) {
+        int idx = dict_find_index(dict, key);
+        if (idx == -1) {
+                return;
+        }
+        if (provisional) {
+                dict->provisional[idx / 8] |= 1 << (idx % 8);
+        } else {
+                dict->provisional[idx / 8] &= ~(1 << (idx % 8));
+        }
+}
+
+bool dict_provisional(TreeDict* dict, const linkaddr_t key) {
+        int idx = dict_find_index(dict, key);
+        return idx != -1 && (dict->provisional[idx / 8] & (1 << (idx % 8)));
+}
+#endif
+
+#if DESCENDANT_TABLE_SIZE > 0
+/*
+    Storing mode destinations (descendant_table.c): the hops to key learned it
+    from a source routed packet, and no storing mode packet missed it since.
+    Cleared at every tree round, and when the parent of a node on the route
+    changes: a node that gets a new parent only clears its own bit and stamps
+    its slot with the table version, dict_storing compares the stamps of the
+    ancestors of key with the one of key when a route is planned.
+ */
+void dict_set_storing(TreeDict* dict, const linkaddr_t key, bool storing) {
+        int idx = dict_find_index(dict, key);
+        if (idx == -1) {
+                return;
+        }
+        if (storing) {
+                dict->storing[idx / 8] |= 1 << (idx % 8);
+                dict->storing_stamp[idx] = dict->version;
+        } else {
+                dict->storing[idx / 8] &= ~(1 << (idx % 8));
+        }
+}
+
+/*
+    True if key is marked storing and no ancestor of key got a new parent
+    since (stamps compared modulo 2^16: the marks last one tree round).
+    An ancestor marked storing after key also counts as moved, which only
+    costs a source routed packet. A stale mark is cleared on the way.
+ */
+bool dict_storing(TreeDict* dict, const linkaddr_t key) {
+        int idx = dict_find_index(dict, key);
+        int hop, hops;
+        linkaddr_t node;
+        if (idx == -1 || !(dict->storing[idx / 8] & (1 << (idx % 8)))) {
+                return false;
+        }
+        node = dict->entries[idx].value;
+        for (hops = 0; hops < dict->len && (hop = dict_find_index(dict, node)) != -1; hops++) {
+                if ((int16_t)(dict->storing_stamp[hop] - dict->storing_stamp[idx]) > 0) {
+                        dict->storing[idx / 8] &= ~(1 << (idx % 8));
+                        return false;
+                }
+                node = dict->entries[hop].value;
+        }
+        return true;
+}
+
+void dict_clear_storing(TreeDict* dict) {
+        memset(dict->storing, 0, sizeof(dict->storing));
+}
+#endif
+
+#if ROUTING_CHECKPOINT || DESCENDANT_TABLE_SIZE > 0
+// Move the slot bit from to to (the slot from is emptied)
+static void dict_move_bit(uint8_t* bits, int from, int to) {
+        if (bits[from / 8] & (1 << (from % 8))) {
+                bits[to / 8] |= 1 << (to % 8);
+        } else {
+                bits[to / 8] &= ~(1 << (to % 8));
+        }
+        bits[from / 8] &= ~(1 << (from % 8));
+}
+#endif
+
+/*
+    Empty the slot idx. Linear probing needs no tombstone: the following
+    entries of the probe sequence move back into the hole, unless their home
+    slot comes after it, so every key stays reachable from its home slot.
+ */
+static void dict_remove_slot(TreeDict* dict, int idx) {
+        uint16_t hole = idx, slot = idx;
+        for (;;) {
+                slot = (slot + 1) & (DICT_CAPACITY - 1);
+                DictEntry* e = &dict->entries[slot];
+                if (linkaddr_cmp(&e->key, &linkaddr_null)) {
+                        break;
+                }
+                // probe distance of the entry against the distance from the hole
+                if (((slot - dict_hash(&e->key)) & (DICT_CAPACITY - 1)) < ((slot - hole) & (DICT_CAPACITY - 1))) {
+                        continue;
+                }
+                dict->entries[hole] = *e;
+#if ROUTING_CHECKPOINT
+                dict_move_bit(dict->provisional, slot, hole);
+#endif
+#if DESCENDANT_TABLE_SIZE > 0
+                dict_move_bit(dict->storing, slot, hole);
+                dict->storing_stamp[hole] = dict->storing_stamp[slot];
+#endif
+                hole = slot;
+        }
+        linkaddr_copy(&dict->entries[hole].key, &linkaddr_null);
+        linkaddr_copy(&dict->entries[hole].value, &linkaddr_null);
+#if ROUTING_CHECKPOINT
+        dict->provisional[hole / 8] &= ~(1 << (hole % 8));
+#endif
+#if DESCENDANT_TABLE_SIZE > 0
+        dict->storing[hole / 8] &= ~(1 << (hole % 8));
+#endif
+}
+
+/*
+    Remove key from the table: routes to key and its subtree fail until the
+    node reports its parent again. The slot is free for another node.
+ */
+void dict_drop(TreeDict* dict, const linkaddr_t key) {
+        int idx = dict_find_index(dict, key);
+        if (idx == -1) {
+                return;
+        }
+#if ROUTE_CACHE_SIZE > 0
+        route_cache_invalidate(dict, &key);
+#endif
+        // a node added again later gets a new stamp (see dict_storing)
+        dict_remove_slot(dict, idx);
+        dict->len--;
+        dict->version++;
+}
+
+/*
+    Forget the parents of key and of every node whose route goes through key
+    (the subtree left for the tree of another sink). The entries of the
+    subtree are first pointed at key, so that the walk up from any of them
+    still reaches key after its ancestors were visited.
+ */
+void dict_drop_subtree(TreeDict* dict, const linkaddr_t key) {
+        int i;
+        for (i = 0; i < DICT_CAPACITY; i++) {
+                linkaddr_t node = dict->entries[i].value;
+                int hops = 0;
+                if (linkaddr_cmp(&dict->entries[i].key, &linkaddr_null)) {
+                        continue;
+                }
+                while (!linkaddr_cmp(&node, &key) && !linkaddr_cmp(&node, &linkaddr_null) && hops++ <= dict->len) {
+                        node = dict_find(dict, &node);
+                }
+                if (linkaddr_cmp(&node, &key)) {
+                        linkaddr_copy(&dict->entries[i].value, &key);
+                }
+        }
+        for (i = 0; i < DICT_CAPACITY; ) {
+                if (linkaddr_cmp(&dict->entries[i].value, &key) &&
+                    !linkaddr_cmp(&dict->entries[i].key, &linkaddr_null)) {
+                        // the next entry of the probe sequence may move to the slot: look at it again
+                        dict_drop(dict, dict->entries[i].key);
+                } else {
+                        i++;
+                }
+        }
+        dict_drop(dict, key);
+}
+
 // -------------------------------------------------------------------------------------------------
 //                                      ROUTING TABLE MANAGEMENT
 // -------------------------------------------------------------------------------------------------
@@ -73,7 +408,7 @@ int dict_add(TreeDict* dict, const linkaddr_t key, linkaddr_t value) {
  */
 void init_routing_path(my_collect_conn* conn) {
         int i = 0;
-        linkaddr_t* path_ptr = conn->routing_table.tree_path;
+        linkaddr_t* path_ptr = conn->routing_table->tree_path;
         while(i < MAX_PATH_LENGTH) {
                 linkaddr_copy(path_ptr, &linkaddr_null);
                 path_ptr++;
@@ -88,7 +423,7 @@ void init_routing_path(my_collect_conn* conn) {
 int already_in_route(my_collect_conn* conn, uint8_t len, linkaddr_t* target) {
         int i;
         for (i = 0; i < len; i++) {
-                if (linkaddr_cmp(&conn->routing_table.tree_path[i], target)) {
+                if (linkaddr_cmp(&conn->routing_table->tree_path[i], target)) {
                         return true;
                 }
         }
@@ -96,49 +431,174 @@ int already_in_route(my_collect_conn* conn, uint8_t len, linkaddr_t* target) {
 }
 
 /*
-    Search for a path from the sink to the destination node, going backwards
-    from the destiantion throught the parents. If not proper path is found returns 0,
-    otherwise the path length.
-    The linkddr_t addresses of the nodes in the path are written to the tree_path
-    array in the conn object.
+    Reverse the hops from..to-1 of the path.
  */
-int find_route(my_collect_conn* conn, const linkaddr_t *dest) {
-        init_routing_path(conn);
+static void reverse_path(linkaddr_t* path, int from, int to) {
+        linkaddr_t tmp;
+        for (to--; from < to; from++, to--) {
+                tmp = path[from];
+                path[from] = path[to];
+                path[to] = tmp;
+        }
+}
 
-        uint8_t path_len = 0;
+/*
+    Walk the parents from dest up to root, writing the nodes to the tree_path
+    array (tree_path[0] is dest). Returns the number of hops from root to dest,
+    0 if a node has no parent or the path presents a loop.
+    With LOOSE_SOURCE_ROUTING the route may be longer than MAX_PATH_LENGTH:
+    tree_path is filled as a ring and ends up with the MAX_PATH_LENGTH hops
+    nearest to root, in the same order.
+ */
+static int walk_route(my_collect_conn* conn, const linkaddr_t* dest, const linkaddr_t* root) {
+        linkaddr_t* path = conn->routing_table->tree_path;
+        int route_len = 0;
         linkaddr_t parent;
         linkaddr_copy(&parent, dest);
+        init_routing_path(conn);
         do {
+#if !LOOSE_SOURCE_ROUTING
+                if (route_len == MAX_PATH_LENGTH) {
+                        // path too long
+                        EVENT_LOG(EV_ROUTE_TOO_LONG,
+                                  (*dest).u8[0], (*dest).u8[1]);
+                        return 0;
+                }
+#endif
                 // copy into path the fist entry (dest node)
-                memcpy(&conn->routing_table.tree_path[path_len], &parent, sizeof(linkaddr_t));
-                parent = dict_find(&conn->routing_table, &parent);
+                memcpy(&path[route_len % MAX_PATH_LENGTH], &parent, sizeof(linkaddr_t));
+                parent = dict_find(conn->routing_table, &parent);
+                route_len++;
                 // abort in case a node has no parent or the path presents a loop
+                // (a route has at most one hop per node in the table)
                 if (linkaddr_cmp(&parent, &linkaddr_null) ||
-                    already_in_route(conn, path_len, &parent))
+                    already_in_route(conn, route_len < MAX_PATH_LENGTH ? route_len : MAX_PATH_LENGTH, &parent) ||
+                    route_len > conn->routing_table->len)
                 {
-                        printf("PATH ERROR: cannot build path for destination node: %02x:%02x. Loop detected.\n",
-                               (*dest).u8[0], (*dest).u8[1]);
+                        EVENT_LOG(EV_ROUTE_LOOP,
+                                  (*dest).u8[0], (*dest).u8[1]);
                         return 0;
                 }
-                path_len++;
-        } while (!linkaddr_cmp(&parent, &sink_addr) && path_len < 10);
+        } while (!linkaddr_cmp(&parent, root));
+
+        if (route_len > MAX_PATH_LENGTH) {
+                // rotate the ring: the oldest hop kept, at route_len % MAX_PATH_LENGTH, goes first
+                reverse_path(path, 0, route_len % MAX_PATH_LENGTH);
+                reverse_path(path, route_len % MAX_PATH_LENGTH, MAX_PATH_LENGTH);
+                reverse_path(path, 0, MAX_PATH_LENGTH);
+        }
+        return route_len;
+}
+
+/*
+    Search for a path from this sink to the destination node, going backwards
+    from the destiantion throught the parents. If not proper path is found returns 0,
+    otherwise the path length.
+    The linkddr_t addresses of the nodes in the path are written to the tree_path
+    array in the conn object (at most MAX_PATH_LENGTH, see walk_route).
+    Routes are served from the route cache when possible; a cached route stays
+    valid until the parent of one of its nodes changes (see dict_add).
+ */
+int find_route(my_collect_conn* conn, const linkaddr_t *dest) {
+#if ROUTE_CACHE_SIZE > 0
+        RouteCacheEntry* cached = route_cache_find(conn->routing_table, dest);
+        if (cached != NULL) {
+                conn->routing_table->route_cache_hits++;
+                memcpy(conn->routing_table->tree_path, cached->path, sizeof(linkaddr_t) * cached->path_len);
+                return cached->path_len;
+        }
+        conn->routing_table->route_cache_misses++;
+#endif
+        int route_len = walk_route(conn, dest, &conn->sink);
+#if ROUTE_CACHE_SIZE > 0
+        if (route_len > 0 && route_len <= MAX_PATH_LENGTH) {
+                route_cache_store(conn->routing_table, dest, route_len);
+        }
+#endif
+        return route_len;
+}
 
-        if (path_len > 10) {
-                // path too long
-                printf("PATH ERROR: Path too long for destination node: %02x:%02x\n",
-                       (*dest).u8[0], (*dest).u8[1]);
+/*
+    The segment of the route to dest that starts at waypoint, as find_route
+    (tree_path[0] is dest). A waypoint that is no longer an ancestor of dest
+    (a storing mode packet followed stale descendant entries to it) gets the
+    route up its parents to the nearest common ancestor, then down to dest,
+    if it fits in MAX_PATH_LENGTH hops. Returns 0 if there is none.
+ */
+int find_segment(my_collect_conn* conn, const linkaddr_t* waypoint, const linkaddr_t* dest) {
+        linkaddr_t up[MAX_PATH_LENGTH];
+        linkaddr_t node;
+        int up_len = 0, route_len = 0, hops, i;
+
+        // ancestors of waypoint, nearest first
+        linkaddr_copy(&node, waypoint);
+        while (up_len < MAX_PATH_LENGTH && !linkaddr_cmp(&node, &conn->sink)) {
+                node = dict_find(conn->routing_table, &node);
+                if (linkaddr_cmp(&node, &linkaddr_null)) {
+                        break;
+                }
+                linkaddr_copy(&up[up_len++], &node);
+        }
+        // first node of the route to dest that is waypoint or one of its ancestors
+        linkaddr_copy(&node, dest);
+        for (hops = 0; hops <= conn->routing_table->len; hops++) {
+                if (linkaddr_cmp(&node, waypoint)) {
+                        return walk_route(conn, dest, waypoint);
+                }
+                for (i = 0; i < up_len && !linkaddr_cmp(&up[i], &node); i++);
+                if (i < up_len) {
+                        break;
+                }
+                node = dict_find(conn->routing_table, &node);
+                if (linkaddr_cmp(&node, &linkaddr_null)) {
+                        return 0;
+                }
+        }
+        if (hops > conn->routing_table->len) {
+                return 0; // loop
+        }
+        if (linkaddr_cmp(&node, dest)) {
+                init_routing_path(conn);
+        } else if ((route_len = walk_route(conn, dest, &node)) == 0) {
                 return 0;
         }
-        return path_len;
+        if (route_len + i + 1 > MAX_PATH_LENGTH) {
+                return 0;
+        }
+        // the hops up from waypoint come last, the first hop at the end
+        for (; i >= 0; i--) {
+                linkaddr_copy(&conn->routing_table->tree_path[route_len++], &up[i]);
+        }
+        return route_len;
 }
 
-void print_route(my_collect_conn* conn, uint8_t route_len, const linkaddr_t* dest) {
-        uint8_t i;
+/*
+    The routing table leads from this sink to dest: the chain of parents ends
+    at the sink, without a loop or an unknown node. Unlike find_route, the
+    lookup logs nothing and the length of the route is not limited.
+ */
+bool my_collect_owns(my_collect_conn* conn, const linkaddr_t* dest) {
+        linkaddr_t node = *dest;
+        int hops = 0;
+        if (!conn->is_sink) {
+                return false;
+        }
+        while (!linkaddr_cmp(&node, &conn->sink)) {
+                node = dict_find(conn->routing_table, &node);
+                if (linkaddr_cmp(&node, &linkaddr_null) || hops++ > conn->routing_table->len) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+void print_route(my_collect_conn* conn, int route_len, const linkaddr_t* dest) {
+        int i;
         printf("Sink route to node %02x:%02x:\n", (*dest).u8[0], (*dest).u8[1]);
-        for (i = 0; i < route_len; i++) {
+        for (i = 0; i < route_len && i < MAX_PATH_LENGTH; i++) {
                 printf("\t%d: %02x:%02x\n",
                        i,
-                       conn->routing_table.tree_path[i].u8[0],
-                       conn->routing_table.tree_path[i].u8[1]);
+                       conn->routing_table->tree_path[i].u8[0],
+                       conn->routing_table->tree_path[i].u8[1]);
         }
 }
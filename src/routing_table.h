@@ -6,9 +6,23 @@
 // ------------------------------------------------------------
 
 
+void dict_init(TreeDict*);
 void print_dict_state(TreeDict*);
+void print_dict_stats(TreeDict*);
 int dict_find_index(TreeDict*, const linkaddr_t);
 int dict_add(TreeDict*, const linkaddr_t, linkaddr_t);
+linkaddr_t dict_find(TreeDict*, const linkaddr_t*);
+void dict_drop(TreeDict*, const linkaddr_t);
+void dict_drop_subtree(TreeDict*, const linkaddr_t);
+#if ROUTING_CHECKPOINT
+void dict_set_provisional(TreeDict*, const linkaddr_t, bool);
+bool dict_provisional(TreeDict*, const linkaddr_t);
+#endif
+#if DESCENDANT_TABLE_SIZE > 0
+void dict_set_storing(TreeDict*, const linkaddr_t, bool);
+bool dict_storing(TreeDict*, const linkaddr_t);
+void dict_clear_storing(TreeDict*);
+#endif
 
 // ------------------------------------------------------------
 //                ROUTING TABLE MANAGEMENT
@@ -17,6 +31,7 @@ int dict_add(TreeDict*, const linkaddr_t, linkaddr_t);
 void init_routing_path(my_collect_conn*);
 int already_in_route(my_collect_conn*, uint8_t, linkaddr_t*);
 int find_route(my_collect_conn*, const linkaddr_t*);
-void print_route(my_collect_conn*, uint8_t, const linkaddr_t*);
+int find_segment(my_collect_conn*, const linkaddr_t*, const linkaddr_t*);
+void print_route(my_collect_conn*, int, const linkaddr_t*);
 
 #endif //ROUTING_TABLE_H
@@ -0,0 +1,170 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "my_collect.h"
+#include "event_log.h"
+#include "send_queue.h"
+
+/*
+   ------------ Queue Management ------------
+ */
+
+/*
+    Empty the queue of the connection. Every connection has its own pool of
+    SEND_QUEUE_SIZE entries, so opening a connection never touches the
+    packets queued by another one.
+ */
+void send_queue_init(my_collect_conn* conn) {
+        uint8_t i;
+        LIST_STRUCT_INIT(conn, send_queue);
+        LIST_STRUCT_INIT(conn, send_queue_free);
+        for (i = 0; i < SEND_QUEUE_SIZE; i++) {
+                list_add(conn->send_queue_free, &conn->send_queue_pool[i]);
+        }
+        conn->sending = 0;
+        conn->queue_drops = 0;
+        conn->tx_drops = 0;
+#if LATENCY_STATS
+        conn->queue_delay = 0;
+        conn->queue_delay_max = 0;
+        conn->queue_packets = 0;
+#endif
+}
+
+static void send_queue_remove_head(my_collect_conn* conn) {
+        send_queue_entry* e = list_pop(conn->send_queue);
+        if (e != NULL) {
+#if LATENCY_STATS
+                uint16_t delay = clock_time() - e->enqueued;
+                conn->queue_delay += delay;
+                conn->queue_delay_max = delay > conn->queue_delay_max ? delay : conn->queue_delay_max;
+                conn->queue_packets++;
+#endif
+                queuebuf_free(e->q);
+                list_push(conn->send_queue_free, e);
+        }
+}
+
+// Number of packets in the send queue (the one being sent included)
+uint8_t send_queue_len(my_collect_conn* conn) {
+        return list_length(conn->send_queue);
+}
+
+/*
+    Add the packet in the packetbuf to the send queue.
+    receiver: destination of the packet, NULL to send it to the parent
+    (resolved at every transmission, so a parent change also redirects
+    the packets already queued).
+    Returns 0 if the queue is full and the packet was dropped.
+ */
+int send_queue_add(my_collect_conn* conn, const linkaddr_t* receiver) {
+        send_queue_entry* e = list_pop(conn->send_queue_free);
+        if (e == NULL) {
+                conn->queue_drops++;
+                EVENT_LOG(EV_QUEUE_FULL,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], conn->queue_drops);
+                return 0;
+        }
+        e->q = queuebuf_new_from_packetbuf();
+        if (e->q == NULL) {
+                list_push(conn->send_queue_free, e);
+                conn->queue_drops++;
+                EVENT_LOG(EV_QUEUEBUF_FULL,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], conn->queue_drops);
+                return 0;
+        }
+        e->to_parent = receiver == NULL ? 1 : 0;
+        if (receiver != NULL) {
+                linkaddr_copy(&e->receiver, receiver);
+        }
+        e->transmissions = 0;
+#if LATENCY_STATS
+        e->enqueued = clock_time();
+#endif
+        list_add(conn->send_queue, e);
+        if (!conn->sending && list_head(conn->send_queue) == e) {
+                send_queue_timer_cb(conn);
+        }
+        return 1;
+}
+
+/*
+   ------------ Transmission ------------
+ */
+
+/*
+    Transmit the packet at the head of the queue. Also used as timer
+    callback to retry a transmission or to move to the next packet.
+ */
+void send_queue_timer_cb(void* ptr) {
+        struct my_collect_conn *conn = ptr;
+        send_queue_entry* e;
+        linkaddr_t receiver;
+
+        while ((e = list_head(conn->send_queue)) != NULL && !conn->sending) {
+                linkaddr_copy(&receiver, e->to_parent ? &conn->parent : &e->receiver);
+                if (linkaddr_cmp(&receiver, &linkaddr_null)) {
+                        conn->tx_drops++;
+                        EVENT_LOG(EV_QUEUE_NO_PARENT,
+                                  linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], conn->tx_drops);
+                        send_queue_remove_head(conn);
+                        continue;
+                }
+                linkaddr_copy(&e->receiver, &receiver);
+                queuebuf_to_packetbuf(e->q);
+#if LATENCY_STATS
+                // the queued copy keeps the delay at arrival, so retransmissions do not add it twice
+                packet_add_delay(clock_time() - e->enqueued);
+#endif
+                e->transmissions++;
+                conn->sending = 1;
+                if (!unicast_send(&conn->uc, &receiver)) {
+                        // not handed to the MAC layer: handle it like a failed transmission
+                        send_queue_sent(conn, MAC_TX_ERR, 0);
+                }
+                return;
+        }
+}
+
+/*
+    Receiver of the transmission waiting for the sent callback.
+    Returns false if no transmission is in progress.
+ */
+bool send_queue_receiver(my_collect_conn* conn, linkaddr_t* receiver) {
+        send_queue_entry* e = list_head(conn->send_queue);
+        if (!conn->sending || e == NULL) {
+                return false;
+        }
+        linkaddr_copy(receiver, &e->receiver);
+        return true;
+}
+
+/*
+    Unicast sent callback: the head of the queue has been transmitted.
+    On success the next packet is sent, on failure the packet is retransmitted
+    up to MAX_RETRANSMISSIONS times after SEND_RETRY_DELAY, then dropped.
+    The next transmission is always started from the timer, never from
+    inside this callback.
+ */
+void send_queue_sent(my_collect_conn* conn, int status, int num_tx) {
+        send_queue_entry* e = list_head(conn->send_queue);
+        if (!conn->sending || e == NULL || status == MAC_TX_DEFERRED) {
+                return;
+        }
+        conn->sending = 0;
+        if (status == MAC_TX_OK) {
+                send_queue_remove_head(conn);
+        } else if (e->transmissions > MAX_RETRANSMISSIONS) {
+                conn->tx_drops++;
+                EVENT_LOG(EV_TX_DROP,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], e->transmissions, status, conn->tx_drops);
+                send_queue_remove_head(conn);
+        } else {
+                EVENT_LOG(EV_TX_RETRY,
+                          linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], status, num_tx);
+                ctimer_set(&conn->send_timer, SEND_RETRY_DELAY, send_queue_timer_cb, conn);
+                return;
+        }
+        if (list_head(conn->send_queue) != NULL) {
+                ctimer_set(&conn->send_timer, 0, send_queue_timer_cb, conn);
+        }
+}
@@ -0,0 +1,11 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+void send_queue_init(my_collect_conn*);
+int  send_queue_add(my_collect_conn*, const linkaddr_t*);
+bool send_queue_receiver(my_collect_conn*, linkaddr_t*);
+uint8_t send_queue_len(my_collect_conn*);
+void send_queue_sent(my_collect_conn*, int, int);
+void send_queue_timer_cb(void*);
+
+#endif // SEND_QUEUE_H
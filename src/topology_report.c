@@ -1,38 +1,67 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include "lib/random.h"
 #include "my_collect.h"
+#include "event_log.h"
+#include "send_queue.h"
 #include "routing_table.h"
+#include "neighbor_table.h"
 
 /*
    ------------ TIMER Callbacks ------------
  */
 
 /*
-    Called when waiting time to forward a topology report
-    has ended.
+    Called when waiting time to send our topology report, or to forward the
+    reports kept from the children, has ended.
  */
 void topology_report_hold_cb(void* ptr) {
         struct my_collect_conn *conn = ptr;
-        if (conn->treport_hold == 1) {
-                conn->treport_hold = 0;
+        if (conn->treport_hold == 1 || conn->treport_len > 0) {
                 send_topology_report(conn, 0); // 0: root topology report (not in forwarding mode)
         }
 }
 
+/*
+    Hold time of a topology report, at most max_hold: the higher the path ETX
+    of the node, the shorter (down to TOPOLOGY_REPORT_JITTER at
+    TOPOLOGY_REPORT_MAX_METRIC). A node's metric is at least one ETX unit above
+    its parent's, so after a tree rebuild the deeper nodes report first and
+    their reports reach the ancestors while these still hold their own.
+ */
+clock_time_t topology_report_hold(my_collect_conn* conn, clock_time_t max_hold) {
+        uint16_t metric = conn->metric < TOPOLOGY_REPORT_MAX_METRIC ? conn->metric : TOPOLOGY_REPORT_MAX_METRIC;
+        return (uint32_t)max_hold * (TOPOLOGY_REPORT_MAX_METRIC - metric) / TOPOLOGY_REPORT_MAX_METRIC +
+               random_rand() % TOPOLOGY_REPORT_JITTER;
+}
+
+/*
+    Start holding the topology report of the node, for at most max_hold
+    (a report already held is rescheduled, its forwarded records are kept).
+    Returns the hold time.
+ */
+clock_time_t topology_report_schedule(my_collect_conn* conn, clock_time_t max_hold) {
+        clock_time_t hold = topology_report_hold(conn, max_hold);
+        conn->treport_hold = 1;
+        ctimer_stop(&conn->treport_hold_timer);
+        ctimer_set(&conn->treport_hold_timer, hold, topology_report_hold_cb, conn);
+        return hold;
+}
+
 /*
    ------------ Topology Report Management ------------
  */
 
 bool check_topology_report_address(my_collect_conn* conn, linkaddr_t node, uint8_t len) {
-        printf("Checking topology report address: %02x:%02x\n", node.u8[0], node.u8[1]);
+        EVENT_LOG(EV_TREPORT_CHECK, node.u8[0], node.u8[1]);
         tree_connection tc;
         uint8_t i;
         for (i = 0; i < len; i++) {
                 memcpy(&tc,
-                       packetbuf_dataptr() + sizeof(enum packet_type) + sizeof(uint8_t) + sizeof(tree_connection) * i,
+                       packetbuf_dataptr() + sizeof(packet_type_t) + sizeof(uint8_t) + sizeof(tree_connection) * i,
                        sizeof(tree_connection));
-                if (linkaddr_cmp(&tc.node, &linkaddr_node_addr)) {
-                        printf("ERROR: Checking topology report address found: %02x:%02x\n", node.u8[0], node.u8[1]);
+                if (linkaddr_cmp(&tc.node, &node)) {
+                        EVENT_LOG(EV_TREPORT_LOOP, node.u8[0], node.u8[1]);
                         return true;
                 }
         }
@@ -40,76 +69,226 @@ bool check_topology_report_address(my_collect_conn* conn, linkaddr_t node, uint8
         return false;
 }
 
+/*
+    Keep the len records of the topology report in the packetbuf, to send
+    them in our next report. A newer record of a node replaces the kept one.
+ */
+static void topology_report_keep(my_collect_conn* conn, uint8_t len) {
+        tree_connection tc;
+        uint8_t i, j;
+        for (i = 0; i < len; i++) {
+                memcpy(&tc,
+                       packetbuf_dataptr() + sizeof(packet_type_t) + sizeof(uint8_t) + sizeof(tree_connection) * i,
+                       sizeof(tree_connection));
+                EVENT_LOG(EV_TREPORT_APPEND, tc.node.u8[0], tc.node.u8[1]);
+                for (j = 0; j < conn->treport_len && !linkaddr_cmp(&conn->treport_buf[j].node, &tc.node); j++);
+                if (j == conn->treport_len) {
+                        conn->treport_len++;
+                }
+                conn->treport_buf[j] = tc;
+        }
+}
+
 /*
     The node sends a topology report to its parent.
     Topology report is sent when the node changes its parent or after too much
-    silence from the application layer (no piggybacking available).
+    silence from the application layer (no piggybacking available). It also
+    carries the records of the reports the node kept from its children.
 
     This method is also used for forwarding towards the sink a topology report
     received from a node.
  */
 void send_topology_report(my_collect_conn* conn, uint8_t forward) {
-        // Just forward upwward a topology report coming from child node
+        // Forward upwward a topology report coming from child node
         if (forward == 1) {
                 uint8_t len;
-                memcpy(&len, packetbuf_dataptr() + sizeof(enum packet_type), sizeof(uint8_t));
-                // if we are waiting to send a topology report (within TOPOLOGY_REPORT_HOLD_TIME)
-                // then piggyback info in the forwarding topology report message
-                if (conn->treport_hold == 1 && !check_topology_report_address(conn, linkaddr_node_addr, len)) {
-                        printf("Appending topology report info for node: %02x:%02x\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
-                        // append to packet header the topology report
-                        enum packet_type pt = topology_report;
-                        tree_connection tc = {.node=linkaddr_node_addr, .parent=conn->parent};
-                        len = len + 1;
-
-                        packetbuf_hdralloc(sizeof(tree_connection));
-                        // Make the header and data buffer contiguous
-                        packetbuf_compact();
-                        memcpy(packetbuf_hdrptr(), &pt, sizeof(enum packet_type));
-                        memcpy(packetbuf_hdrptr() + sizeof(enum packet_type), &len, sizeof(uint8_t));
-                        memcpy(packetbuf_hdrptr() + sizeof(enum packet_type) + sizeof(uint8_t), &tc, sizeof(tree_connection));
-
-                        conn->treport_hold=0;
-                        // reset timer (no need to send this topology report with dedicated packet anymore)
-                        ctimer_stop(&conn->treport_hold_timer);
+                memcpy(&len, packetbuf_dataptr() + sizeof(packet_type_t), sizeof(uint8_t));
+                if (packetbuf_datalen() < sizeof(packet_type_t) + sizeof(uint8_t) + sizeof(tree_connection) * len) {
+                        EVENT_LOG(EV_TREPORT_TOO_SHORT, packetbuf_datalen());
+                        return;
+                }
+                if (check_topology_report_address(conn, linkaddr_node_addr, len)) {
+                        // the report already went through us: drop it, or it circles the loop
+                        // until the tree is repaired (our next report tells the sink our parent)
+                        return;
+                }
+                // keep the records and send them in our next report, as long as one frame
+                // holds them all. If we are not holding a report, wait for the reports of
+                // the rest of our subtree (less for deeper nodes, as our own report)
+                if (conn->treport_len + len < TOPOLOGY_REPORT_MAX_RECORDS) {
+                        if (conn->treport_hold == 0 && conn->treport_len == 0) {
+                                ctimer_set(&conn->treport_hold_timer, topology_report_hold(conn, TOPOLOGY_REPORT_FORWARD_HOLD),
+                                           topology_report_hold_cb, conn);
+                        }
+                        topology_report_keep(conn, len);
+                        return;
+                }
+                // our report is full: forward this one as it is and send ours now
+                send_queue_add(conn, NULL);
+                if (conn->treport_hold == 1 || conn->treport_len > 0) {
+                        send_topology_report(conn, 0);
                 }
-                // send packet to parent
-                unicast_send(&conn->uc, &conn->parent);
                 return;
         }
         // else
-        // Init this node's topology report and send to parent
-        printf("Node %02x:%02x sending a topology report\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
-        enum packet_type pt = topology_report;
+        // Init this node's topology report (our record only if we are holding it,
+        // and the records we kept) and send to parent
+        uint8_t own = conn->treport_hold;
+        uint8_t len = conn->treport_len + own;
+        EVENT_LOG(EV_TREPORT_SEND, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], len);
+        packet_type_t pt = topology_report;
         tree_connection tc = {.node=linkaddr_node_addr, .parent=conn->parent};
-        uint8_t len = 1;
 
         packetbuf_clear();
-        packetbuf_set_datalen(sizeof(tree_connection));
-        memcpy(packetbuf_dataptr(), &tc, sizeof(tree_connection));
+        packetbuf_set_datalen(sizeof(tree_connection) * len);
+        if (own) {
+                memcpy(packetbuf_dataptr(), &tc, sizeof(tree_connection));
+        }
+        memcpy(packetbuf_dataptr() + sizeof(tree_connection) * own, conn->treport_buf,
+               sizeof(tree_connection) * conn->treport_len);
+        conn->treport_hold = 0;
+        conn->treport_len = 0;
+        ctimer_stop(&conn->treport_hold_timer);
+
+        packetbuf_hdralloc(sizeof(packet_type_t) + sizeof(uint8_t));
+        memcpy(packetbuf_hdrptr(), &pt, sizeof(packet_type_t));
+        memcpy(packetbuf_hdrptr() + sizeof(packet_type_t), &len, sizeof(uint8_t));
+        send_queue_add(conn, NULL);
+}
+
+/*
+    Topology report received from sender (not yet forwarded or delivered):
+    the sender's own record is acknowledged in our next beacon.
+ */
+void topology_report_ack(my_collect_conn* conn, const linkaddr_t* sender) {
+        tree_connection tc;
+        uint8_t len, i;
+        memcpy(&len, packetbuf_dataptr() + sizeof(packet_type_t), sizeof(uint8_t));
+        for (i = 0; i < len && sizeof(packet_type_t) + sizeof(uint8_t) + sizeof(tree_connection) * (i + 1) <=
+             packetbuf_datalen(); i++) {
+                memcpy(&tc,
+                       packetbuf_dataptr() + sizeof(packet_type_t) + sizeof(uint8_t) + sizeof(tree_connection) * i,
+                       sizeof(tree_connection));
+                topology_ack_record(conn, sender, &tc);
+        }
+}
+
+/*
+    The node changes parent for one in the tree of new_sink. If the old parent
+    is in the tree of another sink (ours, or the one it moved to), ask that
+    sink to drop us from its partition with a report of one record with a
+    null parent, sent to the old parent. The sink drops our subtree too: the
+    children that follow us report to the new sink (join_tree), the others
+    report their new parent to their own sink.
+ */
+void topology_report_leave(my_collect_conn* conn, const linkaddr_t* new_sink) {
+        Neighbor* parent = neighbor_find(conn, &conn->parent);
+        if (!conn->config.topology_report || parent == NULL ||
+            linkaddr_cmp(&conn->sinks[parent->sink].addr, new_sink)) {
+                return;
+        }
+        EVENT_LOG(EV_TREPORT_LEAVE, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
+                  conn->sinks[parent->sink].addr.u8[0], conn->sinks[parent->sink].addr.u8[1]);
+        packet_type_t pt = topology_report;
+        uint8_t len = 1;
+        tree_connection tc = {.node=linkaddr_node_addr, .parent=linkaddr_null};
 
-        packetbuf_hdralloc(sizeof(enum packet_type) + sizeof(uint8_t));
-        memcpy(packetbuf_hdrptr(), &pt, sizeof(enum packet_type));
-        memcpy(packetbuf_hdrptr() + sizeof(enum packet_type), &len, sizeof(uint8_t));
-        unicast_send(&conn->uc, &conn->parent);
+        packetbuf_clear();
+        packetbuf_copyfrom(&tc, sizeof(tree_connection));
+        packetbuf_hdralloc(sizeof(packet_type_t) + sizeof(uint8_t));
+        memcpy(packetbuf_hdrptr(), &pt, sizeof(packet_type_t));
+        memcpy(packetbuf_hdrptr() + sizeof(packet_type_t), &len, sizeof(uint8_t));
+        send_queue_add(conn, &conn->parent);
 }
 
 /*
     When the sink receives a topology report, it has to read the tree_connection
-    structure in the packet and update the node's parent.
+    structure in the packet and update the node's parent. A null parent means
+    that the node left for the tree of another sink, with its subtree.
  */
 void deliver_topology_report_to_sink(my_collect_conn* conn) {
         // remove header information
         uint8_t len;
         tree_connection tc;
-        memcpy(&len, packetbuf_dataptr() + sizeof(enum packet_type), sizeof(uint8_t));
-        packetbuf_hdrreduce(sizeof(enum packet_type) + sizeof(uint8_t));
-        printf("Sink: received %d topology reports.", len);
+        memcpy(&len, packetbuf_dataptr() + sizeof(packet_type_t), sizeof(uint8_t));
+        packetbuf_hdrreduce(sizeof(packet_type_t) + sizeof(uint8_t));
+        if (packetbuf_datalen() < sizeof(tree_connection) * len) {
+                EVENT_LOG(EV_TREPORT_TOO_SHORT, packetbuf_datalen());
+                return;
+        }
+        EVENT_LOG(EV_TREPORT_RECV, len);
         int i;
         for (i = 0; i < len; i++) {
                 memcpy(&tc, packetbuf_dataptr() + sizeof(tree_connection) * i, sizeof(tree_connection));
-                printf("Sink: received topology report. Updating parent of node %02x:%02x\n", tc.node.u8[0], tc.node.u8[1]);
-                dict_add(&conn->routing_table, tc.node, tc.parent);
+                EVENT_LOG(EV_TREPORT_UPDATE, tc.node.u8[0], tc.node.u8[1]);
+                if (linkaddr_cmp(&tc.parent, &linkaddr_null)) {
+                        dict_drop_subtree(conn->routing_table, tc.node);
+                } else {
+                        dict_add(conn->routing_table, tc.node, tc.parent);
+                }
+        }
+        if (LOG_DUMPS) {
+                print_dict_state(conn->routing_table);
+                print_dict_stats(conn->routing_table);
+        }
+}
+
+/*
+   ------------ Topology Solicitation ------------
+ */
+
+#if TOPOLOGY_SOLICIT
+// Sink only: TOPOLOGY_SOLICIT_MIN_INTERVAL has passed since the last solicitation
+static void topology_solicit_wait_cb(void* ptr) {
+        struct my_collect_conn *conn = ptr;
+        conn->solicit_wait = 0;
+}
+#endif
+
+/*
+    Sink only: ask every node for its parent, to fill the routing table at
+    startup or after a route lookup failed. Starts a new tree round whose
+    beacons carry BEACON_SOLICIT, sent right away instead of at the Trickle time.
+    Returns 0 if a solicited round was started less than
+    TOPOLOGY_SOLICIT_MIN_INTERVAL ago (or TOPOLOGY_SOLICIT is disabled).
+ */
+int topology_solicit(my_collect_conn* conn) {
+#if TOPOLOGY_SOLICIT
+        if (!conn->is_sink || conn->solicit_wait) {
+                return 0;
+        }
+        tree_refresh_cb(conn);
+        conn->solicited = 1;
+        conn->solicit_wait = 1;
+        ctimer_set(&conn->solicit_timer, TOPOLOGY_SOLICIT_MIN_INTERVAL, topology_solicit_wait_cb, conn);
+        EVENT_LOG(EV_SOLICIT_SEND, conn->beacon_seqn);
+        ctimer_set(&conn->beacon_timer, random_rand() % TOPOLOGY_SOLICIT_JITTER, beacon_timer_cb, conn);
+        return 1;
+#else
+        return 0;
+#endif
+}
+
+#if TOPOLOGY_SOLICIT
+/*
+    A node heard a beacon soliciting topology reports in the current round.
+    It passes the solicitation on with its next beacon, sent right away, and
+    holds its topology report for at most TOPOLOGY_SOLICIT_HOLD (see
+    topology_report_hold()), and piggybacks its parent until its parent's
+    beacon acknowledges it.
+    A node without parent reports the parent it gets (set_parent).
+ */
+void topology_solicit_recv(my_collect_conn* conn) {
+        conn->solicited = 1;
+        ctimer_set(&conn->beacon_timer, random_rand() % TOPOLOGY_SOLICIT_JITTER, beacon_timer_cb, conn);
+        if (linkaddr_cmp(&conn->parent, &linkaddr_null)) {
+                return;
+        }
+        // the sink misses routes: piggyback the parent again until it is acknowledged
+        conn->topo_acked_version = conn->topo_version - 1;
+        if (conn->config.topology_report) {
+                clock_time_t hold = topology_report_schedule(conn, TOPOLOGY_SOLICIT_HOLD);
+                EVENT_LOG(EV_SOLICIT_RECV, linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1], conn->metric, (unsigned)hold);
         }
-        print_dict_state(&conn->routing_table);
 }
+#endif
@@ -2,10 +2,18 @@
 #define TOPOLOGY_REPORT_H
 
 void topology_report_hold_cb(void*);
-void topology_report_timer_cb(void*);
+clock_time_t topology_report_hold(my_collect_conn*, clock_time_t);
+clock_time_t topology_report_schedule(my_collect_conn*, clock_time_t);
 
 void deliver_topology_report_to_sink(my_collect_conn*);
-bool check_address_in_topologyreport_block(my_collect_conn*, linkaddr_t);
+bool check_topology_report_address(my_collect_conn*, linkaddr_t, uint8_t);
 void send_topology_report(my_collect_conn*, uint8_t);
+void topology_report_leave(my_collect_conn*, const linkaddr_t*);
+void topology_report_ack(my_collect_conn*, const linkaddr_t*);
+
+int topology_solicit(my_collect_conn*);
+#if TOPOLOGY_SOLICIT
+void topology_solicit_recv(my_collect_conn*);
+#endif
 
 #endif // TOPOLOGY_REPORT_H